@@ -0,0 +1,195 @@
+/*
+ * AdcFilter.cpp
+ *
+ * Decimating filters and calibration for the analog inputs
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#include "AdcFilter.h"
+
+AdcFilter::AdcFilter()
+{
+    setDefaults(config);
+    cicGain = 1;
+    raw = 0;
+    value = 0;
+    reset();
+    resetCost();
+}
+
+bool AdcFilter::validate(ADC_FILTER_SETTINGS &settings)
+{
+    uint32_t gain = 1;
+
+    if (settings.type > ADC_FILTER_CIC) return false;
+    if (settings.decimation == 0 || settings.decimation > ADC_MAX_DECIMATION) return false;
+    if (settings.type == ADC_FILTER_IIR && (settings.param == 0 || settings.param > 15)) return false;
+    if (settings.type == ADC_FILTER_CIC) {
+        if (settings.param == 0 || settings.param > ADC_CIC_MAX_ORDER) return false;
+        for (int i = 0; i < settings.param; i++) {
+            gain *= settings.decimation;
+            if (gain > ADC_CIC_MAX_GAIN) return false;
+        }
+    }
+    return true;
+}
+
+//a 64 sample average with no correction, about what the old fixed smoothing did
+void AdcFilter::setDefaults(ADC_FILTER_SETTINGS &settings)
+{
+    settings.type = ADC_FILTER_BOXCAR;
+    settings.param = 0;
+    settings.decimation = 64;
+    settings.offset = 0;
+    settings.gain = ADC_GAIN_ONE;
+}
+
+bool AdcFilter::configure(ADC_FILTER_SETTINGS &settings)
+{
+    if (!validate(settings)) return false;
+    config = settings;
+    cicGain = 1;
+    if (config.type == ADC_FILTER_CIC) {
+        for (int i = 0; i < config.param; i++) cicGain *= config.decimation;
+    }
+    reset();
+    return true;
+}
+
+void AdcFilter::reset()
+{
+    phase = 0;
+    sum = 0;
+    iir = -1; //first sample seeds it
+    for (int i = 0; i < ADC_CIC_MAX_ORDER; i++) {
+        integrators[i] = 0;
+        combs[i] = 0;
+    }
+    outputs = 0;
+}
+
+void AdcFilter::output(uint32_t filtered)
+{
+    int32_t calibrated;
+
+    raw = filtered;
+    calibrated = ((int32_t)filtered - config.offset) * config.gain / ADC_GAIN_ONE;
+    if (calibrated < 0) calibrated = 0;
+    if (calibrated > 0xFFFF) calibrated = 0xFFFF;
+    value = calibrated;
+    outputs++;
+}
+
+/*
+The filter type is checked once per call rather than per sample so each loop stays tight.
+The first CIC outputs after a reset are off until the combs have seen order outputs.
+*/
+int AdcFilter::process(const volatile uint16_t *samples, int stride, int count)
+{
+    uint32_t start = outputs;
+    uint32_t x, v, t;
+
+    switch (config.type) {
+    case ADC_FILTER_NONE:
+        for (int i = 0; i < count; i++, samples += stride) {
+            if (++phase < config.decimation) continue;
+            phase = 0;
+            output(*samples);
+        }
+        break;
+    case ADC_FILTER_BOXCAR:
+        for (int i = 0; i < count; i++, samples += stride) {
+            sum += *samples;
+            if (++phase < config.decimation) continue;
+            phase = 0;
+            output(sum / config.decimation);
+            sum = 0;
+        }
+        break;
+    case ADC_FILTER_IIR:
+        for (int i = 0; i < count; i++, samples += stride) {
+            x = (uint32_t)*samples << 16;
+            if (iir < 0) iir = x;
+            else iir += ((int32_t)x - iir) >> config.param;
+            if (++phase < config.decimation) continue;
+            phase = 0;
+            output((iir + 0x8000) >> 16);
+        }
+        break;
+    case ADC_FILTER_CIC:
+        for (int i = 0; i < count; i++, samples += stride) {
+            v = *samples;
+            for (int s = 0; s < config.param; s++) v = integrators[s] += v;
+            if (++phase < config.decimation) continue;
+            phase = 0;
+            for (int s = 0; s < config.param; s++) {
+                t = v;
+                v -= combs[s];
+                combs[s] = t;
+            }
+            output(v / cicGain);
+        }
+        break;
+    }
+    return outputs - start;
+}
+
+uint16_t AdcFilter::getValue()
+{
+    return value;
+}
+
+uint16_t AdcFilter::getRawValue()
+{
+    return raw;
+}
+
+uint32_t AdcFilter::getOutputs()
+{
+    return outputs;
+}
+
+void AdcFilter::addCost(uint32_t cycles)
+{
+    costTotal += cycles;
+    costCalls++;
+    if (cycles > costMax) costMax = cycles;
+}
+
+uint32_t AdcFilter::getAvgCost()
+{
+    return costCalls ? costTotal / costCalls : 0;
+}
+
+uint32_t AdcFilter::getMaxCost()
+{
+    return costMax;
+}
+
+void AdcFilter::resetCost()
+{
+    costTotal = 0;
+    costCalls = 0;
+    costMax = 0;
+}
@@ -0,0 +1,93 @@
+/*
+ * AdcFilter.h
+ *
+ * Per channel filter and calibration for the analog inputs. Samples come in at the ADC
+ * rate and come out decimated by a boxcar average, a first order IIR or a CIC filter, then
+ * get a fixed point offset and gain. Nothing in here touches the hardware so recorded
+ * ADC buffers can be run through it on a PC.
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#ifndef ADCFILTER_H_
+#define ADCFILTER_H_
+
+#include <stdint.h>
+
+#define ADC_GAIN_ONE        4096 //gain is 4.12 fixed point
+#define ADC_MAX_DECIMATION  4096
+#define ADC_CIC_MAX_ORDER   3
+#define ADC_CIC_MAX_GAIN    (1ul << 20) //decimation ^ order. Keeps 12 bit samples inside 32 bit registers
+
+enum ADC_FILTER_TYPE {
+    ADC_FILTER_NONE = 0, //every Nth sample
+    ADC_FILTER_BOXCAR = 1, //average of each N samples
+    ADC_FILTER_IIR = 2, //y += (x - y) / 2^param on every sample, every Nth output kept
+    ADC_FILTER_CIC = 3 //param stages of integrate then comb, decimated by N
+};
+
+struct ADC_FILTER_SETTINGS {
+    uint8_t type; //255 means the EEPROM page was never initialized
+    uint8_t param; //IIR shift or CIC order
+    uint16_t decimation;
+    int16_t offset; //in ADC counts, taken off before the gain
+    uint16_t gain;
+};
+
+class AdcFilter
+{
+public:
+    AdcFilter();
+    static bool validate(ADC_FILTER_SETTINGS &settings);
+    static void setDefaults(ADC_FILTER_SETTINGS &settings);
+    bool configure(ADC_FILTER_SETTINGS &settings);
+    void reset();
+    //count samples spaced stride apart. Returns how many filtered values came out
+    int process(const volatile uint16_t *samples, int stride, int count);
+    uint16_t getValue(); //latest filtered and calibrated value
+    uint16_t getRawValue(); //same before calibration
+    uint32_t getOutputs();
+    void addCost(uint32_t cycles);
+    uint32_t getAvgCost();
+    uint32_t getMaxCost();
+    void resetCost();
+
+private:
+    ADC_FILTER_SETTINGS config;
+    uint16_t phase;
+    uint32_t sum; //boxcar accumulator
+    int32_t iir; //IIR state, 16 fractional bits
+    uint32_t integrators[ADC_CIC_MAX_ORDER]; //CIC state. Wraps on purpose, the combs undo it
+    uint32_t combs[ADC_CIC_MAX_ORDER];
+    uint32_t cicGain;
+    uint16_t raw;
+    uint16_t value;
+    uint32_t outputs;
+    uint32_t costTotal; //cycles spent in process()
+    uint32_t costCalls;
+    uint32_t costMax;
+
+    void output(uint32_t filtered);
+};
+
+#endif /* ADCFILTER_H_ */
@@ -0,0 +1,186 @@
+/*
+ * AdcStream.cpp
+ *
+ * Analog input streaming straight from the ADC DMA buffers
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#include "AdcStream.h"
+#include "GVRET.h"
+#include "config.h"
+#include "Logger.h"
+#include "Timebase.h"
+#include "sys_io.h"
+
+AdcStream::AdcStream()
+{
+    mask = 0;
+    decimation = 1;
+    outputs = 0;
+    announced = false;
+    nextBuffer = 0;
+    setNanos = 0;
+    setsSent = 0;
+    overruns = 0;
+}
+
+/*
+mask picks analog inputs 0 to 3, decimation must be a power of two up to 64. Streaming
+starts with the next buffer to complete so every record has a measured start time.
+*/
+bool AdcStream::start(uint8_t mask, uint8_t decimation, uint8_t outputs)
+{
+    if (mask == 0 || mask > 0x0F) return false;
+    if (decimation == 0 || decimation > ADC_SETS_PER_BUFFER || (ADC_SETS_PER_BUFFER % decimation)) return false;
+    if (outputs == 0 || outputs > (ADC_OUT_USB | ADC_OUT_FILE)) return false;
+    this->mask = mask;
+    this->decimation = decimation;
+    this->outputs = outputs;
+    announced = false;
+    setsSent = 0;
+    overruns = 0;
+    nextBuffer = getADCBufferCount();
+    if (nextBuffer == 0) nextBuffer = 1;
+    return true;
+}
+
+void AdcStream::stop()
+{
+    mask = 0;
+}
+
+bool AdcStream::isActive()
+{
+    return mask != 0;
+}
+
+void AdcStream::loop()
+{
+    uint32_t count;
+
+    if (!mask) return;
+    count = getADCBufferCount();
+    while (nextBuffer < count) {
+        //a buffer is rewritten three buffers after it completes. Leave a whole buffer of margin
+        if (count - nextBuffer > 2) {
+            overruns += count - nextBuffer - 1;
+            nextBuffer = count - 1;
+        }
+        sendBuffer(nextBuffer++);
+    }
+}
+
+/*
+USB: 0xF1, PROTO_ADC_DATA, time of the first set (4 bytes, us), ns between sets (4), input mask,
+set count, then for each set 2 bytes for each input in the mask, lowest input first.
+File: EVENT_ADC for each set, timestamped when its first sample was taken.
+Sets are spread evenly between when the previous buffer and this one completed.
+*/
+void AdcStream::sendBuffer(uint32_t n)
+{
+    volatile uint16_t *buf = getADCBuffer(n);
+    uint64_t startTicks = getADCBufferTicks(n - 1);
+    uint32_t span = (uint32_t)(getADCBufferTicks(n) - startTicks);
+    uint8_t sets = ADC_SETS_PER_BUFFER / decimation;
+    uint8_t channels = __builtin_popcount(mask);
+    uint8_t *out = NULL;
+    uint32_t sum, stamp;
+    uint64_t setTicks;
+    CAN_FRAME frame;
+
+    setNanos = (uint32_t)((uint64_t)span * decimation * 1000 / (TIMEBASE_HZ / 1000000) / ADC_SETS_PER_BUFFER);
+    if (!announced) {
+        sendSetupEvent(!(outputs & ADC_OUT_USB));
+        announced = true;
+    }
+
+    if ((outputs & ADC_OUT_USB) && settings.useBinarySerialComm && !SysSettings.lawicelMode) {
+        out = reserveUSBBytes(12 + sets * channels * 2);
+    }
+    if (out) {
+        stamp = (uint32_t)timebase.stampAt(startTicks + span / ADC_SETS_PER_BUFFER);
+        out[0] = 0xF1;
+        out[1] = PROTO_ADC_DATA;
+        for (int c = 0; c < 4; c++) {
+            out[2 + c] = stamp >> (c * 8);
+            out[6 + c] = setNanos >> (c * 8);
+        }
+        out[10] = mask;
+        out[11] = sets;
+        out += 12;
+    }
+    frame.id = GVRET_EVENT_FLAG | EVENT_ADC;
+    frame.extended = true;
+    frame.rtr = 0;
+    frame.length = channels * 2;
+
+    for (int s = 0; s < sets; s++) {
+        int pos = 0;
+        for (int ch = 0; ch < ADC_CHANNELS; ch++) {
+            if (!(mask & (1 << ch))) continue;
+            sum = 0;
+            for (int i = 0; i < decimation; i++) sum += buf[(s * decimation + i) * ADC_CHANNELS + ch];
+            sum /= decimation;
+            if (out) {
+                *out++ = sum & 0xFF;
+                *out++ = sum >> 8;
+            }
+            frame.data.bytes[pos++] = sum & 0xFF;
+            frame.data.bytes[pos++] = sum >> 8;
+        }
+        if ((outputs & ADC_OUT_FILE) && SysSettings.logToFile) {
+            setTicks = startTicks + (uint64_t)span * (s * decimation + 1) / ADC_SETS_PER_BUFFER;
+            sendFrameToFileAt(frame, 0, timebase.stampAt(setTicks));
+        }
+    }
+    setsSent += sets;
+}
+
+/*
+EVENT_ADC_SETUP: input mask, decimation, ns between sets (4 bytes). Goes out when streaming
+starts and at the top of each new log file so EVENT_ADC records can be decoded
+*/
+void AdcStream::sendSetupEvent(bool fileOnly)
+{
+    uint8_t data[6];
+
+    if (!mask) return;
+    if (fileOnly && !(outputs & ADC_OUT_FILE)) return;
+    data[0] = mask;
+    data[1] = decimation;
+    for (int c = 0; c < 4; c++) data[2 + c] = setNanos >> (c * 8);
+    if (fileOnly) logEventFrame(EVENT_ADC_SETUP, 0, data, 6);
+    else sendEventFrame(EVENT_ADC_SETUP, 0, data, 6);
+}
+
+void AdcStream::printStatus()
+{
+    if (!mask) {
+        Logger::console("Analog streaming is off");
+        return;
+    }
+    Logger::console("Streaming inputs 0x%x to%s%s, averaging %i samples, %i ns per set", mask,
+                    (outputs & ADC_OUT_USB) ? " USB" : "", (outputs & ADC_OUT_FILE) ? " file" : "", decimation, setNanos);
+    Logger::console("Sets sent: %i buffer overruns: %i", setsSent, overruns);
+}
@@ -0,0 +1,71 @@
+/*
+ * AdcStream.h
+ *
+ * Streams the analog inputs sample by sample instead of the smoothed values
+ * getAnalog() returns. Records are built straight out of the ADC DMA buffers, timestamped
+ * against the same clock as CAN traffic, and go into the binary USB stream and/or the log
+ * file. Averaging groups of samples brings the rate down to what the link or card can take.
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#ifndef ADCSTREAM_H_
+#define ADCSTREAM_H_
+
+#include <Arduino.h>
+
+#define ADC_SETS_PER_BUFFER 64 //one sample of each of the 4 inputs per set
+#define ADC_CHANNELS        4
+
+enum ADC_STREAM_OUTPUT {
+    ADC_OUT_USB = 1,
+    ADC_OUT_FILE = 2
+};
+
+class AdcStream
+{
+public:
+    AdcStream();
+    bool start(uint8_t mask, uint8_t decimation, uint8_t outputs);
+    void stop();
+    bool isActive();
+    void loop();
+    void sendSetupEvent(bool fileOnly);
+    void printStatus();
+
+private:
+    uint8_t mask; //bit per analog input. 0 = not streaming
+    uint8_t decimation; //raw sample sets averaged into each one sent, divides ADC_SETS_PER_BUFFER
+    uint8_t outputs;
+    bool announced; //setup event has gone out for this run
+    uint32_t nextBuffer; //next DMA buffer number to send
+    uint32_t setNanos; //time between sent sample sets, measured
+    uint32_t setsSent;
+    uint32_t overruns; //buffers lost because loop() didn't get to them in time
+
+    void sendBuffer(uint32_t n);
+};
+
+extern AdcStream adcStream;
+
+#endif /* ADCSTREAM_H_ */
@@ -0,0 +1,225 @@
+/*
+ * BinaryConfig.cpp
+ *
+ * Bulk configuration get and set for the binary protocol
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#include "BinaryConfig.h"
+#include "GVRET.h"
+#include "config.h"
+#include "Logger.h"
+#include "CanBus.h"
+#include "TriggerEngine.h"
+#include <stddef.h>
+
+#define SETTINGS_TAG(member)    settingsStore.fieldTag(STORE_SETTINGS, offsetof(EEPROMSettings, member))
+#define DIGTOGGLE_TAG(member)   settingsStore.fieldTag(STORE_DIGTOGGLE, offsetof(DigitalCANToggleSettings, member))
+
+//a boolean that came in over the wire might hold anything, look at the byte rather than trust it
+static bool isFlag(const boolean &flag)
+{
+    uint8_t value;
+    memcpy(&value, &flag, 1);
+    return value <= 1;
+}
+
+static bool filtersOk(const FILTER *filters)
+{
+    for (int i = 0; i < 8; i++) {
+        if (filters[i].id > 0x1FFFFFFF || filters[i].mask > 0x1FFFFFFF) return false;
+        if (!isFlag(filters[i].extended) || !isFlag(filters[i].enabled)) return false;
+    }
+    return true;
+}
+
+static bool filtersDiffer(const FILTER *a, const FILTER *b)
+{
+    for (int i = 0; i < 8; i++) {
+        if (a[i].id != b[i].id || a[i].mask != b[i].mask) return true;
+        if (a[i].extended != b[i].extended || a[i].enabled != b[i].enabled) return true;
+    }
+    return false;
+}
+
+BinaryConfig::BinaryConfig()
+{
+}
+
+/*
+Answered with F1 34, the record, a status, the length of the fields (2 bytes) and then the
+fields themselves. Tags the record doesn't have are left out rather than failing the get.
+*/
+void BinaryConfig::sendFields(uint8_t record, const uint8_t *tags, uint8_t count)
+{
+    uint16_t length = 0;
+
+    buffer[0] = 0xF1;
+    buffer[1] = PROTO_GET_CONFIG;
+    buffer[2] = record;
+    buffer[3] = CONFIG_BAD_RECORD;
+    if (record < CONFIG_RECORDS) {
+        length = settingsStore.getFields(record, tags, count, buffer + 6, CONFIG_MAX_LENGTH);
+        buffer[3] = CONFIG_OK;
+    }
+    buffer[4] = length & 0xFF;
+    buffer[5] = length >> 8;
+    sendBytesToUSB(buffer, length + 6);
+}
+
+uint8_t *BinaryConfig::getBuffer(uint16_t length)
+{
+    if (length > CONFIG_MAX_LENGTH) return NULL;
+    return buffer;
+}
+
+//F1 35, the record, a status and the tag at fault or 0
+void BinaryConfig::sendStatus(uint8_t record, uint8_t status, uint8_t tag)
+{
+    uint8_t reply[5] = {0xF1, PROTO_SET_CONFIG, record, status, tag};
+    sendBytesToUSB(reply, 5);
+}
+
+void BinaryConfig::set(uint8_t record, uint16_t length)
+{
+    EEPROMSettings settingsCopy;
+    DigitalCANToggleSettings digToggleCopy;
+    uint8_t tag;
+
+    if (length > CONFIG_MAX_LENGTH) {
+        sendStatus(record, CONFIG_BAD_LENGTH, 0);
+        return;
+    }
+
+    switch (record) {
+    case STORE_SETTINGS:
+        settingsCopy = settings;
+        tag = settingsStore.setFields(record, buffer, length, &settingsCopy);
+        if (tag) break;
+        tag = checkSettings(settingsCopy);
+        if (tag) {
+            sendStatus(record, CONFIG_BAD_VALUE, tag);
+            return;
+        }
+        applySettings(settingsCopy);
+        sendStatus(record, CONFIG_OK, 0);
+        return;
+    case STORE_DIGTOGGLE:
+        digToggleCopy = digToggleSettings;
+        tag = settingsStore.setFields(record, buffer, length, &digToggleCopy);
+        if (tag) break;
+        tag = checkDigToggle(digToggleCopy);
+        if (tag) {
+            sendStatus(record, CONFIG_BAD_VALUE, tag);
+            return;
+        }
+        applyDigToggle(digToggleCopy);
+        sendStatus(record, CONFIG_OK, 0);
+        return;
+    default:
+        sendStatus(record, CONFIG_BAD_RECORD, 0);
+        return;
+    }
+    //setFields gives 255 for a field cut short by the end of the data
+    if (tag == 255) sendStatus(record, CONFIG_BAD_LENGTH, 0);
+    else sendStatus(record, CONFIG_BAD_FIELD, tag);
+}
+
+//returns the tag of the first field that can't be used, 0 if they are all good
+uint8_t BinaryConfig::checkSettings(const EEPROMSettings &copy)
+{
+    if (copy.version != settings.version) return SETTINGS_TAG(version);
+    if (copy.tablePages != settings.tablePages) return SETTINGS_TAG(tablePages); //what the tables were brought over from
+    if (copy.storedRecords != settings.storedRecords) return SETTINGS_TAG(storedRecords); //kept by SettingsStore
+    if (!isFlag(copy.CAN0_Enabled)) return SETTINGS_TAG(CAN0_Enabled);
+    if (!isFlag(copy.CAN1_Enabled)) return SETTINGS_TAG(CAN1_Enabled);
+    if (!isFlag(copy.singleWire_Enabled)) return SETTINGS_TAG(singleWire_Enabled);
+    //a disabled bus can keep whatever speed it has
+    if (copy.CAN0_Enabled && (copy.CAN0Speed == 0 || copy.CAN0Speed > 1000000)) return SETTINGS_TAG(CAN0Speed);
+    if (copy.CAN1_Enabled && (copy.CAN1Speed == 0 || copy.CAN1Speed > 1000000)) return SETTINGS_TAG(CAN1Speed);
+    if (copy.singleWire_Enabled && (copy.SWCANSpeed == 0 || copy.SWCANSpeed > 100000)) return SETTINGS_TAG(SWCANSpeed);
+    if (!filtersOk(copy.CAN0Filters)) return SETTINGS_TAG(CAN0Filters);
+    if (!filtersOk(copy.CAN1Filters)) return SETTINGS_TAG(CAN1Filters);
+    if (!isFlag(copy.useBinarySerialComm)) return SETTINGS_TAG(useBinarySerialComm);
+    if ((uint32_t)copy.fileOutputType > CRTD) return SETTINGS_TAG(fileOutputType);
+    if (!memchr(copy.fileNameBase, 0, sizeof(copy.fileNameBase))) return SETTINGS_TAG(fileNameBase);
+    if (!memchr(copy.fileNameExt, 0, sizeof(copy.fileNameExt))) return SETTINGS_TAG(fileNameExt);
+    if (!isFlag(copy.appendFile)) return SETTINGS_TAG(appendFile);
+    if (!isFlag(copy.autoStartLogging)) return SETTINGS_TAG(autoStartLogging);
+    if (copy.logLevel > Logger::Off) return SETTINGS_TAG(logLevel);
+    if (copy.sysType > 3) return SETTINGS_TAG(sysType);
+    if (!isFlag(copy.CAN0ListenOnly)) return SETTINGS_TAG(CAN0ListenOnly);
+    if (!isFlag(copy.CAN1ListenOnly)) return SETTINGS_TAG(CAN1ListenOnly);
+    if (!isFlag(copy.SWCANListenOnly)) return SETTINGS_TAG(SWCANListenOnly);
+    if (!isFlag(copy.echoTx)) return SETTINGS_TAG(echoTx);
+    for (int e = 0; e < EXT_BUSES; e++) {
+        const EXTBUS_SETTINGS &ext = copy.extBuses[e];
+        if (!isFlag(ext.enabled) || !isFlag(ext.listenOnly)) return SETTINGS_TAG(extBuses);
+        if (ext.enabled && (ext.speed == 0 || ext.speed > 1000000)) return SETTINGS_TAG(extBuses);
+    }
+    return 0;
+}
+
+uint8_t BinaryConfig::checkDigToggle(const DigitalCANToggleSettings &copy)
+{
+    if (copy.pin > 77) return DIGTOGGLE_TAG(pin);
+    if (copy.rxTxID > 0x1FFFFFFF) return DIGTOGGLE_TAG(rxTxID);
+    if (copy.length > 8) return DIGTOGGLE_TAG(length);
+    if (!isFlag(copy.enabled)) return DIGTOGGLE_TAG(enabled);
+    return 0;
+}
+
+/*
+The buses are only brought up again when something about them changed since that drops
+frames for a moment. A new system type still needs a power cycle, like from the console.
+*/
+void BinaryConfig::applySettings(const EEPROMSettings &copy)
+{
+    bool busesChanged = false;
+
+    if (copy.CAN0_Enabled != settings.CAN0_Enabled || copy.CAN1_Enabled != settings.CAN1_Enabled) busesChanged = true;
+    if (copy.singleWire_Enabled != settings.singleWire_Enabled) busesChanged = true;
+    if (copy.CAN0Speed != settings.CAN0Speed || copy.CAN1Speed != settings.CAN1Speed) busesChanged = true;
+    if (copy.SWCANSpeed != settings.SWCANSpeed) busesChanged = true;
+    if (copy.CAN0ListenOnly != settings.CAN0ListenOnly || copy.CAN1ListenOnly != settings.CAN1ListenOnly) busesChanged = true;
+    if (copy.SWCANListenOnly != settings.SWCANListenOnly) busesChanged = true;
+    if (filtersDiffer(copy.CAN0Filters, settings.CAN0Filters) || filtersDiffer(copy.CAN1Filters, settings.CAN1Filters)) busesChanged = true;
+    if (memcmp(copy.extBuses, settings.extBuses, sizeof(copy.extBuses))) busesChanged = true;
+
+    settings = copy;
+    Logger::setLoglevel((Logger::LogLevel)settings.logLevel);
+    if (busesChanged) {
+        setupBusRegistry(); //picks up pins for an extra bus
+        setupBuses();
+    }
+    settingsStore.markDirty(STORE_SETTINGS);
+}
+
+void BinaryConfig::applyDigToggle(const DigitalCANToggleSettings &copy)
+{
+    digToggleSettings = copy;
+    setupDigToggle();
+    triggerEngine.compile();
+    settingsStore.markDirty(STORE_DIGTOGGLE);
+}
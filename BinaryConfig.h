@@ -0,0 +1,71 @@
+/*
+ * BinaryConfig.h
+ *
+ * Reads and writes the stored configuration over the binary protocol so host tools don't
+ * have to drive the text console. Fields go back and forth in the same tag, length, value
+ * form SettingsStore keeps in EEPROM, all of a record at once or just the tags asked for.
+ * A write is decoded into a copy and checked as a whole. Only if every field is good does
+ * the copy replace the live settings, so a bad write changes nothing.
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#ifndef BINARYCONFIG_H_
+#define BINARYCONFIG_H_
+
+#include <Arduino.h>
+#include "SettingsStore.h"
+
+#define CONFIG_RECORDS      (STORE_DIGTOGGLE + 1) //the tables after these have console commands of their own
+#define CONFIG_MAX_LENGTH   (2 * STORE_PAGE_SIZE - sizeof(STORE_HEADER)) //fields of the settings, the biggest of those
+#define CONFIG_MAX_TAGS     32 //tags in one get
+
+enum CONFIG_STATUS {
+    CONFIG_OK = 0,
+    CONFIG_BAD_RECORD = 1,
+    CONFIG_BAD_LENGTH = 2, //more than CONFIG_MAX_LENGTH or a field runs off the end
+    CONFIG_BAD_FIELD = 3, //unknown tag or wrong size
+    CONFIG_BAD_VALUE = 4 //out of range or read only
+};
+
+class BinaryConfig
+{
+public:
+    BinaryConfig();
+    void sendFields(uint8_t record, const uint8_t *tags, uint8_t count); //count 0 for every field
+    uint8_t *getBuffer(uint16_t length); //where the fields of a set go, NULL if they won't fit
+    void set(uint8_t record, uint16_t length); //fields are already in the buffer
+    void sendStatus(uint8_t record, uint8_t status, uint8_t tag);
+
+private:
+    uint8_t buffer[CONFIG_MAX_LENGTH + 6]; //room for the reply header in front of the fields on a get
+
+    uint8_t checkSettings(const EEPROMSettings &copy);
+    uint8_t checkDigToggle(const DigitalCANToggleSettings &copy);
+    void applySettings(const EEPROMSettings &copy);
+    void applyDigToggle(const DigitalCANToggleSettings &copy);
+};
+
+extern BinaryConfig binaryConfig;
+
+#endif /* BINARYCONFIG_H_ */
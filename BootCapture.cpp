@@ -0,0 +1,131 @@
+/*
+ * BootCapture.cpp
+ *
+ * Frames received during start up, held in RAM until logging is ready
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#include "BootCapture.h"
+#include "GVRET.h"
+#include "config.h"
+#include "Logger.h"
+#include "Timebase.h"
+#include "BusCensus.h"
+#include "SignalDecoder.h"
+
+static void bootFrame0(CAN_FRAME *frame)
+{
+    bootCapture.frameReceived(*frame, 0);
+}
+
+static void bootFrame1(CAN_FRAME *frame)
+{
+    bootCapture.frameReceived(*frame, 1);
+}
+
+BootCapture::BootCapture(BOOT_RECORD *buffer)
+{
+    frames = buffer;
+    count = 0;
+    lost = 0;
+    busTicks = 0;
+    firstTicks = 0;
+    finishTicks = 0;
+    held = 0;
+}
+
+//due_can hands frames to a general callback instead of its own small receive buffer when one is set
+void BootCapture::begin()
+{
+    Can0.setGeneralCallback(bootFrame0);
+    Can1.setGeneralCallback(bootFrame1);
+}
+
+void BootCapture::busesUp()
+{
+    busTicks = timebase.ticks();
+}
+
+//both CAN interrupts run at the same priority so they can't interrupt each other in here
+void BootCapture::frameReceived(CAN_FRAME &frame, uint8_t bus)
+{
+    uint64_t now = timebase.ticks();
+    BOOT_RECORD *record;
+
+    if (count >= BOOT_CAPTURE_FRAMES) {
+        lost++;
+        return;
+    }
+    if (count == 0) firstTicks = now;
+    record = &frames[count];
+    record->ticks = now;
+    record->id = frame.id;
+    record->length = (frame.length > 8) ? 8 : frame.length;
+    record->flags = bus;
+    if (frame.extended) record->flags |= BOOT_EXTENDED;
+    if (frame.rtr) record->flags |= BOOT_RTR;
+    memcpy(record->data, frame.data.bytes, 8);
+    count++;
+}
+
+/*
+Frames from here on go into the due_can buffers as usual and are read by loop(). They are
+all newer than the held ones, so sending the held ones out now keeps everything in order.
+Held frames are only logged and counted. Gateway, responder and the like would be acting
+on traffic that is long gone.
+*/
+void BootCapture::finish()
+{
+    CAN_FRAME frame;
+    BOOT_RECORD *record;
+    uint8_t bus;
+
+    Can0.setGeneralCallback(NULL);
+    Can1.setGeneralCallback(NULL);
+    held = count;
+    finishTicks = timebase.ticks();
+
+    for (int i = 0; i < held; i++) {
+        record = &frames[i];
+        bus = record->flags & 0x0F;
+        frame.id = record->id;
+        frame.extended = (record->flags & BOOT_EXTENDED) ? 1 : 0;
+        frame.rtr = (record->flags & BOOT_RTR) ? 1 : 0;
+        frame.length = record->length;
+        memcpy(frame.data.bytes, record->data, 8);
+        busCensus.addFrame(frame, bus, (uint32_t)(record->ticks / TIMEBASE_TICKS_US));
+        if (signalDecoder.sendRawFrames()) sendFrameToUSBAt(frame, bus, timebase.stampAt(record->ticks));
+        if (SysSettings.logToFile) sendFrameToFileAt(frame, bus, timebase.stampAt(record->ticks));
+    }
+    Logger::info("Boot capture: %i frames held, %i lost, first %i us after start up", held, lost,
+                 (uint32_t)(firstTicks / TIMEBASE_TICKS_US));
+}
+
+void BootCapture::printStatus()
+{
+    Logger::console("Buses up %i us after start up", (uint32_t)(busTicks / TIMEBASE_TICKS_US));
+    if (firstTicks) Logger::console("First frame at %i us", (uint32_t)(firstTicks / TIMEBASE_TICKS_US));
+    else Logger::console("No frames before start up finished");
+    Logger::console("%i frames held until %i ms, %i lost", held, (uint32_t)(finishTicks / TIMEBASE_TICKS_US / 1000), lost);
+}
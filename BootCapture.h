@@ -0,0 +1,75 @@
+/*
+ * BootCapture.h
+ *
+ * Catches the traffic on the buses while the rest of start up is still going. The CAN
+ * controllers are brought up as soon as the settings are read and their interrupts put
+ * each frame in RAM along with the time it came in. Once SD, EEPROM tables and the rest
+ * are ready the held frames go to the log and USB with those times, ahead of anything
+ * received after, so the wake up traffic right after ignition isn't lost.
+ * The records share their RAM with buffers that are only used once loop() runs.
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#ifndef BOOTCAPTURE_H_
+#define BOOTCAPTURE_H_
+
+#include <Arduino.h>
+#include <due_can.h>
+
+#define BOOT_CAPTURE_FRAMES 512 //24 bytes each
+
+struct BOOT_RECORD {
+    uint64_t ticks; //Timebase ticks when the interrupt ran
+    uint32_t id;
+    uint8_t data[8];
+    uint8_t length;
+    uint8_t flags; //bus in the low bits, BOOT_EXTENDED, BOOT_RTR
+};
+
+#define BOOT_EXTENDED   0x10
+#define BOOT_RTR        0x20
+
+class BootCapture
+{
+public:
+    BootCapture(BOOT_RECORD *buffer); //BOOT_CAPTURE_FRAMES records, free for other uses after finish()
+    void begin(); //before the buses are set up
+    void busesUp();
+    void frameReceived(CAN_FRAME &frame, uint8_t bus); //only called from the CAN interrupts
+    void finish(); //stops capturing and sends out what was held
+    void printStatus();
+
+private:
+    BOOT_RECORD *frames;
+    volatile uint16_t count;
+    volatile uint32_t lost; //frames after the buffer filled
+    uint64_t busTicks; //when the buses were up
+    uint64_t firstTicks; //first frame, 0 if none came in
+    uint64_t finishTicks; //when the held frames were sent out
+    uint16_t held; //count at finish
+};
+
+extern BootCapture bootCapture;
+
+#endif /* BOOTCAPTURE_H_ */
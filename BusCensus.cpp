@@ -0,0 +1,266 @@
+/*
+ * BusCensus.cpp
+ *
+ * Per bus ID table with count, DLC and period statistics
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#include "BusCensus.h"
+#include "GVRET.h"
+#include "config.h"
+#include "Logger.h"
+#include "CanBus.h"
+
+BusCensus::BusCensus()
+{
+    autoSaveInterval = 60000;
+    lastSave = 0;
+    for (int b = 0; b < CENSUS_BUSES; b++) {
+        table[b] = entries;
+        tableSize[b] = 0;
+    }
+    reset();
+}
+
+/*
+Splits the entries evenly between the buses the registry has. A board with just the two
+built in buses gets the same 128 IDs per bus the census always had and each extra bus
+takes its share from the others instead of the table growing with MAX_BUSES.
+The census starts over if the split changes.
+*/
+void BusCensus::setup()
+{
+    int present = 0;
+    bool changed = false;
+
+    for (int b = 0; b < CENSUS_BUSES; b++) if (busRegistry.get(b)) present++;
+    if (present == 0) return;
+
+    CENSUS_ENTRY *next = entries;
+    for (int b = 0; b < CENSUS_BUSES; b++) {
+        uint16_t size = busRegistry.get(b) ? CENSUS_ENTRIES / present : 0;
+        if (table[b] != next || tableSize[b] != size) changed = true;
+        table[b] = next;
+        tableSize[b] = size;
+        next += size;
+    }
+    if (changed) {
+        if (saveFile.isOpen()) saveFile.close();
+        reset();
+    }
+}
+
+void BusCensus::reset()
+{
+    for (int i = 0; i < CENSUS_ENTRIES; i++) entries[i].id = CENSUS_EMPTY;
+    for (int b = 0; b < CENSUS_BUSES; b++) {
+        numEntries[b] = 0;
+        overflows[b] = 0;
+    }
+}
+
+/*
+Called for every received frame so it has to stay cheap. The table is open addressed
+with linear probing and is never allowed to get more than 7/8 full so probe chains
+stay short. Interval statistics use Welford's running algorithm so there is no history to keep.
+*/
+void BusCensus::addFrame(CAN_FRAME &frame, uint8_t bus, uint32_t timestamp)
+{
+    if (bus >= CENSUS_BUSES) return;
+    uint32_t size = tableSize[bus];
+    if (size == 0) return;
+
+    uint32_t key = frame.id;
+    if (frame.extended) key |= 0x80000000;
+    uint32_t pos = ((uint64_t)(key * 2654435761u) * size) >> 32; //scales the hash to the size, no divide
+    CENSUS_ENTRY *entry;
+
+    for (uint32_t probe = 0; probe < size; probe++) {
+        entry = &table[bus][pos];
+        if (entry->id == key) {
+            uint32_t interval = timestamp - entry->lastSeen;
+            uint32_t n = entry->count++; //number of intervals seen including this one
+            entry->lastSeen = timestamp;
+            if (frame.length != entry->dlc) {
+                entry->dlc = frame.length;
+                entry->dlcChanged = 1;
+            }
+            if (n == 1) {
+                entry->meanInterval = interval;
+                entry->m2 = 0.0f;
+                entry->minInterval = interval;
+                entry->maxInterval = interval;
+            } else {
+                if (interval < entry->minInterval) entry->minInterval = interval;
+                if (interval > entry->maxInterval) entry->maxInterval = interval;
+                float delta = (float)interval - entry->meanInterval;
+                entry->meanInterval += delta / n;
+                entry->m2 += delta * ((float)interval - entry->meanInterval);
+            }
+            return;
+        }
+        if (entry->id == CENSUS_EMPTY) {
+            if (numEntries[bus] >= (size * 7) / 8) break;
+            entry->id = key;
+            entry->count = 1;
+            entry->lastSeen = timestamp;
+            entry->minInterval = 0;
+            entry->maxInterval = 0;
+            entry->meanInterval = 0.0f;
+            entry->m2 = 0.0f;
+            entry->dlc = frame.length;
+            entry->dlcChanged = 0;
+            numEntries[bus]++;
+            return;
+        }
+        if (++pos == size) pos = 0;
+    }
+    overflows[bus]++;
+}
+
+float BusCensus::getJitter(CENSUS_ENTRY &entry)
+{
+    if (entry.count < 3) return 0.0f;
+    return sqrtf(entry.m2 / (entry.count - 2)); //count - 1 intervals, sample standard deviation
+}
+
+void BusCensus::printTable(uint8_t bus)
+{
+    if (bus >= CENSUS_BUSES || tableSize[bus] == 0) return;
+    Logger::console("Bus %i: %i IDs (%i frames did not fit in the table)", bus, numEntries[bus], overflows[bus]);
+    Logger::console("ID, Ext, DLC, Count, Mean period (us), Min (us), Max (us), Jitter (us)");
+    for (int i = 0; i < tableSize[bus]; i++) {
+        CENSUS_ENTRY &entry = table[bus][i];
+        if (entry.id == CENSUS_EMPTY) continue;
+        Logger::console("%x, %i, %i%s, %i, %i, %i, %i, %i", entry.id & 0x7FFFFFFF, entry.id >> 31, entry.dlc,
+                        entry.dlcChanged ? "*" : "", entry.count, (uint32_t)entry.meanInterval, entry.minInterval,
+                        entry.maxInterval, (uint32_t)getJitter(entry));
+    }
+}
+
+/*
+Binary version of the table. Sent as:
+0xF1, PROTO_GET_CENSUS, bus, number of entries (2 bytes), then for each entry:
+ID (4 bytes, bit 31 = extended), DLC (bit 7 set if it has changed), count, mean period, min interval, max interval, jitter
+All values are little endian 32 bit integers in microseconds.
+*/
+void BusCensus::sendTableBinary(uint8_t bus)
+{
+    uint8_t buff[25];
+    uint32_t vals[6];
+
+    if (bus >= CENSUS_BUSES) bus = 0;
+    buff[0] = 0xF1;
+    buff[1] = PROTO_GET_CENSUS;
+    buff[2] = bus;
+    buff[3] = numEntries[bus] & 0xFF;
+    buff[4] = numEntries[bus] >> 8;
+    sendBytesToUSB(buff, 5);
+
+    for (int i = 0; i < tableSize[bus]; i++) {
+        CENSUS_ENTRY &entry = table[bus][i];
+        if (entry.id == CENSUS_EMPTY) continue;
+        vals[0] = entry.id;
+        vals[1] = entry.count;
+        vals[2] = (uint32_t)entry.meanInterval;
+        vals[3] = entry.minInterval;
+        vals[4] = entry.maxInterval;
+        vals[5] = (uint32_t)getJitter(entry);
+        buff[4] = entry.dlc | (entry.dlcChanged << 7);
+        for (int v = 0; v < 6; v++) {
+            int pos = (v == 0) ? 0 : 1 + v * 4;
+            buff[pos] = (uint8_t)(vals[v] & 0xFF);
+            buff[pos + 1] = (uint8_t)(vals[v] >> 8);
+            buff[pos + 2] = (uint8_t)(vals[v] >> 16);
+            buff[pos + 3] = (uint8_t)(vals[v] >> 24);
+        }
+        sendBytesToUSB(buff, 25);
+    }
+}
+
+/*
+Starts writing every bus to a CSV file on the SD card, replacing the previous one. Only the
+header goes out here, loop() adds CENSUS_SAVE_ROWS lines at a time so a full table never
+holds up the frame path for the whole file. Rows are written as they are when their turn comes.
+*/
+bool BusCensus::saveToFile()
+{
+    char buff[96];
+    int len;
+
+    lastSave = millis();
+    if (!SysSettings.SDCardInserted) return false;
+    if (saveFile.isOpen()) return true; //one is already under way
+    if (!saveFile.open(CENSUS_FILENAME, O_CREAT | O_TRUNC | O_WRITE)) {
+        Logger::error("Could not open census file");
+        return false;
+    }
+    len = sprintf(buff, "Bus,ID,Extended,DLC,DLCChanged,Count,MeanPeriod,MinInterval,MaxInterval,Jitter\r\n");
+    saveFile.write(buff, len);
+    saveBus = 0;
+    savePos = 0;
+    return true;
+}
+
+bool BusCensus::isSaving()
+{
+    return saveFile.isOpen();
+}
+
+void BusCensus::saveRows()
+{
+    char buff[96];
+    int len;
+    int rows = 0;
+
+    while (saveBus < CENSUS_BUSES && rows < CENSUS_SAVE_ROWS) {
+        if (savePos >= tableSize[saveBus]) {
+            saveBus++;
+            savePos = 0;
+            continue;
+        }
+        CENSUS_ENTRY &entry = table[saveBus][savePos++];
+        if (entry.id == CENSUS_EMPTY) continue;
+        len = sprintf(buff, "%i,%x,%i,%i,%i,%u,%u,%u,%u,%u\r\n", saveBus, (unsigned int)(entry.id & 0x7FFFFFFF),
+                      (int)(entry.id >> 31), entry.dlc, entry.dlcChanged, (unsigned int)entry.count,
+                      (unsigned int)entry.meanInterval, (unsigned int)entry.minInterval,
+                      (unsigned int)entry.maxInterval, (unsigned int)getJitter(entry));
+        saveFile.write(buff, len);
+        rows++;
+    }
+    if (saveBus >= CENSUS_BUSES) saveFile.close();
+}
+
+void BusCensus::setAutoSaveInterval(uint32_t seconds)
+{
+    autoSaveInterval = seconds * 1000;
+}
+
+//While logging to the SD card the census is saved alongside the log every so often so
+//a survey works with no host attached at all.
+void BusCensus::loop()
+{
+    if (saveFile.isOpen()) saveRows();
+    else if (autoSaveInterval != 0 && SysSettings.logToFile && millis() - lastSave > autoSaveInterval) saveToFile();
+}
@@ -0,0 +1,89 @@
+/*
+ * BusCensus.h
+ *
+ * Keeps a per bus table of every ID seen along with how often and how regularly
+ * it shows up. This is the first thing anyone wants when reverse engineering a bus
+ * and doing it on the device means it works without a fast link to a host.
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#ifndef BUSCENSUS_H_
+#define BUSCENSUS_H_
+
+#include <Arduino.h>
+#include <due_can.h>
+#include <SdFat.h>
+#include "config.h"
+
+#define CENSUS_ENTRIES  256 //shared out between the buses the board has when setup() runs
+#define CENSUS_BUSES    MAX_BUSES
+#define CENSUS_EMPTY    0xFFFFFFFF
+#define CENSUS_FILENAME "CENSUS.CSV"
+#define CENSUS_SAVE_ROWS 8 //CSV lines written to the card per loop() while saving
+
+struct CENSUS_ENTRY { //32 bytes
+    uint32_t id; //bit 31 set for extended frames. CENSUS_EMPTY if unused
+    uint32_t count;
+    uint32_t lastSeen; //micros of last reception
+    uint32_t minInterval;
+    uint32_t maxInterval;
+    float meanInterval; //running mean and sum of squared deviations (Welford)
+    float m2;
+    uint8_t dlc;
+    uint8_t dlcChanged; //set if the ID has been seen with more than one length
+};
+
+class BusCensus
+{
+public:
+    BusCensus();
+    void setup(); //call again whenever the bus registry changes
+    void reset();
+    void addFrame(CAN_FRAME &frame, uint8_t bus, uint32_t timestamp);
+    void printTable(uint8_t bus);
+    void sendTableBinary(uint8_t bus);
+    bool saveToFile(); //starts a save, loop() writes the rows
+    bool isSaving();
+    void setAutoSaveInterval(uint32_t seconds);
+    void loop();
+
+private:
+    CENSUS_ENTRY entries[CENSUS_ENTRIES];
+    CENSUS_ENTRY *table[CENSUS_BUSES]; //this bus's share of entries
+    uint16_t tableSize[CENSUS_BUSES]; //0 for a bus the board doesn't have
+    uint16_t numEntries[CENSUS_BUSES];
+    uint32_t overflows[CENSUS_BUSES];
+    uint32_t autoSaveInterval; //in milliseconds. 0 = off
+    uint32_t lastSave;
+    SdFile saveFile;
+    uint8_t saveBus;
+    uint16_t savePos;
+
+    float getJitter(CENSUS_ENTRY &entry);
+    void saveRows();
+};
+
+extern BusCensus busCensus;
+
+#endif /* BUSCENSUS_H_ */
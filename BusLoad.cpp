@@ -0,0 +1,207 @@
+/*
+ * BusLoad.cpp
+ *
+ * Per bus utilization and frame rate estimation
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#include "BusLoad.h"
+#include "GVRET.h"
+#include "config.h"
+#include "Logger.h"
+#include "CanBus.h"
+
+BusLoad::BusLoad()
+{
+    reportInterval = 0;
+    lastReport = 0;
+    buildBitTable(false);
+    reset();
+}
+
+void BusLoad::reset()
+{
+    for (int b = 0; b < BUSLOAD_BUSES; b++) {
+        for (int s = 0; s < BUSLOAD_SLOTS; s++) {
+            slotBits[b][s] = 0;
+            slotFrames[b][s] = 0;
+        }
+        for (int s = 0; s < BUSLOAD_SECONDS; s++) secondBits[b][s] = 0;
+        curBits[b] = 0;
+        curFrames[b] = 0;
+        bits1s[b] = 0;
+        bits10s[b] = 0;
+        frames1s[b] = 0;
+        lastSlotBits[b] = 0;
+        peakSlotBits[b] = 0;
+        peakSlotFrames[b] = 0;
+    }
+    curSlot = 0;
+    curSecond = 0;
+    lastSlotTime = millis();
+}
+
+/*
+Bit times on the wire for every frame type and length, worked out once so the per frame
+cost is a single table lookup.
+Standard frame: 44 bits of framing + 8 per data byte. 34 + 8n of those are subject to stuffing.
+Extended frame: 64 bits of framing + 8 per data byte. 54 + 8n of those are subject to stuffing.
+Both then have 3 bits of interframe space. Remote frames have no data bytes on the wire.
+Worst case stuffing is one bit for every 4 after the first. Since real payloads rarely hit
+that the default estimate uses half of the worst case.
+*/
+void BusLoad::buildBitTable(boolean worstCase)
+{
+    int dataBits, stuffable, stuffBits;
+    for (int ext = 0; ext < 2; ext++) {
+        for (int rtr = 0; rtr < 2; rtr++) {
+            for (int dlc = 0; dlc < 9; dlc++) {
+                dataBits = rtr ? 0 : dlc * 8;
+                stuffable = (ext ? 54 : 34) + dataBits;
+                stuffBits = (stuffable - 1) / 4;
+                if (!worstCase) stuffBits = stuffBits / 2;
+                frameBits[ext][rtr][dlc] = (ext ? 64 : 44) + dataBits + stuffBits + 3;
+            }
+        }
+    }
+}
+
+void BusLoad::setWorstCaseStuffing(boolean worstCase)
+{
+    buildBitTable(worstCase);
+}
+
+void BusLoad::setReportInterval(uint16_t millis)
+{
+    reportInterval = millis;
+}
+
+void BusLoad::addFrame(CAN_FRAME &frame, uint8_t bus)
+{
+    if (bus >= BUSLOAD_BUSES) return;
+    uint8_t dlc = frame.length;
+    if (dlc > 8) dlc = 8;
+    curBits[bus] += frameBits[frame.extended ? 1 : 0][frame.rtr ? 1 : 0][dlc];
+    curFrames[bus]++;
+}
+
+uint32_t BusLoad::getBitrate(uint8_t bus)
+{
+    return busRegistry.getSpeed(bus);
+}
+
+uint16_t BusLoad::calcLoad(uint32_t bits, uint32_t bitrate, uint32_t windowMs)
+{
+    if (bitrate == 0) return 0;
+    uint64_t load = ((uint64_t)bits * 1000000ull) / ((uint64_t)bitrate * windowMs);
+    if (load > 1000) load = 1000;
+    return (uint16_t)load;
+}
+
+void BusLoad::loop()
+{
+    //close out any 100ms slots that have finished. Frames from a stalled loop land in the first one.
+    while (millis() - lastSlotTime >= BUSLOAD_SLOT_MS) {
+        lastSlotTime += BUSLOAD_SLOT_MS;
+        for (int b = 0; b < BUSLOAD_BUSES; b++) {
+            //slot curSlot still holds the value from a second ago which is about to fall out
+            bits1s[b] += curBits[b] - slotBits[b][curSlot];
+            frames1s[b] += curFrames[b] - slotFrames[b][curSlot];
+            slotBits[b][curSlot] = curBits[b];
+            slotFrames[b][curSlot] = curFrames[b];
+            lastSlotBits[b] = curBits[b];
+            if (curBits[b] > peakSlotBits[b]) peakSlotBits[b] = curBits[b];
+            if (curFrames[b] > peakSlotFrames[b]) peakSlotFrames[b] = curFrames[b];
+            curBits[b] = 0;
+            curFrames[b] = 0;
+        }
+        curSlot = (curSlot + 1) % BUSLOAD_SLOTS;
+        if (curSlot == 0) { //a whole second is in the slots now, and the same goes for the seconds
+            for (int b = 0; b < BUSLOAD_BUSES; b++) {
+                bits10s[b] += bits1s[b] - secondBits[b][curSecond];
+                secondBits[b][curSecond] = bits1s[b];
+            }
+            curSecond = (curSecond + 1) % BUSLOAD_SECONDS;
+        }
+    }
+
+    if (reportInterval > 0 && (millis() - lastReport) >= reportInterval) {
+        lastReport = millis();
+        if (settings.useBinarySerialComm && !SysSettings.lawicelMode) sendStatsBinary();
+    }
+}
+
+void BusLoad::getStats(uint8_t bus, BUS_LOAD_STATS &stats)
+{
+    uint32_t bitrate = getBitrate(bus);
+    stats.load100ms = calcLoad(lastSlotBits[bus], bitrate, BUSLOAD_SLOT_MS);
+    stats.load1s = calcLoad(bits1s[bus], bitrate, 1000);
+    stats.load10s = calcLoad(bits10s[bus], bitrate, 10000);
+    stats.peakLoad = calcLoad(peakSlotBits[bus], bitrate, BUSLOAD_SLOT_MS);
+    stats.framesPerSec = frames1s[bus];
+    stats.peakFramesPerSec = peakSlotFrames[bus] * (1000 / BUSLOAD_SLOT_MS);
+}
+
+void BusLoad::printStats()
+{
+    BUS_LOAD_STATS stats;
+    for (int b = 0; b < BUSLOAD_BUSES; b++) {
+        if (b >= 2 && !busRegistry.isEnabled(b)) continue;
+        getStats(b, stats);
+        Logger::console("Bus %i load 100ms: %i.%i%% 1s: %i.%i%% 10s: %i.%i%% peak: %i.%i%%  frames/s: %i peak: %i", b,
+                        stats.load100ms / 10, stats.load100ms % 10, stats.load1s / 10, stats.load1s % 10,
+                        stats.load10s / 10, stats.load10s % 10, stats.peakLoad / 10, stats.peakLoad % 10,
+                        stats.framesPerSec, stats.peakFramesPerSec);
+    }
+}
+
+/*
+0xF1, PROTO_BUS_LOAD, number of buses, then for each bus six 16 bit little endian values:
+100ms load, 1s load, 10s load, peak 100ms load (all in tenths of a percent), frames/s, peak frames/s
+*/
+void BusLoad::sendStatsBinary()
+{
+    uint8_t buff[3 + BUSLOAD_BUSES * 12];
+    BUS_LOAD_STATS stats;
+    uint16_t vals[6];
+    int pos = 3;
+
+    buff[0] = 0xF1;
+    buff[1] = PROTO_BUS_LOAD;
+    buff[2] = BUSLOAD_BUSES;
+    for (int b = 0; b < BUSLOAD_BUSES; b++) {
+        getStats(b, stats);
+        vals[0] = stats.load100ms;
+        vals[1] = stats.load1s;
+        vals[2] = stats.load10s;
+        vals[3] = stats.peakLoad;
+        vals[4] = stats.framesPerSec;
+        vals[5] = stats.peakFramesPerSec;
+        for (int v = 0; v < 6; v++) {
+            buff[pos++] = vals[v] & 0xFF;
+            buff[pos++] = vals[v] >> 8;
+        }
+    }
+    sendBytesToUSB(buff, pos);
+}
@@ -0,0 +1,93 @@
+/*
+ * BusLoad.h
+ *
+ * Estimates the utilization of each bus from the frames that are received on it.
+ * Each frame is converted to the number of bit times it occupied (from ID type, DLC and
+ * stuff bits) and those are accumulated into 100ms slots, and the slots into whole seconds.
+ * Those give sliding 100ms and 1s windows and a 10s one that moves on once a second, without
+ * ever having to sum them up again.
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#ifndef BUSLOAD_H_
+#define BUSLOAD_H_
+
+#include <Arduino.h>
+#include <due_can.h>
+#include "config.h"
+
+#define BUSLOAD_BUSES       MAX_BUSES
+#define BUSLOAD_SLOT_MS     100
+#define BUSLOAD_SLOTS       10 //10 slots of 100ms = 1 second window
+#define BUSLOAD_SECONDS     10 //then 10 whole seconds for the 10 second window
+
+struct BUS_LOAD_STATS {
+    uint16_t load100ms; //all loads are in tenths of a percent
+    uint16_t load1s;
+    uint16_t load10s;
+    uint16_t peakLoad; //highest 100ms load since last reset
+    uint16_t framesPerSec; //over the last second
+    uint16_t peakFramesPerSec; //highest 100ms frame count scaled to a second
+};
+
+class BusLoad
+{
+public:
+    BusLoad();
+    void reset();
+    void addFrame(CAN_FRAME &frame, uint8_t bus);
+    void loop();
+    void getStats(uint8_t bus, BUS_LOAD_STATS &stats);
+    void printStats();
+    void sendStatsBinary();
+    void setReportInterval(uint16_t millis);
+    void setWorstCaseStuffing(boolean worstCase);
+
+private:
+    uint32_t slotBits[BUSLOAD_BUSES][BUSLOAD_SLOTS];
+    uint16_t slotFrames[BUSLOAD_BUSES][BUSLOAD_SLOTS];
+    uint32_t secondBits[BUSLOAD_BUSES][BUSLOAD_SECONDS];
+    uint32_t curBits[BUSLOAD_BUSES];
+    uint16_t curFrames[BUSLOAD_BUSES];
+    uint32_t bits1s[BUSLOAD_BUSES]; //running sums over the most recent 10 completed slots and 10 completed seconds
+    uint32_t bits10s[BUSLOAD_BUSES];
+    uint32_t frames1s[BUSLOAD_BUSES];
+    uint32_t lastSlotBits[BUSLOAD_BUSES];
+    uint32_t peakSlotBits[BUSLOAD_BUSES];
+    uint16_t peakSlotFrames[BUSLOAD_BUSES];
+    uint8_t curSlot;
+    uint8_t curSecond;
+    uint32_t lastSlotTime;
+    uint16_t reportInterval; //milliseconds between binary reports. 0 = off
+    uint32_t lastReport;
+    uint8_t frameBits[2][2][9]; //[extended][rtr][dlc] bit times for a frame including interframe space
+
+    void buildBitTable(boolean worstCase);
+    uint32_t getBitrate(uint8_t bus);
+    uint16_t calcLoad(uint32_t bits, uint32_t bitrate, uint32_t windowMs);
+};
+
+extern BusLoad busLoad;
+
+#endif /* BUSLOAD_H_ */
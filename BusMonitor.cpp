@@ -0,0 +1,210 @@
+/*
+ * BusMonitor.cpp
+ *
+ * Error counter sampling, bus state tracking and bus-off recovery
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#include "BusMonitor.h"
+#include "GVRET.h"
+#include "config.h"
+#include "Logger.h"
+#include "CanBus.h"
+
+static const char *stateNames[] = {"active", "warning", "passive", "bus-off", "disabled"};
+
+BusMonitor::BusMonitor()
+{
+    lastSample = 0;
+    initialBackoff = 10;
+    maxBackoff = 1000;
+    for (int b = 0; b < BUSMON_BUSES; b++) {
+        status[b].state = BUS_DISABLED;
+        status[b].tec = 0;
+        status[b].rec = 0;
+        status[b].errorFlags = 0;
+        status[b].lawicelFlags = 0;
+        status[b].busOffCount = 0;
+        status[b].errorFrames = 0;
+        status[b].stateSince = 0;
+        status[b].recoverAt = 0;
+        status[b].backoff = initialBackoff;
+        status[b].recoveries = 0;
+    }
+}
+
+//initialMs of 0 turns off automatic recovery. The controllers then take the slow path
+//of waiting out 128 idle sequences on their own (which never happens on a bus that stays broken)
+void BusMonitor::setRecoveryBackoff(uint16_t initialMs, uint16_t maxMs)
+{
+    initialBackoff = initialMs;
+    maxBackoff = (maxMs < initialMs) ? initialMs : maxMs;
+    for (int b = 0; b < BUSMON_BUSES; b++) status[b].backoff = initialBackoff;
+}
+
+void BusMonitor::loop()
+{
+    if (millis() - lastSample < BUSMON_SAMPLE_MS) return;
+    lastSample = millis();
+
+    for (int b = 0; b < BUSMON_BUSES; b++) {
+        CanBus *bus = busRegistry.get(b);
+        uint8_t state, tec, rec, flags;
+        if (!bus || !bus->isRunning()) {
+            status[b].state = BUS_DISABLED;
+            continue;
+        }
+        bus->getErrors(state, tec, rec, flags);
+        updateStatus(b, state, tec, rec, flags);
+    }
+
+    for (int b = 0; b < BUSMON_BUSES; b++) {
+        BUS_STATUS &stat = status[b];
+        if (stat.state == BUS_OFF) {
+            if (initialBackoff > 0 && (int32_t)(millis() - stat.recoverAt) >= 0) recover(b);
+        } else if (stat.state != BUS_DISABLED && stat.backoff != initialBackoff && (millis() - stat.stateSince) > BUSMON_STABLE_MS) {
+            stat.backoff = initialBackoff;
+        }
+    }
+}
+
+void BusMonitor::updateStatus(uint8_t bus, uint8_t newState, uint8_t tec, uint8_t rec, uint8_t flags)
+{
+    BUS_STATUS &stat = status[bus];
+    bool changed = false;
+
+    if (flags || tec > stat.tec || rec > stat.rec) {
+        stat.errorFrames++;
+        changed = (flags != 0);
+    }
+    stat.errorFlags |= flags;
+    stat.lawicelFlags |= flags;
+    stat.tec = tec;
+    stat.rec = rec;
+
+    if (newState != stat.state) {
+        if (newState == BUS_OFF) {
+            stat.busOffCount++;
+            stat.recoverAt = millis() + stat.backoff;
+        }
+        stat.state = newState;
+        stat.stateSince = millis();
+        changed = true;
+    }
+
+    if (changed) sendStatusEvent(bus);
+}
+
+/*
+Status events go out in line with the frame traffic as a GVRET_EVENT_FLAG frame of type EVENT_BUS_STATUS:
+state, TEC, REC, error flags (BUSERR_*) since the last event, bus-off count (16 bit little endian)
+*/
+void BusMonitor::sendStatusEvent(uint8_t bus)
+{
+    BUS_STATUS &stat = status[bus];
+    uint8_t data[6];
+
+    data[0] = stat.state;
+    data[1] = stat.tec;
+    data[2] = stat.rec;
+    data[3] = stat.errorFlags;
+    data[4] = stat.busOffCount & 0xFF;
+    data[5] = stat.busOffCount >> 8;
+    stat.errorFlags = 0;
+    sendEventFrame(EVENT_BUS_STATUS, bus, data, 6);
+}
+
+/*
+Resetting the controller state without touching its configuration gets the bus back in a few bit
+times instead of waiting on 128 x 11 recessive bits. Each bus-off in a row doubles the
+wait before trying again so a bus that is really broken isn't hammered with error frames.
+*/
+void BusMonitor::recover(uint8_t bus)
+{
+    BUS_STATUS &stat = status[bus];
+    CanBus *canBus = busRegistry.get(bus);
+
+    if (canBus) canBus->recover();
+    stat.recoveries++;
+    stat.recoverAt = millis() + stat.backoff;
+    if (stat.backoff < maxBackoff) {
+        stat.backoff *= 2;
+        if (stat.backoff > maxBackoff) stat.backoff = maxBackoff;
+    }
+}
+
+//LAWICEL status bits for the first bus. Error bits are latched until read like a real adapter does.
+uint8_t BusMonitor::getLawicelStatus()
+{
+    BUS_STATUS &stat = status[0];
+    uint8_t val = 0;
+
+    if (stat.state == BUS_ERROR_WARNING || stat.state == BUS_ERROR_PASSIVE || stat.state == BUS_OFF) val |= 4;
+    if (stat.lawicelFlags & BUSERR_RX_OVERFLOW) val |= 8;
+    if (stat.state == BUS_ERROR_PASSIVE || stat.state == BUS_OFF) val |= 0x20;
+    if (stat.lawicelFlags & BUSERR_ARB_LOST) val |= 0x40;
+    if ((stat.lawicelFlags & (BUSERR_CRC | BUSERR_STUFF | BUSERR_ACK | BUSERR_FORM | BUSERR_BIT)) || stat.state == BUS_OFF) val |= 0x80;
+    stat.lawicelFlags = 0;
+    return val;
+}
+
+void BusMonitor::printStatus()
+{
+    for (int b = 0; b < BUSMON_BUSES; b++) {
+        BUS_STATUS &stat = status[b];
+        if (b >= 2 && !busRegistry.isEnabled(b)) continue;
+        Logger::console("Bus %i: %s for %ims  TEC: %i REC: %i  Errors: %i  Bus-off: %i  Recoveries: %i", b,
+                        stateNames[stat.state], millis() - stat.stateSince, stat.tec, stat.rec, stat.errorFrames,
+                        stat.busOffCount, stat.recoveries);
+    }
+    if (initialBackoff > 0) Logger::console("Bus-off recovery after %i ms, backing off to at most %i ms", initialBackoff, maxBackoff);
+    else Logger::console("Automatic bus-off recovery is off");
+}
+
+/*
+0xF1, PROTO_BUS_STATUS, number of buses, then for each bus:
+state, TEC, REC, bus-off count (16 bit), error count (32 bit). All little endian.
+*/
+void BusMonitor::sendStatusBinary()
+{
+    uint8_t buff[3 + BUSMON_BUSES * 9];
+    int pos = 3;
+
+    buff[0] = 0xF1;
+    buff[1] = PROTO_BUS_STATUS;
+    buff[2] = BUSMON_BUSES;
+    for (int b = 0; b < BUSMON_BUSES; b++) {
+        BUS_STATUS &stat = status[b];
+        buff[pos++] = stat.state;
+        buff[pos++] = stat.tec;
+        buff[pos++] = stat.rec;
+        buff[pos++] = stat.busOffCount & 0xFF;
+        buff[pos++] = stat.busOffCount >> 8;
+        buff[pos++] = stat.errorFrames & 0xFF;
+        buff[pos++] = stat.errorFrames >> 8;
+        buff[pos++] = stat.errorFrames >> 16;
+        buff[pos++] = stat.errorFrames >> 24;
+    }
+    sendBytesToUSB(buff, pos);
+}
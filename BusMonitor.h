@@ -0,0 +1,96 @@
+/*
+ * BusMonitor.h
+ *
+ * Samples the error counters and state of each CAN controller so that a quiet bus
+ * can be told apart from a dead one. State changes and error frames are sent out as
+ * status events in the normal USB and file streams and a bus that goes bus-off is
+ * brought back automatically after a configurable backoff.
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#ifndef BUSMONITOR_H_
+#define BUSMONITOR_H_
+
+#include <Arduino.h>
+#include "config.h"
+
+#define BUSMON_BUSES            MAX_BUSES
+#define BUSMON_SAMPLE_MS        10
+#define BUSMON_STABLE_MS        1000 //bus has to stay up this long before the backoff resets
+
+enum BUS_STATE {
+    BUS_ERROR_ACTIVE = 0,
+    BUS_ERROR_WARNING = 1,
+    BUS_ERROR_PASSIVE = 2,
+    BUS_OFF = 3,
+    BUS_DISABLED = 4
+};
+
+//bits used for error flags in status events
+#define BUSERR_CRC          1
+#define BUSERR_STUFF        2
+#define BUSERR_ACK          4
+#define BUSERR_FORM         8
+#define BUSERR_BIT          16
+#define BUSERR_RX_OVERFLOW  32
+#define BUSERR_ARB_LOST     64
+
+struct BUS_STATUS {
+    uint8_t state;
+    uint8_t tec;
+    uint8_t rec;
+    uint8_t errorFlags; //flags seen since the last status event
+    uint8_t lawicelFlags; //flags seen since the last LAWICEL F command
+    uint16_t busOffCount;
+    uint32_t errorFrames; //number of samples that saw an error of any sort
+    uint32_t stateSince; //millis of the last state change
+    uint32_t recoverAt; //millis at which to attempt bus-off recovery
+    uint16_t backoff; //current recovery backoff in ms
+    uint16_t recoveries;
+};
+
+class BusMonitor
+{
+public:
+    BusMonitor();
+    void loop();
+    void printStatus();
+    void sendStatusBinary();
+    uint8_t getLawicelStatus();
+    void setRecoveryBackoff(uint16_t initialMs, uint16_t maxMs);
+    BUS_STATUS status[BUSMON_BUSES];
+
+private:
+    uint32_t lastSample;
+    uint16_t initialBackoff; //0 = don't recover automatically
+    uint16_t maxBackoff;
+
+    void updateStatus(uint8_t bus, uint8_t newState, uint8_t tec, uint8_t rec, uint8_t flags);
+    void sendStatusEvent(uint8_t bus);
+    void recover(uint8_t bus);
+};
+
+extern BusMonitor busMonitor;
+
+#endif /* BUSMONITOR_H_ */
@@ -0,0 +1,1029 @@
+/*
+ * CanBus.cpp
+ *
+ * Bus registry and the SAM3X and MCP2515 controllers behind it
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#include "CanBus.h"
+#include "GVRET.h"
+#include "Logger.h"
+#include "Timebase.h"
+#include "BusMonitor.h"
+#include <SPI.h>
+#include <new>
+
+//MCP2515 SPI instructions
+#define MCP_READ            0x03
+#define MCP_BIT_MODIFY      0x05
+#define MCP_READ_RX_BUFFER  0x90 //| buffer << 2. Starts at RXBnSIDH and clears RXnIF when CS goes high
+#define MCP_READ_STATUS     0xA0
+#define MCP_LOAD_TX_BUFFER  0x40 //| buffer << 1. Starts at TXBnSIDH
+#define MCP_RTS             0x80 //| 1 << buffer
+
+//MCP2515 registers
+#define MCP_RXM0SIDH        0x20 //RXM1 follows at 0x24, each is SIDH, SIDL, EID8, EID0 like the filters
+#define MCP_RXB0CTRL        0x60
+#define MCP_RXB1CTRL        0x70
+#define MCP_CANSTAT         0x0E
+#define MCP_CANCTRL         0x0F
+#define MCP_TXB0CTRL        0x30 //TXB1CTRL and TXB2CTRL follow 0x10 apart
+#define MCP_TXREQ           0x08
+#define MCP_TEC             0x1C
+#define MCP_REC             0x1D
+#define MCP_EFLG            0x2D
+#define MCP_CANINTF         0x2C
+#define MCP_CANINTF_TX0IF   0x04 //TX1IF and TX2IF follow
+
+#define MCP_MODE_LISTEN     0x60 //REQOP bits of CANCTRL
+#define MCP_MODE_CONFIG     0x80
+#define MCP_MODE_MASK       0xE0
+#define MCP_RXB_RXM         0x60 //RXBnCTRL bits that turn the mask and filters off
+#define MCP_STATUS_RX0IF    0x01
+#define MCP_STATUS_RX1IF    0x02
+#define MCP_STATUS_TX0IF    0x08 //TX1IF and TX2IF are 2 and 4 bits up
+#define MCP_SIDL_SRR        0x10
+#define MCP_SIDL_IDE        0x08
+#define MCP_DLC_RTR         0x40
+
+//EFLG bits
+#define MCP_EFLG_EWARN      0x01
+#define MCP_EFLG_RXEP       0x08
+#define MCP_EFLG_TXEP       0x10
+#define MCP_EFLG_TXBO       0x20
+#define MCP_EFLG_RX0OVR     0x40
+#define MCP_EFLG_RX1OVR     0x80
+
+#define MCP_DRAIN_PASSES    4 //so a bus flooding the chip can't keep the interrupt running, the main loop gets the rest
+#define DUE_TX_MAILBOX      7 //due_can leaves the last mailbox for sending
+#define MCP_CONFIG_POLLS    100 //CANSTAT reads waiting for configuration mode, it takes a few bit times
+
+static const uint8_t mcpFilterRegs[MCP_FILTERS] = {0x00, 0x04, 0x08, 0x10, 0x14, 0x18}; //RXFnSIDH
+
+extern MCP2515 SWCAN;
+
+static const SPISettings mcpSPI(MCP_SPI_CLOCK, MSBFIRST, SPI_MODE0);
+
+static void swcanInt();
+static void ext3Int();
+static void ext4Int();
+
+static DueCanBus can0Bus(0, Can0, &settings.CAN0Speed, &settings.CAN0_Enabled, &settings.CAN0ListenOnly, settings.CAN0Filters,
+                         &SysSettings.CAN0EnablePin);
+static DueCanBus can1Bus(1, Can1, &settings.CAN1Speed, &settings.CAN1_Enabled, &settings.CAN1ListenOnly, settings.CAN1Filters,
+                         &SysSettings.CAN1EnablePin);
+static McpCanBus swcanBus(2, &settings.SWCANSpeed, &settings.singleWire_Enabled, &settings.SWCANListenOnly, swcanInt);
+//one for each of EXT_BUSES
+static McpCanBus ext3Bus(3, &settings.extBuses[0].speed, &settings.extBuses[0].enabled, &settings.extBuses[0].listenOnly, ext3Int);
+static McpCanBus ext4Bus(4, &settings.extBuses[1].speed, &settings.extBuses[1].enabled, &settings.extBuses[1].listenOnly, ext4Int);
+static McpCanBus *const extBuses[EXT_BUSES] = {&ext3Bus, &ext4Bus};
+//the extra buses' drivers are built here once their pins are known, so they are in .bss and not on the heap
+static uint64_t extDrivers[EXT_BUSES][(sizeof(MCP2515) + 7) / 8];
+static MCP_RECORD mcpRxPool[MCP_RX_POOL];
+
+static void swcanInt()
+{
+    swcanBus.interrupt();
+}
+
+static void ext3Int()
+{
+    ext3Bus.interrupt();
+}
+
+static void ext4Int()
+{
+    ext4Bus.interrupt();
+}
+
+CanBus::CanBus(uint8_t number, uint32_t *speed, boolean *enabled, boolean *listenOnly)
+{
+    this->number = number;
+    this->speed = speed;
+    this->enabled = enabled;
+    this->listenOnly = listenOnly;
+    running = false;
+    rxFrames = 0;
+    txFrames = 0;
+    txAborted = 0;
+    maxTxWait = 0;
+    wakeups = 0;
+    lastWakeToTx = 0;
+    maxWakeToTx = 0;
+    txCount = 0;
+    txAborting = false;
+    singleWire = false;
+    wakeState = WAKE_IDLE;
+    for (int p = 0; p < TX_CLASSES; p++) {
+        txHead[p] = 0;
+        txTail[p] = 0;
+        txDropped[p] = 0;
+    }
+}
+
+uint8_t CanBus::getNumber()
+{
+    return number;
+}
+
+uint32_t CanBus::getSpeed()
+{
+    return *speed;
+}
+
+bool CanBus::isEnabled()
+{
+    return *enabled;
+}
+
+bool CanBus::isListenOnly()
+{
+    return *listenOnly;
+}
+
+bool CanBus::isRunning()
+{
+    return running;
+}
+
+void CanBus::setSingleWire(bool singleWire)
+{
+    this->singleWire = singleWire;
+}
+
+//the frame is copied so the caller can reuse it right away
+bool CanBus::queueFrame(CAN_FRAME &frame, uint8_t priority, bool wakeup, uint8_t source, uint32_t tag)
+{
+    uint8_t next;
+
+    if (priority >= TX_CLASSES) priority = TX_PRIO_LOW;
+    next = (txHead[priority] + 1) & (TX_QUEUE_DEPTH - 1);
+    if (!running || next == txTail[priority]) {
+        txDropped[priority]++;
+        return false;
+    }
+    TX_RECORD &record = txQueue[priority][txHead[priority]];
+    record.frame = frame;
+    record.ticks = timebase.ticks();
+    record.tag = tag;
+    record.source = source;
+    record.wakeup = wakeup;
+    txHead[priority] = next;
+    pumpTx();
+    return true;
+}
+
+/*
+The controller is given as many frames as it can hold while still sending them in the order it got
+them, so one can start the moment the last one is done without waiting on loop(). Anything queued
+later waits its turn here, so a low priority frame holds up a high priority one for at most that
+many frame times. Each frame that finishes is reported with its own timestamp. A wakeup frame
+waits until nothing else is going out and holds up the rest of the queue while the transceiver
+is in high voltage mode, so nothing else goes out that way.
+*/
+void CanBus::pumpTx()
+{
+    uint64_t ticks;
+    uint32_t wait;
+    bool sent;
+
+    while (txCount > 0 && txDone(ticks)) {
+        TX_RECORD record = txFlight[0];
+        for (int i = 1; i < txCount; i++) txFlight[i - 1] = txFlight[i];
+        txCount--;
+        sent = !txAborting;
+        txAborting = false;
+        txStartTicks = timebase.ticks();
+        finishTx(record, sent, ticks);
+    }
+    if (txCount > 0 && !txAborting && timebase.ticks() - txStartTicks > (uint64_t)TX_TIMEOUT_MS * (TIMEBASE_HZ / 1000)) {
+        abortTx();
+        txAborting = true;
+    }
+    if (wakeState != WAKE_IDLE && !wakeStep()) return;
+
+    while (txCount < TX_IN_FLIGHT && txReady()) {
+        int p;
+        for (p = 0; p < TX_CLASSES; p++) if (txTail[p] != txHead[p]) break;
+        if (p == TX_CLASSES) break;
+        TX_RECORD &record = txQueue[p][txTail[p]];
+        bool wakeup = record.wakeup && singleWire && settings.singleWire_Enabled;
+        if (wakeup && txCount > 0) break; //the transceiver can only change mode with nothing else going out
+        txTail[p] = (txTail[p] + 1) & (TX_QUEUE_DEPTH - 1);
+        wait = (uint32_t)((timebase.ticks() - record.ticks) / TIMEBASE_TICKS_US);
+        if (wait > maxTxWait) maxTxWait = wait;
+        if (wakeup) {
+            txWake = record;
+            setSWCANWakeup();
+            wakeTicks = timebase.ticks();
+            wakeState = WAKE_SETTLING;
+            break;
+        }
+        startFrame(record);
+    }
+}
+
+void CanBus::startFrame(TX_RECORD &record)
+{
+    uint64_t now = timebase.ticks();
+
+    record.ticks = now;
+    if (!startTx(record.frame)) {
+        finishTx(record, false, now);
+        return;
+    }
+    if (txCount == 0) {
+        txStartTicks = now;
+        txAborting = false;
+    }
+    txFlight[txCount++] = record;
+}
+
+void CanBus::finishTx(TX_RECORD &record, bool sent, uint64_t ticks)
+{
+    if (sent) {
+        if (ticks < record.ticks) ticks = record.ticks; //a controller timestamp that wrapped while loop() was held up
+        txFrames++;
+        if (wakeState == WAKE_SENDING) {
+            wakeups++;
+            lastWakeToTx = (uint32_t)((ticks - wakeTicks) / TIMEBASE_TICKS_US);
+            if (lastWakeToTx > maxWakeToTx) maxWakeToTx = lastWakeToTx;
+        }
+        processSentFrameAt(record.frame, number, ticks);
+    } else txAborted++;
+    if (record.source != TX_SOURCE_NONE) processTxDone(record.source, record.tag, sent, ticks);
+
+    if (wakeState == WAKE_SENDING) {
+        wakeState = WAKE_HOLDING;
+        wakeTicks = timebase.ticks();
+    }
+}
+
+//never got to the controller, or it was reset with the frame on it. Only the source is told
+void CanBus::dropTx(TX_RECORD &record)
+{
+    if (record.source != TX_SOURCE_NONE) processTxDone(record.source, record.tag, false, timebase.ticks());
+}
+
+//moves a wakeup along once its time is up. True when the transceiver is back to normal and the queue can go on
+bool CanBus::wakeStep()
+{
+    uint64_t elapsed = timebase.ticks() - wakeTicks;
+
+    if (wakeState == WAKE_SETTLING) {
+        if (elapsed < (uint64_t)WAKE_SETTLE_US * TIMEBASE_TICKS_US) return false;
+        wakeState = WAKE_SENDING;
+        startFrame(txWake);
+        return false;
+    }
+    if (wakeState == WAKE_HOLDING) {
+        if (elapsed < (uint64_t)WAKE_HOLD_US * TIMEBASE_TICKS_US) return false;
+        setSWCANEnabled();
+        wakeState = WAKE_IDLE;
+    }
+    return wakeState == WAKE_IDLE;
+}
+
+//anything queued or half sent is forgotten, the controller is being reset or turned off
+void CanBus::flushTx()
+{
+    for (int p = 0; p < TX_CLASSES; p++) {
+        while (txTail[p] != txHead[p]) {
+            dropTx(txQueue[p][txTail[p]]);
+            txTail[p] = (txTail[p] + 1) & (TX_QUEUE_DEPTH - 1);
+        }
+    }
+    for (int i = 0; i < txCount; i++) dropTx(txFlight[i]);
+    txCount = 0;
+    if (wakeState == WAKE_SETTLING) dropTx(txWake);
+    txAborting = false;
+    if (wakeState != WAKE_IDLE) setSWCANEnabled();
+    wakeState = WAKE_IDLE;
+}
+
+void CanBus::printStatus()
+{
+    Logger::console("Bus %i: %s at %i%s  %i frames in, %i out, %i aborted", number, running ? "running" : "off", *speed,
+                    *listenOnly ? " listen only" : "", rxFrames, txFrames, txAborted);
+    Logger::console("    TX queued high/normal/low: %i/%i/%i  dropped: %i/%i/%i  longest wait: %ius",
+                    (txHead[0] - txTail[0]) & (TX_QUEUE_DEPTH - 1), (txHead[1] - txTail[1]) & (TX_QUEUE_DEPTH - 1),
+                    (txHead[2] - txTail[2]) & (TX_QUEUE_DEPTH - 1), txDropped[0], txDropped[1], txDropped[2], maxTxWait);
+    if (singleWire) Logger::console("    %i high voltage wakeups, wakeup to frame %s last: %ius most: %ius", wakeups,
+                                    txStampAtStart() ? "start" : "end", lastWakeToTx, maxWakeToTx);
+}
+
+DueCanBus::DueCanBus(uint8_t number, CANRaw &can, uint32_t *speed, boolean *enabled, boolean *listenOnly, FILTER *filters,
+                     uint8_t *enablePin) : CanBus(number, speed, enabled, listenOnly), can(can)
+{
+    this->filters = filters;
+    this->enablePin = enablePin;
+    txHanded = 0;
+    lastStamp = 0;
+    txAbortPending = false;
+}
+
+bool DueCanBus::begin()
+{
+    flushTx();
+    txHanded = 0;
+    txAbortPending = false;
+    if (*listenOnly) can.enable_autobaud_listen_mode();
+    else can.disable_autobaud_listen_mode();
+    can.enable();
+    can.begin(*speed, *enablePin);
+    for (int i = 0; i < 7; i++) {
+        if (filters[i].enabled) can.setRXFilter(i, filters[i].id, filters[i].mask, filters[i].extended);
+    }
+    running = true;
+    return true;
+}
+
+void DueCanBus::end()
+{
+    flushTx();
+    txHanded = 0;
+    txAbortPending = false;
+    can.disable();
+    running = false;
+}
+
+bool DueCanBus::read(CAN_FRAME &frame, uint64_t &ticks)
+{
+    if (!can.available()) return false;
+    can.read(frame);
+    ticks = timebase.ticks();
+    return true;
+}
+
+/*
+There is one transmit mailbox. A second frame goes into due_can's own transmit ring and its
+mailbox interrupt loads it the moment the first is done, so the two go out back to back and in order.
+*/
+bool DueCanBus::txReady()
+{
+    return txHanded < 2;
+}
+
+bool DueCanBus::startTx(CAN_FRAME &frame)
+{
+    if (txHanded == 0) lastStamp = can.mailbox_get_status(DUE_TX_MAILBOX) & CAN_MSR_MTIMESTAMP_Msk;
+    if (!can.sendFrame(frame)) return false;
+    //SOF to the end of the interframe space without stuff bits
+    txBits[txHanded++] = (frame.extended ? 67 : 47) + (frame.rtr ? 0 : frame.length * 8);
+    return true;
+}
+
+//the mailbox timestamp is the CAN timer, which counts bit times, at the start of the frame
+uint64_t DueCanBus::stampTicks(uint16_t stamp)
+{
+    uint16_t bitsAgo = (uint16_t)(can.get_internal_timer_value() - stamp);
+    return timebase.ticks() - (uint64_t)bitsAgo * TIMEBASE_HZ / *speed;
+}
+
+/*
+The mailbox timestamp only moves when a frame finishes. With two handed over a new timestamp
+while the mailbox is busy again means the first is done and the second is going. If both were
+done before this looked the first one's start is worked back from the second's.
+*/
+bool DueCanBus::txDone(uint64_t &ticks)
+{
+    uint32_t msr = can.mailbox_get_status(DUE_TX_MAILBOX);
+    uint16_t stamp = msr & CAN_MSR_MTIMESTAMP_Msk;
+    bool idle = (msr & CAN_MSR_MRDY) ? true : false;
+
+    if (txHanded == 0) return false;
+    if (txAbortPending) { //the mailbox is free again, due_can moves on to anything it still holds
+        txAbortPending = false;
+        ticks = timebase.ticks();
+    } else if (!idle) {
+        if (txHanded < 2 || stamp == lastStamp) return false;
+        ticks = stampTicks(stamp);
+    } else if (txHanded == 2) {
+        ticks = stampTicks(stamp) - (uint64_t)txBits[0] * TIMEBASE_HZ / *speed;
+    } else ticks = stampTicks(stamp);
+    lastStamp = stamp;
+    txBits[0] = txBits[1];
+    txHanded--;
+    return true;
+}
+
+bool DueCanBus::txStampAtStart()
+{
+    return true;
+}
+
+void DueCanBus::abortTx()
+{
+    can.mailbox_send_abort_cmd(DUE_TX_MAILBOX);
+    txAbortPending = true;
+}
+
+bool DueCanBus::setFilter(uint8_t slot, uint32_t id, uint32_t mask, bool extended)
+{
+    return can.setRXFilter(slot, id, mask, extended) >= 0;
+}
+
+/*
+Reading CAN_SR clears the error flags in it and the due_can interrupt handler reads it on every
+mailbox interrupt so the flags seen here are only the ones that were left over. Rising error counters
+catch the rest, an error frame always moves one of them.
+*/
+void DueCanBus::getErrors(uint8_t &state, uint8_t &tec, uint8_t &rec, uint8_t &flags)
+{
+    uint32_t sr = can.get_status();
+
+    tec = (uint8_t)can.get_tx_error_cnt();
+    rec = (uint8_t)can.get_rx_error_cnt();
+    flags = 0;
+    state = BUS_ERROR_ACTIVE;
+
+    if (sr & CAN_SR_BOFF) state = BUS_OFF;
+    else if (sr & CAN_SR_ERRP) state = BUS_ERROR_PASSIVE;
+    else if (sr & CAN_SR_WARN) state = BUS_ERROR_WARNING;
+
+    if (sr & CAN_SR_CERR) flags |= BUSERR_CRC;
+    if (sr & CAN_SR_SERR) flags |= BUSERR_STUFF;
+    if (sr & CAN_SR_AERR) flags |= BUSERR_ACK;
+    if (sr & CAN_SR_FERR) flags |= BUSERR_FORM;
+    if (sr & CAN_SR_BERR) flags |= BUSERR_BIT;
+}
+
+//pulsing the enable bit resets the controller state without touching its configuration
+void DueCanBus::recover()
+{
+    can.disable();
+    can.enable();
+}
+
+McpCanBus::McpCanBus(uint8_t number, uint32_t *speed, boolean *enabled, boolean *listenOnly, void (*isr)())
+    : CanBus(number, speed, enabled, listenOnly)
+{
+    driver = NULL;
+    csPin = 255;
+    intPin = 255;
+    this->isr = isr;
+    queue = NULL;
+    queueMask = 0;
+    head = 0;
+    tail = 0;
+    received = 0;
+    lost = 0;
+    overruns = 0;
+    overrunSeen = false;
+    txPending = 0;
+    txDoneSeen = 0;
+    maxDepth = 0;
+    for (int f = 0; f < MCP_FILTERS; f++) filters[f].enabled = false;
+}
+
+void McpCanBus::setDriver(MCP2515 *driver, uint8_t csPin, uint8_t intPin)
+{
+    this->driver = driver;
+    this->csPin = csPin;
+    this->intPin = intPin;
+}
+
+bool McpCanBus::hasDriver()
+{
+    return driver != NULL;
+}
+
+//whatever was waiting in the old share is dropped
+void McpCanBus::setQueue(MCP_RECORD *queue, uint8_t size)
+{
+    if (queue == this->queue && queueMask == size - 1) return;
+    noInterrupts();
+    this->queue = queue;
+    queueMask = size - 1;
+    head = 0;
+    tail = 0;
+    maxDepth = 0;
+    interrupts();
+}
+
+//passes everything until setFilter() is used, the features that care about IDs do their own filtering
+bool McpCanBus::begin()
+{
+    if (!driver || !queue) return false;
+    flushTx();
+    txPending = 0;
+    if (running) detachInterrupt(intPin);
+    running = false;
+    SPI.begin();
+    if (!driver->Init(*speed, 16)) {
+        Logger::error("Bus %i: MCP2515 init failed", number);
+        return false;
+    }
+    driver->InitFilters(true);
+    if (!applyFilters()) Logger::error("Bus %i: MCP2515 filters not set", number);
+    if (*listenOnly) driver->Mode(MCP_MODE_LISTEN);
+    attachInterrupt(intPin, isr, FALLING);
+    running = true;
+    return true;
+}
+
+void McpCanBus::end()
+{
+    flushTx();
+    txPending = 0;
+    if (running) detachInterrupt(intPin);
+    running = false;
+}
+
+uint8_t McpCanBus::command(uint8_t instruction)
+{
+    uint8_t value;
+
+    SPI.beginTransaction(mcpSPI);
+    digitalWrite(csPin, LOW);
+    SPI.transfer(instruction);
+    value = SPI.transfer(0);
+    digitalWrite(csPin, HIGH);
+    SPI.endTransaction();
+    return value;
+}
+
+//one burst for the whole buffer: SIDH, SIDL, EID8, EID0, DLC and 8 data bytes
+void McpCanBus::readBuffer(uint8_t buffer, uint64_t ticks)
+{
+    uint8_t regs[13];
+    uint8_t next = (head + 1) & queueMask;
+
+    SPI.beginTransaction(mcpSPI);
+    digitalWrite(csPin, LOW);
+    SPI.transfer(MCP_READ_RX_BUFFER | (buffer << 2));
+    memset(regs, 0, sizeof(regs));
+    SPI.transfer(regs, sizeof(regs));
+    digitalWrite(csPin, HIGH);
+    SPI.endTransaction();
+
+    received++;
+    if (next == tail) { //still had to be read to free the chip's buffer
+        lost++;
+        return;
+    }
+
+    CAN_FRAME &frame = queue[head].frame;
+    if (regs[1] & MCP_SIDL_IDE) {
+        frame.extended = 1;
+        frame.id = ((uint32_t)regs[0] << 21) | ((uint32_t)(regs[1] & 0xE0) << 13) | ((uint32_t)(regs[1] & 0x03) << 16)
+                   | ((uint32_t)regs[2] << 8) | regs[3];
+        frame.rtr = (regs[4] & MCP_DLC_RTR) ? 1 : 0;
+    } else {
+        frame.extended = 0;
+        frame.id = ((uint32_t)regs[0] << 3) | (regs[1] >> 5);
+        frame.rtr = (regs[1] & MCP_SIDL_SRR) ? 1 : 0;
+    }
+    frame.length = regs[4] & 0x0F;
+    if (frame.length > 8) frame.length = 8;
+    memcpy(frame.data.bytes, regs + 5, 8);
+    queue[head].ticks = ticks;
+    head = next;
+}
+
+/*
+Keeps going until both buffers are empty so a frame that lands while the first is being read
+isn't left for the next interrupt. A transmit buffer that emptied is noted with the time so the
+frame's completion is stamped here instead of whenever loop() gets around to it. Overflow flags
+are counted and cleared here and getErrors() reports them. The driver's own handler runs last
+and clears the interrupt flags.
+*/
+/*
+INT stays low while any flag in CANINTF is set but the pin interrupt is on the falling edge. A
+flag that comes up while this is running leaves INT low with no edge to come, so it goes round
+until INT is high again. Past MCP_DRAIN_PASSES read() picks up what is left from the main loop.
+*/
+void McpCanBus::interrupt()
+{
+    uint8_t depth;
+
+    for (int pass = 0; pass < MCP_DRAIN_PASSES; pass++) {
+        service();
+        if (digitalRead(intPin) == HIGH) break;
+    }
+
+    depth = (head - tail) & queueMask;
+    if (depth > maxDepth) maxDepth = depth;
+}
+
+//one look at every flag. Reading a receive buffer clears its flag, the transmit flags are cleared here
+void McpCanBus::service()
+{
+    uint64_t now = timebase.ticks();
+    uint8_t status, eflg;
+    uint8_t txFlags = 0;
+
+    status = command(MCP_READ_STATUS);
+    for (int b = 0; b < 3; b++) {
+        if (!(status & (MCP_STATUS_TX0IF << (b * 2)))) continue;
+        if (txPending & ~txDoneSeen & (1 << b)) {
+            txDoneTicks[b] = now;
+            txDoneSeen |= 1 << b;
+        }
+        txFlags |= MCP_CANINTF_TX0IF << b;
+    }
+    if (status & MCP_STATUS_RX0IF) readBuffer(0, now);
+    if (status & MCP_STATUS_RX1IF) readBuffer(1, now);
+
+    SPI.beginTransaction(mcpSPI);
+    if (txFlags) {
+        digitalWrite(csPin, LOW);
+        SPI.transfer(MCP_BIT_MODIFY);
+        SPI.transfer(MCP_CANINTF);
+        SPI.transfer(txFlags);
+        SPI.transfer(0);
+        digitalWrite(csPin, HIGH);
+    }
+    digitalWrite(csPin, LOW);
+    SPI.transfer(MCP_READ);
+    SPI.transfer(MCP_EFLG);
+    eflg = SPI.transfer(0);
+    digitalWrite(csPin, HIGH);
+    if (eflg & (MCP_EFLG_RX0OVR | MCP_EFLG_RX1OVR)) {
+        digitalWrite(csPin, LOW);
+        SPI.transfer(MCP_BIT_MODIFY);
+        SPI.transfer(MCP_EFLG);
+        SPI.transfer(MCP_EFLG_RX0OVR | MCP_EFLG_RX1OVR);
+        SPI.transfer(0);
+        digitalWrite(csPin, HIGH);
+        if (eflg & MCP_EFLG_RX0OVR) overruns++;
+        if (eflg & MCP_EFLG_RX1OVR) overruns++;
+        overrunSeen = true;
+    }
+    SPI.endTransaction();
+
+    driver->intHandler();
+}
+
+bool McpCanBus::read(CAN_FRAME &frame, uint64_t &ticks)
+{
+    //INT still low once the ring is empty means the interrupt gave up on a flood or a flag came up
+    //as it finished. There won't be another edge so it is run from here
+    if (tail == head && running && digitalRead(intPin) == LOW) {
+        noInterrupts();
+        interrupt();
+        interrupts();
+    }
+    if (tail != head) {
+        frame = queue[tail].frame;
+        ticks = queue[tail].ticks;
+        tail = (tail + 1) & queueMask;
+        return true;
+    }
+    //any the driver read before the interrupt got to them
+    if (running && driver->GetRXFrame(frame)) {
+        ticks = timebase.ticks();
+        return true;
+    }
+    return false;
+}
+
+/*
+Frames are loaded into TXB2, then TXB1, then TXB0 with the same priority. The chip sends the highest
+numbered buffer first when priorities tie, so they go out in the order they were loaded. Once TXB0
+is used it waits for that one to finish before starting over at TXB2.
+*/
+int McpCanBus::nextTxBuffer()
+{
+    if (txPending == 0) return 2;
+    if (txPending & 1) return -1;
+    return (txPending & 2) ? 0 : 1;
+}
+
+int McpCanBus::oldestTxBuffer()
+{
+    return (txPending & 4) ? 2 : ((txPending & 2) ? 1 : 0);
+}
+
+bool McpCanBus::txReady()
+{
+    return running && nextTxBuffer() >= 0;
+}
+
+bool McpCanBus::startTx(CAN_FRAME &frame)
+{
+    uint8_t regs[13];
+    int buffer = nextTxBuffer();
+
+    if (!running || buffer < 0) return false;
+    if (frame.extended) {
+        regs[0] = frame.id >> 21;
+        regs[1] = ((frame.id >> 13) & 0xE0) | MCP_SIDL_IDE | ((frame.id >> 16) & 0x03);
+        regs[2] = frame.id >> 8;
+        regs[3] = frame.id;
+    } else {
+        regs[0] = frame.id >> 3;
+        regs[1] = (frame.id << 5) & 0xE0;
+        regs[2] = 0;
+        regs[3] = 0;
+    }
+    regs[4] = (frame.length > 8 ? 8 : frame.length) | (frame.rtr ? MCP_DLC_RTR : 0);
+    memcpy(regs + 5, frame.data.bytes, 8);
+
+    noInterrupts();
+    driver->BitModify(MCP_CANINTF, MCP_CANINTF_TX0IF << buffer, 0);
+    SPI.beginTransaction(mcpSPI);
+    digitalWrite(csPin, LOW);
+    SPI.transfer(MCP_LOAD_TX_BUFFER | (buffer << 1));
+    SPI.transfer(regs, sizeof(regs));
+    digitalWrite(csPin, HIGH);
+    digitalWrite(csPin, LOW);
+    SPI.transfer(MCP_RTS | (1 << buffer));
+    digitalWrite(csPin, HIGH);
+    SPI.endTransaction();
+    txPending |= 1 << buffer;
+    txDoneSeen &= ~(1 << buffer);
+    interrupts();
+    return true;
+}
+
+//stamped by the interrupt when it saw the buffer empty, otherwise when this noticed it
+bool McpCanBus::txDone(uint64_t &ticks)
+{
+    int buffer;
+    uint8_t ctrl;
+
+    if (txPending == 0) return false;
+    buffer = oldestTxBuffer();
+    noInterrupts();
+    ctrl = driver->Read(MCP_TXB0CTRL + buffer * 0x10);
+    if (ctrl & MCP_TXREQ) {
+        interrupts();
+        return false;
+    }
+    ticks = (txDoneSeen & (1 << buffer)) ? txDoneTicks[buffer] : timebase.ticks();
+    txPending &= ~(1 << buffer);
+    txDoneSeen &= ~(1 << buffer);
+    interrupts();
+    return true;
+}
+
+//the transmit interrupt comes once the frame is done
+bool McpCanBus::txStampAtStart()
+{
+    return false;
+}
+
+void McpCanBus::abortTx()
+{
+    if (txPending == 0) return;
+    noInterrupts();
+    driver->BitModify(MCP_TXB0CTRL + oldestTxBuffer() * 0x10, MCP_TXREQ, 0);
+    interrupts();
+}
+
+/*
+Slots 0 and 1 are RXF0-1 and share the RXB0 mask, 2 to 5 are RXF2-5 and share the RXB1 one. So a
+filter is turned down if its mask or frame type doesn't match another one enabled in its group.
+A zero mask turns the slot off. They last until a power cycle, the settings only keep CAN0 and CAN1's.
+*/
+bool McpCanBus::setFilter(uint8_t slot, uint32_t id, uint32_t mask, bool extended)
+{
+    if (slot >= MCP_FILTERS) return false;
+    int first = (slot < 2) ? 0 : 2;
+    int last = (slot < 2) ? 2 : MCP_FILTERS;
+    if (mask != 0) {
+        for (int f = first; f < last; f++) {
+            if (f == slot || !filters[f].enabled) continue;
+            if (filters[f].mask != mask || filters[f].extended != extended) return false;
+        }
+    }
+    filters[slot].id = id;
+    filters[slot].mask = mask;
+    filters[slot].extended = extended;
+    filters[slot].enabled = (mask != 0);
+    return running ? applyFilters() : true;
+}
+
+//SIDH, SIDL, EID8, EID0. Only filters have the IDE bit, a mask covers whatever the filter says
+void McpCanBus::writeId(uint8_t address, uint32_t value, bool extended, bool filter)
+{
+    if (extended) {
+        driver->Write(address, value >> 21);
+        driver->Write(address + 1, ((value >> 13) & 0xE0) | ((value >> 16) & 0x03) | (filter ? MCP_SIDL_IDE : 0));
+        driver->Write(address + 2, value >> 8);
+        driver->Write(address + 3, value);
+    } else {
+        driver->Write(address, value >> 3);
+        driver->Write(address + 1, (value << 5) & 0xE0);
+        driver->Write(address + 2, 0);
+        driver->Write(address + 3, 0);
+    }
+}
+
+/*
+Masks and filters can only be written in configuration mode, which drops the chip off the bus for
+a moment. With nothing set both buffers take every frame. Otherwise each group's mask comes from
+its filters, or the other group's if it has none, and unused filters repeat one that is set so
+they can't let anything else in. The chip goes back to the mode it was in.
+*/
+bool McpCanBus::applyFilters()
+{
+    int used[2] = {-1, -1}; //first enabled filter of each group
+    uint8_t ctrl, mode;
+    int polls;
+
+    for (int f = 0; f < MCP_FILTERS; f++) {
+        int group = (f < 2) ? 0 : 1;
+        if (filters[f].enabled && used[group] < 0) used[group] = f;
+    }
+
+    noInterrupts();
+    ctrl = driver->Read(MCP_CANCTRL);
+    driver->BitModify(MCP_CANCTRL, MCP_MODE_MASK, MCP_MODE_CONFIG);
+    for (polls = 0; polls < MCP_CONFIG_POLLS; polls++) {
+        if ((driver->Read(MCP_CANSTAT) & MCP_MODE_MASK) == MCP_MODE_CONFIG) break;
+    }
+    if (polls == MCP_CONFIG_POLLS) {
+        interrupts();
+        return false;
+    }
+
+    if (used[0] < 0 && used[1] < 0) {
+        driver->BitModify(MCP_RXB0CTRL, MCP_RXB_RXM, MCP_RXB_RXM);
+        driver->BitModify(MCP_RXB1CTRL, MCP_RXB_RXM, MCP_RXB_RXM);
+    } else {
+        for (int group = 0; group < 2; group++) {
+            FILTER &source = filters[used[group] >= 0 ? used[group] : used[1 - group]];
+            writeId(MCP_RXM0SIDH + group * 4, source.mask, source.extended, false);
+            for (int f = (group ? 2 : 0); f < (group ? MCP_FILTERS : 2); f++) {
+                FILTER &filter = filters[f].enabled ? filters[f] : source;
+                writeId(mcpFilterRegs[f], filter.id, filter.extended, true);
+            }
+        }
+        driver->BitModify(MCP_RXB0CTRL, MCP_RXB_RXM, 0);
+        driver->BitModify(MCP_RXB1CTRL, MCP_RXB_RXM, 0);
+    }
+
+    mode = ctrl & MCP_MODE_MASK;
+    driver->BitModify(MCP_CANCTRL, MCP_MODE_MASK, mode);
+    interrupts();
+    return true;
+}
+
+void McpCanBus::getErrors(uint8_t &state, uint8_t &tec, uint8_t &rec, uint8_t &flags)
+{
+    uint8_t eflg;
+
+    flags = 0;
+    state = BUS_ERROR_ACTIVE;
+    if (!running) {
+        state = BUS_DISABLED;
+        tec = 0;
+        rec = 0;
+        return;
+    }
+
+    //the interrupt handler talks SPI too so keep it out while the registers are read
+    noInterrupts();
+    tec = driver->Read(MCP_TEC);
+    rec = driver->Read(MCP_REC);
+    eflg = driver->Read(MCP_EFLG);
+    if (eflg & (MCP_EFLG_RX0OVR | MCP_EFLG_RX1OVR)) driver->BitModify(MCP_EFLG, MCP_EFLG_RX0OVR | MCP_EFLG_RX1OVR, 0);
+    if (overrunSeen) flags |= BUSERR_RX_OVERFLOW; //the interrupt usually sees them first
+    overrunSeen = false;
+    interrupts();
+
+    if (eflg & MCP_EFLG_TXBO) state = BUS_OFF;
+    else if (eflg & (MCP_EFLG_TXEP | MCP_EFLG_RXEP)) state = BUS_ERROR_PASSIVE;
+    else if (eflg & MCP_EFLG_EWARN) state = BUS_ERROR_WARNING;
+    if (eflg & (MCP_EFLG_RX0OVR | MCP_EFLG_RX1OVR)) flags |= BUSERR_RX_OVERFLOW;
+}
+
+//bounce through configuration mode then back to whatever mode it was running in
+void McpCanBus::recover()
+{
+    uint8_t ctrl;
+
+    if (!running) return;
+    noInterrupts();
+    ctrl = driver->Read(MCP_CANCTRL);
+    driver->Write(MCP_CANCTRL, (ctrl & 0x1F) | 0x80);
+    driver->Write(MCP_CANCTRL, ctrl);
+    interrupts();
+}
+
+void McpCanBus::printStatus()
+{
+    CanBus::printStatus();
+    Logger::console("    MCP2515 on CS %i INT %i: %i received, %i waiting, most waiting %i of %i", csPin, intPin, received,
+                    (head - tail) & queueMask, maxDepth, queueMask);
+    Logger::console("    %i lost with the queue full, %i overrun in the MCP2515", lost, overruns);
+}
+
+BusRegistry::BusRegistry()
+{
+    for (int b = 0; b < MAX_BUSES; b++) buses[b] = NULL;
+    count = 0;
+}
+
+/*
+Can be run again after the extra buses are set up. A driver is only made once for each extra
+bus though, changing its pins takes a power cycle. The MCP2515 buses there are split the receive
+pool between them, any one that has gone is stopped so it gives its share back.
+*/
+void BusRegistry::setup()
+{
+    buses[0] = &can0Bus;
+    buses[1] = &can1Bus;
+    can1Bus.setSingleWire(!SysSettings.dedicatedSWCAN); //the transceiver sits on CAN1 without the MCP2515
+    swcanBus.setSingleWire(SysSettings.dedicatedSWCAN);
+    if (SysSettings.dedicatedSWCAN) {
+        swcanBus.setDriver(&SWCAN, CANDUE22_SW_CS, CANDUE22_SW_INT);
+        buses[2] = &swcanBus;
+    }
+    for (int e = 0; e < EXT_BUSES; e++) {
+        EXTBUS_SETTINGS &ext = settings.extBuses[e];
+        buses[FIRST_EXT_BUS + e] = NULL;
+        if (ext.csPin == 255 || ext.intPin == 255) continue;
+        if (!extBuses[e]->hasDriver()) {
+            pinMode(ext.csPin, OUTPUT);
+            digitalWrite(ext.csPin, HIGH);
+            pinMode(ext.intPin, INPUT);
+            extBuses[e]->setDriver(new (extDrivers[e]) MCP2515(ext.csPin, ext.intPin), ext.csPin, ext.intPin);
+        }
+        buses[FIRST_EXT_BUS + e] = extBuses[e];
+    }
+
+    McpCanBus *const mcpBuses[1 + EXT_BUSES] = {&swcanBus, &ext3Bus, &ext4Bus};
+    const uint8_t mcpNumbers[1 + EXT_BUSES] = {2, FIRST_EXT_BUS, FIRST_EXT_BUS + 1};
+    int present = 0;
+    for (int m = 0; m < 1 + EXT_BUSES; m++) if (buses[mcpNumbers[m]]) present++;
+    uint8_t share = MCP_RX_QUEUE;
+    while (present && share * present > MCP_RX_POOL) share /= 2;
+    MCP_RECORD *next = mcpRxPool;
+    for (int m = 0; m < 1 + EXT_BUSES; m++) {
+        if (buses[mcpNumbers[m]]) {
+            mcpBuses[m]->setQueue(next, share);
+            next += share;
+        } else if (mcpBuses[m]->isRunning()) mcpBuses[m]->end();
+    }
+
+    count = 0;
+    for (int b = 0; b < MAX_BUSES; b++) if (buses[b]) count = b + 1;
+    SysSettings.numBuses = count;
+}
+
+CanBus *BusRegistry::get(uint8_t bus)
+{
+    if (bus >= MAX_BUSES) return NULL;
+    return buses[bus];
+}
+
+uint8_t BusRegistry::getCount()
+{
+    return count;
+}
+
+bool BusRegistry::sendFrame(CAN_FRAME &frame, uint8_t bus, uint8_t priority, bool wakeup, uint8_t source, uint32_t tag)
+{
+    CanBus *canBus = get(bus);
+    return canBus ? canBus->queueFrame(frame, priority, wakeup, source, tag) : false;
+}
+
+void BusRegistry::loop()
+{
+    for (int b = 0; b < MAX_BUSES; b++) {
+        if (buses[b] && buses[b]->isRunning()) buses[b]->pumpTx();
+    }
+}
+
+uint32_t BusRegistry::getSpeed(uint8_t bus)
+{
+    CanBus *canBus = get(bus);
+    return canBus ? canBus->getSpeed() : 0;
+}
+
+bool BusRegistry::isEnabled(uint8_t bus)
+{
+    CanBus *canBus = get(bus);
+    return canBus ? canBus->isEnabled() : false;
+}
+
+void BusRegistry::printStatus()
+{
+    for (int b = 0; b < MAX_BUSES; b++) {
+        if (buses[b]) buses[b]->printStatus();
+    }
+}
@@ -0,0 +1,238 @@
+/*
+ * CanBus.h
+ *
+ * One interface for every CAN controller GVRET drives so the rest of the firmware can
+ * work with bus numbers instead of Can0, Can1 and SWCAN by name. The two controllers in
+ * the SAM3X are buses 0 and 1, the single wire MCP2515 on CANDue 2.2 is bus 2 and any
+ * further MCP2515 chips on the SPI bus follow from FIRST_EXT_BUS. BusRegistry knows which
+ * of them the board actually has.
+ *
+ * MCP2515 buses are emptied from the chip's interrupt, both receive buffers with one READ
+ * RX BUFFER burst each, into a ring that loop() works through at its own pace. The chip
+ * only has room for two frames so waiting for loop() lost frames whenever it was busy.
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#ifndef CANBUS_H_
+#define CANBUS_H_
+
+#include <Arduino.h>
+#include <due_can.h>
+#include <MCP2515.h>
+#include "config.h"
+
+#define MCP_RX_QUEUE    64 //most one MCP2515 gets, must be a power of two
+#define MCP_RX_POOL     128 //shared out between the MCP2515 buses the board has when BusRegistry::setup() runs
+#define MCP_FILTERS     6 //RXF0-1 share the RXB0 mask, RXF2-5 the RXB1 one
+#define MCP_SPI_CLOCK   10000000 //fastest the MCP2515 takes
+#define TX_QUEUE_DEPTH  8 //frames waiting in each priority class of each bus. Must be a power of two
+#define TX_IN_FLIGHT    3 //most frames any controller is given at once. They still go out in the order they were given
+#define TX_TIMEOUT_MS   250 //a frame nobody acknowledges for this long is aborted so the queue keeps moving
+#define WAKE_SETTLE_US  1000 //transceiver in high voltage wakeup mode this long before the frame starts
+#define WAKE_HOLD_US    1000 //and this long after it is sent before going back to normal mode
+
+enum TX_WAKE_STATE {
+    WAKE_IDLE = 0,
+    WAKE_SETTLING = 1, //mode pins set, waiting to start the frame
+    WAKE_SENDING = 2,
+    WAKE_HOLDING = 3 //frame is out, waiting to put the mode pins back
+};
+
+struct TX_RECORD {
+    CAN_FRAME frame;
+    uint64_t ticks; //when it was queued, then when the controller was given it
+    uint32_t tag; //handed back to the source with the result
+    uint8_t source; //TX_SOURCE
+    bool wakeup; //send with the single wire transceiver in high voltage wakeup mode
+};
+
+class CanBus
+{
+public:
+    CanBus(uint8_t number, uint32_t *speed, boolean *enabled, boolean *listenOnly);
+    virtual bool begin() = 0; //brings the bus up as its settings say, listen only and filters included
+    virtual void end() = 0;
+    virtual bool read(CAN_FRAME &frame, uint64_t &ticks) = 0; //next received frame and the Timebase ticks when it came in
+    virtual bool setFilter(uint8_t slot, uint32_t id, uint32_t mask, bool extended) = 0;
+    virtual void getErrors(uint8_t &state, uint8_t &tec, uint8_t &rec, uint8_t &flags) = 0; //BUS_STATE and BUSERR_ flags
+    virtual void recover() = 0; //get going again after bus-off
+    virtual void printStatus();
+    virtual bool txStampAtStart() = 0; //the ticks a sent frame is reported with are its start, otherwise its end
+    uint8_t getNumber();
+    uint32_t getSpeed();
+    bool isEnabled();
+    bool isListenOnly();
+    bool isRunning();
+    bool queueFrame(CAN_FRAME &frame, uint8_t priority, bool wakeup, uint8_t source = TX_SOURCE_NONE, uint32_t tag = 0); //false if that priority's queue is full
+    void pumpTx(); //finishes off the frames that have been sent and gives the controller more
+    void flushTx();
+    void setSingleWire(bool singleWire); //bus has the single wire transceiver and its mode pins
+
+    uint32_t rxFrames;
+    uint32_t txFrames; //confirmed sent
+    uint32_t txDropped[TX_CLASSES]; //no room in the queue
+    uint32_t txAborted; //never acknowledged
+    uint32_t maxTxWait; //longest a frame sat in the queue, us
+    uint32_t wakeups; //frames sent in high voltage wakeup mode
+    uint32_t lastWakeToTx; //us from the mode pins changing to the frame's timestamp, its start or end as txStampAtStart() says
+    uint32_t maxWakeToTx;
+
+protected:
+    uint8_t number;
+    uint32_t *speed; //in the settings
+    boolean *enabled;
+    boolean *listenOnly;
+    bool running;
+
+    virtual bool txReady() = 0; //controller can take another frame and still keep them in order
+    virtual bool startTx(CAN_FRAME &frame) = 0; //hands one more frame to the controller
+    virtual bool txDone(uint64_t &ticks) = 0; //oldest frame it was given is finished with. ticks is when it went
+    virtual void abortTx() = 0; //gives up on the oldest frame
+
+private:
+    TX_RECORD txQueue[TX_CLASSES][TX_QUEUE_DEPTH];
+    uint8_t txHead[TX_CLASSES];
+    uint8_t txTail[TX_CLASSES];
+    TX_RECORD txFlight[TX_IN_FLIGHT]; //on the controller, oldest first
+    uint8_t txCount;
+    uint64_t txStartTicks; //when the oldest one got to the front
+    TX_RECORD txWake; //waiting on the transceiver to start
+    uint64_t wakeTicks; //when the current wakeup step started
+    bool txAborting;
+    bool singleWire;
+    uint8_t wakeState;
+
+    void startFrame(TX_RECORD &record);
+    void finishTx(TX_RECORD &record, bool sent, uint64_t ticks);
+    void dropTx(TX_RECORD &record);
+    bool wakeStep();
+};
+
+class DueCanBus : public CanBus
+{
+public:
+    DueCanBus(uint8_t number, CANRaw &can, uint32_t *speed, boolean *enabled, boolean *listenOnly, FILTER *filters, uint8_t *enablePin);
+    bool begin();
+    void end();
+    bool read(CAN_FRAME &frame, uint64_t &ticks);
+    bool setFilter(uint8_t slot, uint32_t id, uint32_t mask, bool extended);
+    void getErrors(uint8_t &state, uint8_t &tec, uint8_t &rec, uint8_t &flags);
+    void recover();
+    bool txStampAtStart();
+
+protected:
+    bool txReady();
+    bool startTx(CAN_FRAME &frame);
+    bool txDone(uint64_t &ticks);
+    void abortTx();
+
+private:
+    CANRaw &can;
+    FILTER *filters; //8 of them, the last mailbox is for sending
+    uint8_t *enablePin; //transceiver enable in SysSettings
+    uint8_t txHanded; //given to due_can and not finished with yet
+    uint16_t txBits[2]; //rough length of each in bit times
+    uint16_t lastStamp; //mailbox timestamp when the oldest one was still going
+    bool txAbortPending;
+
+    uint64_t stampTicks(uint16_t stamp);
+};
+
+struct MCP_RECORD {
+    CAN_FRAME frame;
+    uint64_t ticks; //Timebase ticks when the interrupt read it
+};
+
+class McpCanBus : public CanBus
+{
+public:
+    McpCanBus(uint8_t number, uint32_t *speed, boolean *enabled, boolean *listenOnly, void (*isr)());
+    void setDriver(MCP2515 *driver, uint8_t csPin, uint8_t intPin);
+    bool hasDriver();
+    void setQueue(MCP_RECORD *queue, uint8_t size); //its share of the receive pool, size a power of two
+    bool begin();
+    void end();
+    bool read(CAN_FRAME &frame, uint64_t &ticks);
+    bool setFilter(uint8_t slot, uint32_t id, uint32_t mask, bool extended);
+    void getErrors(uint8_t &state, uint8_t &tec, uint8_t &rec, uint8_t &flags);
+    void recover();
+    void printStatus();
+    bool txStampAtStart();
+    void interrupt(); //only called from this chip's interrupt
+
+protected:
+    bool txReady();
+    bool startTx(CAN_FRAME &frame);
+    bool txDone(uint64_t &ticks);
+    void abortTx();
+
+private:
+    MCP2515 *driver;
+    uint8_t csPin;
+    uint8_t intPin;
+    void (*isr)();
+    MCP_RECORD *queue;
+    uint8_t queueMask; //size - 1
+    volatile uint8_t head; //written by the interrupt
+    volatile uint8_t tail;
+    volatile uint32_t received;
+    volatile uint32_t lost; //frames dropped because the ring was full
+    volatile uint32_t overruns; //frames the chip dropped itself
+    volatile bool overrunSeen; //since getErrors() last looked
+    uint8_t txPending; //transmit buffers given a frame that txDone() hasn't reported yet, a bit each
+    volatile uint8_t txDoneSeen; //of those, the ones the interrupt saw finish
+    volatile uint64_t txDoneTicks[3];
+    uint8_t maxDepth;
+    FILTER filters[MCP_FILTERS]; //programmed into the chip by begin()
+
+    void service();
+    uint8_t command(uint8_t instruction);
+    void readBuffer(uint8_t buffer, uint64_t ticks);
+    bool applyFilters();
+    int nextTxBuffer();
+    int oldestTxBuffer();
+    void writeId(uint8_t address, uint32_t value, bool extended, bool filter);
+};
+
+class BusRegistry
+{
+public:
+    BusRegistry();
+    void setup(); //works out which buses there are from the board and settings
+    CanBus *get(uint8_t bus); //NULL if there is no such bus
+    uint8_t getCount(); //highest bus number there is plus one
+    bool sendFrame(CAN_FRAME &frame, uint8_t bus, uint8_t priority, bool wakeup, uint8_t source = TX_SOURCE_NONE, uint32_t tag = 0);
+    void loop();
+    uint32_t getSpeed(uint8_t bus); //0 if there is no such bus
+    bool isEnabled(uint8_t bus);
+    void printStatus();
+
+private:
+    CanBus *buses[MAX_BUSES];
+    uint8_t count;
+};
+
+extern BusRegistry busRegistry;
+
+#endif /* CANBUS_H_ */
@@ -0,0 +1,157 @@
+/*
+ * ClockServo.cpp
+ *
+ * Offset and drift estimation for time sync
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#include "ClockServo.h"
+
+ClockServo::ClockServo()
+{
+    reset();
+}
+
+void ClockServo::reset()
+{
+    anchorLocal = 0;
+    anchorRef = 0;
+    freq = 0.0;
+    slewRate = 0.0;
+    slewTotal = 0;
+    lastError = 0;
+    state = SERVO_UNSYNCED;
+    outliers = 0;
+    goodSamples = 0;
+}
+
+/*
+The rate and the slew are added up before rounding. Both together are well under 100% so
+a later local time can never map to an earlier reference time.
+*/
+uint64_t ClockServo::toReference(uint64_t local)
+{
+    double slewed = 0.0;
+
+    if (state == SERVO_UNSYNCED) return local;
+    int64_t elapsed = (int64_t)(local - anchorLocal);
+    if (elapsed > 0 && slewTotal != 0) {
+        slewed = elapsed * slewRate;
+        if (slewTotal > 0 ? slewed > slewTotal : slewed < slewTotal) slewed = (double)slewTotal;
+    }
+    return anchorRef + elapsed + (int64_t)(elapsed * freq + slewed);
+}
+
+/*
+Jump straight to the reference. This only happens before the servo has locked and only forward,
+apart from taking on the master's time at the first sample. The frequency estimate is kept, it
+is still the best guess there is
+*/
+void ClockServo::step(uint64_t local, uint64_t reference)
+{
+    anchorLocal = local;
+    anchorRef = reference;
+    slewRate = 0.0;
+    slewTotal = 0;
+    outliers = 0;
+    goodSamples = 0;
+    state = SERVO_TRACKING;
+}
+
+//carry on from where the mapping is now and make up amount over about the next interval
+void ClockServo::slew(uint64_t local, int64_t amount, int64_t interval)
+{
+    anchorRef = toReference(local);
+    anchorLocal = local;
+    slewTotal = amount;
+    slewRate = (interval > 0) ? (double)amount / (double)interval : 0.0;
+    if (slewRate > SERVO_MAX_SLEW || (interval <= 0 && amount > 0)) slewRate = SERVO_MAX_SLEW;
+    if (slewRate < -SERVO_MAX_SLEW || (interval <= 0 && amount < 0)) slewRate = -SERVO_MAX_SLEW;
+}
+
+/*
+The error is what the current mapping got wrong for this sample. Part of it (KP) is slewed out
+over the next sync interval and part of it, spread over the time since the last sample, is taken
+as the rate being off (KI). Nothing is corrected by jumping so timestamps keep counting up. Slew
+that hasn't been made up by the next sample shows up in that sample's error.
+One bad sample, like a sync frame that sat in a busy transmit mailbox, is thrown out unless more
+like it follow. Then the clock is stepped if it isn't locked yet and the error is forward,
+otherwise the whole error is slewed out at the fastest rate allowed.
+*/
+int32_t ClockServo::sample(uint64_t local, uint64_t reference)
+{
+    int64_t error;
+    int64_t interval;
+
+    if (state == SERVO_UNSYNCED) {
+        step(local, reference);
+        lastError = 0;
+        return 0;
+    }
+
+    error = (int64_t)(reference - toReference(local));
+    interval = (int64_t)(local - anchorLocal);
+    if (error > 0x7FFFFFFF) lastError = 0x7FFFFFFF;
+    else if (error < -0x7FFFFFFF) lastError = -0x7FFFFFFF;
+    else lastError = (int32_t)error;
+
+    if (error > SERVO_STEP || error < -SERVO_STEP || interval <= 0) {
+        if (outliers < SERVO_STEP_COUNT) outliers++;
+        if (outliers < SERVO_STEP_COUNT || interval <= 0) return lastError;
+        if (state != SERVO_LOCKED && error > 0) step(local, reference);
+        else {
+            slew(local, error, 0);
+            goodSamples = 0;
+            state = SERVO_TRACKING;
+        }
+        return lastError;
+    }
+    outliers = 0;
+
+    slew(local, (int64_t)(SERVO_KP * error), interval); //anchored with the old rate, before it changes
+    freq += SERVO_KI * (double)error / (double)interval;
+    if (freq > SERVO_MAX_FREQ) freq = SERVO_MAX_FREQ;
+    if (freq < -SERVO_MAX_FREQ) freq = -SERVO_MAX_FREQ;
+
+    if (error < SERVO_LOCK && error > -SERVO_LOCK) {
+        if (goodSamples < SERVO_LOCK_COUNT) goodSamples++;
+    } else goodSamples = 0;
+    state = (goodSamples >= SERVO_LOCK_COUNT) ? SERVO_LOCKED : SERVO_TRACKING;
+    return lastError;
+}
+
+uint8_t ClockServo::getState()
+{
+    return state;
+}
+
+int32_t ClockServo::getLastError()
+{
+    return lastError;
+}
+
+int32_t ClockServo::getFreqPpb()
+{
+    return (int32_t)(freq * 1000000000.0);
+}
@@ -0,0 +1,79 @@
+/*
+ * ClockServo.h
+ *
+ * PI loop that maps a local clock onto a reference clock from pairs of timestamps
+ * taken at the same instant. It estimates both the offset and the rate difference so
+ * the mapping stays good between samples. Nothing in here touches the hardware so
+ * it can be built and fed simulated clocks on a PC.
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#ifndef CLOCKSERVO_H_
+#define CLOCKSERVO_H_
+
+#include <stdint.h>
+
+#define SERVO_KP            0.5 //fraction of each phase error slewed out before the next sample
+#define SERVO_KI            0.1 //fraction of each observed rate error folded into the frequency estimate
+#define SERVO_STEP          1000 //microseconds. Errors past this are outliers, or a step if they keep coming
+#define SERVO_STEP_COUNT    3 //outliers in a row before the clock is stepped, or slewed once locked
+#define SERVO_LOCK          50 //microseconds. Error must stay under this to count as locked
+#define SERVO_LOCK_COUNT    4
+#define SERVO_MAX_FREQ      0.0005 //500ppm, well past any crystal
+#define SERVO_MAX_SLEW      0.002 //fastest a phase error is slewed out, on top of the frequency
+
+enum SERVO_STATE {
+    SERVO_UNSYNCED = 0,
+    SERVO_TRACKING = 1,
+    SERVO_LOCKED = 2
+};
+
+class ClockServo
+{
+public:
+    ClockServo();
+    void reset();
+    //local and reference are microsecond timestamps of the same moment. Returns the error seen before correcting
+    int32_t sample(uint64_t local, uint64_t reference);
+    uint64_t toReference(uint64_t local); //never goes backwards for a later local time once synced
+    uint8_t getState();
+    int32_t getLastError();
+    int32_t getFreqPpb(); //how much faster the reference runs than the local clock
+
+private:
+    uint64_t anchorLocal; //local time of the last correction
+    uint64_t anchorRef; //reference time it mapped to
+    double freq;
+    double slewRate; //extra rate applied from the anchor until slewTotal has been made up
+    int64_t slewTotal;
+    int32_t lastError;
+    uint8_t state;
+    uint8_t outliers;
+    uint8_t goodSamples;
+
+    void step(uint64_t local, uint64_t reference);
+    void slew(uint64_t local, int64_t amount, int64_t interval);
+};
+
+#endif /* CLOCKSERVO_H_ */
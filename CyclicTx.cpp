@@ -0,0 +1,338 @@
+/*
+ * CyclicTx.cpp
+ *
+ * Timer driven periodic message transmission
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#include "CyclicTx.h"
+#include "GVRET.h"
+#include "config.h"
+#include "Logger.h"
+#include "SettingsStore.h"
+#include "Timebase.h"
+#include "TriggerEngine.h"
+#include <Wire_EEPROM.h>
+
+//TC1 channel 2 isn't used by anything else in the firmware
+void TC5_Handler()
+{
+    TC1->TC_CHANNEL[2].TC_SR; //reading the status clears the interrupt
+    cyclicTx.tick();
+}
+
+CyclicTx::CyclicTx()
+{
+    for (int i = 0; i < MAX_CYCLIC; i++) {
+        clearMessage(i);
+        counters[i] = 0;
+        periods[i] = 0;
+    }
+    ticks = 0;
+    pending = 0;
+    active = 0;
+    for (int s = 0; s < CYCLIC_WHEEL; s++) wheel[s] = 0;
+    resetStats();
+}
+
+/*
+1ms compare match on TC1 channel 2 running from MCK/2
+*/
+void CyclicTx::begin()
+{
+    pmc_set_writeprotect(false);
+    pmc_enable_periph_clk(ID_TC5);
+    TC1->TC_CHANNEL[2].TC_CMR = TC_CMR_TCCLKS_TIMER_CLOCK1 | TC_CMR_WAVE | TC_CMR_WAVSEL_UP_RC;
+    TC1->TC_CHANNEL[2].TC_RC = VARIANT_MCK / 2 / 1000;
+    TC1->TC_CHANNEL[2].TC_IER = TC_IER_CPCS;
+    TC1->TC_CHANNEL[2].TC_IDR = ~TC_IER_CPCS;
+    NVIC_ClearPendingIRQ(TC5_IRQn);
+    NVIC_EnableIRQ(TC5_IRQn);
+    TC1->TC_CHANNEL[2].TC_CCR = TC_CCR_CLKEN | TC_CCR_SWTRG;
+}
+
+CYCLIC_MSG &CyclicTx::getMessage(uint8_t which)
+{
+    return pages[which / CYCLIC_PER_PAGE].msgs[which % CYCLIC_PER_PAGE];
+}
+
+void CyclicTx::loadTable()
+{
+    settingsStore.attach(STORE_CYCLIC, pages);
+    if (!settingsStore.isDirty(STORE_CYCLIC)) { //otherwise what is in RAM is newer than anything stored
+        memset(pages, 0, sizeof(pages));
+        if (!settingsStore.load(STORE_CYCLIC)) { //from before the tables were records, or a blank EEPROM
+            for (int p = 0; p < CYCLIC_PAGES; p++) {
+                if (!settingsStore.tablePageUsed(EEPROM_PAGE_CYCLIC + p)) continue; //nothing stored there
+                EEPROM.read(EEPROM_PAGE_CYCLIC + p, pages[p]);
+                if (pages[p].msgs[0].enabled == 255) {
+                    Logger::console("Resetting cyclic message page %i to defaults", p);
+                    for (int i = 0; i < CYCLIC_PER_PAGE; i++) clearMessage(p * CYCLIC_PER_PAGE + i);
+                }
+            }
+            settingsStore.markDirty(STORE_CYCLIC);
+        }
+    }
+    compile();
+}
+
+void CyclicTx::saveTable(uint8_t which)
+{
+    if (which >= MAX_CYCLIC) return;
+    settingsStore.markDirty(STORE_CYCLIC);
+}
+
+void CyclicTx::clearMessage(uint8_t which)
+{
+    if (which >= MAX_CYCLIC) return;
+    memset(&getMessage(which), 0, sizeof(CYCLIC_MSG));
+}
+
+/*
+Rebuild the timer wheel. Messages are staggered by their index so a table full of
+identical periods doesn't put every frame on the bus in the same tick.
+*/
+void CyclicTx::compile()
+{
+    noInterrupts();
+    for (int s = 0; s < CYCLIC_WHEEL; s++) wheel[s] = 0;
+    active = 0;
+    pending = 0;
+    for (int i = 0; i < MAX_CYCLIC; i++) {
+        CYCLIC_MSG &msg = getMessage(i);
+        periods[i] = msg.period;
+        if (msg.enabled != 1 || msg.period == 0) continue;
+        dueTick[i] = ticks + 1 + (i % msg.period);
+        wheel[dueTick[i] & (CYCLIC_WHEEL - 1)] |= 1ul << i;
+        active |= 1ul << i;
+    }
+    interrupts();
+}
+
+/*
+One millisecond has passed. Only the slot for this tick is looked at, messages in it whose
+period is longer than the wheel stay put until the lap they are really due on.
+*/
+void CyclicTx::tick()
+{
+    uint32_t now = ++ticks;
+    uint32_t slot = now & (CYCLIC_WHEEL - 1);
+    uint32_t bits = wheel[slot];
+    uint32_t bit;
+    int i;
+
+    while (bits) {
+        i = __builtin_ctz(bits);
+        bits &= bits - 1;
+        if (dueTick[i] != now) continue;
+        bit = 1ul << i;
+        if (pending & bit) overruns[i]++;
+        pending |= bit;
+        dueTick[i] = now + periods[i];
+        wheel[slot] &= ~bit;
+        wheel[dueTick[i] & (CYCLIC_WHEEL - 1)] |= bit;
+    }
+}
+
+/*
+The timer only marks frames as due. They are built and handed to the controllers here
+so the CAN transmit buffers are never touched from two interrupt levels at once.
+*/
+void CyclicTx::loop()
+{
+    uint32_t ready;
+    uint32_t now, interval, jitter;
+    CAN_FRAME frame;
+    int i;
+
+    if (!pending) return;
+    noInterrupts();
+    ready = pending;
+    pending = 0;
+    interrupts();
+
+    while (ready) {
+        i = __builtin_ctz(ready);
+        ready &= ready - 1;
+        CYCLIC_MSG &msg = getMessage(i);
+        frame.id = msg.id;
+        frame.extended = msg.extended;
+        frame.rtr = 0;
+        frame.length = msg.length;
+        memcpy(frame.data.bytes, msg.data, 8);
+        if (!GatewayRules::runOps(frame, msg.ops, msg.numOps, counters[i])) continue;
+
+        now = timebase.micros32();
+        //other ECUs time out on a periodic frame that goes missing so these don't wait behind a replay
+        if (!sendFrameOnBus(frame, msg.bus, TX_PRIO_NORMAL)) {
+            failed[i]++;
+            continue;
+        }
+        if (sentCount[i] > 0) {
+            interval = now - lastSent[i];
+            jitter = (interval > msg.period * 1000ul) ? interval - msg.period * 1000ul : msg.period * 1000ul - interval;
+            totalJitter[i] += jitter;
+            if (jitter > maxJitter[i]) maxJitter[i] = jitter;
+        }
+        lastSent[i] = now;
+        sentCount[i]++;
+    }
+}
+
+bool CyclicTx::setMessage(uint8_t which, CYCLIC_MSG &msg)
+{
+    if (which >= MAX_CYCLIC) return false;
+    if (msg.bus >= MAX_BUSES || msg.length > 8 || msg.numOps > CYCLIC_OPS) return false;
+    if (msg.period == 0 || msg.period > CYCLIC_MAX_PERIOD) return false;
+    for (int c = 0; c < msg.numOps; c++) {
+        if (msg.ops[c].byteNum > 7) return false;
+    }
+    for (int c = msg.numOps; c < CYCLIC_OPS; c++) memset(&msg.ops[c], 0, sizeof(REWRITE_OP));
+    msg.enabled = 1;
+    msg.reserved = 0;
+    getMessage(which) = msg;
+    counters[which] = 0;
+    sentCount[which] = 0;
+    compile();
+    return true;
+}
+
+/*
+Messages come from the serial console as
+BUS,ID,PERIOD,HEX PAYLOAD[,OP:BYTE:VALUE[:PARAM],...]
+with the same ops as the GWRULE command. For example: 0,0x3F1,10,0000000000000000,CNT:6:0x0F,CHK:7:0
+*/
+bool CyclicTx::setMessage(uint8_t which, char *definition)
+{
+    CYCLIC_MSG msg;
+    char *tok;
+    int len, hi, lo;
+
+    memset(&msg, 0, sizeof(msg));
+    tok = strtok(definition, ",");
+    if (!tok) return false;
+    msg.bus = strtol(tok, NULL, 0);
+    tok = strtok(NULL, ",");
+    if (!tok) return false;
+    msg.id = strtoul(tok, NULL, 0);
+    msg.extended = (msg.id > 0x7FF) ? 1 : 0;
+    tok = strtok(NULL, ",");
+    if (!tok) return false;
+    msg.period = strtol(tok, NULL, 0);
+    tok = strtok(NULL, ",");
+    if (!tok) return false;
+    len = strlen(tok);
+    if ((len & 1) || len > 16) return false;
+    msg.length = len / 2;
+    for (int c = 0; c < msg.length; c++) {
+        hi = TriggerEngine::hexNibble(tok[c * 2]);
+        lo = TriggerEngine::hexNibble(tok[c * 2 + 1]);
+        if (hi < 0 || lo < 0) return false;
+        msg.data[c] = (hi << 4) | lo;
+    }
+    while ((tok = strtok(NULL, ",")) != NULL) {
+        if (msg.numOps >= CYCLIC_OPS) return false;
+        if (!GatewayRules::parseOp(tok, msg.ops[msg.numOps])) return false;
+        msg.numOps++;
+    }
+    return setMessage(which, msg);
+}
+
+void CyclicTx::printMessages()
+{
+    char buff[120];
+    char *ptr;
+
+    for (int i = 0; i < MAX_CYCLIC; i++) {
+        CYCLIC_MSG &msg = getMessage(i);
+        if (msg.enabled != 1) continue;
+        ptr = buff;
+        ptr += sprintf(ptr, "CYCLIC%i=%i,0x%x,%i,", i, msg.bus, (unsigned int)msg.id, msg.period);
+        for (int c = 0; c < msg.length && c < 8; c++) ptr += sprintf(ptr, "%02X", msg.data[c]);
+        for (int c = 0; c < msg.numOps && c < CYCLIC_OPS; c++) {
+            *ptr++ = ',';
+            ptr += GatewayRules::printOp(ptr, msg.ops[c]);
+        }
+        *ptr = 0;
+        Logger::console(buff);
+    }
+}
+
+void CyclicTx::resetStats()
+{
+    for (int i = 0; i < MAX_CYCLIC; i++) {
+        sentCount[i] = 0;
+        overruns[i] = 0;
+        failed[i] = 0;
+        maxJitter[i] = 0;
+        totalJitter[i] = 0;
+    }
+}
+
+void CyclicTx::printStats()
+{
+    uint32_t avg;
+
+    for (int i = 0; i < MAX_CYCLIC; i++) {
+        if (!(active & (1ul << i))) continue;
+        avg = (sentCount[i] > 1) ? totalJitter[i] / (sentCount[i] - 1) : 0;
+        Logger::console("Cyclic %i sent: %i jitter avg: %i us max: %i us overruns: %i failed: %i", i, sentCount[i], avg,
+                        maxJitter[i], overruns[i], failed[i]);
+    }
+}
+
+/*
+0xF1, PROTO_GET_CYCLIC_STATS, count, then for each running message:
+index, sent (4 bytes), average jitter us (2), max jitter us (2), overruns (2)
+*/
+void CyclicTx::sendStatsBinary()
+{
+    uint8_t buff[3 + MAX_CYCLIC * 11];
+    uint32_t avg, max;
+    int pos = 3;
+
+    buff[0] = 0xF1;
+    buff[1] = PROTO_GET_CYCLIC_STATS;
+    buff[2] = 0;
+    for (int i = 0; i < MAX_CYCLIC; i++) {
+        if (!(active & (1ul << i))) continue;
+        avg = (sentCount[i] > 1) ? totalJitter[i] / (sentCount[i] - 1) : 0;
+        max = maxJitter[i];
+        if (avg > 0xFFFF) avg = 0xFFFF;
+        if (max > 0xFFFF) max = 0xFFFF;
+        buff[2]++;
+        buff[pos++] = i;
+        buff[pos++] = sentCount[i] & 0xFF;
+        buff[pos++] = sentCount[i] >> 8;
+        buff[pos++] = sentCount[i] >> 16;
+        buff[pos++] = sentCount[i] >> 24;
+        buff[pos++] = avg & 0xFF;
+        buff[pos++] = avg >> 8;
+        buff[pos++] = max & 0xFF;
+        buff[pos++] = max >> 8;
+        buff[pos++] = min(overruns[i], 0xFFFFul) & 0xFF;
+        buff[pos++] = min(overruns[i], 0xFFFFul) >> 8;
+    }
+    sendBytesToUSB(buff, pos);
+}
@@ -0,0 +1,101 @@
+/*
+ * CyclicTx.h
+ *
+ * Table of periodic messages the device sends on its own. A hardware timer ticks a
+ * timer wheel once a millisecond and marks messages that are due, the main loop then
+ * builds and queues them. Each message can run the same counter/checksum ops as the
+ * gateway rewrite rules so rolling counters and checksums stay valid without a host.
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#ifndef CYCLICTX_H_
+#define CYCLICTX_H_
+
+#include <Arduino.h>
+#include <due_can.h>
+#include "GatewayRules.h"
+
+#define CYCLIC_PER_PAGE     8 //32 byte entries, 256 byte EEPROM page
+#define CYCLIC_PAGES        4
+#define MAX_CYCLIC          (CYCLIC_PER_PAGE * CYCLIC_PAGES) //no more than 32, messages are tracked in bitfields
+#define CYCLIC_OPS          3
+#define CYCLIC_WHEEL        64 //timer wheel slots, one per millisecond tick. Must be a power of two
+#define CYCLIC_MAX_PERIOD   60000
+
+struct CYCLIC_MSG { //32 bytes
+    uint32_t id;
+    uint8_t bus;
+    uint8_t length;
+    uint8_t enabled; //255 means the EEPROM page was never initialized
+    uint8_t numOps;
+    uint16_t period; //milliseconds
+    uint8_t extended;
+    uint8_t reserved;
+    uint8_t data[8];
+    REWRITE_OP ops[CYCLIC_OPS];
+};
+
+struct CYCLIC_PAGE {
+    CYCLIC_MSG msgs[CYCLIC_PER_PAGE];
+};
+
+class CyclicTx
+{
+public:
+    CyclicTx();
+    void begin(); //starts the hardware timer
+    void loadTable();
+    void saveTable(uint8_t which);
+    void compile();
+    bool setMessage(uint8_t which, char *definition);
+    bool setMessage(uint8_t which, CYCLIC_MSG &msg);
+    void clearMessage(uint8_t which);
+    CYCLIC_MSG &getMessage(uint8_t which);
+    void tick(); //only called from the timer interrupt
+    void loop();
+    void printMessages();
+    void printStats();
+    void resetStats();
+    void sendStatsBinary();
+
+private:
+    CYCLIC_PAGE pages[CYCLIC_PAGES];
+    uint32_t wheel[CYCLIC_WHEEL]; //bitfield of messages whose next due tick falls in each slot
+    uint32_t dueTick[MAX_CYCLIC];
+    uint16_t periods[MAX_CYCLIC]; //copy for the timer so it never reads a message being edited
+    volatile uint32_t ticks;
+    volatile uint32_t pending; //set by the timer, cleared once the frame is queued
+    uint32_t active;
+    uint8_t counters[MAX_CYCLIC];
+    uint32_t lastSent[MAX_CYCLIC]; //micros
+    uint32_t sentCount[MAX_CYCLIC];
+    uint32_t overruns[MAX_CYCLIC]; //came due again before the last one went out
+    uint32_t failed[MAX_CYCLIC]; //bus wouldn't take the frame
+    uint32_t maxJitter[MAX_CYCLIC]; //microseconds away from the ideal period
+    uint32_t totalJitter[MAX_CYCLIC];
+};
+
+extern CyclicTx cyclicTx;
+
+#endif /* CYCLICTX_H_ */
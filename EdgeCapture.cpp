@@ -0,0 +1,207 @@
+/*
+ * EdgeCapture.cpp
+ *
+ * Timestamped, debounced edges on the digital inputs
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#include "EdgeCapture.h"
+#include "GVRET.h"
+#include "Logger.h"
+#include "Timebase.h"
+#include "TriggerEngine.h"
+#include "sys_io.h"
+#include "SettingsStore.h"
+#include <Wire_EEPROM.h>
+
+static void edge0()
+{
+    edgeCapture.pinChanged(0);
+}
+
+static void edge1()
+{
+    edgeCapture.pinChanged(1);
+}
+
+static void edge2()
+{
+    edgeCapture.pinChanged(2);
+}
+
+static void edge3()
+{
+    edgeCapture.pinChanged(3);
+}
+
+EdgeCapture::EdgeCapture()
+{
+    config.eventMask = 0;
+    config.reserved = 0;
+    config.debounce = EDGE_DEFAULT_DEBOUNCE;
+    debounceTicks = EDGE_DEFAULT_DEBOUNCE * TIMEBASE_TICKS_US;
+    head = tail = 0;
+    lost = 0;
+    for (int i = 0; i < NUM_DIGITAL; i++) {
+        state[i] = 0;
+        lastEdge[i] = 0;
+        edgeCount[i] = 0;
+    }
+}
+
+void EdgeCapture::loadSettings()
+{
+    settingsStore.attach(STORE_EDGES, &config);
+    if (!settingsStore.isDirty(STORE_EDGES)) { //otherwise what is in RAM is newer than anything stored
+        config.eventMask = 0;
+        config.reserved = 0;
+        config.debounce = EDGE_DEFAULT_DEBOUNCE;
+        if (!settingsStore.load(STORE_EDGES)) { //from before the settings were a record, or a blank EEPROM
+            EEPROM.read(EEPROM_PAGE_EDGES, config);
+            if (config.eventMask == 255) {
+                Logger::console("Resetting input edge settings to defaults");
+                config.eventMask = 0;
+                config.reserved = 0;
+                config.debounce = EDGE_DEFAULT_DEBOUNCE;
+            }
+            settingsStore.markDirty(STORE_EDGES);
+        }
+    }
+    debounceTicks = config.debounce * TIMEBASE_TICKS_US;
+}
+
+bool EdgeCapture::setup(uint8_t eventMask, uint16_t debounce)
+{
+    if (eventMask > 0x0F) return false;
+    config.eventMask = eventMask;
+    config.debounce = debounce;
+    debounceTicks = debounce * TIMEBASE_TICKS_US;
+    settingsStore.markDirty(STORE_EDGES);
+    return true;
+}
+
+//after sys_io has set the pins up as inputs
+void EdgeCapture::begin()
+{
+    static void (*handlers[NUM_DIGITAL])() = {edge0, edge1, edge2, edge3};
+
+    for (int i = 0; i < NUM_DIGITAL; i++) {
+        state[i] = readPin(i);
+        attachInterrupt(getDigitalPin(i), handlers[i], CHANGE);
+    }
+}
+
+//straight from the port register, digitalRead() is too slow for an interrupt
+bool EdgeCapture::readPin(uint8_t input)
+{
+    const PinDescription &pin = g_APinDescription[getDigitalPin(input)];
+    return !(pin.pPort->PIO_PDSR & pin.ulPin);
+}
+
+void EdgeCapture::push(uint8_t input, bool newState, uint64_t ticks)
+{
+    uint8_t next = (head + 1) & (EDGE_QUEUE - 1);
+
+    state[input] = newState;
+    lastEdge[input] = ticks;
+    if (next == tail) {
+        lost++;
+        return;
+    }
+    queue[head].ticks = ticks;
+    queue[head].input = input;
+    queue[head].state = newState;
+    head = next;
+}
+
+/*
+The first change after a quiet period is the edge and its time is taken right here.
+Anything inside the debounce time after that is contact bounce and ignored.
+*/
+void EdgeCapture::pinChanged(uint8_t input)
+{
+    uint64_t now = timebase.ticks();
+    bool newState = readPin(input);
+
+    if (now - lastEdge[input] < debounceTicks) return;
+    if (newState == state[input]) return;
+    push(input, newState, now);
+}
+
+/*
+If the pin settled somewhere other than where the first edge left it, the last
+interrupt was thrown away as bounce. Catch that once the debounce time is over.
+*/
+void EdgeCapture::resync()
+{
+    uint64_t now;
+    bool pinState;
+
+    for (int i = 0; i < NUM_DIGITAL; i++) {
+        noInterrupts();
+        now = timebase.ticks();
+        pinState = readPin(i);
+        if (now - lastEdge[i] >= debounceTicks && pinState != state[i]) push(i, pinState, now);
+        interrupts();
+    }
+}
+
+/*
+EVENT_INPUT: input, new state, ns past the microsecond in the timestamp (2 bytes)
+*/
+void EdgeCapture::loop()
+{
+    EDGE_RECORD edge;
+    uint8_t data[4];
+    uint32_t ns;
+
+    resync();
+    while (tail != head) {
+        edge = queue[tail];
+        tail = (tail + 1) & (EDGE_QUEUE - 1);
+        edgeCount[edge.input]++;
+        triggerEngine.inputEdge(edge.input, edge.state);
+        if (!(config.eventMask & (1 << edge.input))) continue;
+        ns = (edge.ticks % TIMEBASE_TICKS_US) * 1000 / TIMEBASE_TICKS_US;
+        data[0] = edge.input;
+        data[1] = edge.state;
+        data[2] = ns & 0xFF;
+        data[3] = ns >> 8;
+        sendEventFrameAt(EVENT_INPUT, 0, data, 4, timebase.stampAt(edge.ticks));
+    }
+}
+
+bool EdgeCapture::getState(uint8_t input)
+{
+    if (input >= NUM_DIGITAL) return false;
+    return state[input];
+}
+
+void EdgeCapture::printStatus()
+{
+    Logger::console("Debounce: %i us  events for inputs: 0x%x  edges lost: %i", config.debounce, config.eventMask, lost);
+    for (int i = 0; i < NUM_DIGITAL; i++) {
+        Logger::console("Input %i: %s, %i edges", i, state[i] ? "active" : "inactive", edgeCount[i]);
+    }
+}
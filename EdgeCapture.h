@@ -0,0 +1,83 @@
+/*
+ * EdgeCapture.h
+ *
+ * Pin change interrupts on the four digital inputs. Every edge is timestamped on the
+ * timebase as it happens and queued, so how long loop() takes doesn't matter. Debouncing
+ * is by time: the first edge counts and the input is ignored for a while after it.
+ * Edges go to the trigger engine and, for the inputs asked for, out as events.
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#ifndef EDGECAPTURE_H_
+#define EDGECAPTURE_H_
+
+#include <Arduino.h>
+#include "config.h"
+
+#define EDGE_QUEUE              32 //must be a power of two
+#define EDGE_DEFAULT_DEBOUNCE   2000 //microseconds
+
+struct EDGE_SETTINGS { //SettingsStore record STORE_EDGES
+    uint8_t eventMask; //inputs that send EVENT_INPUT. 255 means the EEPROM page was never initialized
+    uint8_t reserved;
+    uint16_t debounce; //microseconds
+};
+
+struct EDGE_RECORD {
+    uint64_t ticks;
+    uint8_t input;
+    uint8_t state; //1 = active, same sense as getDigital()
+};
+
+class EdgeCapture
+{
+public:
+    EdgeCapture();
+    void loadSettings();
+    bool setup(uint8_t eventMask, uint16_t debounce);
+    void begin();
+    void pinChanged(uint8_t input); //only called from the pin interrupts
+    void loop();
+    bool getState(uint8_t input);
+    void printStatus();
+
+private:
+    EDGE_SETTINGS config;
+    uint32_t debounceTicks;
+    EDGE_RECORD queue[EDGE_QUEUE];
+    volatile uint8_t head; //written by the interrupts
+    volatile uint8_t tail;
+    volatile uint8_t state[NUM_DIGITAL];
+    volatile uint64_t lastEdge[NUM_DIGITAL];
+    volatile uint32_t lost; //edges dropped because the queue was full
+    uint32_t edgeCount[NUM_DIGITAL];
+
+    bool readPin(uint8_t input);
+    void push(uint8_t input, bool newState, uint64_t ticks);
+    void resync();
+};
+
+extern EdgeCapture edgeCapture;
+
+#endif /* EDGECAPTURE_H_ */
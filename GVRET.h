@@ -54,7 +54,21 @@ enum STATE {
     SET_SINGLEWIRE_MODE,
     SET_SYSTYPE,
     ECHO_CAN_FRAME,
-    SETUP_EXT_BUSES
+    SETUP_EXT_BUSES,
+    GET_CENSUS,
+    SET_BUS_LOAD_REPORT,
+    SET_SIGNAL_STREAM,
+    ISOTP_SETUP,
+    ISOTP_SEND,
+    SET_CYCLIC,
+    REPLAY_START,
+    REPLAY_FRAME,
+    REPLAY_END,
+    SD_REPLAY,
+    TIME_SYNC64,
+    ADC_STREAM,
+    CONFIG_GET,
+    CONFIG_SET
 };
 
 enum GVRET_PROTOCOL
@@ -73,15 +87,74 @@ enum GVRET_PROTOCOL
     PROTO_ECHO_CAN_FRAME = 11,
     PROTO_GET_NUMBUSES = 12,
     PROTO_GET_EXT_BUSES = 13,
-    PROTO_SET_EXT_BUSES = 14
+    PROTO_SET_EXT_BUSES = 14,
+    PROTO_GET_CENSUS = 15,
+    PROTO_BUS_LOAD = 16,
+    PROTO_BUS_STATUS = 17,
+    PROTO_SIGNAL_DATA = 18,
+    PROTO_GET_SIGNAL_DEFS = 19,
+    PROTO_ISOTP_SETUP = 20,
+    PROTO_ISOTP_SEND = 21,
+    PROTO_ISOTP_RECEIVE = 22,
+    PROTO_ISOTP_STATUS = 23,
+    PROTO_SET_CYCLIC = 24,
+    PROTO_GET_CYCLIC_STATS = 25,
+    PROTO_REPLAY_START = 26,
+    PROTO_REPLAY_FRAME = 27,
+    PROTO_REPLAY_CREDIT = 28,
+    PROTO_REPLAY_END = 29,
+    PROTO_SD_REPLAY = 30,
+    PROTO_TIME_SYNC64 = 31,
+    PROTO_ADC_STREAM = 32,
+    PROTO_ADC_DATA = 33,
+    PROTO_GET_CONFIG = 34,
+    PROTO_SET_CONFIG = 35
+};
+
+//Frames with this bit set in the ID didn't come off of a bus. They are events generated by GVRET
+//itself and sent down the same paths as frame traffic so they are timestamped in line with it.
+//The low byte of the ID says what sort of event it is.
+#define GVRET_EVENT_FLAG    0x20000000
+
+//Set in the ID of a frame GVRET sent itself rather than received, when echoing transmitted frames is on.
+//The timestamp is when it went out on the bus.
+#define GVRET_TX_FLAG       0x40000000
+
+enum GVRET_EVENT
+{
+    EVENT_BUS_STATUS = 1,
+    EVENT_TRIGGER = 2,
+    EVENT_TIMEBASE = 3, //full 64 bit microsecond time, sent whenever the 32 bit timestamps wrap
+    EVENT_TIME_SYNC = 4, //CAN time sync mode and state, error (4 bytes, us), rate correction (2 bytes, 0.01ppm)
+    EVENT_ADC_SETUP = 5, //analog stream channel mask, decimation, ns between sample sets (4 bytes)
+    EVENT_ADC = 6, //one analog sample set, 2 bytes for each streamed input in order
+    EVENT_INPUT = 7 //digital input edge. Input, new state, ns past the microsecond (2 bytes)
 };
 
 void loadSettings();
+void loadTables();
+void setupBusRegistry();
+void setupBuses();
+void setupBus(int whichBus);
+void setupDigToggle();
 void setSWCANSleep();
 void setSWCANEnabled();
 void setSWCANWakeup();
-void processDigToggleFrame(CAN_FRAME &frame);
-void sendDigToggleMsg();
+void processIncomingFrame(CAN_FRAME &frame, int whichBus);
+void processIncomingFrameAt(CAN_FRAME &frame, int whichBus, uint64_t rxTicks);
+void processSentFrameAt(CAN_FRAME &frame, int whichBus, uint64_t txTicks);
+void processTxDone(uint8_t source, uint32_t tag, bool sent, uint64_t txTicks);
+void sendBytesToUSB(uint8_t *data, int length);
+uint8_t *reserveUSBBytes(int length);
+void flushSerialBuffer();
+bool sendFrameOnBus(CAN_FRAME &frame, int whichBus, uint8_t priority = TX_PRIO_NORMAL, bool wakeup = false,
+                    uint8_t source = TX_SOURCE_NONE, uint32_t tag = 0);
+void sendFrameToFileAt(CAN_FRAME &frame, int whichBus, uint64_t stamp, bool sent = false);
+void sendFrameToUSBAt(CAN_FRAME &frame, int whichBus, uint64_t stamp, bool sent = false);
+void sendEventFrame(uint8_t eventType, int whichBus, uint8_t *data, uint8_t length);
+void sendEventFrameAt(uint8_t eventType, int whichBus, uint8_t *data, uint8_t length, uint64_t stamp);
+void logEventFrame(uint8_t eventType, int whichBus, uint8_t *data, uint8_t length);
+void logFileOpened();
 
 #endif /* GVRET_H_ */
 
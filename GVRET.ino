@@ -36,6 +36,25 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include <due_can.h>
 #include <MCP2515.h>
 #include "SerialConsole.h"
+#include "GatewayRules.h"
+#include "BusCensus.h"
+#include "BusLoad.h"
+#include "BusMonitor.h"
+#include "SignalDecoder.h"
+#include "TriggerEngine.h"
+#include "IsoTp.h"
+#include "Responder.h"
+#include "CyclicTx.h"
+#include "Replay.h"
+#include "SdReplay.h"
+#include "Timebase.h"
+#include "TimeSync.h"
+#include "AdcStream.h"
+#include "EdgeCapture.h"
+#include "SettingsStore.h"
+#include "BinaryConfig.h"
+#include "BootCapture.h"
+#include "CanBus.h"
 
 /*
 Notes on project:
@@ -61,79 +80,148 @@ SdFat sd;
 MCP2515 SWCAN(CANDUE22_SW_CS, CANDUE22_SW_INT);
 
 SerialConsole console;
+GatewayRules gatewayRules;
+BusCensus busCensus;
+BusLoad busLoad;
+BusMonitor busMonitor;
+SignalDecoder signalDecoder;
+TriggerEngine triggerEngine;
+/*
+Frames held during start up are sent out before loop() first runs, and nothing can open an
+ISO-TP session or start a replay before then, so those buffers share the boot capture's RAM.
+*/
+static union {
+    BOOT_RECORD bootFrames[BOOT_CAPTURE_FRAMES];
+    struct {
+        REPLAY_ENTRY replayQueue[REPLAY_QUEUE];
+        uint8_t isoTpPdu[ISOTP_MAX_PDU];
+    } later;
+} sharedRam;
+
+IsoTp isoTp(sharedRam.later.isoTpPdu);
+Responder responder;
+CyclicTx cyclicTx;
+Replay replay(sharedRam.later.replayQueue);
+SdReplay sdReplay;
+Timebase timebase;
+TimeSync timeSync;
+AdcStream adcStream;
+EdgeCapture edgeCapture;
+SettingsStore settingsStore;
+BinaryConfig binaryConfig;
+BootCapture bootCapture(sharedRam.bootFrames);
+BusRegistry busRegistry;
+
+void setDefaultSettings()
+{
+    settings.version = EEPROM_VER;
+    settings.appendFile = false;
+    settings.CAN0Speed = 500000;
+    settings.CAN0_Enabled = true;
+    settings.CAN1Speed = 500000;
+    settings.CAN1_Enabled = true;
+    settings.SWCANSpeed = 33333;
+    settings.singleWire_Enabled = false;
+    sprintf((char *)settings.fileNameBase, "CANBUS");
+    sprintf((char *)settings.fileNameExt, "TXT");
+    settings.fileNum = 1;
+    for (int i = 0; i < 3; i++) {
+        settings.CAN0Filters[i].enabled = true;
+        settings.CAN0Filters[i].extended = true;
+        settings.CAN0Filters[i].id = 0;
+        settings.CAN0Filters[i].mask = 0;
+        settings.CAN1Filters[i].enabled = true;
+        settings.CAN1Filters[i].extended = true;
+        settings.CAN1Filters[i].id = 0;
+        settings.CAN1Filters[i].mask = 0;
+    }
+    for (int j = 3; j < 8; j++) {
+        settings.CAN0Filters[j].enabled = true;
+        settings.CAN0Filters[j].extended = false;
+        settings.CAN0Filters[j].id = 0;
+        settings.CAN0Filters[j].mask = 0;
+        settings.CAN1Filters[j].enabled = true;
+        settings.CAN1Filters[j].extended = false;
+        settings.CAN1Filters[j].id = 0;
+        settings.CAN1Filters[j].mask = 0;
+    }
+    settings.fileOutputType = CRTD;
+    settings.useBinarySerialComm = false;
+    settings.autoStartLogging = false;
+    settings.logLevel = 1; //info
+    settings.sysType = 0; //CANDUE as default
+    settings.valid = 0; //not used right now
+    settings.CAN0ListenOnly = false;
+    settings.CAN1ListenOnly = false;
+    settings.SWCANListenOnly = false;
+    settings.tablePages = 0xFFFF; //not known which old table pages were used, read them all
+    for (int b = 0; b < EXT_BUSES; b++) {
+        settings.extBuses[b].speed = 500000;
+        settings.extBuses[b].enabled = false;
+        settings.extBuses[b].listenOnly = false;
+        settings.extBuses[b].csPin = 255;
+        settings.extBuses[b].intPin = 255;
+    }
+    settings.echoTx = false;
+    settings.storedRecords = 0xFFFF; //read every table record once to find out which are empty
+}
 
-bool digTogglePinState;
-uint8_t digTogglePinCounter;
-
-void SWCAN_Int()
+void setDefaultDigToggle()
 {
-    SWCAN.intHandler();
+    digToggleSettings.enabled = false;
+    digToggleSettings.length = 0;
+    digToggleSettings.mode = 0;
+    digToggleSettings.pin = 1;
+    digToggleSettings.rxTxID = 0x700;
+    for (int c=0 ; c<8 ; c++) digToggleSettings.payload[c] = 0;
 }
 
-//initializes all the system EEPROM values. Chances are this should be broken out a bit but
-//there is only one checksum check for all of them so it's simple to do it all here.
+//initializes all the system EEPROM values. Defaults go in first so anything a stored copy
+//doesn't have, like a setting newer than the copy, keeps its default instead of wiping the rest.
 void loadSettings()
 {
-    EEPROM.read(EEPROM_PAGE, settings);
-
-    if (settings.version != EEPROM_VER) { //if settings are not the current version then erase them and set defaults
-        Logger::console("Resetting to factory defaults");
-        settings.version = EEPROM_VER;
-        settings.appendFile = false;
-        settings.CAN0Speed = 500000;
-        settings.CAN0_Enabled = true;
-        settings.CAN1Speed = 500000;
-        settings.CAN1_Enabled = true;
-        settings.SWCANSpeed = 33333;
-        settings.singleWire_Enabled = false;
-        sprintf((char *)settings.fileNameBase, "CANBUS");
-        sprintf((char *)settings.fileNameExt, "TXT");
-        settings.fileNum = 1;
-        for (int i = 0; i < 3; i++) {
-            settings.CAN0Filters[i].enabled = true;
-            settings.CAN0Filters[i].extended = true;
-            settings.CAN0Filters[i].id = 0;
-            settings.CAN0Filters[i].mask = 0;
-            settings.CAN1Filters[i].enabled = true;
-            settings.CAN1Filters[i].extended = true;
-            settings.CAN1Filters[i].id = 0;
-            settings.CAN1Filters[i].mask = 0;
+    struct { //the old copy was a few bytes over a page and ran into EEPROM_PAGE + 1
+        uint8_t bytes[EEPROM_LEGACY_LENGTH];
+    } legacy;
+    bool save;
+
+    if (!settingsStore.isDirty(STORE_SETTINGS)) { //otherwise what is in RAM is newer than anything stored
+        setDefaultSettings();
+        save = !settingsStore.load(STORE_SETTINGS);
+        if (save) {
+            EEPROM.read(EEPROM_PAGE, legacy); //from before SettingsStore, or a blank EEPROM
+            if (legacy.bytes[0] == EEPROM_VER_LEGACY) { //version is the first field in every layout
+                memcpy(&settings, legacy.bytes, EEPROM_LEGACY_LENGTH); //the newer fields keep their defaults
+                settings.tablePages = 0xFFFF; //not in that layout, so every table page is read once
+            }
+            else settings.version = 0xFF; //older than anything that can be read
         }
-        for (int j = 3; j < 8; j++) {
-            settings.CAN0Filters[j].enabled = true;
-            settings.CAN0Filters[j].extended = false;
-            settings.CAN0Filters[j].id = 0;
-            settings.CAN0Filters[j].mask = 0;
-            settings.CAN1Filters[j].enabled = true;
-            settings.CAN1Filters[j].extended = false;
-            settings.CAN1Filters[j].id = 0;
-            settings.CAN1Filters[j].mask = 0;
+
+        if (settings.version == 0xFF) { //blank, or reset to factory defaults was asked for
+            Logger::console("Resetting to factory defaults");
+            setDefaultSettings();
+            save = true;
+        } else {
+            Logger::console("Using stored values from EEPROM");
         }
-        settings.fileOutputType = CRTD;
-        settings.useBinarySerialComm = false;
-        settings.autoStartLogging = false;
-        settings.logLevel = 1; //info
-        settings.sysType = 0; //CANDUE as default
-        settings.valid = 0; //not used right now
-        settings.CAN0ListenOnly = false;
-        settings.CAN1ListenOnly = false;
-        EEPROM.write(EEPROM_PAGE, settings);
-    } else {
-        Logger::console("Using stored values from EEPROM");
+        if (settings.version != EEPROM_VER) { //stored by older firmware. Anything that needs converting is done here
+            settings.version = EEPROM_VER;
+            save = true;
+        }
+        if (save) settingsStore.markDirty(STORE_SETTINGS);
     }
 
-    EEPROM.read(EEPROM_PAGE + 1, digToggleSettings);
-    if (digToggleSettings.mode == 255) {
-        Logger::console("Resetting digital toggling system to defaults");
-        digToggleSettings.enabled = false;
-        digToggleSettings.length = 0;
-        digToggleSettings.mode = 0;
-        digToggleSettings.pin = 1;
-        digToggleSettings.rxTxID = 0x700;
-        for (int c=0 ; c<8 ; c++) digToggleSettings.payload[c] = 0;
-        EEPROM.write(EEPROM_PAGE + 1, digToggleSettings);
-    } else {
-        Logger::console("Using stored values for digital toggling system");
+    if (!settingsStore.isDirty(STORE_DIGTOGGLE)) {
+        setDefaultDigToggle();
+        save = !settingsStore.load(STORE_DIGTOGGLE);
+        if (save) EEPROM.read(EEPROM_PAGE + 1, digToggleSettings);
+        if (digToggleSettings.mode == 255) {
+            Logger::console("Resetting digital toggling system to defaults");
+            setDefaultDigToggle();
+        } else {
+            Logger::console("Using stored values for digital toggling system");
+        }
+        if (save) settingsStore.markDirty(STORE_DIGTOGGLE);
     }
 
     Logger::setLoglevel((Logger::LogLevel)settings.logLevel);
@@ -242,6 +330,19 @@ void loadSettings()
     }
 }
 
+//everything else in EEPROM. Not needed to bring the buses up so it waits until they are
+void loadTables()
+{
+    gatewayRules.loadTable();
+    signalDecoder.loadTable();
+    triggerEngine.loadTable();
+    responder.loadTable();
+    cyclicTx.loadTable();
+    timeSync.loadSettings();
+    loadADCFilters();
+    edgeCapture.loadSettings();
+}
+
 void setSWCANSleep()
 {
     if (SysSettings.SWCANMode0Pin != 255) digitalWrite(SysSettings.SWCANMode0Pin, LOW);
@@ -266,6 +367,7 @@ void setSWCANWakeup()
 
 void setup()
 {
+    timebase.begin(); //first so everything after has timestamps to work with
     pinMode(CANDUE22_SW_CS, OUTPUT);
     pinMode(CANDUE22_SW_INT, INPUT);
     digitalWrite(CANDUE22_SW_CS, HIGH);
@@ -282,7 +384,8 @@ void setup()
     digitalWrite(ENABLE_PASS_0TO1_PIN, HIGH); // enable pull-up resistor
     digitalWrite(ENABLE_PASS_1TO0_PIN, HIGH); // enable pull-up resistor
 
-    Serial.begin(115200);
+    //only what it takes to get the buses going comes before capturing. Frames are held
+    //in RAM until the rest is ready
     Wire.begin();
     EEPROM.setWPPin(18); // a guess...
 
@@ -290,6 +393,14 @@ void setup()
 
     EEPROM.setWPPin(SysSettings.eepromWPPin);
 
+    setupBusRegistry();
+    bootCapture.begin();
+    setupBuses();
+    bootCapture.busesUp();
+
+    Serial.begin(115200);
+    loadTables();
+
     if (SysSettings.useSD) {
         if (!sd.begin(SysSettings.SDCardSelPin, SPI_FULL_SPEED)) {
             Logger::error("Could not initialize SDCard! No file logging will be possible!");
@@ -305,89 +416,87 @@ void setup()
 
     sys_early_setup();
     setup_sys_io();
+    edgeCapture.begin();
+
+    setupDigToggle();
+    triggerEngine.compile(); //again now that the pins are set up so input rules start from the real pin state
+
+    SysSettings.lawicelMode = false;
+    SysSettings.lawicelAutoPoll = false;
+    SysSettings.lawicelTimestamping = false;
+    SysSettings.lawicelPollCounter = 0;
+
+    bootCapture.finish(); //held frames go out before loop() reads any newer ones
+    cyclicTx.begin(); //last so periodic frames only start once every bus is up
+    sdReplay.bootCheck();
 
+    SerialUSB.print("Done with init\n");
+    digitalWrite(BLINK_LED, HIGH);
+}
+
+void setupDigToggle()
+{
     if (digToggleSettings.enabled) {
         if (digToggleSettings.mode & 1) { //input CAN and output pin state mode
             pinMode(digToggleSettings.pin, OUTPUT);
-            if (digToggleSettings.mode & 0x80) {
-                digitalWrite(digToggleSettings.pin, LOW);
-                digTogglePinState = false;
-            } else {
-                digitalWrite(digToggleSettings.pin, HIGH);
-                digTogglePinState = true;
-            }
+            if (digToggleSettings.mode & 0x80) digitalWrite(digToggleSettings.pin, LOW);
+            else digitalWrite(digToggleSettings.pin, HIGH);
         } else { //read pin and output CAN mode
             pinMode(digToggleSettings.pin, INPUT);
-            digTogglePinCounter = 0;
-            if (digToggleSettings.mode & 0x80) digTogglePinState = false;
-            else digTogglePinState = true;
         }
     }
+}
 
-    if (settings.CAN0_Enabled) {
-        if (settings.CAN0ListenOnly) {
-            Can0.enable_autobaud_listen_mode();
-        } else {
-            Can0.disable_autobaud_listen_mode();
-        }
-        Can0.enable();
-        Can0.begin(settings.CAN0Speed, SysSettings.CAN0EnablePin);
-    } else Can0.disable();
+/*
+Brings every bus up the way settings says, speeds, listen only and filters included. Run at start
+up and again when a whole new configuration comes in over the binary protocol.
+*/
+//works out the buses again along with everything that keeps a table per bus
+void setupBusRegistry()
+{
+    busRegistry.setup();
+    busCensus.setup();
+}
 
-    if (settings.CAN1_Enabled) {
-        if (settings.CAN1ListenOnly) {
-            Can1.enable_autobaud_listen_mode();
-        } else {
-            Can1.disable_autobaud_listen_mode();
-        }
-        Can1.enable();
-        Can1.begin(settings.CAN1Speed, SysSettings.CAN1EnablePin);
-        if (!SysSettings.dedicatedSWCAN) 
-        {
-            if (settings.singleWire_Enabled) {
-                setSWCANEnabled();
-            } else {
-                setSWCANSleep();
-            }
-        }
-    } else Can1.disable();
-    
-    if (SysSettings.dedicatedSWCAN) setSWCANSleep();
+void setupBuses()
+{
+    CanBus *bus;
 
-    if (settings.singleWire_Enabled && SysSettings.dedicatedSWCAN)
-    {
-        SPI.begin();
-        if(SWCAN.Init(settings.SWCANSpeed,16))
-        {
-            SerialUSB.println("MCP2515 Init OK ...");
-            attachInterrupt(CANDUE22_SW_INT, SWCAN_Int, FALLING);
-            setSWCANEnabled();
-        } else {
-            SerialUSB.println("MCP2515 Init Failed ...");
-        }
-    } 
+    for (int b = 0; b < MAX_BUSES; b++) {
+        bus = busRegistry.get(b);
+        if (!bus) continue;
+        if (!bus->isEnabled()) bus->end();
+        else if (!bus->begin()) Logger::error("Could not start bus %i", b);
+    }
 
-    for (int i = 0; i < 7; i++) {
-        if (settings.CAN0Filters[i].enabled) {
-            Can0.setRXFilter(i, settings.CAN0Filters[i].id,
-                             settings.CAN0Filters[i].mask, settings.CAN0Filters[i].extended);
-        }
-        if (settings.CAN1Filters[i].enabled) {
-            Can1.setRXFilter(i, settings.CAN1Filters[i].id,
-                             settings.CAN1Filters[i].mask, settings.CAN1Filters[i].extended);
-        }
+    //the single wire transceiver shares CAN1 on boards without the MCP2515
+    if (!SysSettings.dedicatedSWCAN) {
+        if (settings.CAN1_Enabled && settings.singleWire_Enabled) setSWCANEnabled();
+        else setSWCANSleep();
+    } else {
+        bus = busRegistry.get(2);
+        if (bus && bus->isRunning()) setSWCANEnabled();
+        else setSWCANSleep();
     }
+}
 
-    if (settings.singleWire_Enabled && SysSettings.dedicatedSWCAN)
-        SWCAN.InitFilters(true); //let everything through
-    
-    SysSettings.lawicelMode = false;
-    SysSettings.lawicelAutoPoll = false;
-    SysSettings.lawicelTimestamping = false;
-    SysSettings.lawicelPollCounter = 0;
+//restart one bus after its settings changed. Does nothing for a bus the board doesn't have
+void setupBus(int whichBus)
+{
+    CanBus *bus = busRegistry.get(whichBus);
 
-    SerialUSB.print("Done with init\n");
-    digitalWrite(BLINK_LED, HIGH);
+    if (bus) {
+        if (bus->isEnabled()) bus->begin();
+        else bus->end();
+    }
+    if (whichBus == 2 && SysSettings.dedicatedSWCAN) {
+        if (bus && bus->isRunning()) setSWCANEnabled();
+        else setSWCANSleep();
+    }
+    if ((whichBus == 1 || whichBus == 2) && !SysSettings.dedicatedSWCAN) { //without the MCP2515 single wire is just the transceiver mode on CAN1
+        if (settings.CAN1_Enabled && settings.singleWire_Enabled) setSWCANEnabled();
+        else setSWCANSleep();
+    }
 }
 
 void setPromiscuousMode()
@@ -426,10 +535,17 @@ void toggleRXLED()
 }
 
 void sendFrameToUSB(CAN_FRAME &frame, int whichBus)
+{
+    sendFrameToUSBAt(frame, whichBus, timebase.stamp64());
+}
+
+//for things that happened a little while ago, stamp is in the timescale of timebase.stamp64()
+void sendFrameToUSBAt(CAN_FRAME &frame, int whichBus, uint64_t stamp, bool sent)
 {
     uint8_t buff[22];
     uint8_t temp;
-    uint32_t now = micros();
+    uint32_t now = (uint32_t)stamp;
+    uint32_t id = frame.id;
 
     if (SysSettings.lawicelMode) {
         if (frame.extended) {
@@ -454,17 +570,19 @@ void sendFrameToUSB(CAN_FRAME &frame, int whichBus)
         SerialUSB.write(13);
     } else {
         if (settings.useBinarySerialComm) {
-            if (frame.extended) frame.id |= 1 << 31;
+            if (frame.extended) id |= 1 << 31;
+            if (sent) id |= GVRET_TX_FLAG;
+            if (serialBufferLength > SER_BUFF_SIZE - 24) flushSerialBuffer();
             serialBuffer[serialBufferLength++] = 0xF1;
             serialBuffer[serialBufferLength++] = 0; //0 = canbus frame sending
             serialBuffer[serialBufferLength++] = (uint8_t)(now & 0xFF);
             serialBuffer[serialBufferLength++] = (uint8_t)(now >> 8);
             serialBuffer[serialBufferLength++] = (uint8_t)(now >> 16);
             serialBuffer[serialBufferLength++] = (uint8_t)(now >> 24);
-            serialBuffer[serialBufferLength++] = (uint8_t)(frame.id & 0xFF);
-            serialBuffer[serialBufferLength++] = (uint8_t)(frame.id >> 8);
-            serialBuffer[serialBufferLength++] = (uint8_t)(frame.id >> 16);
-            serialBuffer[serialBufferLength++] = (uint8_t)(frame.id >> 24);
+            serialBuffer[serialBufferLength++] = (uint8_t)(id & 0xFF);
+            serialBuffer[serialBufferLength++] = (uint8_t)(id >> 8);
+            serialBuffer[serialBufferLength++] = (uint8_t)(id >> 16);
+            serialBuffer[serialBufferLength++] = (uint8_t)(id >> 24);
             serialBuffer[serialBufferLength++] = frame.length + (uint8_t)(whichBus << 4);
             for (int c = 0; c < frame.length; c++) {
                 serialBuffer[serialBufferLength++] = frame.data.bytes[c];
@@ -474,7 +592,7 @@ void sendFrameToUSB(CAN_FRAME &frame, int whichBus)
             serialBuffer[serialBufferLength++] = temp;
             //SerialUSB.write(buff, 12 + frame.length);
         } else {
-            SerialUSB.print(micros());
+            SerialUSB.print(now);
             SerialUSB.print(" - ");
             SerialUSB.print(frame.id, HEX);
             if (frame.extended) SerialUSB.print(" X ");
@@ -486,34 +604,80 @@ void sendFrameToUSB(CAN_FRAME &frame, int whichBus)
                 SerialUSB.print(" ");
                 SerialUSB.print(frame.data.bytes[c], HEX);
             }
+            if (sent) SerialUSB.print(" TX");
             SerialUSB.println();
         }
     }
 }
 
+//Adds bytes to the buffered USB output. Anything sending binary protocol traffic to the host
+//outside of the command handling should come through here so it stays in order with frame traffic.
+void sendBytesToUSB(uint8_t *data, int length)
+{
+    if (serialBufferLength + length > SER_BUFF_SIZE) flushSerialBuffer();
+    if (length > SER_BUFF_SIZE) {
+        SerialUSB.write(data, length);
+        return;
+    }
+    memcpy(serialBuffer + serialBufferLength, data, length);
+    serialBufferLength += length;
+}
+
+/*
+Hands out space at the end of the buffered USB output so a record can be built in place
+instead of in a temporary first. The bytes count as sent as soon as this returns.
+*/
+uint8_t *reserveUSBBytes(int length)
+{
+    uint8_t *out;
+
+    if (length > SER_BUFF_SIZE) return NULL;
+    if (serialBufferLength + length > SER_BUFF_SIZE) flushSerialBuffer();
+    out = serialBuffer + serialBufferLength;
+    serialBufferLength += length;
+    return out;
+}
+
+void flushSerialBuffer()
+{
+    if (serialBufferLength > 0) {
+        SerialUSB.write(serialBuffer, serialBufferLength);
+        serialBufferLength = 0;
+    }
+    lastFlushMicros = micros();
+}
+
 void sendFrameToFile(CAN_FRAME &frame, int whichBus)
+{
+    sendFrameToFileAt(frame, whichBus, timebase.stamp64());
+}
+
+//for things that happened a little while ago, stamp is in the timescale of timebase.stamp64()
+void sendFrameToFileAt(CAN_FRAME &frame, int whichBus, uint64_t stamp, bool sent)
 {
     uint8_t buff[40];
     uint8_t temp;
     uint32_t timestamp;
+    uint32_t id = frame.id;
+    if (sent) id |= GVRET_TX_FLAG;
     if (settings.fileOutputType == BINARYFILE) {
-        if (frame.extended) frame.id |= 1 << 31;
-        timestamp = micros();
+        if (frame.extended) id |= 1 << 31;
+        timestamp = (uint32_t)stamp;
         buff[0] = (uint8_t)(timestamp & 0xFF);
         buff[1] = (uint8_t)(timestamp >> 8);
         buff[2] = (uint8_t)(timestamp >> 16);
         buff[3] = (uint8_t)(timestamp >> 24);
-        buff[4] = (uint8_t)(frame.id & 0xFF);
-        buff[5] = (uint8_t)(frame.id >> 8);
-        buff[6] = (uint8_t)(frame.id >> 16);
-        buff[7] = (uint8_t)(frame.id >> 24);
+        buff[4] = (uint8_t)(id & 0xFF);
+        buff[5] = (uint8_t)(id >> 8);
+        buff[6] = (uint8_t)(id >> 16);
+        buff[7] = (uint8_t)(id >> 24);
         buff[8] = frame.length + (uint8_t)(whichBus << 4);
         for (int c = 0; c < frame.length; c++) {
             buff[9 + c] = frame.data.bytes[c];
         }
         Logger::fileRaw(buff, 9 + frame.length);
     } else if (settings.fileOutputType == GVRET) {
-        sprintf((char *)buff, "%i,%x,%i,%i,%i", millis(), frame.id, frame.extended, whichBus, frame.length);
+        sprintf((char *)buff, "%i,%x,%i,%i,%i", (uint32_t)(stamp / 1000), id, frame.extended, whichBus, frame.length);
         Logger::fileRaw(buff, strlen((char *)buff));
 
         for (int c = 0; c < frame.length; c++) {
@@ -526,7 +690,8 @@ void sendFrameToFile(CAN_FRAME &frame, int whichBus)
     } else if (settings.fileOutputType == CRTD) {
         int idBits = 11;
         if (frame.extended) idBits = 29;
-        sprintf((char *)buff, "%f R%i %x", millis() / 1000.0f, idBits, frame.id);
+        temp = timebase.printSeconds((char *)buff, stamp);
+        sprintf((char *)buff + temp, " %c%i %x", sent ? 'T' : 'R', idBits, frame.id);
         Logger::fileRaw(buff, strlen((char *)buff));
 
         for (int c = 0; c < frame.length; c++) {
@@ -539,39 +704,115 @@ void sendFrameToFile(CAN_FRAME &frame, int whichBus)
     }
 }
 
-void processDigToggleFrame(CAN_FRAME &frame)
+/*
+Sends a GVRET generated event through the same outputs as received frames. LAWICEL hosts
+have no way to tell these apart from real traffic so they only get them in the log file.
+*/
+static void buildEventFrame(CAN_FRAME &frame, uint8_t eventType, uint8_t *data, uint8_t length)
 {
-    bool gotFrame = false;
-    if (digToggleSettings.rxTxID == frame.id) {
-        if (digToggleSettings.length == 0) gotFrame = true;
-        else {
-            gotFrame = true;
-            for (int c = 0; c < digToggleSettings.length; c++) {
-                if (digToggleSettings.payload[c] != frame.data.byte[c]) {
-                    gotFrame = false;
-                    break;
-                }
-            }
-        }
-    }
+    frame.id = GVRET_EVENT_FLAG | eventType;
+    frame.extended = true;
+    frame.rtr = 0;
+    if (length > 8) length = 8;
+    frame.length = length;
+    for (int c = 0; c < length; c++) frame.data.bytes[c] = data[c];
+}
 
-    if (gotFrame) { //then toggle output pin
-        Logger::console("Got special digital toggle frame. Toggling the output!");
-        digitalWrite(digToggleSettings.pin, digTogglePinState?LOW:HIGH);
-        digTogglePinState = !digTogglePinState;
-    }
+void sendEventFrame(uint8_t eventType, int whichBus, uint8_t *data, uint8_t length)
+{
+    sendEventFrameAt(eventType, whichBus, data, length, timebase.stamp64());
+}
+
+void sendEventFrameAt(uint8_t eventType, int whichBus, uint8_t *data, uint8_t length, uint64_t stamp)
+{
+    CAN_FRAME frame;
+
+    buildEventFrame(frame, eventType, data, length);
+    if (!SysSettings.lawicelMode) sendFrameToUSBAt(frame, whichBus, stamp);
+    if (SysSettings.logToFile) sendFrameToFileAt(frame, whichBus, stamp);
 }
 
-void sendDigToggleMsg()
+//same but only into the log file
+void logEventFrame(uint8_t eventType, int whichBus, uint8_t *data, uint8_t length)
 {
     CAN_FRAME frame;
-    frame.id = digToggleSettings.rxTxID;
-    if (frame.id > 0x7FF) frame.extended = true;
-    else frame.extended = false;
-    frame.length = digToggleSettings.length;
-    for (int c = 0; c < frame.length; c++) frame.data.byte[c] = digToggleSettings.payload[c];
-    if (digToggleSettings.mode & 2) Can0.sendFrame(frame);
-    if (digToggleSettings.mode & 4) Can1.sendFrame(frame);
+
+    buildEventFrame(frame, eventType, data, length);
+    sendFrameToFile(frame, whichBus);
+}
+
+//Logger calls this right after it opens a new log file. Whatever goes out here is the file's header
+void logFileOpened()
+{
+    timebase.logHeader();
+    timeSync.sendStatusEvent(true);
+    adcStream.sendSetupEvent(true);
+}
+
+/*
+Everything that wants to see received traffic hangs off of here. Called once for
+each frame read from any of the buses.
+*/
+void processIncomingFrame(CAN_FRAME &frame, int whichBus)
+{
+    processIncomingFrameAt(frame, whichBus, timebase.ticks());
+}
+
+//same but for a frame that was taken off the bus earlier, rxTicks is from Timebase::ticks() at the time
+void processIncomingFrameAt(CAN_FRAME &frame, int whichBus, uint64_t rxTicks)
+{
+    CAN_FRAME gatewayFrame;
+    uint32_t now = (uint32_t)(rxTicks / TIMEBASE_TICKS_US);
+
+    responder.processFrame(frame, whichBus, now); //first so automatic replies go out as soon as possible
+    timeSync.processFrame(frame, whichBus, now);
+    busCensus.addFrame(frame, whichBus, now);
+    busLoad.addFrame(frame, whichBus);
+    signalDecoder.processFrame(frame, whichBus, now);
+    triggerEngine.processFrame(frame, whichBus);
+    isoTp.processFrame(frame, whichBus);
+
+    if (whichBus == 0 && digitalRead(ENABLE_PASS_0TO1_PIN)) { // if pin is NOT shorted to GND
+        gatewayFrame = frame;
+        if (gatewayRules.processFrame(gatewayFrame, 0)) sendFrameOnBus(gatewayFrame, 1);
+    }
+    if (whichBus == 1 && digitalRead(ENABLE_PASS_1TO0_PIN)) {
+        gatewayFrame = frame;
+        if (gatewayRules.processFrame(gatewayFrame, 1)) sendFrameOnBus(gatewayFrame, 0);
+    }
+
+    toggleRXLED();
+    if (signalDecoder.sendRawFrames()) sendFrameToUSBAt(frame, whichBus, timebase.stampAt(rxTicks));
+    if (SysSettings.logToFile) sendFrameToFileAt(frame, whichBus, timebase.stampAt(rxTicks));
+}
+
+/*
+Called for every frame once it has actually gone out on a bus, with the Timebase ticks of when it did.
+Echoed frames carry GVRET_TX_FLAG in the ID. LAWICEL has no way to mark them so they aren't echoed there.
+*/
+void processSentFrameAt(CAN_FRAME &frame, int whichBus, uint64_t txTicks)
+{
+    if (!settings.echoTx) return;
+    if (!SysSettings.lawicelMode && signalDecoder.sendRawFrames()) sendFrameToUSBAt(frame, whichBus, timebase.stampAt(txTicks), true);
+    if (SysSettings.logToFile) sendFrameToFileAt(frame, whichBus, timebase.stampAt(txTicks), true);
+}
+
+//the feature that queued a frame hears when it went out with the time it did, or that it never will
+void processTxDone(uint8_t source, uint32_t tag, bool sent, uint64_t txTicks)
+{
+    if (source == TX_SOURCE_RESPONDER) responder.frameDone(tag, sent, txTicks);
+    else if (source == TX_SOURCE_REPLAY) replay.frameDone(tag, sent, txTicks);
+    else if (source == TX_SOURCE_TIMESYNC) timeSync.frameDone(tag, sent, txTicks);
+}
+
+/*
+Returns false if the frame couldn't be queued for sending. It goes out in the background from the bus' queue.
+With wakeup set on the single wire bus the transceiver is put in high voltage wakeup mode around the frame.
+A source other than TX_SOURCE_NONE gets processTxDone() with the tag once the frame is finished with.
+*/
+bool sendFrameOnBus(CAN_FRAME &frame, int whichBus, uint8_t priority, bool wakeup, uint8_t source, uint32_t tag)
+{
+    return busRegistry.sendFrame(frame, whichBus, priority, wakeup, source, tag);
 }
 
 /*
@@ -588,27 +829,31 @@ fastest and safest with limited function calls
 */
 void loop()
 {
-    static int loops = 0;
     CAN_FRAME incoming;
     static CAN_FRAME build_out_frame;
     static int out_bus;
+    static bool out_wakeup;
     int in_byte;
-    static byte buff[20];
+    static byte buff[32];
     static int step = 0;
     static STATE state = IDLE;
     static uint32_t build_int;
     uint8_t temp8;
     uint16_t temp16;
-    static bool markToggle = false;
+    static bool isoTpLoading;
+    static uint8_t *configBuffer;
+    static uint64_t syncTicks;
+    uint64_t rxTicks;
     bool isConnected = false;
     int serialCnt;
-    uint32_t now = micros();
+    uint32_t now;
 
     /*if (SerialUSB)*/ isConnected = true;
 
     //there is no switch debouncing here at the moment
     //if mark triggering causes bounce then debounce this later on.
     /*
+    static bool markToggle = false;
     if (getDigital(0)) {
     	if (!markToggle) {
     		markToggle = true;
@@ -623,60 +868,22 @@ void loop()
 
     //if (!SysSettings.lawicelMode || SysSettings.lawicelAutoPoll || SysSettings.lawicelPollCounter > 0)
     //{
-    while (Can0.available()) {
-        Can0.read(incoming);
-        if (digitalRead(ENABLE_PASS_0TO1_PIN)) Can1.sendFrame(incoming); // if pin is NOT shorted to GND
-        toggleRXLED();
-        if (isConnected) sendFrameToUSB(incoming, 0);
-        if (SysSettings.logToFile) sendFrameToFile(incoming, 0);
-        if (digToggleSettings.enabled && (digToggleSettings.mode & 1) && (digToggleSettings.mode & 2)) processDigToggleFrame(incoming);
-    }
-
-    while (Can1.available()) {
-        Can1.read(incoming);
-        if (digitalRead(ENABLE_PASS_1TO0_PIN)) Can0.sendFrame(incoming); // if pin is NOT shorted to GND
-        toggleRXLED();
-        if (isConnected) sendFrameToUSB(incoming, 1);
-        if (digToggleSettings.enabled && (digToggleSettings.mode & 1) && (digToggleSettings.mode & 4)) processDigToggleFrame(incoming);
-        if (SysSettings.logToFile) sendFrameToFile(incoming, 1);
+    for (int b = 0; b < MAX_BUSES; b++) {
+        CanBus *bus = busRegistry.get(b);
+        if (!bus || !bus->isRunning()) continue;
+        while (bus->read(incoming, rxTicks)) {
+            bus->rxFrames++;
+            processIncomingFrameAt(incoming, b, rxTicks);
+        }
     }
 
-    if (SysSettings.dedicatedSWCAN && settings.singleWire_Enabled && SWCAN.GetRXFrame(incoming))
-    {
-        toggleRXLED();
-        if (isConnected) sendFrameToUSB(incoming, 2);
-        if (SysSettings.logToFile) sendFrameToFile(incoming, 2);
-    }
+    busRegistry.loop();
 
     if (SysSettings.lawicelPollCounter > 0) SysSettings.lawicelPollCounter--;
     //}
 
-    if (digToggleSettings.enabled && !(digToggleSettings.mode & 1)) {
-        if (digTogglePinState) { //pin currently high. Look for it going low
-            if (!digitalRead(digToggleSettings.pin)) digTogglePinCounter++; //went low, increment debouncing counter
-            else digTogglePinCounter = 0; //whoops, it bounced or never transitioned, reset counter to 0
-
-            if (digTogglePinCounter > 3) { //transitioned to LOW for 4 checks in a row. We'll believe it then.
-                digTogglePinState = false;
-                sendDigToggleMsg();
-            }
-        } else { //pin currently low. Look for it going high
-            if (digitalRead(digToggleSettings.pin)) digTogglePinCounter++; //went high, increment debouncing counter
-            else digTogglePinCounter = 0; //whoops, it bounced or never transitioned, reset counter to 0
-
-            if (digTogglePinCounter > 3) { //transitioned to HIGH for 4 checks in a row. We'll believe it then.
-                digTogglePinState = true;
-                sendDigToggleMsg();
-            }
-        }
-    }
-
     if (micros() - lastFlushMicros > SER_BUFF_FLUSH_INTERVAL) {
-        if (serialBufferLength > 0) {
-            SerialUSB.write(serialBuffer, serialBufferLength);
-            serialBufferLength = 0;
-            lastFlushMicros = micros();
-        }
+        if (serialBufferLength > 0) flushSerialBuffer();
     }
 
     serialCnt = 0;
@@ -704,6 +911,7 @@ void loop()
             case PROTO_TIME_SYNC:
                 state = TIME_SYNC;
                 step = 0;
+                now = timebase.stamp32(); //the same timescale the frames are stamped in
                 buff[0] = 0xF1;
                 buff[1] = 1; //time sync
                 buff[2] = (uint8_t)(now & 0xFF);
@@ -762,7 +970,7 @@ void loop()
                 buff[4] = settings.CAN0Speed >> 8;
                 buff[5] = settings.CAN0Speed >> 16;
                 buff[6] = settings.CAN0Speed >> 24;
-                buff[7] = settings.CAN1_Enabled + ((unsigned char)settings.CAN1ListenOnly << 4) + (unsigned char)settings.singleWire_Enabled << 6;
+                buff[7] = settings.CAN1_Enabled + ((unsigned char)settings.CAN1ListenOnly << 4) + ((unsigned char)settings.singleWire_Enabled << 6);
                 buff[8] = settings.CAN1Speed;
                 buff[9] = settings.CAN1Speed >> 8;
                 buff[10] = settings.CAN1Speed >> 16;
@@ -809,7 +1017,7 @@ void loop()
             case PROTO_GET_NUMBUSES:
                 buff[0] = 0xF1;
                 buff[1] = 12;
-                buff[2] = 3; //CAN0, CAN1, SWCAN
+                buff[2] = max(3, busRegistry.getCount()); //CAN0, CAN1, SWCAN then any extra MCP2515 buses
                 SerialUSB.write(buff, 3);
                 state = IDLE;
                 break;
@@ -821,16 +1029,14 @@ void loop()
                 buff[4] = settings.SWCANSpeed >> 8;
                 buff[5] = settings.SWCANSpeed >> 16;
                 buff[6] = settings.SWCANSpeed >> 24;
-                buff[7] = 0; //fourth bus enabled
-                buff[8] = 0; //fourth bus speed (4 bytes)
-                buff[9] = 0;
-                buff[10] = 0;
-                buff[11] = 0;
-                buff[12] = 0; //fifth bus enabled
-                buff[13] = 0; //fifth bus speed (4 bytes)
-                buff[14] = 0;
-                buff[15] = 0;
-                buff[16] = 0;
+                for (int e = 0; e < EXT_BUSES; e++) { //fourth and fifth buses, enabled then speed (4 bytes)
+                    EXTBUS_SETTINGS &ext = settings.extBuses[e];
+                    buff[7 + e * 5] = ext.enabled + ((unsigned char)ext.listenOnly << 4);
+                    buff[8 + e * 5] = ext.speed;
+                    buff[9 + e * 5] = ext.speed >> 8;
+                    buff[10 + e * 5] = ext.speed >> 16;
+                    buff[11 + e * 5] = ext.speed >> 24;
+                }
                 SerialUSB.write(buff, 17);
                 state = IDLE;             
                 break;
@@ -839,6 +1045,74 @@ void loop()
                 step = 0;
                 buff[0] = 0xF1;      
                 break;                
+            case PROTO_GET_CENSUS:
+                state = GET_CENSUS;
+                break;
+            case PROTO_BUS_LOAD:
+                state = SET_BUS_LOAD_REPORT;
+                step = 0;
+                break;
+            case PROTO_BUS_STATUS:
+                busMonitor.sendStatusBinary();
+                state = IDLE;
+                break;
+            case PROTO_SIGNAL_DATA:
+                state = SET_SIGNAL_STREAM;
+                break;
+            case PROTO_GET_SIGNAL_DEFS:
+                signalDecoder.sendDefsBinary();
+                state = IDLE;
+                break;
+            case PROTO_ISOTP_SETUP:
+                state = ISOTP_SETUP;
+                step = 0;
+                break;
+            case PROTO_ISOTP_SEND:
+                state = ISOTP_SEND;
+                step = 0;
+                break;
+            case PROTO_SET_CYCLIC:
+                state = SET_CYCLIC;
+                step = 0;
+                break;
+            case PROTO_GET_CYCLIC_STATS:
+                cyclicTx.sendStatsBinary();
+                state = IDLE;
+                break;
+            case PROTO_REPLAY_START:
+                state = REPLAY_START;
+                break;
+            case PROTO_REPLAY_FRAME:
+                state = REPLAY_FRAME;
+                step = 0;
+                break;
+            case PROTO_REPLAY_CREDIT:
+                replay.sendCredits();
+                state = IDLE;
+                break;
+            case PROTO_REPLAY_END:
+                state = REPLAY_END;
+                break;
+            case PROTO_TIME_SYNC64:
+                syncTicks = timebase.ticks(); //as close to arrival as the command can be caught
+                state = TIME_SYNC64;
+                break;
+            case PROTO_SD_REPLAY:
+                state = SD_REPLAY;
+                step = 0;
+                break;
+            case PROTO_ADC_STREAM:
+                state = ADC_STREAM;
+                step = 0;
+                break;
+            case PROTO_GET_CONFIG:
+                state = CONFIG_GET;
+                step = 0;
+                break;
+            case PROTO_SET_CONFIG:
+                state = CONFIG_SET;
+                step = 0;
+                break;
             }
             break;
         case BUILD_CAN_FRAME:
@@ -861,7 +1135,8 @@ void loop()
                 } else build_out_frame.extended = false;
                 break;
             case 4:
-                out_bus = in_byte & 3;
+                out_bus = in_byte & 7;
+                out_wakeup = (in_byte & 0x80) ? true : false; //high voltage wakeup on single wire
                 break;
             case 5:
                 build_out_frame.length = in_byte & 0xF;
@@ -876,27 +1151,9 @@ void loop()
                     temp8 = checksumCalc(buff, step);
                     //if (temp8 == in_byte)
                     //{
-                    if (settings.singleWire_Enabled == 1) {
-                        if (build_out_frame.id == 0x100) {
-                            if ( ((out_bus == 1) && !SysSettings.dedicatedSWCAN) || (out_bus == 2) ) {
-                                setSWCANWakeup();
-                                delay(1);
-                            }
-                        }
-                    }
+                    //0x100 always goes out as a wakeup, older hosts count on that
                     build_out_frame.rtr = 0;
-                    if (out_bus == 0) Can0.sendFrame(build_out_frame);
-                    if (out_bus == 1) Can1.sendFrame(build_out_frame);
-                    if (out_bus == 2) SWCAN.sendFrame(build_out_frame);
-
-                    if (settings.singleWire_Enabled == 1) {
-                        if (build_out_frame.id == 0x100) {
-                            if ( ((out_bus == 1) && !SysSettings.dedicatedSWCAN) || (out_bus == 2) ) {
-                                delay(1);
-                                setSWCANEnabled();
-                            }
-                        }
-                    }
+                    sendFrameOnBus(build_out_frame, out_bus, TX_PRIO_NORMAL, out_wakeup || build_out_frame.id == 0x100);
                     //}
                 }
                 break;
@@ -930,33 +1187,14 @@ void loop()
                 build_int |= in_byte << 24;
                 if (build_int > 0) {
                     if (build_int & 0x80000000) { //signals that enabled and listen only status are also being passed
-                        if (build_int & 0x40000000) {
-                            settings.CAN0_Enabled = true;
-                            Can0.enable();
-                        } else {
-                            settings.CAN0_Enabled = false;
-                            Can0.disable();
-                        }
-                        if (build_int & 0x20000000) {
-                            settings.CAN0ListenOnly = true;
-                            Can0.enable_autobaud_listen_mode();
-                        } else {
-                            settings.CAN0ListenOnly = false;
-                            Can0.disable_autobaud_listen_mode();
-                        }
-                    } else {
-                        Can0.enable(); //if not using extended status mode then just default to enabling - this was old behavior
-                        settings.CAN0_Enabled = true;
-                    }
+                        settings.CAN0_Enabled = (build_int & 0x40000000) ? true : false;
+                        settings.CAN0ListenOnly = (build_int & 0x20000000) ? true : false;
+                    } else settings.CAN0_Enabled = true; //if not using extended status mode then just default to enabling - this was old behavior
                     build_int = build_int & 0xFFFFF;
                     if (build_int > 1000000) build_int = 1000000;
-                    Can0.begin(build_int, SysSettings.CAN0EnablePin);
-                    //Can0.set_baudrate(build_int);
                     settings.CAN0Speed = build_int;
-                } else { //disable first canbus
-                    Can0.disable();
-                    settings.CAN0_Enabled = false;
-                }
+                } else settings.CAN0_Enabled = false; //disable first canbus
+                setupBus(0);
                 break;
             case 4:
                 build_int = in_byte;
@@ -971,40 +1209,17 @@ void loop()
                 build_int |= in_byte << 24;
                 if (build_int > 0) {
                     if (build_int & 0x80000000) { //signals that enabled and listen only status are also being passed
-                        if (build_int & 0x40000000) {
-                            settings.CAN1_Enabled = true;
-                            Can1.enable();
-                        } else {
-                            settings.CAN1_Enabled = false;
-                            Can1.disable();
-                        }
-                        if (build_int & 0x20000000) {
-                            settings.CAN1ListenOnly = true;
-                            Can1.enable_autobaud_listen_mode();
-                        } else {
-                            settings.CAN1ListenOnly = false;
-                            Can1.disable_autobaud_listen_mode();
-                        }
-                    } else {
-                        Can1.enable(); //if not using extended status mode then just default to enabling - this was old behavior
-                        settings.CAN1_Enabled = true;
-                    }
+                        settings.CAN1_Enabled = (build_int & 0x40000000) ? true : false;
+                        settings.CAN1ListenOnly = (build_int & 0x20000000) ? true : false;
+                    } else settings.CAN1_Enabled = true;
                     build_int = build_int & 0xFFFFF;
                     if (build_int > 1000000) build_int = 1000000;
-                    Can1.begin(build_int, SysSettings.CAN1EnablePin);
-                    if (settings.singleWire_Enabled && !SysSettings.dedicatedSWCAN) setSWCANEnabled();
-                    else setSWCANSleep();
-                    //Can1.set_baudrate(build_int);
-
                     settings.CAN1Speed = build_int;
-                } else { //disable second canbus
-                    if (!SysSettings.dedicatedSWCAN) setSWCANSleep();
-                    Can1.disable();
-                    settings.CAN1_Enabled = false;
-                }
+                } else settings.CAN1_Enabled = false; //disable second canbus
+                setupBus(1);
                 state = IDLE;
                 //now, write out the new canbus settings to EEPROM
-                EEPROM.write(EEPROM_PAGE, settings);
+                settingsStore.markDirty(STORE_SETTINGS);
                 setPromiscuousMode();
                 break;
             }
@@ -1018,12 +1233,12 @@ void loop()
                 settings.singleWire_Enabled = false;
                 setSWCANSleep();
             }
-            EEPROM.write(EEPROM_PAGE, settings);
+            settingsStore.markDirty(STORE_SETTINGS);
             state = IDLE;
             break;
         case SET_SYSTYPE:
             settings.sysType = in_byte;
-            EEPROM.write(EEPROM_PAGE, settings);
+            settingsStore.markDirty(STORE_SETTINGS);
             loadSettings();
             state = IDLE;
             break;
@@ -1070,90 +1285,242 @@ void loop()
             }
             step++;
             break;
-        case SETUP_EXT_BUSES: //setup enable/listenonly/speed for SWCAN, Enable/Speed for LIN1, LIN2
+        case SETUP_EXT_BUSES: //setup enable/listenonly/speed for SWCAN then the two extra MCP2515 buses
             switch (step) {
             case 0:
+            case 4:
+            case 8:
                 build_int = in_byte;
                 break;
             case 1:
+            case 5:
+            case 9:
                 build_int |= in_byte << 8;
                 break;
             case 2:
+            case 6:
+            case 10:
                 build_int |= in_byte << 16;
                 break;
             case 3:
                 build_int |= in_byte << 24;
                 if (build_int > 0) {
                     if (build_int & 0x80000000) { //signals that enabled and listen only status are also being passed
-                        if (build_int & 0x40000000) {
-                            settings.singleWire_Enabled = true;
-                            setSWCANEnabled();
-                        } else {
-                            settings.singleWire_Enabled = false;
-                            setSWCANSleep();
-                        }
-                        if (build_int & 0x20000000) {
-                            settings.SWCANListenOnly = true;
-                            //SWCAN.enable_autobaud_listen_mode();
-                        } else {
-                            settings.SWCANListenOnly = false;
-                            //SWCAN.disable_autobaud_listen_mode();
-                        }
-                    } else {
-                        setSWCANEnabled();
-                        settings.singleWire_Enabled = true;
-                    }
+                        settings.singleWire_Enabled = (build_int & 0x40000000) ? true : false;
+                        settings.SWCANListenOnly = (build_int & 0x20000000) ? true : false;
+                    } else settings.singleWire_Enabled = true;
                     build_int = build_int & 0xFFFFF;
                     if (build_int > 100000) build_int = 100000;
                     settings.SWCANSpeed = build_int;
-                    SPI.begin();
-                    if(SWCAN.Init(settings.SWCANSpeed,16))
-                    {
-                        SerialUSB.println("MCP2515 Init OK ...");
-                        attachInterrupt(CANDUE22_SW_INT, SWCAN_Int, FALLING);
-                        setSWCANEnabled();
-                    } else {
-                        SerialUSB.println("MCP2515 Init Failed ...");
-                    }
-                } else { //disable first canbus
-                    void setSWCANSleep();
-                    settings.singleWire_Enabled = false;
-                }
-                break;
-            case 4:
-                build_int = in_byte;
-                break;
-            case 5:
-                build_int |= in_byte << 8;
-                break;
-            case 6:
-                build_int |= in_byte << 16;
+                } else settings.singleWire_Enabled = false;
+                setupBus(2);
                 break;
             case 7:
-                build_int |= in_byte << 24;
-                break;
-            case 8:
-                build_int = in_byte;
-                break;
-            case 9:
-                build_int |= in_byte << 8;
-                break;
-            case 10:
-                build_int |= in_byte << 16;
-                break;
             case 11:
                 build_int |= in_byte << 24;
-                state = IDLE;
-                //now, write out the new canbus settings to EEPROM
-                EEPROM.write(EEPROM_PAGE, settings);                
+                temp8 = (step == 7) ? 0 : 1;
+                if (build_int > 0) {
+                    if (build_int & 0x80000000) {
+                        settings.extBuses[temp8].enabled = (build_int & 0x40000000) ? true : false;
+                        settings.extBuses[temp8].listenOnly = (build_int & 0x20000000) ? true : false;
+                    } else settings.extBuses[temp8].enabled = true;
+                    build_int = build_int & 0xFFFFF;
+                    if (build_int > 1000000) build_int = 1000000;
+                    settings.extBuses[temp8].speed = build_int;
+                } else settings.extBuses[temp8].enabled = false;
+                setupBus(FIRST_EXT_BUS + temp8);
+                if (step == 11) {
+                    state = IDLE;
+                    //now, write out the new canbus settings to EEPROM
+                    settingsStore.markDirty(STORE_SETTINGS);
+                }
                 break;
             }        
             step++;
             break; 
+        case GET_CENSUS: //one byte, which bus to dump
+            busCensus.sendTableBinary(in_byte);
+            state = IDLE;
+            break;
+        case SET_BUS_LOAD_REPORT: //two bytes, milliseconds between automatic reports (0 = off). Answers right away too
+            if (step == 0) build_int = in_byte;
+            else {
+                build_int |= in_byte << 8;
+                busLoad.setReportInterval(build_int);
+                busLoad.sendStatsBinary();
+                state = IDLE;
+            }
+            step++;
+            break;
+        case SET_SIGNAL_STREAM: //one byte, SIGNAL_STREAM_MODE
+            signalDecoder.setStreamMode(in_byte);
+            state = IDLE;
+            break;
+        case ISOTP_SETUP: //session, bus (0xFF closes the session), tx ID (4), rx ID (4), block size, STmin, flags, pad byte
+            buff[step++] = in_byte;
+            if (step == 14) {
+                uint32_t txId = buff[2] | (buff[3] << 8) | (buff[4] << 16) | (buff[5] << 24);
+                uint32_t rxId = buff[6] | (buff[7] << 8) | (buff[8] << 16) | (buff[9] << 24);
+                if (buff[1] == 0xFF) {
+                    isoTp.closeSession(buff[0]);
+                    isoTp.sendStatus(buff[0], ISOTP_OK);
+                } else if (isoTp.setupSession(buff[0], buff[1], txId, rxId, buff[12], buff[13], buff[10], buff[11]))
+                    isoTp.sendStatus(buff[0], ISOTP_OK);
+                else isoTp.sendStatus(buff[0], ISOTP_INVALID);
+                state = IDLE;
+            }
+            break;
+        case SET_CYCLIC: //index, bus (0xFF clears), ID (4, bit 31 = extended), period ms (2), length, data (8), 3 ops of opcode, byte, value, param
+            buff[step++] = in_byte;
+            if (step == 29) {
+                CYCLIC_MSG msg;
+                bool ok;
+                if (buff[1] == 0xFF) {
+                    ok = buff[0] < MAX_CYCLIC;
+                    cyclicTx.clearMessage(buff[0]);
+                    cyclicTx.compile();
+                } else {
+                    memset(&msg, 0, sizeof(msg));
+                    msg.bus = buff[1];
+                    msg.id = buff[2] | (buff[3] << 8) | (buff[4] << 16) | (buff[5] << 24);
+                    msg.extended = (msg.id & 1 << 31) ? 1 : 0;
+                    msg.id &= 0x7FFFFFFF;
+                    msg.period = buff[6] | (buff[7] << 8);
+                    msg.length = buff[8];
+                    memcpy(msg.data, &buff[9], 8);
+                    for (int c = 0; c < CYCLIC_OPS; c++) {
+                        if (buff[17 + c * 4] == RW_NOP) continue;
+                        memcpy(&msg.ops[msg.numOps++], &buff[17 + c * 4], 4);
+                    }
+                    ok = cyclicTx.setMessage(buff[0], msg);
+                }
+                if (ok) cyclicTx.saveTable(buff[0]);
+                uint8_t reply[4] = {0xF1, PROTO_SET_CYCLIC, buff[0], (uint8_t)ok};
+                sendBytesToUSB(reply, 4);
+                state = IDLE;
+            }
+            break;
+        case REPLAY_START: //flags. Answered with PROTO_REPLAY_CREDIT for the whole queue
+            replay.start(in_byte);
+            state = IDLE;
+            break;
+        case REPLAY_FRAME: //time us from replay start (4), bus, ID (4, bit 31 = extended), length, data. Uses one credit
+            buff[step++] = in_byte;
+            if (step == 10 && buff[9] > 8) buff[9] = 8;
+            if (step >= 10 && step == 10 + buff[9]) {
+                build_out_frame.id = buff[5] | (buff[6] << 8) | (buff[7] << 16) | (buff[8] << 24);
+                build_out_frame.extended = (build_out_frame.id & 1 << 31) ? true : false;
+                build_out_frame.id &= 0x7FFFFFFF;
+                build_out_frame.rtr = 0;
+                build_out_frame.length = buff[9];
+                memcpy(build_out_frame.data.bytes, &buff[10], buff[9]);
+                replay.queueFrame(buff[0] | (buff[1] << 8) | (buff[2] << 16) | (buff[3] << 24), buff[4], build_out_frame);
+                state = IDLE;
+            }
+            break;
+        case REPLAY_END: //0 = finish what is queued, 1 = abort. The summary comes back as PROTO_REPLAY_END
+            if (in_byte == 1) replay.stop();
+            else replay.finish();
+            state = IDLE;
+            break;
+        case TIME_SYNC64: //sequence number to echo back
+            timebase.sendSync(in_byte, syncTicks);
+            state = IDLE;
+            break;
+        case SD_REPLAY: //format (0 stops), loops (2, 0 = forever), speed % (2, 0 = untimed), bus map (3, 0xFF drops), name length, name
+            buff[step++] = in_byte;
+            if (step == 1 && buff[0] == 0) {
+                sdReplay.stop();
+                state = IDLE;
+            } else if (step == 9 && buff[8] > SDREPLAY_NAME) {
+                state = IDLE;
+            } else if (step > 8 && step == 9 + buff[8]) {
+                char filename[SDREPLAY_NAME + 1];
+                memcpy(filename, &buff[9], buff[8]);
+                filename[buff[8]] = 0;
+                bool ok = sdReplay.start(filename, (FILEOUTPUTTYPE)buff[0], buff[1] | (buff[2] << 8), buff[3] | (buff[4] << 8), &buff[5]);
+                uint8_t reply[3] = {0xF1, PROTO_SD_REPLAY, (uint8_t)ok};
+                sendBytesToUSB(reply, 3);
+                state = IDLE;
+            }
+            break;
+        case ADC_STREAM: //input mask (0 stops), decimation, outputs
+            buff[step++] = in_byte;
+            if (step == 1 && buff[0] == 0) {
+                adcStream.stop();
+                state = IDLE;
+            } else if (step == 3) {
+                bool ok = adcStream.start(buff[0], buff[1], buff[2]);
+                uint8_t reply[3] = {0xF1, PROTO_ADC_STREAM, (uint8_t)ok};
+                sendBytesToUSB(reply, 3);
+                state = IDLE;
+            }
+            break;
+        case ISOTP_SEND: //session, length (2 bytes), then the PDU. Answered with PROTO_ISOTP_STATUS when done
+            if (step == 0) out_bus = in_byte;
+            else if (step == 1) build_int = in_byte;
+            else if (step == 2) {
+                build_int |= in_byte << 8;
+                isoTpLoading = build_int <= ISOTP_MAX_PDU && isoTp.startLoad(out_bus, build_int);
+                if (build_int == 0) {
+                    isoTp.sendStatus(out_bus, ISOTP_INVALID);
+                    state = IDLE;
+                }
+            } else { //a PDU that can't be sent is still read to the end so its bytes aren't taken for commands
+                if (isoTpLoading) isoTp.loadByte(out_bus, step - 3, in_byte);
+                if (step - 2 == (int)build_int) {
+                    if (build_int > ISOTP_MAX_PDU) isoTp.sendStatus(out_bus, ISOTP_INVALID);
+                    else if (isoTpLoading) isoTp.startTransmit(out_bus);
+                    else isoTp.sendStatus(out_bus, ISOTP_BUSY);
+                    state = IDLE;
+                }
+            }
+            step++;
+            break;
+        case CONFIG_GET: //record, tag count (0 for all of them), then the tags
+            if (step == 0) out_bus = in_byte;
+            else if (step == 1) build_int = in_byte;
+            else if (step - 2 < CONFIG_MAX_TAGS) buff[step - 2] = in_byte;
+            step++;
+            if (step == (int)build_int + 2) {
+                binaryConfig.sendFields(out_bus, buff, (build_int > CONFIG_MAX_TAGS) ? CONFIG_MAX_TAGS : build_int);
+                state = IDLE;
+            }
+            break;
+        case CONFIG_SET: //record, length (2 bytes), then the fields. Nothing changes unless every field is good
+            if (step == 0) out_bus = in_byte;
+            else if (step == 1) build_int = in_byte;
+            else if (step == 2) build_int |= in_byte << 8;
+            else if (configBuffer) configBuffer[step - 3] = in_byte;
+            if (step == 2) configBuffer = binaryConfig.getBuffer(build_int);
+            step++;
+            if (step > 2 && step - 3 == (int)build_int) {
+                if (configBuffer) binaryConfig.set(out_bus, build_int);
+                else binaryConfig.sendStatus(out_bus, CONFIG_BAD_LENGTH, 0); //too long, the bytes were thrown away
+                state = IDLE;
+            }
+            break;
+        default:
+            break;
         }
     }
     Logger::loop();
+    settingsStore.loop();
+    timebase.loop();
+    timeSync.loop();
+    edgeCapture.loop();
+    busCensus.loop();
+    busLoad.loop();
+    busMonitor.loop();
+    signalDecoder.loop();
+    triggerEngine.loop();
+    isoTp.loop();
+    responder.loop();
+    cyclicTx.loop();
+    sdReplay.loop();
+    replay.loop();
+    adcStream.loop();
     //this should still be here. It checks for a flag set during an interrupt
-    //sys_io_adc_poll();
+    sys_io_adc_poll();
 }
 
@@ -0,0 +1,309 @@
+/*
+ * GatewayRules.cpp
+ *
+ * Per ID rewrite programs for the CAN0 <-> CAN1 gateway
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#include "GatewayRules.h"
+#include "config.h"
+#include "sys_io.h"
+#include "Logger.h"
+#include "SettingsStore.h"
+#include <due_wire.h>
+#include <Wire_EEPROM.h>
+
+static const char *opNames[] = {"NOP", "SET", "AND", "OR", "XOR", "CNT", "CHK", "DROP"};
+
+GatewayRules::GatewayRules()
+{
+    for (int i = 0; i < MAX_REWRITE_RULES; i++) {
+        table.rules[i].enabled = 0;
+        table.rules[i].numOps = 0;
+    }
+    resetStats();
+}
+
+void GatewayRules::loadTable()
+{
+    settingsStore.attach(STORE_GWRULES, &table);
+    if (!settingsStore.isDirty(STORE_GWRULES)) { //otherwise what is in RAM is newer than anything stored
+        memset(&table, 0, sizeof(table));
+        if (!settingsStore.load(STORE_GWRULES)) { //from before the tables were records, or a blank EEPROM
+            if (settingsStore.tablePageUsed(EEPROM_PAGE_GWRULES)) EEPROM.read(EEPROM_PAGE_GWRULES, table);
+            if (table.rules[0].enabled == 255) {
+                Logger::console("Resetting gateway rewrite rules to defaults");
+                for (int i = 0; i < MAX_REWRITE_RULES; i++) clearRule(i);
+            }
+            saveTable();
+        }
+    }
+    compile();
+}
+
+void GatewayRules::saveTable()
+{
+    settingsStore.markDirty(STORE_GWRULES);
+}
+
+//Build the ID index from the rule table. Rules are matched by exact ID so a frame
+//that has no rule costs a single hash probe on the gateway path.
+void GatewayRules::compile()
+{
+    index.clear();
+    for (int i = 0; i < MAX_REWRITE_RULES; i++) {
+        counters[i] = 0;
+        if (table.rules[i].enabled != 1) continue;
+        if (!index.add(table.rules[i].srcBus, table.rules[i].id, i)) {
+            Logger::error("Could not index gateway rule %i", i);
+        }
+    }
+}
+
+void GatewayRules::clearRule(uint8_t which)
+{
+    if (which >= MAX_REWRITE_RULES) return;
+    table.rules[which].id = 0;
+    table.rules[which].srcBus = 0;
+    table.rules[which].enabled = 0;
+    table.rules[which].numOps = 0;
+    table.rules[which].reserved = 0;
+    for (int c = 0; c < MAX_REWRITE_OPS; c++) {
+        table.rules[which].ops[c].opcode = RW_NOP;
+        table.rules[which].ops[c].byteNum = 0;
+        table.rules[which].ops[c].value = 0;
+        table.rules[which].ops[c].param = 0;
+    }
+}
+
+/*
+Rule definitions come from the serial console in the form
+ID,BUS,OP:BYTE:VALUE[:PARAM],OP:BYTE:VALUE[:PARAM],...
+For example: 0x120,0,SET:2:0xFF,CNT:6:0x0F,CHK:7:3
+*/
+bool GatewayRules::setRule(uint8_t which, char *definition)
+{
+    REWRITE_RULE rule;
+    char *tok;
+
+    if (which >= MAX_REWRITE_RULES) return false;
+
+    tok = strtok(definition, ",");
+    if (!tok) return false;
+    rule.id = strtoul(tok, NULL, 0);
+    tok = strtok(NULL, ",");
+    if (!tok) return false;
+    rule.srcBus = strtol(tok, NULL, 0);
+    if (rule.srcBus > 1) return false;
+    rule.numOps = 0;
+    rule.reserved = 0;
+
+    while ((tok = strtok(NULL, ",")) != NULL) {
+        if (rule.numOps >= MAX_REWRITE_OPS) return false;
+        if (!parseOp(tok, rule.ops[rule.numOps])) return false;
+        rule.numOps++;
+    }
+
+    for (int c = rule.numOps; c < MAX_REWRITE_OPS; c++) {
+        rule.ops[c].opcode = RW_NOP;
+        rule.ops[c].byteNum = 0;
+        rule.ops[c].value = 0;
+        rule.ops[c].param = 0;
+    }
+    rule.enabled = 1;
+    table.rules[which] = rule;
+    compile();
+    return true;
+}
+
+//OP:BYTE:VALUE[:PARAM] as used by the GWRULE command
+bool GatewayRules::parseOp(char *str, REWRITE_OP &op)
+{
+    char *ptr = strchr(str, ':');
+    if (ptr) *ptr++ = 0;
+    op.opcode = RW_NOP;
+    for (int c = 0; c < 8; c++) {
+        if (!strcasecmp(str, opNames[c])) op.opcode = c;
+    }
+    if (op.opcode == RW_NOP) return false;
+    op.byteNum = 0;
+    op.value = 0;
+    op.param = 0;
+    if (ptr) op.byteNum = strtol(ptr, &ptr, 0);
+    if (ptr && *ptr == ':') op.value = strtol(ptr + 1, &ptr, 0);
+    if (ptr && *ptr == ':') op.param = strtol(ptr + 1, &ptr, 0);
+    return op.byteNum <= 7;
+}
+
+int GatewayRules::printOp(char *buff, REWRITE_OP &op)
+{
+    return sprintf(buff, "%s:%i:0x%x:%i", opNames[op.opcode & 7], op.byteNum, op.value, op.param);
+}
+
+uint8_t GatewayRules::crc8(uint8_t crc, uint8_t data, uint8_t poly)
+{
+    crc ^= data;
+    for (int b = 0; b < 8; b++) {
+        if (crc & 0x80) crc = (crc << 1) ^ poly;
+        else crc = crc << 1;
+    }
+    return crc;
+}
+
+uint8_t GatewayRules::calcChecksum(CAN_FRAME &frame, uint8_t type, uint8_t byteNum, uint8_t seed)
+{
+    uint8_t result = seed;
+    int c;
+
+    switch (type) {
+    case CSUM_XOR:
+        for (c = 0; c < frame.length; c++) if (c != byteNum) result ^= frame.data.bytes[c];
+        break;
+    case CSUM_SUM_ID:
+        result += (frame.id & 0xFF) + ((frame.id >> 8) & 0xFF) + ((frame.id >> 16) & 0xFF) + ((frame.id >> 24) & 0xFF);
+        result += frame.length;
+    //fall through - the data bytes are added too
+    case CSUM_SUM:
+        for (c = 0; c < frame.length; c++) if (c != byteNum) result += frame.data.bytes[c];
+        break;
+    case CSUM_CRC8_J1850:
+        result = 0xFF;
+        if (seed) result = crc8(result, seed, 0x1D);
+        for (c = 0; c < frame.length; c++) if (c != byteNum) result = crc8(result, frame.data.bytes[c], 0x1D);
+        result ^= 0xFF;
+        break;
+    case CSUM_CRC8_H2F:
+        result = 0xFF;
+        for (c = 0; c < frame.length; c++) if (c != byteNum) result = crc8(result, frame.data.bytes[c], 0x2F);
+        if (seed) result = crc8(result, seed, 0x2F);
+        result ^= 0xFF;
+        break;
+    default:
+        result = frame.data.bytes[byteNum & 7];
+        break;
+    }
+    return result;
+}
+
+//Runs a rewrite program against a frame. The work done is bounded by numOps * 8 bytes
+//so the worst case added latency doesn't depend on the traffic. Returns false if the frame should be dropped
+bool GatewayRules::runOps(CAN_FRAME &frame, REWRITE_OP *ops, uint8_t numOps, uint8_t &counter)
+{
+    uint8_t *b;
+    uint8_t shift;
+
+    if (numOps > MAX_REWRITE_OPS) numOps = MAX_REWRITE_OPS;
+    for (int c = 0; c < numOps; c++) {
+        b = &frame.data.bytes[ops[c].byteNum & 7];
+        switch (ops[c].opcode) {
+        case RW_SET:
+            *b = ops[c].value;
+            break;
+        case RW_AND:
+            *b &= ops[c].value;
+            break;
+        case RW_OR:
+            *b |= ops[c].value;
+            break;
+        case RW_XOR:
+            *b ^= ops[c].value;
+            break;
+        case RW_COUNTER:
+            if (ops[c].value == 0) break;
+            shift = __builtin_ctz(ops[c].value);
+            counter++;
+            *b = (*b & ~ops[c].value) | ((counter << shift) & ops[c].value);
+            break;
+        case RW_CHECKSUM:
+            *b = calcChecksum(frame, ops[c].value, ops[c].byteNum & 7, ops[c].param);
+            break;
+        case RW_DROP:
+            return false;
+        }
+    }
+    return true;
+}
+
+bool GatewayRules::processFrame(CAN_FRAME &frame, uint8_t srcBus)
+{
+    framesSeen++;
+    uint32_t startCycles = getCycleCount();
+    uint32_t slots = index.lookup(srcBus, frame.id);
+    bool forward = true;
+
+    if (slots) {
+        //only the lowest numbered matching rule runs. This keeps the worst case to one program per frame
+        int which = __builtin_ctz(slots);
+        hitCount[which]++;
+        forward = runOps(frame, table.rules[which].ops, table.rules[which].numOps, counters[which]);
+        if (forward) framesRewritten++;
+        else framesDropped++;
+    }
+
+    uint32_t cycles = getCycleCount() - startCycles;
+    totalCycles += cycles;
+    if (cycles > maxCycles) maxCycles = cycles;
+    return forward;
+}
+
+void GatewayRules::resetStats()
+{
+    framesSeen = 0;
+    framesRewritten = 0;
+    framesDropped = 0;
+    totalCycles = 0;
+    maxCycles = 0;
+    for (int i = 0; i < MAX_REWRITE_RULES; i++) hitCount[i] = 0;
+}
+
+void GatewayRules::printRules()
+{
+    char buff[24 + MAX_REWRITE_OPS * 20]; //GWRULE7=0x1fffffff,1 then up to ",DROP:255:0xff:255" for each op
+    char *ptr;
+    for (int i = 0; i < MAX_REWRITE_RULES; i++) {
+        REWRITE_RULE &rule = table.rules[i];
+        if (rule.enabled != 1) continue;
+        ptr = buff;
+        ptr += sprintf(ptr, "GWRULE%i=0x%x,%i", i, (unsigned int)rule.id, rule.srcBus);
+        for (int c = 0; c < rule.numOps && c < MAX_REWRITE_OPS; c++) {
+            *ptr++ = ',';
+            ptr += printOp(ptr, rule.ops[c]);
+        }
+        Logger::console(buff);
+    }
+}
+
+void GatewayRules::printStats()
+{
+    uint32_t cyclesPerMicro = SystemCoreClock / 1000000;
+    uint32_t avgCycles = 0;
+    if (framesSeen > 0) avgCycles = totalCycles / framesSeen;
+
+    Logger::console("Gateway frames: %i rewritten: %i dropped: %i", framesSeen, framesRewritten, framesDropped);
+    Logger::console("Rule processing avg: %i ns max: %i ns (%i cycles)", avgCycles * 1000 / cyclesPerMicro,
+                    maxCycles * 1000 / cyclesPerMicro, maxCycles);
+    for (int i = 0; i < MAX_REWRITE_RULES; i++) {
+        if (table.rules[i].enabled == 1) Logger::console("Rule %i hits: %i", i, hitCount[i]);
+    }
+}
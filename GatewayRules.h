@@ -0,0 +1,117 @@
+/*
+ * GatewayRules.h
+ *
+ * Payload rewriting for frames passed between CAN0 and CAN1 by the gateway.
+ * Each rule is a tiny program of byte operations that is run against frames
+ * with a given ID coming from a given bus before they're forwarded.
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#ifndef GATEWAYRULES_H_
+#define GATEWAYRULES_H_
+
+#include <Arduino.h>
+#include <due_can.h>
+#include "IDIndex.h"
+
+#define MAX_REWRITE_RULES   8
+#define MAX_REWRITE_OPS     5
+
+enum REWRITE_OPCODE {
+    RW_NOP = 0,
+    RW_SET = 1,      //byte = value
+    RW_AND = 2,      //byte &= value
+    RW_OR = 3,       //byte |= value
+    RW_XOR = 4,      //byte ^= value
+    RW_COUNTER = 5,  //value is a bit mask within the byte. Bits under the mask get a rolling counter owned by the rule
+    RW_CHECKSUM = 6, //value is a CHECKSUM_TYPE, param is a seed. Computed over all other bytes of the frame
+    RW_DROP = 7      //don't forward the frame at all
+};
+
+enum CHECKSUM_TYPE {
+    CSUM_XOR = 0,        //XOR of all bytes then XOR seed
+    CSUM_SUM = 1,        //8 bit sum of all bytes plus seed
+    CSUM_SUM_ID = 2,     //8 bit sum of ID low + ID high + length + all bytes plus seed (Toyota, Honda style)
+    CSUM_CRC8_J1850 = 3, //CRC8 poly 0x1D, init 0xFF, final XOR 0xFF (AUTOSAR E2E profile 1). Nonzero seed is fed in first as data ID
+    CSUM_CRC8_H2F = 4    //CRC8 poly 0x2F, init 0xFF, final XOR 0xFF (AUTOSAR CRC8H2F). Nonzero seed is fed in last as magic byte
+};
+
+struct REWRITE_OP { //4 bytes
+    uint8_t opcode;
+    uint8_t byteNum;
+    uint8_t value;
+    uint8_t param;
+};
+
+struct REWRITE_RULE { //28 bytes
+    uint32_t id;
+    uint8_t srcBus; //bus the frame arrives on. 0 = CAN0 -> CAN1, 1 = CAN1 -> CAN0
+    uint8_t enabled; //255 here means the EEPROM page was never initialized
+    uint8_t numOps;
+    uint8_t reserved;
+    REWRITE_OP ops[MAX_REWRITE_OPS];
+};
+
+struct REWRITE_TABLE { //SettingsStore record STORE_GWRULES, a field per rule
+    REWRITE_RULE rules[MAX_REWRITE_RULES];
+};
+
+class GatewayRules
+{
+public:
+    GatewayRules();
+    void loadTable();
+    void saveTable();
+    void compile();
+    bool setRule(uint8_t which, char *definition);
+    void clearRule(uint8_t which);
+    void printRules();
+    void printStats();
+    void resetStats();
+    bool processFrame(CAN_FRAME &frame, uint8_t srcBus); //returns false if the frame should be dropped
+
+    //these don't depend on the table so other parts of the firmware can use them too
+    static uint8_t calcChecksum(CAN_FRAME &frame, uint8_t type, uint8_t byteNum, uint8_t seed);
+    static bool runOps(CAN_FRAME &frame, REWRITE_OP *ops, uint8_t numOps, uint8_t &counter);
+    static bool parseOp(char *str, REWRITE_OP &op);
+    static int printOp(char *buff, REWRITE_OP &op); //returns characters written like sprintf
+
+    REWRITE_TABLE table;
+
+private:
+    IDIndex index;
+    uint8_t counters[MAX_REWRITE_RULES];
+    uint32_t hitCount[MAX_REWRITE_RULES];
+    uint32_t framesSeen;
+    uint32_t framesRewritten;
+    uint32_t framesDropped;
+    uint32_t totalCycles;
+    uint32_t maxCycles;
+
+    static uint8_t crc8(uint8_t crc, uint8_t data, uint8_t poly);
+};
+
+extern GatewayRules gatewayRules;
+
+#endif /* GATEWAYRULES_H_ */
@@ -0,0 +1,102 @@
+/*
+ * IDIndex.cpp
+ *
+ * Open addressing hash from bus/ID to a bitfield of interested table slots
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#include "IDIndex.h"
+
+IDIndex::IDIndex()
+{
+    clear();
+}
+
+void IDIndex::clear()
+{
+    for (int i = 0; i < IDINDEX_SIZE; i++) {
+        table[i].used = false;
+        table[i].slots = 0;
+    }
+    for (int b = 0; b < IDINDEX_BUSES; b++) wildcards[b] = 0;
+    numUsed = 0;
+}
+
+//Fibonacci hashing. IDs on a real bus tend to be clustered so a plain modulo would collide a lot
+uint32_t IDIndex::hash(uint8_t bus, uint32_t id)
+{
+    return ((id * 2654435761u) >> 26 ^ bus) & (IDINDEX_SIZE - 1);
+}
+
+bool IDIndex::add(uint8_t bus, uint32_t id, uint8_t slot)
+{
+    if (slot > 31 || bus >= IDINDEX_BUSES) return false;
+    uint32_t pos = hash(bus, id);
+    for (int probe = 0; probe < IDINDEX_SIZE; probe++) {
+        INDEX_ENTRY &entry = table[pos];
+        if (entry.used && entry.bus == bus && entry.id == id) {
+            entry.slots |= (1ul << slot);
+            return true;
+        }
+        if (!entry.used) {
+            //never fill the table completely or lookups of unknown IDs would never terminate early
+            if (numUsed >= IDINDEX_SIZE - 1) return false;
+            entry.used = true;
+            entry.bus = bus;
+            entry.id = id;
+            entry.slots = (1ul << slot);
+            numUsed++;
+            return true;
+        }
+        pos = (pos + 1) & (IDINDEX_SIZE - 1);
+    }
+    return false;
+}
+
+void IDIndex::addWildcard(uint8_t bus, uint8_t slot)
+{
+    if (slot > 31 || bus >= IDINDEX_BUSES) return;
+    wildcards[bus] |= (1ul << slot);
+}
+
+uint32_t IDIndex::lookup(uint8_t bus, uint32_t id)
+{
+    if (bus >= IDINDEX_BUSES) return 0;
+    uint32_t result = wildcards[bus];
+    if (numUsed == 0) return result;
+
+    uint32_t pos = hash(bus, id);
+    while (table[pos].used) {
+        if (table[pos].id == id && table[pos].bus == bus) return result | table[pos].slots;
+        pos = (pos + 1) & (IDINDEX_SIZE - 1);
+    }
+    return result;
+}
+
+boolean IDIndex::isEmpty()
+{
+    if (numUsed > 0) return false;
+    for (int b = 0; b < IDINDEX_BUSES; b++) if (wildcards[b]) return false;
+    return true;
+}
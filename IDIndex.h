@@ -0,0 +1,66 @@
+/*
+ * IDIndex.h
+ *
+ * Small fixed size hash index used to go from a (bus, frame ID) pair to the set of
+ * table slots (rules, signals, etc) which are interested in that frame. Frames that
+ * nobody cares about cost a single probe.
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#ifndef IDINDEX_H_
+#define IDINDEX_H_
+
+#include <Arduino.h>
+#include "config.h"
+
+//must be a power of two. Each table using an index can have at most 32 slots
+//because the slots for an ID are returned as a bitfield.
+#define IDINDEX_SIZE    64
+#define IDINDEX_BUSES   MAX_BUSES
+
+class IDIndex
+{
+public:
+    IDIndex();
+    void clear();
+    bool add(uint8_t bus, uint32_t id, uint8_t slot); //exact ID match
+    void addWildcard(uint8_t bus, uint8_t slot); //slot must be checked against every frame on this bus
+    uint32_t lookup(uint8_t bus, uint32_t id); //returns bitfield of candidate slots
+    boolean isEmpty();
+
+private:
+    struct INDEX_ENTRY {
+        uint32_t id;
+        uint32_t slots;
+        uint8_t bus;
+        boolean used;
+    };
+    INDEX_ENTRY table[IDINDEX_SIZE];
+    uint32_t wildcards[IDINDEX_BUSES];
+    int numUsed;
+
+    uint32_t hash(uint8_t bus, uint32_t id);
+};
+
+#endif /* IDINDEX_H_ */
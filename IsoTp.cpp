@@ -0,0 +1,395 @@
+/*
+ * IsoTp.cpp
+ *
+ * ISO-TP segmentation, reassembly and flow control
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#include "IsoTp.h"
+#include "GVRET.h"
+#include "config.h"
+#include "Logger.h"
+#include "Timebase.h"
+
+//protocol control information, high nibble of the first byte
+#define PCI_SINGLE      0
+#define PCI_FIRST       1
+#define PCI_CONSECUTIVE 2
+#define PCI_FLOW        3
+
+#define FC_CTS          0
+#define FC_WAIT         1
+#define FC_OVERFLOW     2
+
+static const char *stateNames[] = {"closed", "idle", "receiving", "waiting for flow control", "sending", "loading"};
+
+IsoTp::IsoTp(uint8_t *pduBuffer)
+{
+    pdu = pduBuffer;
+    bufferOwner = ISOTP_NO_OWNER;
+    for (int i = 0; i < ISOTP_SESSIONS; i++) {
+        sessions[i].state = ISOTP_CLOSED;
+        sessions[i].pdusSent = 0;
+        sessions[i].pdusReceived = 0;
+        sessions[i].errors = 0;
+    }
+}
+
+bool IsoTp::setupSession(uint8_t which, uint8_t bus, uint32_t txId, uint32_t rxId, uint8_t flags, uint8_t padByte,
+                         uint8_t blockSize, uint8_t stMin)
+{
+    if (which >= ISOTP_SESSIONS || bus >= MAX_BUSES) return false;
+    ISOTP_SESSION &session = sessions[which];
+    session.bus = bus;
+    session.txId = txId;
+    session.rxId = rxId;
+    session.flags = flags;
+    session.padByte = padByte;
+    session.blockSize = blockSize;
+    session.stMin = stMin;
+    session.pdusSent = 0;
+    session.pdusReceived = 0;
+    session.errors = 0;
+    session.state = ISOTP_IDLE;
+    return true;
+}
+
+void IsoTp::closeSession(uint8_t which)
+{
+    if (which >= ISOTP_SESSIONS) return;
+    sessions[which].state = ISOTP_CLOSED;
+    releaseBuffer(which);
+}
+
+bool IsoTp::claimBuffer(uint8_t which)
+{
+    if (bufferOwner != ISOTP_NO_OWNER && bufferOwner != which) return false;
+    bufferOwner = which;
+    return true;
+}
+
+void IsoTp::releaseBuffer(uint8_t which)
+{
+    if (bufferOwner == which) bufferOwner = ISOTP_NO_OWNER;
+}
+
+//STmin is 0 - 127 ms or 100 - 900 us for 0xF1 - 0xF9. Anything else is reserved and means the maximum
+uint32_t IsoTp::decodeStMin(uint8_t stMin)
+{
+    if (stMin <= 0x7F) return stMin * 1000ul;
+    if (stMin >= 0xF1 && stMin <= 0xF9) return (stMin - 0xF0) * 100ul;
+    return 127000ul;
+}
+
+bool IsoTp::sendFrame(ISOTP_SESSION &session, uint8_t *data, uint8_t length)
+{
+    CAN_FRAME frame;
+    frame.id = session.txId;
+    frame.extended = (session.flags & ISOTP_EXTENDED) ? 1 : 0;
+    frame.rtr = 0;
+    for (int c = 0; c < length; c++) frame.data.bytes[c] = data[c];
+    if (session.flags & ISOTP_PAD) {
+        for (int c = length; c < 8; c++) frame.data.bytes[c] = session.padByte;
+        length = 8;
+    }
+    frame.length = length;
+    return sendFrameOnBus(frame, session.bus, TX_PRIO_HIGH);
+}
+
+void IsoTp::sendFlowControl(ISOTP_SESSION &session, uint8_t status)
+{
+    uint8_t data[3];
+    data[0] = (PCI_FLOW << 4) | status;
+    data[1] = session.blockSize;
+    data[2] = session.stMin;
+    sendFrame(session, data, 3);
+}
+
+//Hands a PDU to the host. Any PDU can be up to 4095 bytes so it goes out in one piece:
+//0xF1, PROTO_ISOTP_RECEIVE, session, length (2 bytes), data
+void IsoTp::deliverPdu(uint8_t which, uint8_t *data)
+{
+    ISOTP_SESSION &session = sessions[which];
+    uint8_t buff[5];
+
+    session.pdusReceived++;
+    if (!settings.useBinarySerialComm || SysSettings.lawicelMode) return;
+    buff[0] = 0xF1;
+    buff[1] = PROTO_ISOTP_RECEIVE;
+    buff[2] = which;
+    buff[3] = session.length & 0xFF;
+    buff[4] = session.length >> 8;
+    sendBytesToUSB(buff, 5);
+    sendBytesToUSB(data, session.length);
+}
+
+void IsoTp::finish(uint8_t which, uint8_t result)
+{
+    ISOTP_SESSION &session = sessions[which];
+
+    session.state = ISOTP_IDLE;
+    releaseBuffer(which);
+    if (result != ISOTP_OK) {
+        session.errors++;
+        Logger::debug("ISO-TP session %i error %i", which, result);
+    }
+    sendStatus(which, result);
+}
+
+//0xF1, PROTO_ISOTP_STATUS, session, ISOTP_RESULT. Sent when a transmit finishes or anything goes wrong
+void IsoTp::sendStatus(uint8_t which, uint8_t result)
+{
+    uint8_t buff[4];
+
+    if (!settings.useBinarySerialComm || SysSettings.lawicelMode) return;
+    buff[0] = 0xF1;
+    buff[1] = PROTO_ISOTP_STATUS;
+    buff[2] = which;
+    buff[3] = result;
+    sendBytesToUSB(buff, 4);
+}
+
+//The host hands over a PDU a byte at a time with loadByte() then calls startTransmit()
+bool IsoTp::startLoad(uint8_t which, uint16_t length)
+{
+    if (which >= ISOTP_SESSIONS) return false;
+    ISOTP_SESSION &session = sessions[which];
+    if (session.state != ISOTP_IDLE || length == 0 || length > ISOTP_MAX_PDU) return false;
+    if (!claimBuffer(which)) return false;
+    session.length = length;
+    session.timer = millis();
+    session.state = ISOTP_TX_LOAD;
+    return true;
+}
+
+//bytes that come in after the load timed out are dropped, the buffer may belong to another session by then
+void IsoTp::loadByte(uint8_t which, uint16_t pos, uint8_t value)
+{
+    if (which >= ISOTP_SESSIONS || sessions[which].state != ISOTP_TX_LOAD || pos >= sessions[which].length) return;
+    pdu[pos] = value;
+}
+
+bool IsoTp::startTransmit(uint8_t which)
+{
+    uint8_t data[8];
+
+    if (which >= ISOTP_SESSIONS) return false;
+    ISOTP_SESSION &session = sessions[which];
+    if (session.state != ISOTP_TX_LOAD) return false; //the load timed out and the host has been told
+
+    uint16_t length = session.length;
+    if (length <= 7) {
+        data[0] = (PCI_SINGLE << 4) | length;
+        memcpy(&data[1], pdu, length);
+        if (!sendFrame(session, data, length + 1)) {
+            finish(which, ISOTP_BUSY);
+            return false;
+        }
+        session.pdusSent++;
+        finish(which, ISOTP_OK);
+        return true;
+    }
+
+    data[0] = (PCI_FIRST << 4) | (length >> 8);
+    data[1] = length & 0xFF;
+    memcpy(&data[2], pdu, 6);
+    if (!sendFrame(session, data, 8)) {
+        finish(which, ISOTP_BUSY);
+        return false;
+    }
+    session.pos = 6;
+    session.seq = 1;
+    session.waits = 0;
+    session.timer = millis();
+    session.state = ISOTP_TX_WAIT_FC;
+    return true;
+}
+
+bool IsoTp::sendConsecutive(ISOTP_SESSION &session)
+{
+    uint8_t data[8];
+    int count = session.length - session.pos;
+    if (count > 7) count = 7;
+
+    data[0] = (PCI_CONSECUTIVE << 4) | session.seq;
+    memcpy(&data[1], &pdu[session.pos], count);
+    if (!sendFrame(session, data, count + 1)) return false; //TX buffers full, try again next loop
+    session.pos += count;
+    session.seq = (session.seq + 1) & 0xF;
+    session.lastCF = timebase.micros32();
+    session.timer = millis();
+    return true;
+}
+
+/*
+Frames for a session are handled right in the receive path so flow control goes back to the
+ECU within microseconds of its first frame, not after a trip through the host.
+*/
+void IsoTp::processFrame(CAN_FRAME &frame, uint8_t bus)
+{
+    for (int i = 0; i < ISOTP_SESSIONS; i++) {
+        ISOTP_SESSION &session = sessions[i];
+        if (session.state == ISOTP_CLOSED || session.bus != bus || session.rxId != frame.id) continue;
+        if (frame.extended != ((session.flags & ISOTP_EXTENDED) ? 1 : 0)) continue;
+        if (frame.length > 0) handleRx(i, frame);
+    }
+}
+
+void IsoTp::handleRx(uint8_t which, CAN_FRAME &frame)
+{
+    ISOTP_SESSION &session = sessions[which];
+    uint8_t *d = frame.data.bytes;
+    int count;
+
+    switch (d[0] >> 4) {
+    case PCI_SINGLE:
+        count = d[0] & 0xF;
+        if (count == 0 || count > 7 || count > frame.length - 1) return;
+        if (session.state != ISOTP_IDLE && session.state != ISOTP_RX) return; //the buffer belongs to a transmit
+        if (session.state == ISOTP_RX) finish(which, ISOTP_UNEXPECTED);
+        session.length = count;
+        deliverPdu(which, &d[1]);
+        break;
+
+    case PCI_FIRST:
+        if (frame.length < 8) return;
+        if (session.state != ISOTP_IDLE && session.state != ISOTP_RX) return;
+        if (session.state == ISOTP_RX) finish(which, ISOTP_UNEXPECTED);
+        session.length = ((d[0] & 0xF) << 8) | d[1];
+        if (session.length < 8) return;
+        if (!claimBuffer(which)) { //another session has a PDU in flight, tell the sender to give up
+            sendFlowControl(session, FC_OVERFLOW);
+            finish(which, ISOTP_BUSY);
+            return;
+        }
+        memcpy(pdu, &d[2], 6);
+        session.pos = 6;
+        session.seq = 1;
+        session.blockCount = 0;
+        session.timer = millis();
+        session.state = ISOTP_RX;
+        sendFlowControl(session, FC_CTS);
+        break;
+
+    case PCI_CONSECUTIVE:
+        if (session.state != ISOTP_RX) return;
+        if ((d[0] & 0xF) != session.seq) {
+            finish(which, ISOTP_WRONG_SN);
+            return;
+        }
+        count = session.length - session.pos;
+        if (count > 7) count = 7;
+        if (count > frame.length - 1) count = frame.length - 1;
+        memcpy(&pdu[session.pos], &d[1], count);
+        session.pos += count;
+        session.seq = (session.seq + 1) & 0xF;
+        session.timer = millis();
+        if (session.pos >= session.length) {
+            session.state = ISOTP_IDLE;
+            deliverPdu(which, pdu);
+            releaseBuffer(which);
+        } else if (session.blockSize > 0 && ++session.blockCount >= session.blockSize) {
+            session.blockCount = 0;
+            sendFlowControl(session, FC_CTS);
+        }
+        break;
+
+    case PCI_FLOW:
+        if (session.state != ISOTP_TX_WAIT_FC || frame.length < 3) return;
+        switch (d[0] & 0xF) {
+        case FC_CTS:
+            session.remoteBlockSize = d[1];
+            session.remoteStMin = decodeStMin(d[2]);
+            session.blockCount = 0;
+            session.waits = 0;
+            session.lastCF = timebase.micros32() - session.remoteStMin; //first one can go right away
+            session.timer = millis();
+            session.state = ISOTP_TX;
+            break;
+        case FC_WAIT:
+            session.timer = millis();
+            if (++session.waits > ISOTP_MAX_WAITS) finish(which, ISOTP_TIMEOUT_BS);
+            break;
+        case FC_OVERFLOW:
+            finish(which, ISOTP_OVERFLOW);
+            break;
+        default:
+            finish(which, ISOTP_INVALID);
+            break;
+        }
+        break;
+    }
+}
+
+void IsoTp::loop()
+{
+    int burst;
+
+    for (int i = 0; i < ISOTP_SESSIONS; i++) {
+        ISOTP_SESSION &session = sessions[i];
+        switch (session.state) {
+        case ISOTP_TX_LOAD:
+            if (millis() - session.timer > ISOTP_TIMEOUT) finish(i, ISOTP_TIMEOUT_LOAD);
+            break;
+        case ISOTP_RX:
+            if (millis() - session.timer > ISOTP_TIMEOUT) finish(i, ISOTP_TIMEOUT_CR);
+            break;
+        case ISOTP_TX_WAIT_FC:
+            if (millis() - session.timer > ISOTP_TIMEOUT) finish(i, ISOTP_TIMEOUT_BS);
+            break;
+        case ISOTP_TX:
+            //with STmin of 0 keep the transmit buffers topped up, otherwise one frame each time STmin runs out
+            for (burst = 0; burst < ISOTP_BURST; burst++) {
+                if (timebase.micros32() - session.lastCF < session.remoteStMin) break;
+                if (!sendConsecutive(session)) break;
+                if (session.pos >= session.length) {
+                    session.pdusSent++;
+                    finish(i, ISOTP_OK);
+                    break;
+                }
+                if (session.remoteBlockSize > 0 && ++session.blockCount >= session.remoteBlockSize) {
+                    session.timer = millis();
+                    session.state = ISOTP_TX_WAIT_FC;
+                    break;
+                }
+            }
+            if (session.state == ISOTP_TX && millis() - session.timer > ISOTP_TIMEOUT) finish(i, ISOTP_TIMEOUT_BS);
+            break;
+        }
+    }
+}
+
+void IsoTp::printSessions()
+{
+    for (int i = 0; i < ISOTP_SESSIONS; i++) {
+        ISOTP_SESSION &session = sessions[i];
+        if (session.state == ISOTP_CLOSED) {
+            Logger::console("ISO-TP session %i: closed", i);
+            continue;
+        }
+        Logger::console("ISO-TP session %i: bus %i tx 0x%x rx 0x%x BS %i STmin %i - %s. Sent: %i Received: %i Errors: %i", i,
+                        session.bus, session.txId, session.rxId, session.blockSize, session.stMin,
+                        stateNames[session.state], session.pdusSent, session.pdusReceived, session.errors);
+    }
+}
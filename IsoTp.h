@@ -0,0 +1,127 @@
+/*
+ * IsoTp.h
+ *
+ * ISO 15765-2 (ISO-TP) transport on the device. The host hands over or gets back whole
+ * PDUs of up to 4095 bytes while segmentation, flow control and STmin pacing happen here
+ * at bus speed instead of across a USB round trip per frame. Normal addressing only.
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#ifndef ISOTP_H_
+#define ISOTP_H_
+
+#include <Arduino.h>
+#include <due_can.h>
+
+#define ISOTP_SESSIONS      4
+#define ISOTP_MAX_PDU       4095
+#define ISOTP_TIMEOUT       1000 //N_Bs and N_Cr in milliseconds. Also how long the host gets to hand over a PDU
+#define ISOTP_NO_OWNER      0xFF
+#define ISOTP_MAX_WAITS     10 //flow control WAIT frames accepted in a row before giving up
+#define ISOTP_BURST         8 //most consecutive frames queued per loop when STmin is 0
+
+//session flags
+#define ISOTP_PAD           1 //pad every frame out to 8 bytes with padByte
+#define ISOTP_EXTENDED      2 //29 bit IDs
+
+enum ISOTP_STATE {
+    ISOTP_CLOSED = 0,
+    ISOTP_IDLE = 1,
+    ISOTP_RX = 2,         //got a first frame, taking consecutive frames
+    ISOTP_TX_WAIT_FC = 3, //sent a first frame or a full block, waiting on flow control
+    ISOTP_TX = 4,         //sending consecutive frames
+    ISOTP_TX_LOAD = 5     //host is still filling the buffer with a PDU to send
+};
+
+enum ISOTP_RESULT {
+    ISOTP_OK = 0,
+    ISOTP_TIMEOUT_BS = 1, //no flow control from the other side
+    ISOTP_TIMEOUT_CR = 2, //consecutive frames stopped coming
+    ISOTP_WRONG_SN = 3,
+    ISOTP_OVERFLOW = 4,   //receiver said the PDU is too big or we got one that is
+    ISOTP_BUSY = 5,
+    ISOTP_INVALID = 6,
+    ISOTP_UNEXPECTED = 7, //protocol frame that doesn't fit the session state
+    ISOTP_TIMEOUT_LOAD = 8 //the host stopped partway through a PDU to send
+};
+
+struct ISOTP_SESSION {
+    uint8_t state;
+    uint8_t bus;
+    uint8_t flags;
+    uint8_t padByte;
+    uint32_t txId;
+    uint32_t rxId;
+    uint8_t blockSize; //what we ask for when receiving
+    uint8_t stMin;
+    uint8_t remoteBlockSize; //what the other side asked for when we send
+    uint32_t remoteStMin; //in microseconds
+    uint8_t blockCount;
+    uint8_t seq;
+    uint8_t waits;
+    uint16_t length;
+    uint16_t pos;
+    uint32_t timer; //millis of last progress
+    uint32_t lastCF; //micros of the last consecutive frame sent
+    uint32_t pdusSent;
+    uint32_t pdusReceived;
+    uint32_t errors;
+};
+
+class IsoTp
+{
+public:
+    IsoTp(uint8_t *pduBuffer); //ISOTP_MAX_PDU bytes, not touched before a session is set up
+    bool setupSession(uint8_t which, uint8_t bus, uint32_t txId, uint32_t rxId, uint8_t flags, uint8_t padByte,
+                      uint8_t blockSize, uint8_t stMin);
+    void closeSession(uint8_t which);
+    bool startLoad(uint8_t which, uint16_t length); //false if the session or the PDU buffer is busy
+    void loadByte(uint8_t which, uint16_t pos, uint8_t value);
+    bool startTransmit(uint8_t which);
+    void processFrame(CAN_FRAME &frame, uint8_t bus);
+    void loop();
+    void printSessions();
+    void sendStatus(uint8_t which, uint8_t result);
+
+private:
+    ISOTP_SESSION sessions[ISOTP_SESSIONS];
+    //Every session shares one PDU buffer so only one multi frame PDU is in flight at a time.
+    //Single frames go straight through and never need it
+    uint8_t *pdu;
+    uint8_t bufferOwner;
+
+    bool sendFrame(ISOTP_SESSION &session, uint8_t *data, uint8_t length);
+    void sendFlowControl(ISOTP_SESSION &session, uint8_t status);
+    bool sendConsecutive(ISOTP_SESSION &session);
+    void handleRx(uint8_t which, CAN_FRAME &frame);
+    void finish(uint8_t which, uint8_t result);
+    void deliverPdu(uint8_t which, uint8_t *data);
+    bool claimBuffer(uint8_t which);
+    void releaseBuffer(uint8_t which);
+    static uint32_t decodeStMin(uint8_t stMin);
+};
+
+extern IsoTp isoTp;
+
+#endif /* ISOTP_H_ */
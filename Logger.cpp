@@ -27,6 +27,8 @@
 #include "Logger.h"
 #include "config.h"
 #include "sys_io.h"
+#include "GVRET.h"
+#include "SettingsStore.h"
 #include <due_wire.h>
 #include <Wire_EEPROM.h>
 #include <SdFat.h>
@@ -157,13 +159,14 @@ boolean Logger::setupFile()
             filename.concat(settings.fileNum++);
             filename.concat(".");
             filename.concat(settings.fileNameExt);
-            EEPROM.write(EEPROM_PAGE, settings); //save settings to save updated filenum
+            settingsStore.markDirty(STORE_SETTINGS); //save settings to save updated filenum
             fileRef.open(filename.c_str(), O_CREAT | O_TRUNC | O_WRITE);
         }
         if (!fileRef.isOpen()) {
             Logger::error("open failed");
             return false;
         }
+        logFileOpened();
     }
 
     //Before we add the next frame see if the buffer is nearly full. if so flush it first.
@@ -207,7 +210,7 @@ void Logger::file(const char *message, ...)
             }
 
             if (*message == 's') {
-                register char *s = (char *)va_arg(args, int);
+                char *s = va_arg(args, char *);
                 buffPutString(s);
                 continue;
             }
@@ -238,7 +241,7 @@ void Logger::file(const char *message, ...)
             }
 
             if (*message == 'l') {
-                sprintf(buff, "%l", va_arg(args, long));
+                sprintf(buff, "%ld", va_arg(args, long));
                 buffPutString(buff);
                 continue;
             }
@@ -368,6 +371,9 @@ void Logger::log(LogLevel level, const char *format, va_list args)
     case Error:
         SerialUSB.print("ERROR");
         break;
+
+    default:
+        break;
     }
 
     SerialUSB.print(": ");
@@ -409,7 +415,7 @@ void Logger::logMessage(const char *format, va_list args)
             }
 
             if (*format == 's') {
-                register char *s = (char *) va_arg(args, int);
+                char *s = va_arg(args, char *);
                 SerialUSB.print(s);
                 continue;
             }
@@ -0,0 +1,230 @@
+/*
+ * Replay.cpp
+ *
+ * Credit based, device timed log replay
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#include "Replay.h"
+#include "GVRET.h"
+#include "Logger.h"
+#include "Timebase.h"
+
+Replay::Replay(REPLAY_ENTRY *buffer)
+{
+    queue = buffer;
+    active = false;
+    ending = false;
+    started = false;
+    flags = 0;
+    head = 0;
+    tail = 0;
+    inFlight = 0;
+    framesSent = 0;
+    overflows = 0;
+    maxError = 0;
+    totalError = 0;
+    lateFrames = 0;
+}
+
+/*
+Clears out anything left from an earlier run and gives the host the whole queue worth of credits
+*/
+void Replay::start(uint8_t flags)
+{
+    this->flags = flags;
+    head = 0;
+    tail = 0;
+    inFlight = 0;
+    active = true;
+    ending = false;
+    started = false;
+    ungranted = 0;
+    framesSent = 0;
+    overflows = 0;
+    maxError = 0;
+    totalError = 0;
+    lateFrames = 0;
+    if (!(flags & REPLAY_LOCAL)) grant(REPLAY_QUEUE);
+}
+
+void Replay::finish()
+{
+    if (!active) return;
+    ending = true;
+}
+
+void Replay::stop()
+{
+    if (!active) return;
+    tail = head;
+    ending = true;
+}
+
+bool Replay::isActive()
+{
+    return active;
+}
+
+uint16_t Replay::freeSlots()
+{
+    return REPLAY_QUEUE - (uint16_t)(head - tail);
+}
+
+bool Replay::queueFrame(uint32_t time, uint8_t bus, CAN_FRAME &frame)
+{
+    if (!active || ending) return false;
+    if (freeSlots() == 0) {
+        overflows++;
+        return false;
+    }
+    if (!started) {
+        startMicros = timebase.micros32() + REPLAY_LEAD;
+        started = true;
+    }
+    REPLAY_ENTRY &entry = queue[head & (REPLAY_QUEUE - 1)];
+    entry.frame = frame;
+    entry.time = time;
+    entry.bus = bus;
+    head++;
+    return true;
+}
+
+/*
+0xF1, PROTO_REPLAY_CREDIT, credits (2 bytes). The host adds these to what it may still send
+*/
+void Replay::grant(uint16_t credits)
+{
+    uint8_t buff[4];
+    buff[0] = 0xF1;
+    buff[1] = PROTO_REPLAY_CREDIT;
+    buff[2] = credits & 0xFF;
+    buff[3] = credits >> 8;
+    sendBytesToUSB(buff, 4);
+}
+
+//the host asked. Anything freed but not yet granted goes out now
+void Replay::sendCredits()
+{
+    grant(ungranted);
+    ungranted = 0;
+}
+
+/*
+Sends every frame whose time has come. A frame the bus won't queue stays at the head of the
+queue so order is kept and the lateness shows up in the timing error. The timing is taken when
+each frame actually goes out, see frameDone().
+*/
+void Replay::loop()
+{
+    uint32_t now, due;
+
+    if (!active) return;
+
+    while (tail != head) {
+        REPLAY_ENTRY &entry = queue[tail & (REPLAY_QUEUE - 1)];
+        now = timebase.micros32();
+        due = startMicros + entry.time;
+        if ((flags & REPLAY_TIMED) && (int32_t)(now - due) < 0) break;
+        inFlight++; //before queueing, the bus can report it done straight away
+        if (!sendFrameOnBus(entry.frame, entry.bus, TX_PRIO_LOW, false, TX_SOURCE_REPLAY, due)) {
+            inFlight--;
+            break;
+        }
+        tail++;
+        ungranted++;
+    }
+
+    if (flags & REPLAY_LOCAL) ungranted = 0;
+    else if (ungranted >= REPLAY_CREDIT_BATCH || (ungranted > 0 && tail == head)) sendCredits();
+    if (ending && tail == head && inFlight == 0) {
+        active = false;
+        if (flags & REPLAY_LOCAL) printStatus();
+        else sendSummary();
+    }
+}
+
+//frames the bus gave up on don't count as sent
+void Replay::frameDone(uint32_t due, bool success, uint64_t txTicks)
+{
+    uint32_t now = (uint32_t)(txTicks / TIMEBASE_TICKS_US);
+    uint32_t error;
+
+    if (inFlight > 0) inFlight--;
+    if (!active || !success) return;
+    if (flags & REPLAY_TIMED) {
+        error = ((int32_t)(now - due) > 0) ? now - due : 0;
+        totalError += error;
+        if (error > maxError) maxError = error;
+        if (error > REPLAY_DEADLINE) lateFrames++;
+    }
+    if (framesSent == 0) firstSent = now;
+    lastSent = now;
+    framesSent++;
+}
+
+/*
+0xF1, PROTO_REPLAY_END, frames sent (4), average timing error us (4), max timing error us (4),
+elapsed us from first to last frame (4), frames per second (4), frames sent without credit (4),
+frames that missed REPLAY_DEADLINE (4)
+*/
+void Replay::sendSummary()
+{
+    uint8_t buff[30];
+    uint32_t values[7];
+    uint32_t elapsed = (framesSent > 1) ? lastSent - firstSent : 0;
+    int pos = 2;
+
+    values[0] = framesSent;
+    values[1] = framesSent ? (uint32_t)(totalError / framesSent) : 0;
+    values[2] = maxError;
+    values[3] = elapsed;
+    values[4] = elapsed ? (uint32_t)((uint64_t)(framesSent - 1) * 1000000ull / elapsed) : 0;
+    values[5] = overflows;
+    values[6] = lateFrames;
+
+    buff[0] = 0xF1;
+    buff[1] = PROTO_REPLAY_END;
+    for (int c = 0; c < 7; c++) {
+        buff[pos++] = values[c] & 0xFF;
+        buff[pos++] = values[c] >> 8;
+        buff[pos++] = values[c] >> 16;
+        buff[pos++] = values[c] >> 24;
+    }
+    sendBytesToUSB(buff, pos);
+    printStatus();
+}
+
+void Replay::printStatus()
+{
+    uint32_t elapsed = (framesSent > 1) ? lastSent - firstSent : 0;
+
+    Logger::info("Replay %s, %i frames sent in %i ms, %i queued", active ? "running" : "idle", framesSent,
+                 elapsed / 1000, REPLAY_QUEUE - freeSlots());
+    if (framesSent > 0 && (flags & REPLAY_TIMED)) {
+        Logger::info("Replay timing error avg: %i us max: %i us, %i frames over %i us late",
+                     (uint32_t)(totalError / framesSent), maxError, lateFrames, REPLAY_DEADLINE);
+    }
+    if (overflows) Logger::info("Replay frames sent without credit: %i", overflows);
+}
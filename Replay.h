@@ -0,0 +1,94 @@
+/*
+ * Replay.h
+ *
+ * Plays a captured log back onto the buses. Frames are streamed in over the binary
+ * protocol with a timestamp and wait in a queue until their time comes up on the
+ * device's own clock, so USB scheduling doesn't show up as bus timing. The host is
+ * only allowed to send as many frames as it has been given credits for, which makes
+ * it impossible to overrun the queue.
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#ifndef REPLAY_H_
+#define REPLAY_H_
+
+#include <Arduino.h>
+#include <due_can.h>
+
+#define REPLAY_QUEUE        128 //frames. Must be a power of two
+#define REPLAY_CREDIT_BATCH 16 //hand credits back to the host in groups of this many
+#define REPLAY_LEAD         20000 //microseconds of buffering before the first frame goes out
+#define REPLAY_DEADLINE     1000 //frames later than this many microseconds count as missed deadlines
+
+//flags for start()
+#define REPLAY_TIMED        1 //keep the original spacing. Otherwise frames go out as fast as the bus takes them
+#define REPLAY_LOCAL        2 //fed from on the device (SD card) so no credits or summary go to the host
+
+struct REPLAY_ENTRY {
+    CAN_FRAME frame;
+    uint32_t time; //microseconds from the start of the replay
+    uint8_t bus;
+};
+
+class Replay
+{
+public:
+    Replay(REPLAY_ENTRY *buffer); //REPLAY_QUEUE entries, not touched before start()
+    void start(uint8_t flags);
+    void finish(); //no more frames are coming. The summary goes out once the queue drains and the last frame is out
+    void stop(); //drop whatever is left right now
+    bool queueFrame(uint32_t time, uint8_t bus, CAN_FRAME &frame);
+    uint16_t freeSlots();
+    bool isActive();
+    void loop();
+    void frameDone(uint32_t due, bool success, uint64_t txTicks); //from processTxDone()
+    void sendCredits();
+    void printStatus();
+
+private:
+    REPLAY_ENTRY *queue;
+    uint16_t head; //next slot to fill
+    uint16_t tail; //next frame to send
+    uint16_t inFlight; //handed to the bus and not finished with yet
+    bool active;
+    bool ending;
+    bool started; //first frame is in and the clock is running
+    uint8_t flags;
+    uint32_t startMicros;
+    uint32_t firstSent; //as the controller timestamped them
+    uint32_t lastSent;
+    uint16_t ungranted; //slots freed up that the host hasn't been told about
+    uint32_t framesSent;
+    uint32_t overflows; //host sent without credit
+    uint32_t maxError; //microseconds late against the original timing
+    uint64_t totalError;
+    uint32_t lateFrames; //missed REPLAY_DEADLINE
+
+    void grant(uint16_t credits);
+    void sendSummary();
+};
+
+extern Replay replay;
+
+#endif /* REPLAY_H_ */
@@ -0,0 +1,324 @@
+/*
+ * Responder.cpp
+ *
+ * Automatic request -> response table with latency measurement
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#include "Responder.h"
+#include "GVRET.h"
+#include "config.h"
+#include "Logger.h"
+#include "SettingsStore.h"
+#include "Timebase.h"
+#include "TriggerEngine.h"
+#include <Wire_EEPROM.h>
+
+Responder::Responder()
+{
+    for (int i = 0; i < MAX_RESPONSES; i++) clearEntry(i);
+    queueUsed = 0;
+    resetStats();
+}
+
+RESPONSE_ENTRY &Responder::getEntry(uint8_t which)
+{
+    return pages[which / RESPONSES_PER_PAGE].entries[which % RESPONSES_PER_PAGE];
+}
+
+void Responder::loadTable()
+{
+    settingsStore.attach(STORE_RESPONDER, pages);
+    if (!settingsStore.isDirty(STORE_RESPONDER)) { //otherwise what is in RAM is newer than anything stored
+        memset(pages, 0, sizeof(pages));
+        if (!settingsStore.load(STORE_RESPONDER)) { //from before the tables were records, or a blank EEPROM
+            for (int p = 0; p < RESPONSE_PAGES; p++) {
+                if (!settingsStore.tablePageUsed(EEPROM_PAGE_RESPONDER + p)) continue; //nothing stored there
+                EEPROM.read(EEPROM_PAGE_RESPONDER + p, pages[p]);
+                if (pages[p].entries[0].enabled == 255) {
+                    Logger::console("Resetting responder page %i to defaults", p);
+                    for (int i = 0; i < RESPONSES_PER_PAGE; i++) clearEntry(p * RESPONSES_PER_PAGE + i);
+                }
+            }
+            settingsStore.markDirty(STORE_RESPONDER);
+        }
+    }
+    compile();
+}
+
+void Responder::saveTable(uint8_t which)
+{
+    if (which >= MAX_RESPONSES) return;
+    settingsStore.markDirty(STORE_RESPONDER);
+}
+
+void Responder::clearEntry(uint8_t which)
+{
+    if (which >= MAX_RESPONSES) return;
+    memset(&getEntry(which), 0, sizeof(RESPONSE_ENTRY));
+}
+
+void Responder::compile()
+{
+    index.clear();
+    for (int i = 0; i < MAX_RESPONSES; i++) {
+        RESPONSE_ENTRY &entry = getEntry(i);
+        if (entry.enabled != 1) continue;
+        reqMask[i] = 0;
+        reqValue[i] = 0;
+        for (int c = 0; c < entry.reqLength && c < 8; c++) {
+            reqMask[i] |= (uint64_t)entry.reqMask[c] << (c * 8);
+            reqValue[i] |= (uint64_t)(entry.reqValue[c] & entry.reqMask[c]) << (c * 8);
+        }
+        if (!index.add(entry.reqBus, entry.reqId, i)) Logger::error("Could not index response %i", i);
+    }
+}
+
+void Responder::resetStats()
+{
+    for (int i = 0; i < MAX_RESPONSES; i++) hitCount[i] = 0;
+    sent = 0;
+    dropped = 0;
+    minLatency = 0xFFFFFFFF;
+    maxLatency = 0;
+    totalLatency = 0;
+}
+
+void Responder::buildFrame(RESPONSE_FRAME &resp, CAN_FRAME &request, CAN_FRAME &out)
+{
+    out.id = resp.id;
+    out.extended = resp.extended;
+    out.rtr = 0;
+    out.length = resp.length;
+    for (int c = 0; c < 8; c++) {
+        if (resp.fromRequest & (1 << c)) out.data.bytes[c] = request.data.bytes[resp.data[c] & 7];
+        else out.data.bytes[c] = resp.data[c];
+    }
+}
+
+//counted once the bus says how it went
+void Responder::send(CAN_FRAME &frame, uint8_t bus, uint32_t requestTime)
+{
+    if (!sendFrameOnBus(frame, bus, TX_PRIO_HIGH, false, TX_SOURCE_RESPONDER, requestTime)) dropped++;
+}
+
+void Responder::frameDone(uint32_t requestTime, bool success, uint64_t txTicks)
+{
+    if (!success) {
+        dropped++;
+        return;
+    }
+    uint32_t latency = (uint32_t)(txTicks / TIMEBASE_TICKS_US) - requestTime;
+    sent++;
+    totalLatency += latency;
+    if (latency < minLatency) minLatency = latency;
+    if (latency > maxLatency) maxLatency = latency;
+}
+
+/*
+Called before anything else looks at a received frame. Only the first matching entry answers,
+like a real module would. Responses without a delay go out right from here, the rest wait in
+a small queue that loop() empties.
+*/
+void Responder::processFrame(CAN_FRAME &frame, uint8_t bus, uint32_t rxMicros)
+{
+    uint32_t slots = index.lookup(bus, frame.id);
+    CAN_FRAME out;
+    int which, slot;
+
+    while (slots) {
+        which = __builtin_ctz(slots);
+        slots &= slots - 1;
+        RESPONSE_ENTRY &entry = getEntry(which);
+        if (frame.length < entry.reqLength) continue;
+        if ((frame.data.value & reqMask[which]) != reqValue[which]) continue;
+
+        hitCount[which]++;
+        for (int r = 0; r < MAX_RESPONSE_FRAMES; r++) {
+            RESPONSE_FRAME &resp = entry.responses[r];
+            if (resp.length == 0) continue;
+            buildFrame(resp, frame, out);
+            if (entry.delay == 0) {
+                send(out, resp.bus, rxMicros);
+                continue;
+            }
+            if (queueUsed == (1ul << RESPONSE_QUEUE) - 1) {
+                dropped++;
+                continue;
+            }
+            slot = __builtin_ctz(~queueUsed);
+            queue[slot].frame = out;
+            queue[slot].bus = resp.bus;
+            queue[slot].due = rxMicros + entry.delay;
+            queue[slot].requestTime = rxMicros;
+            queueUsed |= 1ul << slot;
+        }
+        return;
+    }
+}
+
+void Responder::loop()
+{
+    uint32_t bits = queueUsed;
+    int slot;
+
+    while (bits) {
+        slot = __builtin_ctz(bits);
+        bits &= bits - 1;
+        if ((int32_t)(timebase.micros32() - queue[slot].due) < 0) continue;
+        send(queue[slot].frame, queue[slot].bus, queue[slot].requestTime);
+        queueUsed &= ~(1ul << slot);
+    }
+}
+
+/*
+BUS,ID,TEMPLATE where TEMPLATE is two characters per byte, either a hex byte or Rn to copy
+byte n of the request. For example 0,0x7E8,0662F190R3R4AA
+*/
+bool Responder::parseResponse(char *str, RESPONSE_FRAME &resp)
+{
+    char *tok[3];
+    int len, hi, lo;
+
+    memset(&resp, 0, sizeof(resp));
+    tok[0] = strtok(str, ",");
+    tok[1] = strtok(NULL, ",");
+    tok[2] = strtok(NULL, ",");
+    if (!tok[0] || !tok[1] || !tok[2]) return false;
+
+    resp.bus = strtol(tok[0], NULL, 0);
+    if (resp.bus >= MAX_BUSES) return false;
+    resp.id = strtoul(tok[1], NULL, 0);
+    resp.extended = (resp.id > 0x7FF) ? 1 : 0;
+    len = strlen(tok[2]);
+    if ((len & 1) || len == 0 || len > 16) return false;
+    resp.length = len / 2;
+    for (int c = 0; c < resp.length; c++) {
+        char *p = &tok[2][c * 2];
+        if (toupper(p[0]) == 'R') {
+            if (p[1] < '0' || p[1] > '7') return false;
+            resp.fromRequest |= 1 << c;
+            resp.data[c] = p[1] - '0';
+        } else {
+            hi = TriggerEngine::hexNibble(p[0]);
+            lo = TriggerEngine::hexNibble(p[1]);
+            if (hi < 0 || lo < 0) return false;
+            resp.data[c] = (hi << 4) | lo;
+        }
+    }
+    return true;
+}
+
+/*
+Entries come from the serial console as
+REQBUS,REQID[,PATTERN];RESPONSE[;RESPONSE][;DELAY]
+PATTERN is hex bytes with X for don't care nibbles. A part with no commas is the delay in microseconds.
+For example: 0,0x7E0,0322F190;0,0x7E8,0662F190R3R4AA;200
+*/
+bool Responder::setEntry(uint8_t which, char *definition)
+{
+    RESPONSE_ENTRY entry;
+    char *parts[2 + MAX_RESPONSE_FRAMES];
+    char *ptr = definition;
+    char *tok;
+    int numParts = 0;
+    int numResponses = 0;
+
+    if (which >= MAX_RESPONSES) return false;
+
+    while (ptr && numParts < 2 + MAX_RESPONSE_FRAMES) {
+        parts[numParts++] = ptr;
+        ptr = strchr(ptr, ';');
+        if (ptr) *ptr++ = 0;
+    }
+    if (ptr || numParts < 2) return false;
+
+    memset(&entry, 0, sizeof(entry));
+    tok = strtok(parts[0], ",");
+    if (!tok) return false;
+    entry.reqBus = strtol(tok, NULL, 0);
+    if (entry.reqBus >= MAX_BUSES) return false;
+    tok = strtok(NULL, ",");
+    if (!tok) return false;
+    entry.reqId = strtoul(tok, NULL, 0);
+    tok = strtok(NULL, ",");
+    if (tok && !TriggerEngine::parsePattern(tok, entry.reqMask, entry.reqValue, entry.reqLength)) return false;
+
+    for (int c = 1; c < numParts; c++) {
+        if (!strchr(parts[c], ',')) {
+            entry.delay = strtoul(parts[c], NULL, 0);
+            continue;
+        }
+        if (numResponses >= MAX_RESPONSE_FRAMES) return false;
+        if (!parseResponse(parts[c], entry.responses[numResponses++])) return false;
+    }
+    if (numResponses == 0) return false;
+
+    entry.enabled = 1;
+    getEntry(which) = entry;
+    compile();
+    return true;
+}
+
+void Responder::printEntries()
+{
+    char buff[120];
+    char *ptr;
+
+    for (int i = 0; i < MAX_RESPONSES; i++) {
+        RESPONSE_ENTRY &entry = getEntry(i);
+        if (entry.enabled != 1) continue;
+        ptr = buff;
+        ptr += sprintf(ptr, "RESP%i=%i,0x%x", i, entry.reqBus, (unsigned int)entry.reqId);
+        if (entry.reqLength > 0) *ptr++ = ',';
+        for (int c = 0; c < entry.reqLength; c++) {
+            *ptr++ = (entry.reqMask[c] & 0xF0) ? "0123456789ABCDEF"[entry.reqValue[c] >> 4] : 'X';
+            *ptr++ = (entry.reqMask[c] & 0x0F) ? "0123456789ABCDEF"[entry.reqValue[c] & 0xF] : 'X';
+        }
+        *ptr = 0;
+        for (int r = 0; r < MAX_RESPONSE_FRAMES; r++) {
+            RESPONSE_FRAME &resp = entry.responses[r];
+            if (resp.length == 0) continue;
+            ptr += sprintf(ptr, ";%i,0x%x,", resp.bus, (unsigned int)resp.id);
+            for (int c = 0; c < resp.length && c < 8; c++) {
+                if (resp.fromRequest & (1 << c)) ptr += sprintf(ptr, "R%i", resp.data[c]);
+                else ptr += sprintf(ptr, "%02X", resp.data[c]);
+            }
+        }
+        if (entry.delay > 0) sprintf(ptr, ";%u", (unsigned int)entry.delay);
+        Logger::console(buff);
+    }
+}
+
+void Responder::printStats()
+{
+    Logger::console("Responses sent: %i dropped: %i", sent, dropped);
+    if (sent > 0) {
+        Logger::console("Request to response latency min: %i us avg: %i us max: %i us", minLatency,
+                        totalLatency / sent, maxLatency);
+    }
+    for (int i = 0; i < MAX_RESPONSES; i++) {
+        if (getEntry(i).enabled == 1) Logger::console("Response %i requests answered: %i", i, hitCount[i]);
+    }
+}
@@ -0,0 +1,116 @@
+/*
+ * Responder.h
+ *
+ * Table of automatic replies. A request frame (bus, ID and masked payload) is answered
+ * with up to two response frames whose payload can copy bytes out of the request. This
+ * runs first thing in the receive path so the device can stand in for a missing module
+ * without the host being in the loop.
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#ifndef RESPONDER_H_
+#define RESPONDER_H_
+
+#include <Arduino.h>
+#include <due_can.h>
+#include "IDIndex.h"
+
+#define RESPONSES_PER_PAGE  4 //64 byte entries, 256 byte EEPROM page
+#define RESPONSE_PAGES      4
+#define MAX_RESPONSES       (RESPONSES_PER_PAGE * RESPONSE_PAGES)
+#define MAX_RESPONSE_FRAMES 2
+#define RESPONSE_QUEUE      16 //delayed responses waiting to go out
+
+struct RESPONSE_FRAME { //16 bytes
+    uint32_t id;
+    uint8_t bus;
+    uint8_t length; //0 = this response frame isn't used
+    uint8_t extended;
+    uint8_t fromRequest; //bit n set = byte n is copied from request byte data[n]
+    uint8_t data[8];
+};
+
+struct RESPONSE_ENTRY { //64 bytes
+    uint32_t reqId;
+    uint8_t reqBus;
+    uint8_t reqLength; //minimum request length, also how many pattern bytes are used
+    uint8_t enabled; //255 means the EEPROM page was never initialized
+    uint8_t reserved;
+    uint8_t reqMask[8];
+    uint8_t reqValue[8];
+    uint32_t delay; //microseconds between request and response. 0 = right away
+    RESPONSE_FRAME responses[MAX_RESPONSE_FRAMES];
+    uint8_t reserved2[4];
+};
+
+struct RESPONSE_PAGE {
+    RESPONSE_ENTRY entries[RESPONSES_PER_PAGE];
+};
+
+struct PENDING_RESPONSE {
+    CAN_FRAME frame;
+    uint8_t bus;
+    uint32_t due; //micros
+    uint32_t requestTime;
+};
+
+class Responder
+{
+public:
+    Responder();
+    void loadTable();
+    void saveTable(uint8_t which);
+    void compile();
+    bool setEntry(uint8_t which, char *definition);
+    void clearEntry(uint8_t which);
+    RESPONSE_ENTRY &getEntry(uint8_t which);
+    void processFrame(CAN_FRAME &frame, uint8_t bus, uint32_t rxMicros);
+    void frameDone(uint32_t requestTime, bool success, uint64_t txTicks); //from processTxDone()
+    void loop();
+    void printEntries();
+    void printStats();
+    void resetStats();
+
+private:
+    RESPONSE_PAGE pages[RESPONSE_PAGES];
+    IDIndex index;
+    uint64_t reqMask[MAX_RESPONSES];
+    uint64_t reqValue[MAX_RESPONSES];
+    PENDING_RESPONSE queue[RESPONSE_QUEUE];
+    uint32_t queueUsed; //bitfield of queue slots in use
+    uint32_t hitCount[MAX_RESPONSES];
+    uint32_t sent;
+    uint32_t dropped; //couldn't be queued or were never acknowledged
+    uint32_t minLatency; //request received to response sent as the controller timestamped them, in microseconds
+    uint32_t maxLatency;
+    uint32_t totalLatency;
+
+    void buildFrame(RESPONSE_FRAME &resp, CAN_FRAME &request, CAN_FRAME &out);
+    void send(CAN_FRAME &frame, uint8_t bus, uint32_t requestTime);
+    bool parseResponse(char *str, RESPONSE_FRAME &resp);
+};
+
+extern Responder responder;
+
+#endif /* RESPONDER_H_ */
@@ -0,0 +1,266 @@
+/*
+ * SdReplay.cpp
+ *
+ * Standalone log playback from the SD card
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#include "SdReplay.h"
+#include "Replay.h"
+#include "GVRET.h"
+#include "Logger.h"
+#include "sys_io.h"
+
+SdReplay::SdReplay()
+{
+    running = false;
+    name[0] = 0;
+    framesRead = 0;
+    skipped = 0;
+}
+
+bool SdReplay::isRunning()
+{
+    return running;
+}
+
+bool SdReplay::start(const char *filename, FILEOUTPUTTYPE format, uint16_t loops, uint16_t speed, uint8_t *busMap)
+{
+    if (running) stop();
+    if (!SysSettings.SDCardInserted) {
+        Logger::error("No SD card to replay from");
+        return false;
+    }
+    if (format != BINARYFILE && format != GVRET && format != CRTD) return false;
+    if (!file.open(filename, O_READ)) {
+        Logger::error("Could not open %s for replay", filename);
+        return false;
+    }
+
+    strncpy(name, filename, SDREPLAY_NAME);
+    name[SDREPLAY_NAME] = 0;
+    this->format = format;
+    this->loops = loops;
+    this->speed = speed;
+    for (int b = 0; b < 3; b++) this->busMap[b] = busMap[b];
+    pass = 0;
+    elapsed = 0;
+    framesRead = 0;
+    skipped = 0;
+    rewind();
+    running = true;
+    replay.start((speed ? REPLAY_TIMED : 0) | REPLAY_LOCAL);
+    Logger::info("Replaying %s", name);
+    return true;
+}
+
+void SdReplay::stop()
+{
+    if (!running) return;
+    replay.stop();
+    file.close();
+    running = false;
+}
+
+//called once at the end of setup. Lets a car be set up to replay with nothing but a switch
+void SdReplay::bootCheck()
+{
+    uint8_t identity[3] = {0, 1, 2};
+    String filename;
+
+    if (!SysSettings.SDCardInserted || !getDigital(SDREPLAY_BOOT_INPUT)) return;
+    filename = String(SDREPLAY_BOOT_FILE);
+    filename.concat(".");
+    filename.concat(settings.fileNameExt);
+    start(filename.c_str(), (settings.fileOutputType == NONE) ? BINARYFILE : settings.fileOutputType, 0, 100, identity);
+}
+
+void SdReplay::rewind()
+{
+    file.seekSet(0);
+    bufLen[0] = bufLen[1] = 0;
+    bufPos[0] = bufPos[1] = 0;
+    cur = 0;
+    eof = false;
+    recordLen = 0;
+    havePrev = false;
+}
+
+/*
+Each call does at most one card read, into whichever buffer isn't being parsed, then parses as
+many records as the Replay queue has room for. Frames already queued cover the time the next
+read takes.
+*/
+void SdReplay::loop()
+{
+    uint8_t fill;
+    int count;
+
+    if (!running) return;
+    if (!replay.isActive()) { //replay was aborted or taken over by the host
+        file.close();
+        running = false;
+        return;
+    }
+
+    fill = (bufLen[cur] == 0) ? cur : cur ^ 1;
+    if (bufLen[fill] == 0 && !eof) {
+        count = file.read(buffers[fill], SDREPLAY_BLOCK);
+        if (count <= 0) eof = true;
+        else {
+            bufLen[fill] = count;
+            bufPos[fill] = 0;
+        }
+    }
+
+    while (bufLen[cur] > 0 && replay.freeSlots() > 0) {
+        parseByte(buffers[cur][bufPos[cur]++]);
+        if (bufPos[cur] >= bufLen[cur]) {
+            bufLen[cur] = 0;
+            cur ^= 1;
+        }
+    }
+
+    if (eof && bufLen[0] == 0 && bufLen[1] == 0) {
+        pass++;
+        if (loops == 0 || pass < loops) {
+            rewind();
+            return;
+        }
+        replay.finish(); //Replay logs the timing summary once the last frame is out
+        file.close();
+        running = false;
+        Logger::info("Finished reading %s, %i frames, %i records skipped", name, framesRead, skipped);
+    }
+}
+
+void SdReplay::parseByte(uint8_t c)
+{
+    if (format == BINARYFILE) {
+        record[recordLen++] = c;
+        if (recordLen >= 9 && recordLen >= 9 + min(record[8] & 0xF, 8)) {
+            queueRecord();
+            recordLen = 0;
+        }
+        return;
+    }
+
+    if (c == '\r' || c == '\n') {
+        if (recordLen > 0) {
+            record[recordLen] = 0;
+            queueRecord();
+        }
+        recordLen = 0;
+    } else if (recordLen < SDREPLAY_LINE - 1) record[recordLen++] = c;
+}
+
+//timestamp (4), ID (4, bit 31 = extended), length + (bus << 4), data
+bool SdReplay::parseBinary(CAN_FRAME &frame, uint8_t &bus, uint32_t &time)
+{
+    time = record[0] | (record[1] << 8) | (record[2] << 16) | (record[3] << 24);
+    frame.id = record[4] | (record[5] << 8) | (record[6] << 16) | (record[7] << 24);
+    frame.extended = (frame.id & 1 << 31) ? true : false;
+    frame.id &= 0x7FFFFFFF;
+    frame.length = min(record[8] & 0xF, 8);
+    bus = record[8] >> 4;
+    memcpy(frame.data.bytes, &record[9], frame.length);
+    return true;
+}
+
+//millis,id,extended,bus,length,data...  all in hex after the timestamp except the flags
+bool SdReplay::parseGVRET(CAN_FRAME &frame, uint8_t &bus, uint32_t &time)
+{
+    char *tok[5];
+
+    tok[0] = strtok((char *)record, ",");
+    for (int c = 1; c < 5; c++) tok[c] = strtok(NULL, ",");
+    if (!tok[4] || !isdigit(tok[0][0])) return false; //marks and other notes end up in here too
+    time = strtoul(tok[0], NULL, 10) * 1000;
+    frame.id = strtoul(tok[1], NULL, 16);
+    frame.extended = strtol(tok[2], NULL, 10) ? true : false;
+    bus = strtol(tok[3], NULL, 10);
+    frame.length = strtol(tok[4], NULL, 10);
+    if (frame.length > 8) return false;
+    for (int c = 0; c < frame.length; c++) {
+        char *data = strtok(NULL, ",");
+        if (!data) return false;
+        frame.data.bytes[c] = strtoul(data, NULL, 16);
+    }
+    return true;
+}
+
+//seconds R11|R29 id data...  CRTD logs don't say which bus so everything is bus 0
+bool SdReplay::parseCRTD(CAN_FRAME &frame, uint8_t &bus, uint32_t &time)
+{
+    char *tok[3];
+    char *data;
+
+    tok[0] = strtok((char *)record, " ");
+    tok[1] = strtok(NULL, " ");
+    tok[2] = strtok(NULL, " ");
+    if (!tok[2] || (tok[1][0] != 'R' && tok[1][0] != 'T')) return false;
+    time = (uint32_t)(uint64_t)(strtod(tok[0], NULL) * 1000000.0);
+    frame.extended = (atoi(tok[1] + 1) == 29);
+    frame.id = strtoul(tok[2], NULL, 16);
+    bus = 0;
+    frame.length = 0;
+    while ((data = strtok(NULL, " ")) != NULL && frame.length < 8) {
+        frame.data.bytes[frame.length++] = strtoul(data, NULL, 16);
+    }
+    return true;
+}
+
+void SdReplay::queueRecord()
+{
+    CAN_FRAME frame;
+    uint8_t bus;
+    uint32_t time;
+    bool ok = false;
+
+    frame.rtr = 0;
+    if (format == BINARYFILE) ok = parseBinary(frame, bus, time);
+    else if (format == GVRET) ok = parseGVRET(frame, bus, time);
+    else if (format == CRTD) ok = parseCRTD(frame, bus, time);
+    //logged GVRET events have IDs past 29 bits and aren't real traffic
+    if (!ok || frame.id > 0x1FFFFFFF || bus > 2 || busMap[bus] == SDREPLAY_NO_BUS) {
+        skipped++;
+        return;
+    }
+
+    if (havePrev) elapsed += (uint32_t)(time - prevTime);
+    else if (pass > 0) elapsed += SDREPLAY_LOOP_GAP;
+    prevTime = time;
+    havePrev = true;
+
+    framesRead++;
+    replay.queueFrame(speed ? (uint32_t)(elapsed * 100 / speed) : 0, busMap[bus], frame);
+}
+
+void SdReplay::printStatus()
+{
+    if (running) Logger::console("Replaying %s pass %i of %i, %i frames read, %i records skipped", name, pass + 1, loops,
+                                     framesRead, skipped);
+    else Logger::console("No SD card replay running");
+    replay.printStatus();
+}
@@ -0,0 +1,92 @@
+/*
+ * SdReplay.h
+ *
+ * Plays a log file off of the SD card onto the buses with no host attached. Any of
+ * the formats sendFrameToFile writes can be read back. The file is read a block at a
+ * time into two buffers, one being parsed while the other is refilled, and parsed
+ * frames wait in the Replay queue so a slow card read never leaves a gap on the bus.
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#ifndef SDREPLAY_H_
+#define SDREPLAY_H_
+
+#include <Arduino.h>
+#include <due_can.h>
+#include <SdFat.h>
+#include "config.h"
+
+#define SDREPLAY_BLOCK      512 //one SD sector per read
+#define SDREPLAY_LINE       96 //longest text line that will be parsed
+#define SDREPLAY_NAME       20
+#define SDREPLAY_LOOP_GAP   1000 //microseconds between the end of the file and the start of the next pass
+#define SDREPLAY_NO_BUS     0xFF //bus map entry that drops frames from that bus
+#define SDREPLAY_BOOT_INPUT 3 //digital input that starts SDREPLAY_BOOT_FILE at power up when active
+#define SDREPLAY_BOOT_FILE  "REPLAY" //the extension and format are the ones set up for logging
+
+class SdReplay
+{
+public:
+    SdReplay();
+    //loops 0 = forever. speed is in percent, 0 sends as fast as possible. busMap gives the output bus for buses 0-2
+    bool start(const char *filename, FILEOUTPUTTYPE format, uint16_t loops, uint16_t speed, uint8_t *busMap);
+    void stop();
+    void bootCheck();
+    void loop();
+    bool isRunning();
+    void printStatus();
+
+private:
+    SdFile file;
+    char name[SDREPLAY_NAME + 1];
+    uint8_t buffers[2][SDREPLAY_BLOCK];
+    uint16_t bufLen[2]; //0 = empty and waiting on a read
+    uint16_t bufPos[2];
+    uint8_t cur; //buffer being parsed
+    bool eof;
+    bool running;
+    FILEOUTPUTTYPE format;
+    uint16_t loops;
+    uint16_t pass;
+    uint16_t speed;
+    uint8_t busMap[3];
+    uint8_t record[SDREPLAY_LINE]; //record being put together across buffer boundaries
+    uint8_t recordLen;
+    bool havePrev;
+    uint32_t prevTime; //file timestamp of the previous frame in microseconds
+    uint64_t elapsed; //unscaled microseconds since the start of playback
+    uint32_t framesRead;
+    uint32_t skipped; //lines that weren't frames, events and frames from unmapped buses
+
+    void rewind();
+    void parseByte(uint8_t c);
+    bool parseBinary(CAN_FRAME &frame, uint8_t &bus, uint32_t &time);
+    bool parseGVRET(CAN_FRAME &frame, uint8_t &bus, uint32_t &time);
+    bool parseCRTD(CAN_FRAME &frame, uint8_t &bus, uint32_t &time);
+    void queueRecord();
+};
+
+extern SdReplay sdReplay;
+
+#endif /* SDREPLAY_H_ */
@@ -30,11 +30,861 @@
 #include <due_wire.h>
 #include <Wire_EEPROM.h>
 #include <due_can.h>
-#include <MCP2515.h>
 #include "config.h"
 #include "sys_io.h"
+#include "GatewayRules.h"
+#include "BusCensus.h"
+#include "BusLoad.h"
+#include "BusMonitor.h"
+#include "SignalDecoder.h"
+#include "TriggerEngine.h"
+#include "IsoTp.h"
+#include "Responder.h"
+#include "CyclicTx.h"
+#include "SdReplay.h"
+#include "Timebase.h"
+#include "TimeSync.h"
+#include "AdcStream.h"
+#include "EdgeCapture.h"
+#include "SettingsStore.h"
+#include "BootCapture.h"
+#include "CanBus.h"
 
-extern MCP2515 SWCAN;
+#define STR_(x) #x
+#define STR(x) STR_(x) //numeric macros into help strings
+
+static bool filterSet(uint8_t bus, uint8_t filter, char *values)
+{
+    if (filter > 7) return false;
+    if (bus > 1) return false;
+
+    //there should be four tokens
+    char *idTok = strtok(values, ",");
+    char *maskTok = strtok(NULL, ",");
+    char *extTok = strtok(NULL, ",");
+    char *enTok = strtok(NULL, ",");
+
+    if (!idTok) return false; //if any of them were null then something was wrong. Abort.
+    if (!maskTok) return false;
+    if (!extTok) return false;
+    if (!enTok) return false;
+
+    int idVal = strtol(idTok, NULL, 0);
+    int maskVal = strtol(maskTok, NULL, 0);
+    int extVal = strtol(extTok, NULL, 0);
+    int enVal = strtol(enTok, NULL, 0);
+
+    Logger::console("Setting CAN%iFILTER%i to ID 0x%x Mask 0x%x Extended %i Enabled %i", bus, filter, idVal, maskVal, extVal, enVal);
+
+    if (bus == 0) {
+        settings.CAN0Filters[filter].id = idVal;
+        settings.CAN0Filters[filter].mask = maskVal;
+        settings.CAN0Filters[filter].extended = extVal;
+        settings.CAN0Filters[filter].enabled = enVal;
+    } else if (bus == 1) {
+        settings.CAN1Filters[filter].id = idVal;
+        settings.CAN1Filters[filter].mask = maskVal;
+        settings.CAN1Filters[filter].extended = extVal;
+        settings.CAN1Filters[filter].enabled = enVal;
+    }
+    busRegistry.get(bus)->setFilter(filter, idVal, maskVal, extVal);
+
+    return true;
+}
+
+static bool canSend(uint8_t bus, char *inputString, bool wakeup)
+{
+    char *idTok = strtok(inputString, ",");
+    char *lenTok = strtok(NULL, ",");
+    char *dataTok;
+    CAN_FRAME frame;
+
+    if (!idTok) return false;
+    if (!lenTok) return false;
+
+    int idVal = strtol(idTok, NULL, 0);
+    int lenVal = strtol(lenTok, NULL, 0);
+
+    if (lenVal < 0 || lenVal > 8) return false;
+    for (int i = 0; i < lenVal; i++) {
+        dataTok = strtok(NULL, ",");
+        if (!dataTok) return false;
+        frame.data.byte[i] = strtol(dataTok, NULL, 0);
+    }
+
+    //things seem good so try to send the frame.
+    frame.id = idVal;
+    if (idVal >= 0x7FF) frame.extended = true;
+    else frame.extended = false;
+    frame.length = lenVal;
+    frame.rtr = 0;
+    if (!sendFrameOnBus(frame, bus, TX_PRIO_NORMAL, wakeup)) {
+        Logger::console("Bus %i transmit queue is full or the bus is off", bus);
+        return false;
+    }
+    Logger::console("Sending frame with id: 0x%x len: %i", frame.id, frame.length);
+    SysSettings.txToggle = !SysSettings.txToggle;
+    setLED(SysSettings.LED_CANTX, SysSettings.txToggle);
+    return true;
+}
+
+/*
+Command handlers. Each gets its table entry so one handler can serve several keys, with
+param saying which bus or bit it is working on.
+*/
+static uint8_t cmdFlag(const CONSOLE_COMMAND &cmd, CONSOLE_ARGS &args)
+{
+    if (args.value < 0 || args.value > 1) {
+        Logger::console("Invalid setting! Enter a value 0 - 1");
+        return 0;
+    }
+    Logger::console("Setting %s to %i", cmd.key, args.value);
+    *(bool *)cmd.value = args.value;
+    return cmd.save;
+}
+
+static uint8_t cmdModeBit(const CONSOLE_COMMAND &cmd, CONSOLE_ARGS &args)
+{
+    uint8_t *mode = (uint8_t *)cmd.value;
+
+    if (args.value < 0 || args.value > 1) {
+        Logger::console("Invalid setting! Enter a value 0 - 1");
+        return 0;
+    }
+    Logger::console("Setting %s to %i", cmd.key, args.value);
+    if (args.value) *mode |= 1 << cmd.param;
+    else *mode &= ~(1 << cmd.param);
+    return cmd.save;
+}
+
+//unsigned number up to param for VAL_U8, whatever fits otherwise. VAL_HEX32 is a CAN ID
+static uint8_t cmdNumber(const CONSOLE_COMMAND &cmd, CONSOLE_ARGS &args)
+{
+    uint32_t value = strtoul(args.str, NULL, 0);
+    uint32_t limit = 0x1FFFFFFF;
+
+    if (cmd.valueType == VAL_U8) limit = cmd.param;
+    if (cmd.valueType == VAL_U16) limit = 0xFFFF;
+    if (args.str[0] == '-' || value > limit) {
+        Logger::console("Invalid setting! Enter a value 0 - %i", limit);
+        return 0;
+    }
+    Logger::console("Setting %s to %i", cmd.key, value);
+    if (cmd.valueType == VAL_U8) *(uint8_t *)cmd.value = value;
+    else if (cmd.valueType == VAL_U16) *(uint16_t *)cmd.value = value;
+    else *(uint32_t *)cmd.value = value;
+    return cmd.save;
+}
+
+//param is the size of the buffer
+static uint8_t cmdString(const CONSOLE_COMMAND &cmd, CONSOLE_ARGS &args)
+{
+    if (strlen(args.str) >= cmd.param) {
+        Logger::console("Too long! At most %i characters", cmd.param - 1);
+        return 0;
+    }
+    Logger::console("Setting %s to %s", cmd.key, args.str);
+    strcpy((char *)cmd.value, args.str);
+    return cmd.save;
+}
+
+static uint8_t cmdLogLevel(const CONSOLE_COMMAND &, CONSOLE_ARGS &args)
+{
+    static const char *names[] = {"debug", "info", "warning", "error", "off"};
+    static const Logger::LogLevel levels[] = {Logger::Debug, Logger::Info, Logger::Warn, Logger::Error, Logger::Off};
+
+    if (args.value < 0 || args.value > 4) return 0;
+    Logger::console("setting loglevel to '%s'", names[args.value]);
+    Logger::setLoglevel(levels[args.value]);
+    return SAVE_SETTINGS;
+}
+
+static uint8_t cmdSysType(const CONSOLE_COMMAND &, CONSOLE_ARGS &args)
+{
+    if (args.value < 4 && args.value >= 0) {
+        settings.sysType = args.value;
+        Logger::console("System type updated. Power cycle to apply.");
+        return SAVE_SETTINGS;
+    }
+    Logger::console("Invalid system type. Please enter a value of 0 for CanDue (V1), 1 for GEVCU, 2 for CANDue 1.3-2.1, 3 for CANDue 2.2");
+    return 0;
+}
+
+static uint8_t cmdSettingsStatus(const CONSOLE_COMMAND &, CONSOLE_ARGS &)
+{
+    settingsStore.printStatus();
+    return 0;
+}
+
+static uint8_t cmdBootStatus(const CONSOLE_COMMAND &, CONSOLE_ARGS &)
+{
+    bootCapture.printStatus();
+    return 0;
+}
+
+static uint8_t cmdCanEnable(const CONSOLE_COMMAND &cmd, CONSOLE_ARGS &args)
+{
+    int value = args.value;
+
+    if (value < 0) value = 0;
+    if (value > 1) value = 1;
+    Logger::console("Setting CAN%i Enabled to %i", cmd.param, value);
+    *(boolean *)cmd.value = value;
+    if (value == 1) busRegistry.get(cmd.param)->begin();
+    else busRegistry.get(cmd.param)->end();
+    return SAVE_SETTINGS;
+}
+
+//param 2 is single wire
+static uint8_t cmdCanSpeed(const CONSOLE_COMMAND &cmd, CONSOLE_ARGS &args)
+{
+    if (args.value <= 0 || args.value > 1000000) {
+        Logger::console("Invalid baud rate! Enter a value 1 - 1000000");
+        return 0;
+    }
+    *(uint32_t *)cmd.value = args.value;
+    if (cmd.param < 2) Logger::console("Setting CAN%i Baud Rate to %i", cmd.param, args.value);
+    else Logger::console("Setting SWCAN Baud Rate to %i", args.value);
+    if (busRegistry.isEnabled(cmd.param)) busRegistry.get(cmd.param)->begin();
+    return SAVE_SETTINGS;
+}
+
+//param 2 is single wire. The bus is restarted so its filters go back on along with the mode
+static uint8_t cmdListenOnly(const CONSOLE_COMMAND &cmd, CONSOLE_ARGS &args)
+{
+    if (args.value < 0 || args.value > 1) {
+        Logger::console("Invalid setting! Enter a value 0 - 1");
+        return 0;
+    }
+    if (cmd.param < 2) Logger::console("Setting CAN%i Listen Only to %i", cmd.param, args.value);
+    else Logger::console("Setting SWCAN Listen Only to %i", args.value);
+    *(boolean *)cmd.value = args.value;
+    setupBus(cmd.param);
+    return SAVE_SETTINGS;
+}
+
+static uint8_t cmdFilter(const CONSOLE_COMMAND &cmd, CONSOLE_ARGS &args)
+{
+    return filterSet(cmd.param, args.index, args.str) ? SAVE_SETTINGS : 0;
+}
+
+static uint8_t cmdCanSend(const CONSOLE_COMMAND &cmd, CONSOLE_ARGS &args)
+{
+    canSend(cmd.param, args.str, false);
+    return 0;
+}
+
+//the single wire transceiver is on CAN1 unless the board has the MCP2515 for it
+static uint8_t cmdSwWake(const CONSOLE_COMMAND &, CONSOLE_ARGS &args)
+{
+    if (!settings.singleWire_Enabled) {
+        Logger::console("Single wire CAN is off");
+        return 0;
+    }
+    canSend(SysSettings.dedicatedSWCAN ? 2 : 1, args.str, true);
+    return 0;
+}
+
+static uint8_t cmdMark(const CONSOLE_COMMAND &, CONSOLE_ARGS &args)
+{
+    if (settings.fileOutputType == GVRET) Logger::file("Mark: %s", args.str);
+    if (settings.fileOutputType == CRTD) {
+        uint8_t buff[40];
+        int i = timebase.printSeconds((char *)buff);
+        sprintf((char *)buff + i, " CEV ");
+        Logger::fileRaw(buff, strlen((char *)buff));
+        Logger::fileRaw((uint8_t *)args.str, strlen(args.str));
+        buff[0] = '\r';
+        buff[1] = '\n';
+        Logger::fileRaw(buff, 2);
+    }
+    if (!settings.useBinarySerialComm) Logger::console("Mark: %s", args.str);
+    return 0;
+}
+
+static uint8_t cmdFileType(const CONSOLE_COMMAND &, CONSOLE_ARGS &args)
+{
+    int value = args.value;
+
+    if (value < 0) value = 0;
+    if (value > 3) value = 3;
+    Logger::console("Setting File Output Type to %i", value);
+    settings.fileOutputType = (FILEOUTPUTTYPE)value; //the numbers all intentionally match up so this works
+    return SAVE_SETTINGS;
+}
+
+static uint8_t cmdPayload(const CONSOLE_COMMAND &, CONSOLE_ARGS &args)
+{
+    char *dataTok = strtok(args.str, ",");
+    int i = 0;
+
+    if (!dataTok) {
+        Logger::console("Error processing payload");
+        return 0;
+    }
+    while (i < 8 && dataTok) {
+        digToggleSettings.payload[i++] = strtol(dataTok, NULL, 0);
+        dataTok = strtok(NULL, ",");
+    }
+    Logger::console("Set new payload bytes");
+    return SAVE_DIGTOGGLE;
+}
+
+static uint8_t cmdGwRule(const CONSOLE_COMMAND &, CONSOLE_ARGS &args)
+{
+    if (!strcasecmp(args.str, "OFF")) {
+        gatewayRules.clearRule(args.index);
+        gatewayRules.compile();
+        gatewayRules.saveTable();
+        Logger::console("Cleared gateway rule %i", args.index);
+    } else if (gatewayRules.setRule(args.index, args.str)) {
+        gatewayRules.saveTable();
+        Logger::console("Set gateway rule %i", args.index);
+    } else Logger::console("Error processing rule definition");
+    return 0;
+}
+
+static uint8_t cmdGwStats(const CONSOLE_COMMAND &, CONSOLE_ARGS &args)
+{
+    if (args.value == 0) {
+        gatewayRules.resetStats();
+        Logger::console("Gateway statistics reset");
+    } else gatewayRules.printStats();
+    return 0;
+}
+
+static uint8_t cmdTrigger(const CONSOLE_COMMAND &, CONSOLE_ARGS &args)
+{
+    if (!strcasecmp(args.str, "OFF")) {
+        triggerEngine.clearRule(args.index);
+        triggerEngine.compile();
+        triggerEngine.saveTable(args.index);
+        Logger::console("Cleared trigger %i", args.index);
+    } else if (triggerEngine.setRule(args.index, args.str)) {
+        triggerEngine.saveTable(args.index);
+        Logger::console("Set trigger %i", args.index);
+    } else Logger::console("Error processing trigger definition");
+    return 0;
+}
+
+static uint8_t cmdTrigStats(const CONSOLE_COMMAND &, CONSOLE_ARGS &)
+{
+    triggerEngine.printStats();
+    return 0;
+}
+
+static uint8_t cmdIsoTp(const CONSOLE_COMMAND &, CONSOLE_ARGS &args)
+{
+    char *tok[5];
+
+    if (!strcasecmp(args.str, "OFF")) {
+        isoTp.closeSession(args.index);
+        Logger::console("Closed ISO-TP session %i", args.index);
+        return 0;
+    }
+    tok[0] = strtok(args.str, ",");
+    for (int c = 1; c < 5; c++) tok[c] = strtok(NULL, ",");
+    if (!tok[0] || !tok[1] || !tok[2]) {
+        Logger::console("Need at least BUS,TXID,RXID");
+        return 0;
+    }
+    uint32_t txId = strtoul(tok[1], NULL, 0);
+    uint32_t rxId = strtoul(tok[2], NULL, 0);
+    uint8_t flags = ISOTP_PAD;
+    if (txId > 0x7FF || rxId > 0x7FF) flags |= ISOTP_EXTENDED;
+    if (isoTp.setupSession(args.index, strtol(tok[0], NULL, 0), txId, rxId, flags, 0xAA,
+                           tok[3] ? strtol(tok[3], NULL, 0) : 0, tok[4] ? strtol(tok[4], NULL, 0) : 0))
+        Logger::console("Opened ISO-TP session %i", args.index);
+    else Logger::console("Invalid session settings");
+    return 0;
+}
+
+static uint8_t cmdIsoTpStatus(const CONSOLE_COMMAND &, CONSOLE_ARGS &)
+{
+    isoTp.printSessions();
+    return 0;
+}
+
+static uint8_t cmdResponse(const CONSOLE_COMMAND &, CONSOLE_ARGS &args)
+{
+    if (!strcasecmp(args.str, "OFF")) {
+        responder.clearEntry(args.index);
+        responder.compile();
+        responder.saveTable(args.index);
+        Logger::console("Cleared response %i", args.index);
+    } else if (responder.setEntry(args.index, args.str)) {
+        responder.saveTable(args.index);
+        Logger::console("Set response %i", args.index);
+    } else Logger::console("Error processing response definition");
+    return 0;
+}
+
+static uint8_t cmdRespStats(const CONSOLE_COMMAND &, CONSOLE_ARGS &args)
+{
+    if (args.value == 0) {
+        responder.resetStats();
+        Logger::console("Responder statistics reset");
+    } else responder.printStats();
+    return 0;
+}
+
+static uint8_t cmdCyclic(const CONSOLE_COMMAND &, CONSOLE_ARGS &args)
+{
+    if (!strcasecmp(args.str, "OFF")) {
+        cyclicTx.clearMessage(args.index);
+        cyclicTx.compile();
+        cyclicTx.saveTable(args.index);
+        Logger::console("Cleared cyclic message %i", args.index);
+    } else if (cyclicTx.setMessage(args.index, args.str)) {
+        cyclicTx.saveTable(args.index);
+        Logger::console("Set cyclic message %i", args.index);
+    } else Logger::console("Error processing cyclic message definition");
+    return 0;
+}
+
+static uint8_t cmdCyclicStats(const CONSOLE_COMMAND &, CONSOLE_ARGS &args)
+{
+    if (args.value == 0) {
+        cyclicTx.resetStats();
+        Logger::console("Cyclic message statistics reset");
+    } else cyclicTx.printStats();
+    return 0;
+}
+
+static uint8_t cmdSdReplay(const CONSOLE_COMMAND &, CONSOLE_ARGS &args)
+{
+    char *tok[5];
+    uint8_t busMap[3] = {0, 1, 2};
+
+    if (!strcasecmp(args.str, "STOP")) {
+        sdReplay.stop();
+        Logger::console("SD card replay stopped");
+        return 0;
+    }
+    tok[0] = strtok(args.str, ",");
+    for (int c = 1; c < 5; c++) tok[c] = strtok(NULL, ",");
+    FILEOUTPUTTYPE format = tok[1] ? (FILEOUTPUTTYPE)strtol(tok[1], NULL, 0) : settings.fileOutputType;
+    if (tok[4]) {
+        for (int c = 0; c < 3 && tok[4][c]; c++) {
+            busMap[c] = (toupper(tok[4][c]) == 'X') ? SDREPLAY_NO_BUS : tok[4][c] - '0';
+        }
+    }
+    if (!sdReplay.start(tok[0], format, tok[2] ? strtol(tok[2], NULL, 0) : 1,
+                        tok[3] ? strtol(tok[3], NULL, 0) : 100, busMap))
+        Logger::console("Could not start replay");
+    return 0;
+}
+
+static uint8_t cmdReplayStatus(const CONSOLE_COMMAND &, CONSOLE_ARGS &)
+{
+    sdReplay.printStatus();
+    return 0;
+}
+
+static uint8_t cmdTimeSync(const CONSOLE_COMMAND &, CONSOLE_ARGS &args)
+{
+    char *tok[4];
+    uint8_t mode = 255;
+
+    tok[0] = strtok(args.str, ",");
+    for (int c = 1; c < 4; c++) tok[c] = strtok(NULL, ",");
+    if (tok[0] && !strcasecmp(tok[0], "OFF")) mode = TIMESYNC_OFF;
+    else if (tok[0] && !strcasecmp(tok[0], "MASTER")) mode = TIMESYNC_MASTER;
+    else if (tok[0] && !strcasecmp(tok[0], "SLAVE")) mode = TIMESYNC_SLAVE;
+    if (mode == 255 || (mode != TIMESYNC_OFF && !tok[1])) Logger::console("Invalid time sync setting");
+    else if (timeSync.setup(mode, tok[1] ? strtol(tok[1], NULL, 0) : 0,
+                            tok[2] ? strtoul(tok[2], NULL, 0) : TIMESYNC_DEFAULT_ID,
+                            tok[3] ? strtol(tok[3], NULL, 0) : TIMESYNC_DEFAULT_PERIOD))
+        timeSync.printStatus();
+    else Logger::console("Invalid time sync setting");
+    return 0;
+}
+
+static uint8_t cmdTimeSyncStatus(const CONSOLE_COMMAND &, CONSOLE_ARGS &)
+{
+    timeSync.printStatus();
+    return 0;
+}
+
+static uint8_t cmdAdcStream(const CONSOLE_COMMAND &, CONSOLE_ARGS &args)
+{
+    char *tok[3];
+
+    if (!strcasecmp(args.str, "OFF")) {
+        adcStream.stop();
+        Logger::console("Analog streaming stopped");
+        return 0;
+    }
+    tok[0] = strtok(args.str, ",");
+    for (int c = 1; c < 3; c++) tok[c] = strtok(NULL, ",");
+    if (tok[0] && adcStream.start(strtol(tok[0], NULL, 16), tok[1] ? strtol(tok[1], NULL, 0) : 16,
+                                  tok[2] ? strtol(tok[2], NULL, 0) : (long)ADC_OUT_USB))
+        adcStream.printStatus();
+    else Logger::console("Invalid analog stream setting");
+    return 0;
+}
+
+static uint8_t cmdAdcStatus(const CONSOLE_COMMAND &, CONSOLE_ARGS &)
+{
+    adcStream.printStatus();
+    return 0;
+}
+
+static uint8_t cmdAdcFilter(const CONSOLE_COMMAND &, CONSOLE_ARGS &args)
+{
+    static const char *types[] = {"NONE", "BOXCAR", "IIR", "CIC"};
+    ADC_FILTER_SETTINGS filter;
+    char *tok[3];
+
+    getADCFilter(args.index, filter);
+    tok[0] = strtok(args.str, ",");
+    for (int c = 1; c < 3; c++) tok[c] = strtok(NULL, ",");
+    filter.type = 255;
+    for (int c = 0; c < 4; c++) if (tok[0] && !strcasecmp(tok[0], types[c])) filter.type = c;
+    filter.decimation = tok[1] ? strtol(tok[1], NULL, 0) : 1;
+    filter.param = tok[2] ? strtol(tok[2], NULL, 0) : 0;
+    if (!tok[1] || !setADCFilter(args.index, filter)) Logger::console("Invalid analog filter setting");
+    else printADCFilters();
+    return 0;
+}
+
+static uint8_t cmdAdcCal(const CONSOLE_COMMAND &, CONSOLE_ARGS &args)
+{
+    ADC_FILTER_SETTINGS filter;
+    char *tok[2];
+
+    getADCFilter(args.index, filter);
+    tok[0] = strtok(args.str, ",");
+    tok[1] = strtok(NULL, ",");
+    if (tok[0] && tok[1] && atof(tok[1]) >= 0 && atof(tok[1]) < 16) {
+        filter.offset = strtol(tok[0], NULL, 0);
+        filter.gain = (uint16_t)(atof(tok[1]) * ADC_GAIN_ONE + 0.5);
+        setADCFilter(args.index, filter);
+        printADCFilters();
+    } else Logger::console("Invalid analog calibration. GAIN must be under 16");
+    return 0;
+}
+
+static uint8_t cmdAdcFilters(const CONSOLE_COMMAND &, CONSOLE_ARGS &)
+{
+    printADCFilters();
+    return 0;
+}
+
+static uint8_t cmdEdges(const CONSOLE_COMMAND &, CONSOLE_ARGS &args)
+{
+    char *tok[2];
+
+    tok[0] = strtok(args.str, ",");
+    tok[1] = strtok(NULL, ",");
+    if (tok[0] && edgeCapture.setup(strtol(tok[0], NULL, 16), tok[1] ? strtol(tok[1], NULL, 0) : EDGE_DEFAULT_DEBOUNCE))
+        edgeCapture.printStatus();
+    else Logger::console("Invalid edge capture setting");
+    return 0;
+}
+
+static uint8_t cmdEdgeStatus(const CONSOLE_COMMAND &, CONSOLE_ARGS &)
+{
+    edgeCapture.printStatus();
+    return 0;
+}
+
+static uint8_t cmdCensus(const CONSOLE_COMMAND &, CONSOLE_ARGS &args)
+{
+    if (args.value >= 0 && args.value < CENSUS_BUSES) busCensus.printTable(args.value);
+    else for (int b = 0; b < CENSUS_BUSES; b++) busCensus.printTable(b);
+    return 0;
+}
+
+static uint8_t cmdCensusReset(const CONSOLE_COMMAND &, CONSOLE_ARGS &)
+{
+    busCensus.reset();
+    Logger::console("Census cleared");
+    return 0;
+}
+
+static uint8_t cmdCensusSave(const CONSOLE_COMMAND &, CONSOLE_ARGS &args)
+{
+    if (args.value > 0) {
+        busCensus.setAutoSaveInterval(args.value);
+        Logger::console("Census will be saved every %i seconds while logging", args.value);
+    } else if (busCensus.saveToFile()) Logger::console("Saving census to %s", CENSUS_FILENAME);
+    else Logger::console("Could not save census. Is there an SD card?");
+    return 0;
+}
+
+static uint8_t cmdBusLoad(const CONSOLE_COMMAND &, CONSOLE_ARGS &args)
+{
+    if (args.value == 0) {
+        busLoad.reset();
+        Logger::console("Bus load statistics reset");
+    } else busLoad.printStats();
+    return 0;
+}
+
+static uint8_t cmdBusLoadStuff(const CONSOLE_COMMAND &, CONSOLE_ARGS &args)
+{
+    if (args.value >= 0 && args.value <= 1) {
+        busLoad.setWorstCaseStuffing(args.value);
+        Logger::console("Setting bus load stuff bit calculation to %s", args.value ? "worst case" : "estimated");
+    } else Logger::console("Invalid setting! Enter a value 0 - 1");
+    return 0;
+}
+
+static uint8_t cmdBusStatus(const CONSOLE_COMMAND &, CONSOLE_ARGS &)
+{
+    busMonitor.printStatus();
+    return 0;
+}
+
+static uint8_t cmdBuses(const CONSOLE_COMMAND &, CONSOLE_ARGS &)
+{
+    busRegistry.printStatus();
+    return 0;
+}
+
+//the pins are only looked at the first time a bus is set up, changing them takes a power cycle
+static uint8_t cmdExtBus(const CONSOLE_COMMAND &, CONSOLE_ARGS &args)
+{
+    EXTBUS_SETTINGS &ext = settings.extBuses[args.index];
+    CanBus *bus;
+    char *tok[5];
+    int32_t speed;
+
+    tok[0] = strtok(args.str, ",");
+    for (int c = 1; c < 5; c++) tok[c] = strtok(NULL, ",");
+    speed = tok[1] ? strtol(tok[1], NULL, 0) : 0;
+    if (!tok[0] || speed <= 0 || speed > 1000000) {
+        Logger::console("Invalid setting! Enter enable, baud rate (1 - 1000000), listen only, CS pin, INT pin");
+        return 0;
+    }
+    ext.enabled = strtol(tok[0], NULL, 0) ? true : false;
+    ext.speed = speed;
+    ext.listenOnly = (tok[2] && strtol(tok[2], NULL, 0)) ? true : false;
+    if (tok[3] && tok[4]) {
+        ext.csPin = strtol(tok[3], NULL, 0);
+        ext.intPin = strtol(tok[4], NULL, 0);
+    }
+    setupBusRegistry();
+    setupBus(FIRST_EXT_BUS + args.index);
+    bus = busRegistry.get(FIRST_EXT_BUS + args.index);
+    if (bus) bus->printStatus();
+    else Logger::console("Bus %i has no CS and INT pins set", FIRST_EXT_BUS + args.index);
+    return SAVE_SETTINGS;
+}
+
+static uint8_t cmdBusOffRecovery(const CONSOLE_COMMAND &, CONSOLE_ARGS &args)
+{
+    char *comma = strchr(args.str, ',');
+    int maxDelay = comma ? strtol(comma + 1, NULL, 0) : 1000;
+
+    if (args.value >= 0 && args.value <= 10000 && maxDelay >= 0 && maxDelay <= 60000) {
+        busMonitor.setRecoveryBackoff(args.value, maxDelay);
+        if (args.value == 0) Logger::console("Automatic bus-off recovery disabled");
+        else Logger::console("Bus-off recovery after %i ms backing off to %i ms", args.value, maxDelay);
+    } else Logger::console("Invalid setting! Delays are 0 - 10000 and 0 - 60000 ms");
+    return 0;
+}
+
+static uint8_t cmdSignal(const CONSOLE_COMMAND &, CONSOLE_ARGS &args)
+{
+    if (!strcasecmp(args.str, "OFF")) {
+        signalDecoder.clearSignal(args.index);
+        signalDecoder.compile();
+        signalDecoder.saveTable(args.index);
+        Logger::console("Cleared signal %i", args.index);
+    } else if (signalDecoder.setSignal(args.index, args.str)) {
+        signalDecoder.saveTable(args.index);
+        Logger::console("Set signal %i", args.index);
+    } else Logger::console("Error processing signal definition");
+    return 0;
+}
+
+static uint8_t cmdSignals(const CONSOLE_COMMAND &, CONSOLE_ARGS &args)
+{
+    if (args.value == 1) signalDecoder.printValues();
+    else signalDecoder.printSignals();
+    return 0;
+}
+
+static uint8_t cmdSignalStream(const CONSOLE_COMMAND &, CONSOLE_ARGS &args)
+{
+    if (args.value >= 0 && args.value <= 2) {
+        signalDecoder.setStreamMode(args.value);
+        Logger::console("Setting signal stream mode to %i", args.value);
+    } else Logger::console("Invalid setting! Enter a value 0 - 2");
+    return 0;
+}
+
+static uint8_t cmdSignalLog(const CONSOLE_COMMAND &, CONSOLE_ARGS &args)
+{
+    if (args.value >= 0 && args.value <= 1) {
+        signalDecoder.setFileLogging(args.value);
+        Logger::console("Setting signal logging to %i", args.value);
+    } else Logger::console("Invalid setting! Enter a value 0 - 1");
+    return 0;
+}
+
+static void showGwRules()
+{
+    gatewayRules.printRules();
+}
+
+static void showTriggers()
+{
+    triggerEngine.printRules();
+}
+
+static void showResponses()
+{
+    responder.printEntries();
+}
+
+static void showCyclic()
+{
+    cyclicTx.printMessages();
+}
+
+static void showSignals()
+{
+    signalDecoder.printSignals();
+}
+static const CONSOLE_COMMAND commands[] = {
+    //key, count, group, value type, param, save, value, handler, usage, help, extra
+    {"LOGLEVEL", 0, 0, VAL_U8, 0, 0, &settings.logLevel, cmdLogLevel, NULL, "set log level (0=debug, 1=info, 2=warn, 3=error, 4=off)", NULL},
+    {"SYSTYPE", 0, 0, VAL_U8, 0, 0, &settings.sysType, cmdSysType, NULL, "set board type (0=CANDue, 1=GEVCU, 2 = CANDUE1.3-2.1, 3 = CANDUE2.2)", NULL},
+    {"SETTINGSSTATUS", 0, 0, VAL_NONE, 0, 0, NULL, cmdSettingsStatus, "1", "Show where settings are stored in EEPROM and if a write is pending", NULL},
+    {"BOOTSTATUS", 0, 0, VAL_NONE, 0, 0, NULL, cmdBootStatus, "1", "Show how soon the buses were up and what was captured during start up", NULL},
+
+    {"CAN0EN", 0, 1, VAL_BOOL, 0, 0, &settings.CAN0_Enabled, cmdCanEnable, NULL, "Enable/Disable CAN0 (0 = Disable, 1 = Enable)", NULL},
+    {"CAN0SPEED", 0, 1, VAL_U32, 0, 0, &settings.CAN0Speed, cmdCanSpeed, NULL, "Set speed of CAN0 in baud (125000, 250000, etc)", NULL},
+    {"CAN0LISTENONLY", 0, 1, VAL_BOOL, 0, 0, &settings.CAN0ListenOnly, cmdListenOnly, NULL, "Enable/Disable Listen Only Mode (0 = Dis, 1 = En)", NULL},
+    {"CAN0FILTER", 8, 1, VAL_FILTER, 0, 0, settings.CAN0Filters, cmdFilter, NULL, "ID, Mask, Extended, Enabled", NULL},
+
+    {"CAN1EN", 0, 2, VAL_BOOL, 1, 0, &settings.CAN1_Enabled, cmdCanEnable, NULL, "Enable/Disable CAN1 (0 = Disable, 1 = Enable)", NULL},
+    {"CAN1SPEED", 0, 2, VAL_U32, 1, 0, &settings.CAN1Speed, cmdCanSpeed, NULL, "Set speed of CAN1 in baud (125000, 250000, etc)", NULL},
+    {"CAN1LISTENONLY", 0, 2, VAL_BOOL, 1, 0, &settings.CAN1ListenOnly, cmdListenOnly, NULL, "Enable/Disable Listen Only Mode (0 = Dis, 1 = En)", NULL},
+    {"CAN1FILTER", 8, 2, VAL_FILTER, 1, 0, settings.CAN1Filters, cmdFilter, NULL, "ID, Mask, Extended, Enabled", NULL},
+    {"CAN0SEND", 0, 2, VAL_NONE, 0, 0, NULL, cmdCanSend, "ID,LEN,<BYTES SEPARATED BY COMMAS>", "Ex: CAN0SEND=0x200,4,1,2,3,4", NULL},
+    {"CAN1SEND", 0, 2, VAL_NONE, 1, 0, NULL, cmdCanSend, "ID,LEN,<BYTES SEPARATED BY COMMAS>", "Ex: CAN1SEND=0x200,8,00,00,00,10,0xAA,0xBB,0xA0,00", NULL},
+    {"MARK", 0, 2, VAL_NONE, 0, 0, NULL, cmdMark, "<Description of what you are doing>", "Set a mark in the log file about what you are about to do.", NULL},
+    {"SINGLEWIRE", 0, 2, VAL_BOOL, 0, SAVE_SETTINGS, &settings.singleWire_Enabled, cmdFlag, NULL,
+     "Single wire CAN (0 = Off, 1 = Use CAN1 in single wire mode or enable the dedicated interface)", NULL},
+    {"SWSPEED", 0, 2, VAL_U32, 2, 0, &settings.SWCANSpeed, cmdCanSpeed, NULL, "Set speed of SW CAN Interface (33333 or 100000 likely)", NULL},
+    {"SWLISTENONLY", 0, 2, VAL_BOOL, 2, 0, &settings.SWCANListenOnly, cmdListenOnly, NULL, "Enable/Disable Listen Only Mode on the SW CAN Interface (0 = Dis, 1 = En)", NULL},
+    {"SWSEND", 0, 2, VAL_NONE, 2, 0, NULL, cmdCanSend, "ID,LEN,<BYTES SEPARATED BY COMMAS>", "Ex: SWSEND=0x200,4,1,2,3,4", NULL},
+    {"SWWAKE", 0, 2, VAL_NONE, 0, 0, NULL, cmdSwWake, "ID,LEN,<BYTES SEPARATED BY COMMAS>",
+     "Send on single wire with a high voltage wakeup. Ex: SWWAKE=0x621,8,0,0x40,0,0,0,0,0,0", NULL},
+    {"EXTBUS", EXT_BUSES, 2, VAL_NONE, 0, 0, NULL, cmdExtBus, "EN,SPEED,LISTEN[,CS,INT]",
+     "Extra MCP2515 bus on SPI, EXTBUS0 is bus " STR(FIRST_EXT_BUS) ". Pins are 255 when not fitted\nEx: EXTBUS0=1,500000,0,52,50", NULL},
+
+    {"BINSERIAL", 0, 3, VAL_BOOL, 0, SAVE_SETTINGS, &settings.useBinarySerialComm, cmdFlag, NULL, "Enable/Disable Binary Sending of CANBus Frames to Serial (0=Dis, 1=En)", NULL},
+    {"TXECHO", 0, 3, VAL_BOOL, 0, SAVE_SETTINGS, &settings.echoTx, cmdFlag, NULL,
+     "Send frames GVRET transmits to serial and the log file too, once they are on the bus (0=Dis, 1=En)", NULL},
+    {"FILETYPE", 0, 3, VAL_FILETYPE, 0, 0, &settings.fileOutputType, cmdFileType, NULL, "Set type of file output (0=None, 1 = Binary, 2 = GVRET, 3 = CRTD)", NULL},
+
+    {"FILEBASE", 0, 4, VAL_STRING, sizeof(settings.fileNameBase), SAVE_SETTINGS, settings.fileNameBase, cmdString, NULL, "Set filename base for saving", NULL},
+    {"FILEEXT", 0, 4, VAL_STRING, sizeof(settings.fileNameExt), SAVE_SETTINGS, settings.fileNameExt, cmdString, NULL, "Set filename ext for saving", NULL},
+    {"FILENUM", 0, 4, VAL_U16, 0, SAVE_SETTINGS, &settings.fileNum, cmdNumber, NULL, "Set incrementing number for filename", NULL},
+    {"FILEAPPEND", 0, 4, VAL_BOOL, 0, SAVE_SETTINGS, &settings.appendFile, cmdFlag, NULL,
+     "Append to file (no numbers) or use incrementing numbers after basename (0=Incrementing Numbers, 1=Append)", NULL},
+    {"FILEAUTO", 0, 4, VAL_BOOL, 0, SAVE_SETTINGS, &settings.autoStartLogging, cmdFlag, NULL, "Automatically start logging at startup (0=No, 1 = Yes)", NULL},
+
+    {"DIGTOGEN", 0, 5, VAL_BOOL, 0, SAVE_DIGTOGGLE, &digToggleSettings.enabled, cmdFlag, NULL, "Enable digital toggling system (0 = Dis, 1 = En)", NULL},
+    {"DIGTOGMODE", 0, 5, VAL_MODEBIT, 0, SAVE_DIGTOGGLE, &digToggleSettings.mode, cmdModeBit, NULL,
+     "Set digital toggle mode (0 = Read pin, send CAN, 1 = Receive CAN, set pin)", NULL},
+    {"DIGTOGLEVEL", 0, 5, VAL_MODEBIT, 7, SAVE_DIGTOGGLE, &digToggleSettings.mode, cmdModeBit, NULL, "Set default level of digital pin (0 = LOW, 1 = HIGH)", NULL},
+    {"DIGTOGPIN", 0, 5, VAL_U8, 77, SAVE_DIGTOGGLE, &digToggleSettings.pin, cmdNumber, NULL, "Pin to use for digital toggling system (Use Arduino Digital Pin Number)", NULL},
+    {"DIGTOGID", 0, 5, VAL_HEX32, 0, SAVE_DIGTOGGLE, &digToggleSettings.rxTxID, cmdNumber, NULL, "CAN ID to use for Rx or Tx", NULL},
+    {"DIGTOGCAN0", 0, 5, VAL_MODEBIT, 1, SAVE_DIGTOGGLE, &digToggleSettings.mode, cmdModeBit, NULL, "Use CAN0 with Digital Toggling System? (0 = No, 1 = Yes)", NULL},
+    {"DIGTOGCAN1", 0, 5, VAL_MODEBIT, 2, SAVE_DIGTOGGLE, &digToggleSettings.mode, cmdModeBit, NULL, "Use CAN1 with Digital Toggling System? (0 = No, 1 = Yes)", NULL},
+    {"DIGTOGLEN", 0, 5, VAL_U8, 8, SAVE_DIGTOGGLE, &digToggleSettings.length, cmdNumber, NULL, "Length of frame to send (Tx) or validate (Rx)", NULL},
+    {"DIGTOGPAYLOAD", 0, 5, VAL_PAYLOAD, 0, 0, digToggleSettings.payload, cmdPayload, NULL, "Payload to send or validate against (comma separated list)", NULL},
+
+    {"GWRULE", MAX_REWRITE_RULES, 6, VAL_NONE, 0, 0, NULL, cmdGwRule, "ID,BUS,OP:BYTE:VALUE[:PARAM],...",
+     "Rewrite frames passed through the gateway from BUS (0 or 1). OFF clears the rule\n"
+     "OPs: SET, AND, OR, XOR, CNT (VALUE = counter bit mask), CHK (VALUE = 0 XOR, 1 SUM, 2 SUM+ID, 3 CRC8 J1850, 4 CRC8 H2F, PARAM = seed), DROP\n"
+     "Ex: GWRULE0=0x1A0,0,SET:2:0xFF,CNT:6:0x0F,CHK:7:3", showGwRules},
+    {"GWSTATS", 0, 6, VAL_NONE, 0, 0, NULL, cmdGwStats, "1", "Show gateway rewrite statistics (0 resets them)", NULL},
+
+    {"TRIG", MAX_TRIGGERS, 7, VAL_NONE, 0, 0, NULL, cmdTrigger, "TRIGGER;ACTION[;ACTION]",
+     "Run actions when a trigger fires. OFF clears the rule\n"
+     "TRIGGERs: FRAME,BUS,ID[,IDMASK[,PATTERN]] (PATTERN is hex bytes, X = don't care nibble), INPUT,INPUT,RISE/FALL/BOTH, TIMER,MS\n"
+     "ACTIONs: OUT,OUTPUT,0/1/T  PIN,PIN,0/1/T  SEND,BUS,ID[,HEX PAYLOAD]  LOGON  LOGOFF  MARK\n"
+     "Ex: TRIG0=FRAME,0,0x7E8,0x7FF,0562XX;OUT,0,T;MARK", showTriggers},
+    {"TRIGSTATS", 0, 7, VAL_NONE, 0, 0, NULL, cmdTrigStats, "1", "Show how many times each trigger has fired", NULL},
+
+    {"ISOTP", ISOTP_SESSIONS, 8, VAL_NONE, 0, 0, NULL, cmdIsoTp, "BUS,TXID,RXID[,BS,STMIN]", "Open an ISO-TP session for binary mode PDU transfers. OFF closes it", NULL},
+    {"ISOTPSTATUS", 0, 8, VAL_NONE, 0, 0, NULL, cmdIsoTpStatus, "1", "Show ISO-TP sessions", NULL},
+
+    {"RESP", MAX_RESPONSES, 9, VAL_NONE, 0, 0, NULL, cmdResponse, "REQBUS,REQID[,PATTERN];RESPONSE[;RESPONSE][;DELAY]",
+     "Answer a request frame automatically. OFF clears it\n"
+     "RESPONSE: BUS,ID,TEMPLATE where each TEMPLATE byte is hex or Rn to copy request byte n. DELAY is in microseconds\n"
+     "Ex: RESP0=0,0x7E0,0322F190;0,0x7E8,0662F190R3R4AA;200", showResponses},
+    {"RESPSTATS", 0, 9, VAL_NONE, 0, 0, NULL, cmdRespStats, "1", "Show responder hits and request to response latency (0 resets them)", NULL},
+
+    {"CYCLIC", MAX_CYCLIC, 10, VAL_NONE, 0, 0, NULL, cmdCyclic, "BUS,ID,PERIOD,HEX PAYLOAD[,OP:BYTE:VALUE[:PARAM],...]",
+     "Send a frame every PERIOD ms. OFF clears it\n"
+     "OPs are the same as GWRULE, at most " STR(CYCLIC_OPS) ". Ex: CYCLIC0=0,0x3F1,10,0000000000000000,CNT:6:0x0F,CHK:7:0", showCyclic},
+    {"CYCLICSTATS", 0, 10, VAL_NONE, 0, 0, NULL, cmdCyclicStats, "1", "Show sent counts and period jitter for cyclic messages (0 resets them)", NULL},
+
+    {"SDREPLAY", 0, 11, VAL_NONE, 0, 0, NULL, cmdSdReplay, "FILE[,FORMAT,LOOPS,SPEED,MAP]",
+     "Play a log from the SD card onto the buses. STOP ends it\n"
+     "FORMAT as FILETYPE (default the logging format), LOOPS 0 = forever (default 1), SPEED in % (0 = as fast as possible)\n"
+     "MAP is the output bus for buses 0, 1 and 2, X drops that bus. Ex: SDREPLAY=CAN0.BIN,1,0,100,10X\n"
+     "Input " STR(SDREPLAY_BOOT_INPUT) " active at power up replays " SDREPLAY_BOOT_FILE " with the logging extension and format", NULL},
+    {"REPLAYSTATUS", 0, 11, VAL_NONE, 0, 0, NULL, cmdReplayStatus, "1", "Show replay progress and timing error", NULL},
+
+    {"TIMESYNC", 0, 12, VAL_NONE, 0, 0, NULL, cmdTimeSync, "MODE,BUS[,ID[,PERIOD]]",
+     "Share one timebase between units. MODE is MASTER, SLAVE or OFF\n"
+     "ID defaults to " STR(TIMESYNC_DEFAULT_ID) ", PERIOD is ms between master sync frames (default " STR(TIMESYNC_DEFAULT_PERIOD) "). Ex: TIMESYNC=SLAVE,1", NULL},
+    {"TIMESYNCSTATUS", 0, 12, VAL_NONE, 0, 0, NULL, cmdTimeSyncStatus, "1", "Show time sync state, offset error and rate correction", NULL},
+
+    {"ADCSTREAM", 0, 13, VAL_NONE, 0, 0, NULL, cmdAdcStream, "MASK[,AVG[,OUT]]",
+     "Stream every sample of the analog inputs in MASK (hex, 1 = input 0 ... F = all)\n"
+     "AVG is 1, 2, 4 ... 64 samples averaged per value (default 16), OUT 1 = USB, 2 = log file, 3 = both (default 1)\n"
+     "OFF stops it. Ex: ADCSTREAM=3,8,3", NULL},
+    {"ADCSTATUS", 0, 13, VAL_NONE, 0, 0, NULL, cmdAdcStatus, "1", "Show analog streaming rate and lost buffers", NULL},
+    {"ADCFILTER", NUM_ANALOG, 13, VAL_NONE, 0, 0, NULL, cmdAdcFilter, "TYPE,N[,PARAM]",
+     "Filter for an analog input. TYPE is NONE, BOXCAR, IIR or CIC, output rate is input rate / N\n"
+     "PARAM is the IIR shift (1-15) or CIC order (1-" STR(ADC_CIC_MAX_ORDER) "). Ex: ADCFILTER0=CIC,16,3", NULL},
+    {"ADCCAL", NUM_ANALOG, 13, VAL_NONE, 0, 0, NULL, cmdAdcCal, "OFFSET,GAIN", "Value = (filtered - OFFSET) * GAIN. Ex: ADCCAL1=12,0.805", NULL},
+    {"ADCFILTERS", 0, 13, VAL_NONE, 0, 0, NULL, cmdAdcFilters, "1", "Show filter settings, values and filter cost in CPU cycles", NULL},
+
+    {"EDGES", 0, 14, VAL_NONE, 0, 0, NULL, cmdEdges, "MASK[,DEBOUNCE]",
+     "Send timestamped events for edges on the digital inputs in MASK (hex, 0 = none)\n"
+     "DEBOUNCE is how long in us an input is ignored after an edge (default " STR(EDGE_DEFAULT_DEBOUNCE) "). Ex: EDGES=1,500", NULL},
+    {"EDGESTATUS", 0, 14, VAL_NONE, 0, 0, NULL, cmdEdgeStatus, "1", "Show digital input states and edge counts", NULL},
+
+    {"CENSUS", 0, 15, VAL_NONE, 0, 0, NULL, cmdCensus, "<bus>", "Show every ID seen on a bus with count, DLC, period and jitter (9 = all buses)", NULL},
+    {"CENSUSRESET", 0, 15, VAL_NONE, 0, 0, NULL, cmdCensusReset, "1", "Clear the ID census for all buses", NULL},
+    {"CENSUSSAVE", 0, 15, VAL_NONE, 0, 0, NULL, cmdCensusSave, "<seconds>",
+     "Save the census to " CENSUS_FILENAME " now (0) or every so often while logging (default 60)", NULL},
+    {"BUSLOAD", 0, 15, VAL_NONE, 0, 0, NULL, cmdBusLoad, "1", "Show bus load and frame rate for each bus (0 resets peaks)", NULL},
+    {"BUSLOADSTUFF", 0, 15, VAL_NONE, 0, 0, NULL, cmdBusLoadStuff, "<0/1>", "Count estimated (0) or worst case (1) stuff bits when working out bus load", NULL},
+    {"BUSSTATUS", 0, 15, VAL_NONE, 0, 0, NULL, cmdBusStatus, "1", "Show error counters, bus state and bus-off count for each bus", NULL},
+    {"BUSES", 0, 15, VAL_NONE, 0, 0, NULL, cmdBuses, "1", "Show every bus with its frame counts, transmit queues and, for MCP2515 buses, what was received and lost", NULL},
+    {"BUSOFFRECOVERY", 0, 15, VAL_NONE, 0, 0, NULL, cmdBusOffRecovery, "<ms>[,<max ms>]",
+     "Wait before restarting a bus-off controller, doubling up to max (0 = off)", NULL},
+    {"SIGNAL", MAX_SIGNALS, 15, VAL_NONE, 0, 0, NULL, cmdSignal, "<id>,<bus>,<start bit>,<length>,<I/M>,<U/S>,<scale>,<offset>",
+     "Define decoded signal n or OFF\n"
+     "I = Intel (little endian), M = Motorola (big endian), U = unsigned, S = signed. Bits numbered as in DBC files\n"
+     "Ex: SIGNAL0=0x3D3,0,24,16,I,S,0.1,-400", showSignals},
+    {"SIGNALS", 0, 15, VAL_NONE, 0, 0, NULL, cmdSignals, "<0/1>", "Show signal definitions (0) or latest decoded values (1)", NULL},
+    {"SIGNALSTREAM", 0, 15, VAL_NONE, 0, 0, NULL, cmdSignalStream, "<0-2>", "Binary output of decoded signals. 0 = off, 1 = along with frames, 2 = instead of frames", NULL},
+    {"SIGNALLOG", 0, 15, VAL_NONE, 0, 0, NULL, cmdSignalLog, "<0/1>", "Log decoded signals to " SIGNAL_FILENAME " while logging to SD", NULL}
+};
+
+#define NUM_COMMANDS (sizeof(commands) / sizeof(commands[0]))
+
+static uint8_t sortedCommands[NUM_COMMANDS]; //commands[] indexes in key order, plain before indexed for the same key
+
+static int compareCommand(const char *key, bool indexed, const CONSOLE_COMMAND &cmd)
+{
+    int result = strcmp(key, cmd.key);
+    if (result == 0) result = (int)indexed - (int)(cmd.count != 0);
+    return result;
+}
 
 SerialConsole::SerialConsole()
 {
@@ -46,11 +896,116 @@ void SerialConsole::init()
     //State variables for serial console
     ptrBuffer = 0;
     state = STATE_ROOT_MENU;
+
+    //insertion sort, it runs once on a table that barely changes
+    for (uint8_t i = 0; i < NUM_COMMANDS; i++) {
+        uint8_t j = i;
+        while (j > 0 && compareCommand(commands[i].key, commands[i].count != 0, commands[sortedCommands[j - 1]]) < 0) {
+            sortedCommands[j] = sortedCommands[j - 1];
+            j--;
+        }
+        sortedCommands[j] = i;
+    }
+}
+
+const CONSOLE_COMMAND *SerialConsole::findCommand(const char *key, bool indexed)
+{
+    int low = 0;
+    int high = NUM_COMMANDS - 1;
+
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        const CONSOLE_COMMAND &cmd = commands[sortedCommands[mid]];
+        int result = compareCommand(key, indexed, cmd);
+        if (result == 0) return &cmd;
+        if (result < 0) high = mid - 1;
+        else low = mid + 1;
+    }
+    return NULL;
+}
+
+void SerialConsole::printCommandValue(const CONSOLE_COMMAND &cmd, int index)
+{
+    switch (cmd.valueType) {
+    case VAL_BOOL:
+        SerialUSB.print(*(bool *)cmd.value ? 1 : 0);
+        break;
+    case VAL_U8:
+        SerialUSB.print(*(uint8_t *)cmd.value);
+        break;
+    case VAL_U16:
+        SerialUSB.print(*(uint16_t *)cmd.value);
+        break;
+    case VAL_U32:
+        SerialUSB.print(*(uint32_t *)cmd.value);
+        break;
+    case VAL_HEX32:
+        SerialUSB.print("0x");
+        SerialUSB.print(*(uint32_t *)cmd.value, HEX);
+        break;
+    case VAL_STRING:
+        SerialUSB.print((char *)cmd.value);
+        break;
+    case VAL_MODEBIT:
+        SerialUSB.print((*(uint8_t *)cmd.value >> cmd.param) & 1);
+        break;
+    case VAL_FILETYPE:
+        SerialUSB.print((int)*(FILEOUTPUTTYPE *)cmd.value);
+        break;
+    case VAL_FILTER: {
+        FILTER &filter = ((FILTER *)cmd.value)[index];
+        SerialUSB.print("0x");
+        SerialUSB.print(filter.id, HEX);
+        SerialUSB.print(",0x");
+        SerialUSB.print(filter.mask, HEX);
+        SerialUSB.print(",");
+        SerialUSB.print(filter.extended ? 1 : 0);
+        SerialUSB.print(",");
+        SerialUSB.print(filter.enabled ? 1 : 0);
+        break;
+    }
+    case VAL_PAYLOAD:
+        for (int i = 0; i < 8; i++) {
+            if (i) SerialUSB.print(",");
+            SerialUSB.print("0x");
+            SerialUSB.print(((uint8_t *)cmd.value)[i], HEX);
+        }
+        break;
+    default:
+        SerialUSB.print(cmd.usage);
+        break;
+    }
+}
+
+//KEY=value - help, or KEY<0-n>=usage - help. Filters get a line per index since each has a value
+void SerialConsole::printCommandHelp(const CONSOLE_COMMAND &cmd)
+{
+    int lines = (cmd.valueType == VAL_FILTER) ? cmd.count : 1;
+
+    for (int i = 0; i < lines; i++) {
+        SerialUSB.print(cmd.key);
+        if (cmd.valueType == VAL_FILTER) SerialUSB.print(i);
+        else if (cmd.count) {
+            SerialUSB.print("<0-");
+            SerialUSB.print(cmd.count - 1);
+            SerialUSB.print(">");
+        }
+        SerialUSB.print("=");
+        printCommandValue(cmd, i);
+        SerialUSB.print(" - ");
+        for (const char *c = cmd.help; *c; c++) {
+            if (*c == '\n') {
+                SerialUSB.println();
+                SerialUSB.print("    ");
+            } else SerialUSB.print(*c);
+        }
+        SerialUSB.println();
+    }
+    if (cmd.extra) cmd.extra();
 }
 
 void SerialConsole::printMenu()
 {
-    char buff[80];
     //Show build # here as well in case people are using the native port and don't get to see the start up messages
     SerialUSB.print("Build number: ");
     SerialUSB.println(CFG_BUILD_NUM);
@@ -66,64 +1021,12 @@ void SerialConsole::printMenu()
     SerialUSB.println("s = Start logging to file");
     SerialUSB.println("S = Stop logging to file");
     SerialUSB.println();
-    SerialUSB.println("Config Commands (enter command=newvalue). Current values shown in parenthesis:");
-    SerialUSB.println();
+    SerialUSB.println("Config Commands (enter command=newvalue). Current values shown after the =:");
 
-    Logger::console("LOGLEVEL=%i - set log level (0=debug, 1=info, 2=warn, 3=error, 4=off)", settings.logLevel);
-    Logger::console("SYSTYPE=%i - set board type (0=CANDue, 1=GEVCU, 2 = CANDUE1.3-2.1, 3 = CANDUE2.2)", settings.sysType);
-    SerialUSB.println();
-
-    Logger::console("CAN0EN=%i - Enable/Disable CAN0 (0 = Disable, 1 = Enable)", settings.CAN0_Enabled);
-    Logger::console("CAN0SPEED=%i - Set speed of CAN0 in baud (125000, 250000, etc)", settings.CAN0Speed);
-    Logger::console("CAN0LISTENONLY=%i - Enable/Disable Listen Only Mode (0 = Dis, 1 = En)", settings.CAN0ListenOnly);
-    for (int i = 0; i < 8; i++) {
-        sprintf(buff, "CAN0FILTER%i=0x%%x,0x%%x,%%i,%%i (ID, Mask, Extended, Enabled)", i);
-        Logger::console(buff, settings.CAN0Filters[i].id, settings.CAN0Filters[i].mask,
-                        settings.CAN0Filters[i].extended, settings.CAN0Filters[i].enabled);
+    for (uint8_t i = 0; i < NUM_COMMANDS; i++) {
+        if (i == 0 || commands[i].group != commands[i - 1].group) SerialUSB.println();
+        printCommandHelp(commands[i]);
     }
-    SerialUSB.println();
-
-    Logger::console("CAN1EN=%i - Enable/Disable CAN1 (0 = Disable, 1 = Enable)", settings.CAN1_Enabled);
-    Logger::console("CAN1SPEED=%i - Set speed of CAN1 in baud (125000, 250000, etc)", settings.CAN1Speed);
-    Logger::console("CAN1LISTENONLY=%i - Enable/Disable Listen Only Mode (0 = Dis, 1 = En)", settings.CAN1ListenOnly);
-    for (int i = 0; i < 8; i++) {
-        sprintf(buff, "CAN1FILTER%i=0x%%x,0x%%x,%%i,%%i (ID, Mask, Extended, Enabled)", i);
-        Logger::console(buff, settings.CAN1Filters[i].id, settings.CAN1Filters[i].mask,
-                        settings.CAN1Filters[i].extended, settings.CAN1Filters[i].enabled);
-    }
-    Logger::console("CAN0SEND=ID,LEN,<BYTES SEPARATED BY COMMAS> - Ex: C0SEND=0x200,4,1,2,3,4");
-    Logger::console("CAN1SEND=ID,LEN,<BYTES SEPARATED BY COMMAS> - Ex: C1SEND=0x200,8,00,00,00,10,0xAA,0xBB,0xA0,00");
-    Logger::console("MARK=<Description of what you are doing> - Set a mark in the log file about what you are about to do.");
-    if (!SysSettings.dedicatedSWCAN)
-        Logger::console("SINGLEWIRE=%i - Use single wire mode (0 = Normal Mode 1 = Single Wire Mode", settings.singleWire_Enabled);
-    else
-        Logger::console("SINGLEWIRE=%i - Enable/Disable Single Wire CAN interface (0 = Disable 1 = Enable", settings.singleWire_Enabled);
-        Logger::console("SWSPEED=%i - Set speed of SW CAN Interface (33333 or 100000 likely)", settings.SWCANSpeed);
-        Logger::console("SWSEND=ID,LEN,<BYTES SEPARATED BY COMMAS> - Ex: C0SEND=0x200,4,1,2,3,4");
-    SerialUSB.println();
-
-    Logger::console("BINSERIAL=%i - Enable/Disable Binary Sending of CANBus Frames to Serial (0=Dis, 1=En)", settings.useBinarySerialComm);
-    Logger::console("FILETYPE=%i - Set type of file output (0=None, 1 = Binary, 2 = GVRET, 3 = CRTD)", settings.fileOutputType);
-    SerialUSB.println();
-
-    Logger::console("FILEBASE=%s - Set filename base for saving", (char *)settings.fileNameBase);
-    Logger::console("FILEEXT=%s - Set filename ext for saving", (char *)settings.fileNameExt);
-    Logger::console("FILENUM=%i - Set incrementing number for filename", settings.fileNum);
-    Logger::console("FILEAPPEND=%i - Append to file (no numbers) or use incrementing numbers after basename (0=Incrementing Numbers, 1=Append)", settings.appendFile);
-    Logger::console("FILEAUTO=%i - Automatically start logging at startup (0=No, 1 = Yes)", settings.autoStartLogging);
-    SerialUSB.println();
-
-    Logger::console("DIGTOGEN=%i - Enable digital toggling system (0 = Dis, 1 = En)", digToggleSettings.enabled);
-    Logger::console("DIGTOGMODE=%i - Set digital toggle mode (0 = Read pin, send CAN, 1 = Receive CAN, set pin)", digToggleSettings.mode & 1);
-    Logger::console("DIGTOGLEVEL=%i - Set default level of digital pin (0 = LOW, 1 = HIGH)", digToggleSettings.mode >> 7);
-    Logger::console("DIGTOGPIN=%i - Pin to use for digital toggling system (Use Arduino Digital Pin Number)", digToggleSettings.pin);
-    Logger::console("DIGTOGID=%X - CAN ID to use for Rx or Tx", digToggleSettings.rxTxID);
-    Logger::console("DIGTOGCAN0=%i - Use CAN0 with Digital Toggling System? (0 = No, 1 = Yes)", (digToggleSettings.mode >> 1) & 1);
-    Logger::console("DIGTOGCAN1=%i - Use CAN1 with Digital Toggling System? (0 = No, 1 = Yes)", (digToggleSettings.mode >> 2) & 1);
-    Logger::console("DIGTOGLEN=%i - Length of frame to send (Tx) or validate (Rx)", digToggleSettings.length);
-    Logger::console("DIGTOGPAYLOAD=%X,%X,%X,%X,%X,%X,%X,%X - Payload to send or validate against (comma separated list)", digToggleSettings.payload[0],
-                    digToggleSettings.payload[1], digToggleSettings.payload[2], digToggleSettings.payload[3], digToggleSettings.payload[4],
-                    digToggleSettings.payload[5], digToggleSettings.payload[6], digToggleSettings.payload[7]);
 }
 
 /*	There is a help menu (press H or h or ?)
@@ -163,7 +1066,6 @@ void SerialConsole::handleLawicelCmd()
 {
     cmdBuffer[ptrBuffer] = 0; //make sure to null terminate
     CAN_FRAME outFrame;
-    char buff[80];
     int val;
 
     switch (cmdBuffer[0]) {
@@ -171,24 +1073,22 @@ void SerialConsole::handleLawicelCmd()
         outFrame.id = parseHexString(cmdBuffer + 1, 3);
         outFrame.length = cmdBuffer[4] - '0';
         outFrame.extended = false;
-        if (outFrame.length < 0) outFrame.length = 0;
         if (outFrame.length > 8) outFrame.length = 8;
         for (int data = 0; data < outFrame.length; data++) {
             outFrame.data.bytes[data] = parseHexString(cmdBuffer + 5 + (2 * data), 2);
         }
-        Can0.sendFrame(outFrame);
+        sendFrameOnBus(outFrame, 0);
         if (SysSettings.lawicelAutoPoll) SerialUSB.print("z");
         break;
     case 'T': //transmit extended frame
         outFrame.id = parseHexString(cmdBuffer + 1, 8);
         outFrame.length = cmdBuffer[9] - '0';
         outFrame.extended = false;
-        if (outFrame.length < 0) outFrame.length = 0;
         if (outFrame.length > 8) outFrame.length = 8;
         for (int data = 0; data < outFrame.length; data++) {
             outFrame.data.bytes[data] = parseHexString(cmdBuffer + 10 + (2 * data), 2);
         }
-        Can0.sendFrame(outFrame);
+        sendFrameOnBus(outFrame, 0);
         if (SysSettings.lawicelAutoPoll) SerialUSB.print("Z");
         break;
     case 'S': //setup canbus baud via predefined speeds
@@ -250,30 +1150,34 @@ void SerialConsole::handleLawicelCmd()
     SerialUSB.write(13);
 }
 
-/*For simplicity the configuration setting code uses four characters for each configuration choice. This makes things easier for
- comparison purposes.
- */
+/*
+Commands are KEY=VALUE or KEYn=VALUE. The key is looked up as typed first so keys that end in
+a digit like CAN0EN still work, then again with the trailing number split off as the index.
+Nothing here allocates, the key is copied to the stack and the value is used in place.
+*/
 void SerialConsole::handleConfigCmd()
 {
-    int i;
-    int newValue;
-    char *newString;
-    bool writeEEPROM = false;
-    bool writeDigEE = false;
-    char *dataTok;
+    char key[CONSOLE_KEY_MAX];
+    const CONSOLE_COMMAND *cmd;
+    CONSOLE_ARGS args;
+    uint8_t save;
+    int i = 0;
+    int digits;
 
     //Logger::debug("Cmd size: %i", ptrBuffer);
     if (ptrBuffer < 6)
         return; //4 digit command, =, value is at least 6 characters
     cmdBuffer[ptrBuffer] = 0; //make sure to null terminate
-    String cmdString = String();
-    unsigned char whichEntry = '0';
-    i = 0;
 
     while (cmdBuffer[i] != '=' && i < ptrBuffer) {
-        cmdString.concat(String(cmdBuffer[i++]));
+        if (i == CONSOLE_KEY_MAX - 1) {
+            Logger::console("Unknown command");
+            return;
+        }
+        key[i] = toupper(cmdBuffer[i]);
+        i++;
     }
-    i++; //skip the =
+    key[i++] = 0; //skip the =
     if (i >= ptrBuffer) {
         Logger::console("Command needs a value..ie TORQ=3000");
         Logger::console("");
@@ -281,273 +1185,34 @@ void SerialConsole::handleConfigCmd()
     }
 
     // strtol() is able to parse also hex values (e.g. a string "0xCAFE"), useful for enable/disable by device id
-    newValue = strtol((char *) (cmdBuffer + i), NULL, 0); //try to turn the string into a number
-    newString = (char *)(cmdBuffer + i); //leave it as a string
-
-    cmdString.toUpperCase();
-
-    if (cmdString == String("CAN0EN")) {
-        if (newValue < 0) newValue = 0;
-        if (newValue > 1) newValue = 1;
-        Logger::console("Setting CAN0 Enabled to %i", newValue);
-        settings.CAN0_Enabled = newValue;
-        if (newValue == 1) Can0.begin(settings.CAN0Speed, SysSettings.CAN0EnablePin);
-        else Can0.disable();
-        writeEEPROM = true;
-    } else if (cmdString == String("CAN1EN")) {
-        if (newValue < 0) newValue = 0;
-        if (newValue > 1) newValue = 1;
-        Logger::console("Setting CAN1 Enabled to %i", newValue);
-        if (newValue == 1) Can1.begin(settings.CAN1Speed, SysSettings.CAN1EnablePin);
-        else Can1.disable();
-        settings.CAN1_Enabled = newValue;
-        writeEEPROM = true;
-    } else if (cmdString == String("CAN0SPEED")) {
-        if (newValue > 0 && newValue <= 1000000) {
-            Logger::console("Setting CAN0 Baud Rate to %i", newValue);
-            settings.CAN0Speed = newValue;
-            Can0.begin(settings.CAN0Speed, SysSettings.CAN0EnablePin);
-            writeEEPROM = true;
-        } else Logger::console("Invalid baud rate! Enter a value 1 - 1000000");
-    } else if (cmdString == String("CAN1SPEED")) {
-        if (newValue > 0 && newValue <= 1000000) {
-            Logger::console("Setting CAN1 Baud Rate to %i", newValue);
-            settings.CAN1Speed = newValue;
-            Can1.begin(settings.CAN1Speed, SysSettings.CAN1EnablePin);
-            writeEEPROM = true;
-        } else Logger::console("Invalid baud rate! Enter a value 1 - 1000000");
-    } else if (cmdString == String("SWSPEED")) {
-        if (newValue > 0 && newValue <= 1000000) {
-            Logger::console("Setting SWCAN Baud Rate to %i", newValue);
-            settings.SWCANSpeed = newValue;
-            //Can1.begin(settings.CAN1Speed, SysSettings.CAN1EnablePin);
-            writeEEPROM = true;
-        } else Logger::console("Invalid baud rate! Enter a value 1 - 1000000");
-    } else if (cmdString == String("CAN0LISTENONLY")) {
-        if (newValue >= 0 && newValue <= 1) {
-            Logger::console("Setting CAN0 Listen Only to %i", newValue);
-            settings.CAN0ListenOnly = newValue;
-            if (settings.CAN0ListenOnly) {
-                Can0.enable_autobaud_listen_mode();
-            } else {
-                Can0.disable_autobaud_listen_mode();
-            }
-            writeEEPROM = true;
-        } else Logger::console("Invalid setting! Enter a value 0 - 1");
-    } else if (cmdString == String("CAN1LISTENONLY")) {
-        if (newValue >= 0 && newValue <= 1) {
-            Logger::console("Setting CAN1 Listen Only to %i", newValue);
-            settings.CAN1ListenOnly = newValue;
-            if (settings.CAN1ListenOnly) {
-                Can1.enable_autobaud_listen_mode();
-            } else {
-                Can1.disable_autobaud_listen_mode();
+    args.value = strtol((char *) (cmdBuffer + i), NULL, 0); //try to turn the string into a number
+    args.str = (char *)(cmdBuffer + i); //leave it as a string
+    args.index = 0;
+
+    cmd = findCommand(key, false);
+    if (!cmd) {
+        digits = strlen(key);
+        while (digits > 0 && isdigit(key[digits - 1])) digits--;
+        if (digits > 0 && key[digits] && strlen(key + digits) < 4) {
+            args.index = atoi(key + digits);
+            key[digits] = 0;
+            cmd = findCommand(key, true);
+            if (cmd && args.index >= cmd->count) {
+                Logger::console("Invalid index for %s. Must be between 0 and %i", cmd->key, cmd->count - 1);
+                return;
             }
-            writeEEPROM = true;
-        } else Logger::console("Invalid setting! Enter a value 0 - 1");
-    } else if (cmdString == String("CAN0FILTER0")) { //someone should kick me in the face for this laziness... FIX THIS!
-        handleFilterSet(0, 0, newString);
-    } else if (cmdString == String("CAN0FILTER1")) {
-        if (handleFilterSet(0, 1, newString)) writeEEPROM = true;
-    } else if (cmdString == String("CAN0FILTER2")) {
-        if (handleFilterSet(0, 2, newString)) writeEEPROM = true;
-    } else if (cmdString == String("CAN0FILTER3")) {
-        if (handleFilterSet(0, 3, newString)) writeEEPROM = true;
-    } else if (cmdString == String("CAN0FILTER4")) {
-        if (handleFilterSet(0, 4, newString)) writeEEPROM = true;
-    } else if (cmdString == String("CAN0FILTER5")) {
-        if (handleFilterSet(0, 5, newString)) writeEEPROM = true;
-    } else if (cmdString == String("CAN0FILTER6")) {
-        if (handleFilterSet(0, 6, newString)) writeEEPROM = true;
-    } else if (cmdString == String("CAN0FILTER7")) {
-        if (handleFilterSet(0, 7, newString)) writeEEPROM = true;
-    } else if (cmdString == String("CAN1FILTER0")) {
-        if (handleFilterSet(1, 0, newString)) writeEEPROM = true;
-    } else if (cmdString == String("CAN1FILTER1")) {
-        if (handleFilterSet(1, 1, newString)) writeEEPROM = true;
-    } else if (cmdString == String("CAN1FILTER2")) {
-        if (handleFilterSet(1, 2, newString)) writeEEPROM = true;
-    } else if (cmdString == String("CAN1FILTER3")) {
-        if (handleFilterSet(1, 3, newString)) writeEEPROM = true;
-    } else if (cmdString == String("CAN1FILTER4")) {
-        if (handleFilterSet(1, 4, newString)) writeEEPROM = true;
-    } else if (cmdString == String("CAN1FILTER5")) {
-        if (handleFilterSet(1, 5, newString)) writeEEPROM = true;
-    } else if (cmdString == String("CAN1FILTER6")) {
-        if (handleFilterSet(1, 6, newString)) writeEEPROM = true;
-    } else if (cmdString == String("CAN1FILTER7")) {
-        if (handleFilterSet(1, 7, newString)) writeEEPROM = true;
-    } else if (cmdString == String("CAN0SEND")) {
-        handleCANSend(&Can0, newString);
-    } else if (cmdString == String("CAN1SEND")) {
-        handleCANSend(&Can1, newString);
-    } else if (cmdString == String("SWSEND")) {
-        handleCANSend(&SWCAN, newString);        
-    } else if (cmdString == String("MARK")) { //just ascii based for now
-        if (settings.fileOutputType == GVRET) Logger::file("Mark: %s", newString);
-        if (settings.fileOutputType == CRTD) {
-            uint8_t buff[40];
-            sprintf((char *)buff, "%f CEV ", millis() / 1000.0f);
-            Logger::fileRaw(buff, strlen((char *)buff));
-            Logger::fileRaw((uint8_t *)newString, strlen(newString));
-            buff[0] = '\r';
-            buff[1] = '\n';
-            Logger::fileRaw(buff, 2);
         }
-        if (!settings.useBinarySerialComm) Logger::console("Mark: %s", newString);
-
-    } else if (cmdString == String("SINGLEWIRE")) {
-        if (newValue < 0) newValue = 0;
-        if (newValue > 1) newValue = 1;
-        Logger::console("Setting Single Wire Mode to %i", newValue);
-        settings.singleWire_Enabled = newValue;
-        writeEEPROM = true;
-    } else if (cmdString == String("BINSERIAL")) {
-        if (newValue < 0) newValue = 0;
-        if (newValue > 1) newValue = 1;
-        Logger::console("Setting Serial Binary Comm to %i", newValue);
-        settings.useBinarySerialComm = newValue;
-        writeEEPROM = true;
-    } else if (cmdString == String("FILETYPE")) {
-        if (newValue < 0) newValue = 0;
-        if (newValue > 3) newValue = 3;
-        Logger::console("Setting File Output Type to %i", newValue);
-        settings.fileOutputType = (FILEOUTPUTTYPE)newValue; //the numbers all intentionally match up so this works
-        writeEEPROM = true;
-    } else if (cmdString == String("FILEBASE")) {
-        Logger::console("Setting File Base Name to %s", newString);
-        strcpy((char *)settings.fileNameBase, newString);
-        writeEEPROM = true;
-    } else if (cmdString == String("FILEEXT")) {
-        Logger::console("Setting File Extension to %s", newString);
-        strcpy((char *)settings.fileNameExt, newString);
-        writeEEPROM = true;
-    } else if (cmdString == String("FILENUM")) {
-        Logger::console("Setting File Incrementing Number Base to %i", newValue);
-        settings.fileNum = newValue;
-        writeEEPROM = true;
-    } else if (cmdString == String("FILEAPPEND")) {
-        if (newValue < 0) newValue = 0;
-        if (newValue > 1) newValue = 1;
-        Logger::console("Setting File Append Mode to %i", newValue);
-        settings.appendFile = newValue;
-        writeEEPROM = true;
-    } else if (cmdString == String("FILEAUTO")) {
-        if (newValue < 0) newValue = 0;
-        if (newValue > 1) newValue = 1;
-        Logger::console("Setting Auto File Logging Mode to %i", newValue);
-        settings.autoStartLogging = newValue;
-        writeEEPROM = true;
-    } else if (cmdString == String("SYSTYPE")) {
-        if (newValue < 4 && newValue >= 0) {
-            settings.sysType = newValue;
-            writeEEPROM = true;
-            Logger::console("System type updated. Power cycle to apply.");
-        } else Logger::console("Invalid system type. Please enter a value of 0 for CanDue (V1), 1 for GEVCU, 2 for CANDue 1.3-2.1, 3 for CANDue 2.2");
-    } else if (cmdString == String("DIGTOGEN")) {
-        if (newValue >= 0 && newValue <= 1) {
-            Logger::console("Setting Digital Toggle System Enable to %i", newValue);
-            digToggleSettings.enabled = newValue;
-            writeDigEE = true;
-        } else Logger::console("Invalid enable value. Must be either 0 or 1");
-    } else if (cmdString == String("DIGTOGMODE")) {
-        if (newValue >= 0 && newValue <= 1) {
-            Logger::console("Setting Digital Toggle Mode to %i", newValue);
-            if (newValue == 0) digToggleSettings.mode &= ~1;
-            if (newValue == 1) digToggleSettings.mode |= 1;
-            writeDigEE = true;
-        } else Logger::console("Invalid mode. Must be either 0 or 1");
-    } else if (cmdString == String("DIGTOGLEVEL")) {
-        if (newValue >= 0 && newValue <= 1) {
-            Logger::console("Setting Digital Toggle Starting Level to %i", newValue);
-            if (newValue == 0) digToggleSettings.mode &= ~0x80;
-            if (newValue == 1) digToggleSettings.mode |= 0x80;
-            writeDigEE = true;
-        } else Logger::console("Invalid default level. Must be either 0 or 1");
-    } else if (cmdString == String("DIGTOGPIN")) {
-        if (newValue >= 0 && newValue <= 77) {
-            Logger::console("Setting Digital Toggle Pin to %i", newValue);
-            digToggleSettings.pin = newValue;
-            writeDigEE = true;
-        } else Logger::console("Invalid pin. Must be between 0 and 77");
-    } else if (cmdString == String("DIGTOGID")) {
-        if (newValue >= 0 && newValue < (1 << 30)) {
-            Logger::console("Setting Digital Toggle CAN ID to %X", newValue);
-            digToggleSettings.rxTxID = newValue;
-            writeDigEE = true;
-        } else Logger::console("Invalid CAN ID. Must be either an 11 or 29 bit ID");
-    } else if (cmdString == String("DIGTOGCAN0")) {
-        if (newValue >= 0 && newValue <= 1) {
-            Logger::console("Setting Digital Toggle CAN0 Usage to %i", newValue);
-            if (newValue == 0) digToggleSettings.mode &= ~2;
-            if (newValue == 1) digToggleSettings.mode |= 2;
-            writeDigEE = true;
-        } else Logger::console("Invalid value. Must be either 0 or 1");
-    } else if (cmdString == String("DIGTOGCAN1")) {
-        if (newValue >= 0 && newValue <= 1) {
-            Logger::console("Setting Digital Toggle CAN1 Usage to %i", newValue);
-            if (newValue == 0) digToggleSettings.mode &= ~4;
-            if (newValue == 1) digToggleSettings.mode |= 4;
-            writeDigEE = true;
-        } else Logger::console("Invalid value. Must be either 0 or 1");
-    } else if (cmdString == String("DIGTOGLEN")) {
-        if (newValue >= 0 && newValue <= 8) {
-            Logger::console("Setting Digital Toggle Frame Length to %i", newValue);
-            digToggleSettings.length = newValue;
-            writeDigEE = true;
-        } else Logger::console("Invalid length. Must be between 0 and 8");
-    } else if (cmdString == String("DIGTOGPAYLOAD")) {
-        dataTok = strtok(newString, ",");
-        if (dataTok) {
-            digToggleSettings.payload[0] = strtol(dataTok, NULL, 0);
-            i = 1;
-            while (i < 8 && dataTok) {
-                dataTok = strtok(NULL, ",");
-                if (dataTok) {
-                    digToggleSettings.payload[i] = strtol(dataTok, NULL, 0);
-                    i += 1;
-                }
-            }
-            writeDigEE = true;
-            Logger::console("Set new payload bytes");
-        } else Logger::console("Error processing payload");
-    } else if (cmdString == String("LOGLEVEL")) {
-        switch (newValue) {
-        case 0:
-            Logger::setLoglevel(Logger::Debug);
-            Logger::console("setting loglevel to 'debug'");
-            writeEEPROM = true;
-            break;
-        case 1:
-            Logger::setLoglevel(Logger::Info);
-            Logger::console("setting loglevel to 'info'");
-            writeEEPROM = true;
-            break;
-        case 2:
-            Logger::console("setting loglevel to 'warning'");
-            Logger::setLoglevel(Logger::Warn);
-            writeEEPROM = true;
-            break;
-        case 3:
-            Logger::console("setting loglevel to 'error'");
-            Logger::setLoglevel(Logger::Error);
-            writeEEPROM = true;
-            break;
-        case 4:
-            Logger::console("setting loglevel to 'off'");
-            Logger::setLoglevel(Logger::Off);
-            writeEEPROM = true;
-            break;
-        }
-
-    } else {
-        Logger::console("Unknown command");
     }
-    if (writeEEPROM) {
-        EEPROM.write(EEPROM_PAGE, settings);
+    if (!cmd) {
+        Logger::console("Unknown command");
+        return;
     }
-    if (writeDigEE) {
-        EEPROM.write(EEPROM_PAGE + 1, digToggleSettings);
+
+    save = cmd->handler(*cmd, args);
+    if (save & SAVE_SETTINGS) settingsStore.markDirty(STORE_SETTINGS);
+    if (save & SAVE_DIGTOGGLE) {
+        settingsStore.markDirty(STORE_DIGTOGGLE);
+        triggerEngine.compile();
     }
 }
 
@@ -556,7 +1221,7 @@ LAWICEL single letter commands are now mixed in with the other commands here.
 */
 void SerialConsole::handleShortCmd()
 {
-    uint8_t val;
+    char buff[8];
 
     switch (cmdBuffer[0]) {
     case 'h':
@@ -574,7 +1239,7 @@ void SerialConsole::handleShortCmd()
         break;
     case 'R': //reset to factory defaults.
         settings.version = 0xFF;
-        EEPROM.write(EEPROM_PAGE, settings);
+        settingsStore.markDirty(STORE_SETTINGS);
         Logger::console("Power cycle to reset to factory defaults");
         break;
     case 's': //start logging canbus to file
@@ -590,12 +1255,11 @@ void SerialConsole::handleShortCmd()
         SysSettings.lawicelMode = true;
         break;
     case 'C': //LAWICEL close canbus port (First one)
-        Can0.disable();
+        busRegistry.get(0)->end();
         SerialUSB.write(13); //send CR to mean "ok"
         break;
     case 'L': //LAWICEL open canbus port in listen only mode
-        Can0.begin(settings.CAN0Speed, SysSettings.CAN1EnablePin); //this is NOT really listen only mode but it isn't supported yet so for now...
-        Can0.enable();
+        busRegistry.get(0)->begin(); //only listen only if CAN0 is set to be, LAWICEL can't change the settings
         SerialUSB.write(13); //send CR to mean "ok"
         SysSettings.lawicelMode = true;
         break;
@@ -608,7 +1272,8 @@ void SerialConsole::handleShortCmd()
         if (SysSettings.lawicelPollCounter == 0) SerialUSB.write(13);
         break;
     case 'F': //LAWICEL - read status bits
-        SerialUSB.print("F00"); //bit 0 = RX Fifo Full, 1 = TX Fifo Full, 2 = Error warning, 3 = Data overrun, 5= Error passive, 6 = Arb. Lost, 7 = Bus Error
+        sprintf(buff, "F%02X", busMonitor.getLawicelStatus()); //bit 0 = RX Fifo Full, 1 = TX Fifo Full, 2 = Error warning, 3 = Data overrun, 5= Error passive, 6 = Arb. Lost, 7 = Bus Error
+        SerialUSB.print(buff);
         SerialUSB.write(13);
         break;
     case 'V': //LAWICEL - get version number
@@ -622,79 +1287,6 @@ void SerialConsole::handleShortCmd()
     }
 }
 
-//CAN0FILTER%i=%%i,%%i,%%i,%%i (ID, Mask, Extended, Enabled)", i);
-bool SerialConsole::handleFilterSet(uint8_t bus, uint8_t filter, char *values)
-{
-    if (filter < 0 || filter > 7) return false;
-    if (bus < 0 || bus > 1) return false;
-
-    //there should be four tokens
-    char *idTok = strtok(values, ",");
-    char *maskTok = strtok(NULL, ",");
-    char *extTok = strtok(NULL, ",");
-    char *enTok = strtok(NULL, ",");
-
-    if (!idTok) return false; //if any of them were null then something was wrong. Abort.
-    if (!maskTok) return false;
-    if (!extTok) return false;
-    if (!enTok) return false;
-
-    int idVal = strtol(idTok, NULL, 0);
-    int maskVal = strtol(maskTok, NULL, 0);
-    int extVal = strtol(extTok, NULL, 0);
-    int enVal = strtol(enTok, NULL, 0);
-
-    Logger::console("Setting CAN%iFILTER%i to ID 0x%x Mask 0x%x Extended %i Enabled %i", bus, filter, idVal, maskVal, extVal, enVal);
-
-    if (bus == 0) {
-        settings.CAN0Filters[filter].id = idVal;
-        settings.CAN0Filters[filter].mask = maskVal;
-        settings.CAN0Filters[filter].extended = extVal;
-        settings.CAN0Filters[filter].enabled = enVal;
-        Can0.setRXFilter(filter, idVal, maskVal, extVal);
-    } else if (bus == 1) {
-        settings.CAN1Filters[filter].id = idVal;
-        settings.CAN1Filters[filter].mask = maskVal;
-        settings.CAN1Filters[filter].extended = extVal;
-        settings.CAN1Filters[filter].enabled = enVal;
-        Can1.setRXFilter(filter, idVal, maskVal, extVal);
-    }
-
-    return true;
-}
-
-bool SerialConsole::handleCANSend(CAN_COMMON *port, char *inputString)
-{
-    char *idTok = strtok(inputString, ",");
-    char *lenTok = strtok(NULL, ",");
-    char *dataTok;
-    CAN_FRAME frame;
-
-    if (!idTok) return false;
-    if (!lenTok) return false;
-
-    int idVal = strtol(idTok, NULL, 0);
-    int lenVal = strtol(lenTok, NULL, 0);
-
-    for (int i = 0; i < lenVal; i++) {
-        dataTok = strtok(NULL, ",");
-        if (!dataTok) return false;
-        frame.data.byte[i] = strtol(dataTok, NULL, 0);
-    }
-
-    //things seem good so try to send the frame.
-    frame.id = idVal;
-    if (idVal >= 0x7FF) frame.extended = true;
-    else frame.extended = false;
-    frame.length = lenVal;
-    frame.rtr = 0;
-    port->sendFrame(frame);
-    Logger::console("Sending frame with id: 0x%x len: %i", frame.id, frame.length);
-    SysSettings.txToggle = !SysSettings.txToggle;
-    setLED(SysSettings.LED_CANTX, SysSettings.txToggle);
-    return true;
-}
-
 unsigned int SerialConsole::parseHexCharacter(char chr)
 {
     unsigned int result = 0;
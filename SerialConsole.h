@@ -31,12 +31,61 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "sys_io.h"
 #include "GVRET.h"
 
+#define CONSOLE_KEY_MAX     24
+
+//what a handler wants written back to EEPROM once it's done
+#define SAVE_SETTINGS       1
+#define SAVE_DIGTOGGLE      2
+
+//how the value a command works on is shown in the help
+enum CONSOLE_VALUE {
+    VAL_NONE = 0, //nothing to show, the usage string is printed instead
+    VAL_BOOL,
+    VAL_U8,
+    VAL_U16,
+    VAL_U32,
+    VAL_HEX32,
+    VAL_STRING,
+    VAL_MODEBIT, //bit param of a uint8_t
+    VAL_FILETYPE,
+    VAL_FILTER, //array of FILTER, one help line per index
+    VAL_PAYLOAD //8 bytes
+};
+
+struct CONSOLE_ARGS {
+    int index; //the n in KEYn, 0 for plain keys
+    int value; //the value as a number if it is one
+    char *str; //the value as typed
+};
+
+struct CONSOLE_COMMAND;
+typedef uint8_t (*ConsoleHandler)(const CONSOLE_COMMAND &cmd, CONSOLE_ARGS &args); //returns SAVE_ flags
+
+/*
+One line of the command table. The table is in the order the help shows it and SerialConsole
+builds a sorted index over it once so lookups are a binary search without any String objects.
+*/
+struct CONSOLE_COMMAND {
+    const char *key;
+    uint8_t count; //KEY0 to KEY<count - 1> when not 0
+    uint8_t group; //the help puts a blank line between groups
+    uint8_t valueType;
+    uint8_t param; //bus, bit, limit or whatever else the handler needs
+    uint8_t save; //SAVE_ flags for handlers that only set value
+    void *value;
+    ConsoleHandler handler;
+    const char *usage; //shown after KEY= when there is no value to show
+    const char *help; //each \n starts an indented continuation line
+    void (*extra)(); //prints a table under the help. Can be NULL
+};
+
 class SerialConsole
 {
 public:
     SerialConsole();
     void printMenu();
     void rcvCharacter(uint8_t chr);
+    static const CONSOLE_COMMAND *findCommand(const char *key, bool indexed);
 
 protected:
     enum CONSOLE_STATE {
@@ -53,8 +102,8 @@ private:
     void handleShortCmd();
     void handleConfigCmd();
     void handleLawicelCmd();
-    bool handleFilterSet(uint8_t bus, uint8_t filter, char *values);
-    bool handleCANSend(CAN_COMMON *port, char *inputString); 
+    void printCommandHelp(const CONSOLE_COMMAND &cmd);
+    void printCommandValue(const CONSOLE_COMMAND &cmd, int index);
     unsigned int parseHexCharacter(char chr);
     unsigned int parseHexString(char *str, int length);
 };
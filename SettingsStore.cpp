@@ -0,0 +1,531 @@
+/*
+ * SettingsStore.cpp
+ *
+ * Deferred, wear levelled and CRC checked settings in EEPROM
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#include "SettingsStore.h"
+#include "Logger.h"
+#include "GatewayRules.h"
+#include "SignalDecoder.h"
+#include "TriggerEngine.h"
+#include "Responder.h"
+#include "CyclicTx.h"
+#include "TimeSync.h"
+#include "AdcFilter.h"
+#include "EdgeCapture.h"
+#include <stddef.h>
+#include <Wire_EEPROM.h>
+
+#define STORE_TAG(tag, type, member) {tag, sizeof(((type *)0)->member), offsetof(type, member), 1, NULL}
+#define STORE_ENTRIES(tag, type, count) {tag, sizeof(type), 0, count, NULL}
+#define STORE_TABLE(tag, type, count, blank) {tag, sizeof(type), 0, count, &blank}
+//longest a record of count entries can be, header and all
+#define STORE_ENTRIES_LENGTH(type, count) (sizeof(STORE_HEADER) + (2 + sizeof(type)) * (count))
+
+//Tag numbers are what is in EEPROM. Add new ones at the end and never reuse one
+static const STORE_FIELD settingsFields[] = {
+    STORE_TAG(1, EEPROMSettings, version),
+    STORE_TAG(2, EEPROMSettings, CAN0Speed),
+    STORE_TAG(3, EEPROMSettings, CAN1Speed),
+    STORE_TAG(4, EEPROMSettings, SWCANSpeed),
+    STORE_TAG(5, EEPROMSettings, CAN0_Enabled),
+    STORE_TAG(6, EEPROMSettings, CAN1_Enabled),
+    STORE_TAG(7, EEPROMSettings, singleWire_Enabled),
+    STORE_TAG(8, EEPROMSettings, CAN0Filters),
+    STORE_TAG(9, EEPROMSettings, CAN1Filters),
+    STORE_TAG(10, EEPROMSettings, useBinarySerialComm),
+    STORE_TAG(11, EEPROMSettings, fileOutputType),
+    STORE_TAG(12, EEPROMSettings, fileNameBase),
+    STORE_TAG(13, EEPROMSettings, fileNameExt),
+    STORE_TAG(14, EEPROMSettings, fileNum),
+    STORE_TAG(15, EEPROMSettings, appendFile),
+    STORE_TAG(16, EEPROMSettings, autoStartLogging),
+    STORE_TAG(17, EEPROMSettings, logLevel),
+    STORE_TAG(18, EEPROMSettings, sysType),
+    STORE_TAG(19, EEPROMSettings, CAN0ListenOnly),
+    STORE_TAG(20, EEPROMSettings, CAN1ListenOnly),
+    STORE_TAG(21, EEPROMSettings, SWCANListenOnly),
+    STORE_TAG(22, EEPROMSettings, tablePages),
+    STORE_TAG(23, EEPROMSettings, extBuses),
+    STORE_TAG(24, EEPROMSettings, echoTx),
+    STORE_TAG(25, EEPROMSettings, storedRecords)
+};
+
+static const STORE_FIELD digToggleFields[] = {
+    STORE_TAG(1, DigitalCANToggleSettings, mode),
+    STORE_TAG(2, DigitalCANToggleSettings, pin),
+    STORE_TAG(3, DigitalCANToggleSettings, rxTxID),
+    STORE_TAG(4, DigitalCANToggleSettings, payload),
+    STORE_TAG(5, DigitalCANToggleSettings, length),
+    STORE_TAG(6, DigitalCANToggleSettings, enabled)
+};
+
+//what each table's clear function leaves behind
+static const REWRITE_RULE blankRule = {};
+static const SIGNAL_DEF blankSignal = {0, 0, 0, 0, 0, 1.0f, 0.0f};
+static const TRIGGER_RULE blankTrigger = {};
+static const RESPONSE_ENTRY blankResponse = {};
+static const CYCLIC_MSG blankCyclic = {};
+
+//the tables are arrays of entries, entry n is tag n + 1
+static const STORE_FIELD gatewayFields[] = {STORE_TABLE(1, REWRITE_RULE, MAX_REWRITE_RULES, blankRule)};
+static const STORE_FIELD signalFields[] = {STORE_TABLE(1, SIGNAL_DEF, MAX_SIGNALS, blankSignal)};
+static const STORE_FIELD triggerFields[] = {STORE_TABLE(1, TRIGGER_RULE, MAX_TRIGGERS, blankTrigger)};
+static const STORE_FIELD responderFields[] = {STORE_TABLE(1, RESPONSE_ENTRY, MAX_RESPONSES, blankResponse)};
+static const STORE_FIELD cyclicFields[] = {STORE_TABLE(1, CYCLIC_MSG, MAX_CYCLIC, blankCyclic)};
+static const STORE_FIELD adcFilterFields[] = {STORE_ENTRIES(1, ADC_FILTER_SETTINGS, NUM_ANALOG)};
+
+static const STORE_FIELD timeSyncFields[] = {
+    STORE_TAG(1, TIMESYNC_SETTINGS, mode),
+    STORE_TAG(2, TIMESYNC_SETTINGS, bus),
+    STORE_TAG(3, TIMESYNC_SETTINGS, extended),
+    STORE_TAG(4, TIMESYNC_SETTINGS, id),
+    STORE_TAG(5, TIMESYNC_SETTINGS, period)
+};
+
+static const STORE_FIELD edgeFields[] = {
+    STORE_TAG(1, EDGE_SETTINGS, eventMask),
+    STORE_TAG(2, EDGE_SETTINGS, debounce)
+};
+
+static const char *recordNames[STORE_RECORDS] = {"Settings", "Digital toggle", "Gateway rules", "Signals", "Triggers",
+                                                 "Responder", "Cyclic messages", "Time sync", "ADC filters", "Input edges"};
+//longest STORE_MAGIC_RAW copy. Only these two were ever stored that way
+static const uint16_t recordLength[STORE_RECORDS] = {sizeof(EEPROMSettings), sizeof(DigitalCANToggleSettings)};
+static const STORE_FIELD *const recordFields[STORE_RECORDS] = {settingsFields, digToggleFields, gatewayFields, signalFields,
+                                                               triggerFields, responderFields, cyclicFields, timeSyncFields,
+                                                               adcFilterFields, edgeFields};
+static const uint8_t recordFieldCount[STORE_RECORDS] = {
+    sizeof(settingsFields) / sizeof(STORE_FIELD), sizeof(digToggleFields) / sizeof(STORE_FIELD),
+    sizeof(gatewayFields) / sizeof(STORE_FIELD), sizeof(signalFields) / sizeof(STORE_FIELD),
+    sizeof(triggerFields) / sizeof(STORE_FIELD), sizeof(responderFields) / sizeof(STORE_FIELD),
+    sizeof(cyclicFields) / sizeof(STORE_FIELD), sizeof(timeSyncFields) / sizeof(STORE_FIELD),
+    sizeof(adcFilterFields) / sizeof(STORE_FIELD), sizeof(edgeFields) / sizeof(STORE_FIELD)
+};
+//per slot. This is the EEPROM layout, don't change it. New records go on the end
+static constexpr uint8_t recordPages[STORE_RECORDS] = {2, 1, 1, 3, 3, 5, 5, 1, 1, 1};
+
+static_assert(STORE_ENTRIES_LENGTH(REWRITE_RULE, MAX_REWRITE_RULES) <= recordPages[STORE_GWRULES] * STORE_PAGE_SIZE,
+              "gateway rules don't fit their pages");
+static_assert(STORE_ENTRIES_LENGTH(SIGNAL_DEF, MAX_SIGNALS) <= recordPages[STORE_SIGNALS] * STORE_PAGE_SIZE,
+              "signals don't fit their pages");
+static_assert(STORE_ENTRIES_LENGTH(TRIGGER_RULE, MAX_TRIGGERS) <= recordPages[STORE_TRIGGERS] * STORE_PAGE_SIZE,
+              "triggers don't fit their pages");
+static_assert(STORE_ENTRIES_LENGTH(RESPONSE_ENTRY, MAX_RESPONSES) <= recordPages[STORE_RESPONDER] * STORE_PAGE_SIZE,
+              "responses don't fit their pages");
+static_assert(STORE_ENTRIES_LENGTH(CYCLIC_MSG, MAX_CYCLIC) <= recordPages[STORE_CYCLIC] * STORE_PAGE_SIZE,
+              "cyclic messages don't fit their pages");
+static_assert(STORE_ENTRIES_LENGTH(ADC_FILTER_SETTINGS, NUM_ANALOG) <= recordPages[STORE_ADCFILTER] * STORE_PAGE_SIZE,
+              "ADC filters don't fit their pages");
+static_assert(recordPages[STORE_RESPONDER] <= STORE_MAX_PAGES && recordPages[STORE_CYCLIC] <= STORE_MAX_PAGES,
+              "STORE_MAX_PAGES is smaller than a record");
+
+//CRC-32 (0xEDB88320 reflected). Bitwise is plenty for a few hundred bytes now and then
+static uint32_t crc32(uint32_t crc, const uint8_t *data, uint32_t length)
+{
+    while (length--) {
+        crc ^= *data++;
+        for (int i = 0; i < 8; i++) crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return crc;
+}
+
+SettingsStore::SettingsStore()
+{
+    for (int i = 0; i < STORE_RECORDS; i++) {
+        data[i] = NULL;
+        sequence[i] = 0;
+        crc[i] = 0;
+        slot[i] = STORE_SLOTS - 1; //so the first copy goes in slot 0
+    }
+    dirty = 0;
+    unread = 0;
+    lastChange = 0;
+    writing = -1;
+    writeSlot = 0;
+    writePage = 0;
+    writePages = 0;
+    writeCrc = 0;
+    commits = 0;
+    skipped = 0;
+    badCopies = 0;
+    migrated = 0;
+    data[STORE_SETTINGS] = &settings;
+    data[STORE_DIGTOGGLE] = &digToggleSettings;
+}
+
+void SettingsStore::attach(uint8_t record, void *table)
+{
+    if (record < STORE_RECORDS) data[record] = table;
+}
+
+uint16_t SettingsStore::slotPage(uint8_t record, uint8_t slot)
+{
+    uint16_t page = EEPROM_PAGE_STORE;
+
+    for (int i = 0; i < record; i++) page += recordPages[i] * STORE_SLOTS;
+    return page + slot * recordPages[record];
+}
+
+//only the first page, which is enough to rank the copies without reading all of them
+bool SettingsStore::readHeader(uint8_t record, uint8_t slot, STORE_HEADER &header)
+{
+    EEPROM.read(slotPage(record, slot), *(STORE_PAGE *)image);
+    memcpy(&header, image, sizeof(STORE_HEADER));
+    if (header.magic != STORE_MAGIC && header.magic != STORE_MAGIC_RAW) return false; //never written
+    return sizeof(STORE_HEADER) + header.length <= recordPages[record] * STORE_PAGE_SIZE;
+}
+
+//into image. True if it holds a good copy of the record
+bool SettingsStore::readSlot(uint8_t record, uint8_t slot)
+{
+    STORE_HEADER *header = (STORE_HEADER *)image;
+    uint32_t check;
+    int pages;
+
+    EEPROM.read(slotPage(record, slot), *(STORE_PAGE *)image);
+    pages = (sizeof(STORE_HEADER) + header->length + STORE_PAGE_SIZE - 1) / STORE_PAGE_SIZE;
+    if (pages > recordPages[record]) pages = 0;
+    for (int p = 1; p < pages; p++) {
+        EEPROM.read(slotPage(record, slot) + p, *(STORE_PAGE *)(image + p * STORE_PAGE_SIZE));
+    }
+    if (pages > 0 && (header->magic == STORE_MAGIC || header->length <= recordLength[record])) {
+        check = crc32(0xFFFFFFFF, image + sizeof(STORE_HEADER), header->length);
+        check = crc32(check, (uint8_t *)&header->sequence, sizeof(header->sequence));
+        if (check == header->crc) return true;
+    }
+    badCopies++;
+    return false;
+}
+
+//fields of the record into image after the header. Returns their length
+uint16_t SettingsStore::encode(uint8_t record)
+{
+    return getFields(record, NULL, 0, image + sizeof(STORE_HEADER), recordPages[record] * STORE_PAGE_SIZE - sizeof(STORE_HEADER));
+}
+
+/*
+The fields with the tags asked for, or all of them when count is 0, in the same tag, length,
+value form as EEPROM. Unknown tags are left out, as are blank table entries unless they
+were asked for by tag. Returns the length written to out.
+*/
+uint16_t SettingsStore::getFields(uint8_t record, const uint8_t *tags, uint8_t count, uint8_t *out, uint16_t max)
+{
+    const STORE_FIELD *fields;
+    uint8_t *bytes;
+    uint16_t length = 0;
+    uint8_t tag, size;
+    bool wanted;
+
+    if (record >= STORE_RECORDS || !data[record]) return 0;
+    fields = recordFields[record];
+    bytes = (uint8_t *)data[record];
+    for (int f = 0; f < recordFieldCount[record]; f++) {
+        size = fields[f].size;
+        for (int e = 0; e < fields[f].count; e++) {
+            tag = fields[f].tag + e;
+            wanted = (count == 0);
+            for (int t = 0; t < count; t++) if (tags[t] == tag) wanted = true;
+            if (!wanted) continue;
+            if (count == 0 && fields[f].blank && !memcmp(bytes + fields[f].offset + e * size, fields[f].blank, size)) continue;
+            if (length + 2 + size > max) {
+                Logger::error("%s do not fit, tag %i dropped", recordNames[record], tag);
+                continue;
+            }
+            out[length++] = tag;
+            out[length++] = size;
+            memcpy(out + length, bytes + fields[f].offset + e * size, size);
+            length += size;
+        }
+    }
+    return length;
+}
+
+/*
+Fields from a host into target, a copy of the record. Unlike loading from EEPROM this is
+strict: every tag has to be known and the right size. Returns 0, the first bad tag or 255 if the
+fields run off the end. Anything but 0 leaves target half done and it should be thrown away.
+*/
+uint8_t SettingsStore::setFields(uint8_t record, const uint8_t *in, uint16_t length, void *target)
+{
+    const STORE_FIELD *field;
+    uint16_t pos = 0, offset;
+    uint8_t tag, size;
+
+    if (record >= STORE_RECORDS) return 255;
+    while (pos < length) {
+        if (pos + 2 > length) return 255;
+        tag = in[pos++];
+        size = in[pos++];
+        field = findField(record, tag, offset);
+        if (pos + size > length) return 255;
+        if (!field || size != field->size || tag == 0) return tag ? tag : 255;
+        memcpy((uint8_t *)target + offset, in + pos, size);
+        pos += size;
+    }
+    return 0;
+}
+
+uint8_t SettingsStore::fieldTag(uint8_t record, uint16_t offset)
+{
+    const STORE_FIELD *fields;
+
+    if (record >= STORE_RECORDS) return 0;
+    fields = recordFields[record];
+    for (int f = 0; f < recordFieldCount[record]; f++) {
+        for (int e = 0; e < fields[f].count; e++) {
+            if (fields[f].offset + e * fields[f].size == offset) return fields[f].tag + e;
+        }
+    }
+    return 0;
+}
+
+//and where in the record the tag goes. NULL if the record has no such tag
+const STORE_FIELD *SettingsStore::findField(uint8_t record, uint8_t tag, uint16_t &offset)
+{
+    const STORE_FIELD *fields = recordFields[record];
+
+    for (int f = 0; f < recordFieldCount[record]; f++) {
+        if (tag < fields[f].tag || tag - fields[f].tag >= fields[f].count) continue;
+        offset = fields[f].offset + (tag - fields[f].tag) * fields[f].size;
+        return &fields[f];
+    }
+    return NULL;
+}
+
+/*
+Fields that grew since the copy was written are zero extended, which is right for the
+little endian numbers and the arrays in the settings. Fields that shrank keep their start.
+*/
+void SettingsStore::decode(uint8_t record)
+{
+    STORE_HEADER *header = (STORE_HEADER *)image;
+    const STORE_FIELD *field;
+    uint8_t *bytes = (uint8_t *)data[record];
+    uint8_t *in = image + sizeof(STORE_HEADER);
+    uint16_t pos = 0, offset;
+    uint8_t tag, size;
+
+    if (header->magic == STORE_MAGIC_RAW) { //the struct as it was then, newer fields were only ever added at the end
+        memcpy(bytes, in, header->length);
+        migrated++;
+        return;
+    }
+    fillBlanks(record);
+    while (pos + 2 <= header->length) {
+        tag = in[pos++];
+        size = in[pos++];
+        if (pos + size > header->length) break;
+        field = findField(record, tag, offset);
+        if (field) {
+            if (size < field->size) memset(bytes + offset, 0, field->size);
+            memcpy(bytes + offset, in + pos, (size < field->size) ? size : field->size);
+        }
+        pos += size;
+    }
+}
+
+/*
+Finds the newest good copy by its header and reads the rest of that one only, falling back
+to older copies if it turns out to be bad. A record with changes that haven't been written
+yet is left as it is since it is newer than anything in EEPROM, that way code that saves and
+then reloads everything still sees its change.
+*/
+bool SettingsStore::load(uint8_t record)
+{
+    STORE_HEADER headers[STORE_SLOTS];
+    bool candidate[STORE_SLOTS];
+    int best;
+
+    if (record >= STORE_RECORDS || !data[record]) return false;
+    if (isDirty(record)) return true;
+    if (record >= STORE_GWRULES && !((settings.storedRecords >> record) & 1)) { //empty when it was last written
+        fillBlanks(record);
+        unread |= 1 << record;
+        return true;
+    }
+    if (writing >= 0) { //image is about to be reused, start that copy over later
+        dirty |= 1 << writing;
+        writing = -1;
+    }
+    for (int s = 0; s < STORE_SLOTS; s++) candidate[s] = readHeader(record, s, headers[s]);
+
+    while (true) {
+        best = -1;
+        for (int s = 0; s < STORE_SLOTS; s++) {
+            if (candidate[s] && (best < 0 || (int32_t)(headers[s].sequence - headers[best].sequence) > 0)) best = s;
+        }
+        if (best < 0) return false;
+        if (readSlot(record, best)) break;
+        candidate[best] = false;
+    }
+
+    decode(record);
+    sequence[record] = headers[best].sequence;
+    slot[record] = best;
+    if (headers[best].magic == STORE_MAGIC) {
+        crc[record] = crc32(0xFFFFFFFF, image + sizeof(STORE_HEADER), headers[best].length);
+        if (headers[best].length == 0) setStored(record, false); //nothing in it, skip it next time
+    } else markDirty(record); //rewrite it in the current layout
+    return true;
+}
+
+//the slot and sequence number of the newest copy, good or not, so the next one goes after it
+void SettingsStore::findNewest(uint8_t record)
+{
+    STORE_HEADER header;
+    bool found = false;
+
+    for (int s = 0; s < STORE_SLOTS; s++) {
+        if (!readHeader(record, s, header)) continue;
+        if (found && (int32_t)(header.sequence - sequence[record]) <= 0) continue;
+        sequence[record] = header.sequence;
+        slot[record] = s;
+        found = true;
+    }
+}
+
+//table entries a copy leaves out were blank
+void SettingsStore::fillBlanks(uint8_t record)
+{
+    const STORE_FIELD *fields = recordFields[record];
+    uint8_t *bytes = (uint8_t *)data[record];
+
+    for (int f = 0; f < recordFieldCount[record]; f++) {
+        if (!fields[f].blank) continue;
+        for (int e = 0; e < fields[f].count; e++) {
+            memcpy(bytes + fields[f].offset + e * fields[f].size, fields[f].blank, fields[f].size);
+        }
+    }
+}
+
+/*
+A record's bit in settings.storedRecords is set as soon as it changes and only cleared once an
+empty copy of it has been written. Settings are record 0 and loop() writes the lowest dirty
+record first, so the bit is in EEPROM before anything it says is there.
+*/
+void SettingsStore::setStored(uint8_t record, bool stored)
+{
+    uint16_t records;
+
+    if (record < STORE_GWRULES) return;
+    records = stored ? (settings.storedRecords | (1 << record)) : (settings.storedRecords & ~(1 << record));
+    if (records == settings.storedRecords) return;
+    settings.storedRecords = records;
+    markDirty(STORE_SETTINGS);
+}
+
+void SettingsStore::markDirty(uint8_t record)
+{
+    setStored(record, true);
+    dirty |= 1 << record;
+    lastChange = millis();
+}
+
+bool SettingsStore::isDirty(uint8_t record)
+{
+    return (dirty & (1 << record)) || writing == record;
+}
+
+bool SettingsStore::tablePageUsed(uint16_t page)
+{
+    uint16_t bit = page - EEPROM_PAGE_GWRULES;
+
+    if (bit >= 16) return true;
+    return (settings.tablePages >> bit) & 1;
+}
+
+//snapshot the record into image. Changes made while it is going out mark it dirty again
+void SettingsStore::startCommit(uint8_t record)
+{
+    STORE_HEADER *header = (STORE_HEADER *)image;
+    uint16_t length;
+    uint32_t check;
+
+    dirty &= ~(1 << record);
+    if (unread & (1 << record)) { //skipped at start up, find out where its copies are first
+        findNewest(record);
+        crc[record] = 0xFFFFFFFF; //CRC of no fields at all, the newest copy is empty
+        unread &= ~(1 << record);
+    }
+    length = encode(record);
+    check = crc32(0xFFFFFFFF, image + sizeof(STORE_HEADER), length);
+    if (sequence[record] != 0 && check == crc[record]) {
+        skipped++; //set back to what was already stored
+        if (length == 0) setStored(record, false);
+        return;
+    }
+    header->magic = STORE_MAGIC;
+    header->length = length;
+    header->sequence = sequence[record] + 1;
+    header->crc = crc32(check, (uint8_t *)&header->sequence, sizeof(header->sequence));
+    writeCrc = check;
+    writing = record;
+    writeSlot = (slot[record] + 1) % STORE_SLOTS;
+    writePage = 0;
+    writePages = (sizeof(STORE_HEADER) + length + STORE_PAGE_SIZE - 1) / STORE_PAGE_SIZE;
+}
+
+/*
+One EEPROM page per call so no single pass of the main loop waits on more than one write. The
+slot being written is never the current copy, so losing power part way through just leaves
+a copy with a bad CRC and the previous one is used.
+*/
+void SettingsStore::loop()
+{
+    if (writing < 0) {
+        if (!dirty || (millis() - lastChange) < STORE_COMMIT_DELAY) return;
+        for (int r = 0; r < STORE_RECORDS; r++) {
+            if (dirty & (1 << r)) {
+                startCommit(r);
+                return;
+            }
+        }
+        return;
+    }
+
+    EEPROM.write(slotPage(writing, writeSlot) + writePage, *(STORE_PAGE *)(image + writePage * STORE_PAGE_SIZE));
+    if (++writePage >= writePages) {
+        sequence[writing] = ((STORE_HEADER *)image)->sequence;
+        crc[writing] = writeCrc;
+        slot[writing] = writeSlot;
+        commits++;
+        if (((STORE_HEADER *)image)->length == 0 && !(dirty & (1 << writing))) setStored(writing, false);
+        writing = -1;
+    }
+}
+
+void SettingsStore::printStatus()
+{
+    for (int r = 0; r < STORE_RECORDS; r++) {
+        if (unread & (1 << r)) Logger::console("%s: empty, not read at start up%s", recordNames[r], isDirty(r) ? ", write pending" : "");
+        else if (sequence[r] == 0) Logger::console("%s: not stored yet%s", recordNames[r], isDirty(r) ? ", write pending" : "");
+        else Logger::console("%s: copy %i in slot %i of %i%s", recordNames[r], sequence[r], slot[r], STORE_SLOTS,
+                                 isDirty(r) ? ", write pending" : "");
+    }
+    Logger::console("%i writes, %i unchanged and skipped, %i bad and %i old layout copies found at start up", commits, skipped,
+                    badCopies, migrated);
+}
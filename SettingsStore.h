@@ -0,0 +1,139 @@
+/*
+ * SettingsStore.h
+ *
+ * Keeps the system settings in EEPROM without holding up the main loop. Code that changes
+ * a setting marks its record dirty and carries on. Once changes stop coming the record
+ * is written from loop() a page per pass, so a burst of changes is one write. Each record
+ * rotates through several slots to spread the wear, and every copy carries a sequence
+ * number and CRC so a torn or corrupt write falls back to the copy before it.
+ *
+ * Records are stored as tag, length, value fields rather than as the struct in RAM. Fields
+ * the firmware doesn't know are skipped and fields the copy doesn't have keep their defaults,
+ * so settings survive the structs changing. Tags are never reused.
+ *
+ * The feature tables (gateway rules, signals, triggers and so on) are records too, each entry
+ * a field of its own. Their modules attach the table when loading it and mark it dirty
+ * when it changes, same as the settings. Blank entries are left out so a copy is only as long
+ * as what is in the table, and settings.storedRecords has a bit per record that holds
+ * anything. Empty ones aren't read at start up at all, their slots are only looked at
+ * when something is next written to them.
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#ifndef SETTINGSSTORE_H_
+#define SETTINGSSTORE_H_
+
+#include <Arduino.h>
+#include "config.h"
+
+#define STORE_PAGE_SIZE     256
+#define STORE_MAX_PAGES     5 //biggest record plus header, in pages
+#define STORE_SLOTS         4 //copies of each record written in turn
+#define STORE_COMMIT_DELAY  250 //ms without changes before a dirty record is written
+#define STORE_MAGIC_RAW     0x5354 //copy of the struct as it was in RAM, only written by older firmware
+#define STORE_MAGIC         0x544C //tag, length, value fields
+
+enum STORE_RECORD {
+    STORE_SETTINGS = 0,
+    STORE_DIGTOGGLE = 1,
+    STORE_GWRULES = 2,
+    STORE_SIGNALS = 3,
+    STORE_TRIGGERS = 4,
+    STORE_RESPONDER = 5,
+    STORE_CYCLIC = 6,
+    STORE_TIMESYNC = 7,
+    STORE_ADCFILTER = 8,
+    STORE_EDGES = 9,
+    STORE_RECORDS = 10
+};
+
+struct STORE_HEADER {
+    uint16_t magic;
+    uint16_t length; //of the fields after the header
+    uint32_t sequence; //highest good one is the current copy
+    uint32_t crc; //of the fields then the sequence number
+};
+
+struct STORE_FIELD {
+    uint8_t tag; //of the first one when there are several
+    uint8_t size;
+    uint16_t offset;
+    uint8_t count; //table entries one after the other, entry n has tag + n
+    const void *blank; //entries the same as this are left out of a copy. NULL to store every one
+};
+
+struct STORE_PAGE {
+    uint8_t bytes[STORE_PAGE_SIZE];
+};
+
+class SettingsStore
+{
+public:
+    SettingsStore();
+    void attach(uint8_t record, void *data); //where a table module keeps its record in RAM
+    bool load(uint8_t record); //fills in what the newest good copy has. False if there is none
+    void markDirty(uint8_t record);
+    bool isDirty(uint8_t record);
+    //pages of the old table layout that held nothing aren't read when bringing the tables over
+    bool tablePageUsed(uint16_t page);
+    uint16_t getFields(uint8_t record, const uint8_t *tags, uint8_t count, uint8_t *out, uint16_t max);
+    uint8_t setFields(uint8_t record, const uint8_t *in, uint16_t length, void *target);
+    uint8_t fieldTag(uint8_t record, uint16_t offset); //tag of the struct member at offset, 0 if it isn't stored
+    void loop();
+    void printStatus();
+
+private:
+    void *data[STORE_RECORDS]; //NULL for a table that hasn't been attached yet
+    uint32_t sequence[STORE_RECORDS]; //of the current copy, 0 when there is none
+    uint32_t crc[STORE_RECORDS]; //of the fields in the current copy
+    uint8_t slot[STORE_RECORDS];
+    uint16_t dirty; //bit per record
+    uint16_t unread; //bit per record skipped at start up as empty, its slots are looked at before it is next written
+    uint32_t lastChange; //millis
+    int8_t writing; //record being committed or -1
+    uint8_t writeSlot;
+    uint8_t writePage;
+    uint8_t writePages;
+    uint32_t writeCrc;
+    uint8_t image[STORE_MAX_PAGES * STORE_PAGE_SIZE]; //header and fields as they go out
+    uint32_t commits;
+    uint32_t skipped; //commits dropped because nothing had really changed
+    uint32_t badCopies; //copies with a bad CRC found while loading
+    uint32_t migrated; //copies of older layouts loaded
+
+    uint16_t slotPage(uint8_t record, uint8_t slot);
+    bool readHeader(uint8_t record, uint8_t slot, STORE_HEADER &header);
+    bool readSlot(uint8_t record, uint8_t slot);
+    uint16_t encode(uint8_t record);
+    void decode(uint8_t record);
+    void startCommit(uint8_t record);
+    void findNewest(uint8_t record);
+    void fillBlanks(uint8_t record);
+    void setStored(uint8_t record, bool stored);
+    const STORE_FIELD *findField(uint8_t record, uint8_t tag, uint16_t &offset);
+};
+
+extern SettingsStore settingsStore;
+
+#endif /* SETTINGSSTORE_H_ */
@@ -0,0 +1,315 @@
+/*
+ * SignalDecoder.cpp
+ *
+ * On device signal decoding with change only output to USB and the SD card
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#include "SignalDecoder.h"
+#include "GVRET.h"
+#include "config.h"
+#include "Logger.h"
+#include "SettingsStore.h"
+#include <Wire_EEPROM.h>
+
+SignalDecoder::SignalDecoder()
+{
+    for (int i = 0; i < MAX_SIGNALS; i++) clearSignal(i);
+    streamMode = SIGSTREAM_OFF;
+    logToFile = true;
+    logBuffLength = 0;
+    lastLogWrite = 0;
+    compile();
+}
+
+SIGNAL_DEF &SignalDecoder::getSignal(uint8_t which)
+{
+    return pages[which / SIGNALS_PER_PAGE].signals[which % SIGNALS_PER_PAGE];
+}
+
+void SignalDecoder::loadTable()
+{
+    settingsStore.attach(STORE_SIGNALS, pages);
+    if (!settingsStore.isDirty(STORE_SIGNALS)) { //otherwise what is in RAM is newer than anything stored
+        for (int i = 0; i < MAX_SIGNALS; i++) clearSignal(i);
+        if (!settingsStore.load(STORE_SIGNALS)) { //from before the tables were records, or a blank EEPROM
+            for (int p = 0; p < SIGNAL_PAGES; p++) {
+                if (!settingsStore.tablePageUsed(EEPROM_PAGE_SIGNALS + p)) continue; //nothing stored there
+                EEPROM.read(EEPROM_PAGE_SIGNALS + p, pages[p]);
+                if (pages[p].signals[0].flags == SIG_UNUSED) {
+                    Logger::console("Resetting signal definitions page %i to defaults", p);
+                    for (int i = 0; i < SIGNALS_PER_PAGE; i++) clearSignal(p * SIGNALS_PER_PAGE + i);
+                }
+            }
+            settingsStore.markDirty(STORE_SIGNALS);
+        }
+    }
+    compile();
+}
+
+void SignalDecoder::saveTable(uint8_t which)
+{
+    if (which >= MAX_SIGNALS) return;
+    settingsStore.markDirty(STORE_SIGNALS);
+}
+
+/*
+Works out where each signal sits once so decoding never has to walk bits.
+Intel signals come straight out of the payload read as a little endian 64 bit value.
+Motorola signals come out of the byte swapped payload. In that big endian view DBC start bit s
+(the signal's MSB) lands at bit (7 - s / 8) * 8 + s % 8 and the LSB is length - 1 below it.
+*/
+void SignalDecoder::compile()
+{
+    int msb, lsb;
+
+    index.clear();
+    haveValue = 0;
+    for (int i = 0; i < MAX_SIGNALS; i++) {
+        SIGNAL_DEF &sig = getSignal(i);
+        if (sig.flags == SIG_UNUSED || !(sig.flags & SIG_ENABLED)) continue;
+        if (sig.flags & SIG_MOTOROLA) {
+            msb = (7 - sig.startBit / 8) * 8 + sig.startBit % 8;
+            lsb = msb - sig.length + 1;
+            minLength[i] = 8 - lsb / 8;
+        } else {
+            lsb = sig.startBit;
+            minLength[i] = (sig.startBit + sig.length + 7) / 8;
+        }
+        shift[i] = lsb;
+        mask[i] = (sig.length >= 64) ? 0xFFFFFFFFFFFFFFFFull : ((1ull << sig.length) - 1);
+        if (!index.add(sig.bus, sig.id, i)) {
+            Logger::error("Could not index signal %i", i);
+        }
+    }
+}
+
+void SignalDecoder::clearSignal(uint8_t which)
+{
+    if (which >= MAX_SIGNALS) return;
+    SIGNAL_DEF &sig = getSignal(which);
+    sig.id = 0;
+    sig.bus = 0;
+    sig.startBit = 0;
+    sig.length = 0;
+    sig.flags = 0;
+    sig.scale = 1.0f;
+    sig.offset = 0.0f;
+}
+
+/*
+Signal definitions come from the serial console (or a host side DBC converter) in the form
+ID,BUS,STARTBIT,LENGTH,I|M,U|S,SCALE,OFFSET
+I = Intel (little endian), M = Motorola (big endian, DBC start bit). U = unsigned, S = signed
+For example: 0x3D3,0,24,16,I,S,0.1,-400
+*/
+bool SignalDecoder::setSignal(uint8_t which, char *definition)
+{
+    SIGNAL_DEF sig;
+    char *tok[8];
+    int msb;
+
+    if (which >= MAX_SIGNALS) return false;
+
+    tok[0] = strtok(definition, ",");
+    for (int c = 1; c < 8; c++) tok[c] = strtok(NULL, ",");
+    for (int c = 0; c < 6; c++) if (!tok[c]) return false;
+
+    sig.id = strtoul(tok[0], NULL, 0);
+    sig.bus = strtol(tok[1], NULL, 0);
+    sig.startBit = strtol(tok[2], NULL, 0);
+    sig.length = strtol(tok[3], NULL, 0);
+    sig.flags = SIG_ENABLED;
+    if (toupper(tok[4][0]) == 'M') sig.flags |= SIG_MOTOROLA;
+    else if (toupper(tok[4][0]) != 'I') return false;
+    if (toupper(tok[5][0]) == 'S') sig.flags |= SIG_SIGNED;
+    else if (toupper(tok[5][0]) != 'U') return false;
+    sig.scale = tok[6] ? strtod(tok[6], NULL) : 1.0;
+    sig.offset = tok[7] ? strtod(tok[7], NULL) : 0.0;
+
+    if (sig.bus >= MAX_BUSES || sig.startBit > 63 || sig.length == 0 || sig.length > 64) return false;
+    if (sig.flags & SIG_MOTOROLA) {
+        msb = (7 - sig.startBit / 8) * 8 + sig.startBit % 8;
+        if (msb - sig.length + 1 < 0) return false;
+    } else if (sig.startBit + sig.length > 64) return false;
+
+    getSignal(which) = sig;
+    compile();
+    return true;
+}
+
+/*
+Called for every received frame. Frames with no signals cost one index probe.
+Values only go out when their raw bits change so a steady signal costs nothing after the first frame.
+Output to USB (and to the file minus the first two bytes) is:
+0xF1, PROTO_SIGNAL_DATA, timestamp (4 bytes, micros), count, then count times: signal number, value (float)
+*/
+void SignalDecoder::processFrame(CAN_FRAME &frame, uint8_t bus, uint32_t timestamp)
+{
+    uint32_t slots = index.lookup(bus, frame.id);
+    if (!slots) return;
+
+    uint8_t packet[7 + 5 * MAX_SIGNALS];
+    int pos = 7;
+    uint64_t little = frame.data.value;
+    uint64_t big = __builtin_bswap64(little);
+    uint64_t raw;
+    float value;
+    int which;
+
+    while (slots) {
+        which = __builtin_ctz(slots);
+        slots &= slots - 1;
+        if (frame.length < minLength[which]) continue;
+        SIGNAL_DEF &sig = getSignal(which);
+        raw = (((sig.flags & SIG_MOTOROLA) ? big : little) >> shift[which]) & mask[which];
+        if (raw == lastRaw[which] && (haveValue & (1ul << which))) continue;
+        lastRaw[which] = raw;
+        haveValue |= 1ul << which;
+
+        if ((sig.flags & SIG_SIGNED) && sig.length < 64 && (raw >> (sig.length - 1)) & 1) raw |= ~mask[which];
+        if (sig.flags & SIG_SIGNED) value = (float)(int64_t)raw * sig.scale + sig.offset;
+        else value = (float)raw * sig.scale + sig.offset;
+        lastValue[which] = value;
+
+        packet[pos++] = which;
+        memcpy(&packet[pos], &value, 4);
+        pos += 4;
+    }
+    if (pos == 7) return;
+
+    packet[0] = 0xF1;
+    packet[1] = PROTO_SIGNAL_DATA;
+    packet[2] = (uint8_t)(timestamp & 0xFF);
+    packet[3] = (uint8_t)(timestamp >> 8);
+    packet[4] = (uint8_t)(timestamp >> 16);
+    packet[5] = (uint8_t)(timestamp >> 24);
+    packet[6] = (pos - 7) / 5;
+
+    if (streamMode != SIGSTREAM_OFF && settings.useBinarySerialComm && !SysSettings.lawicelMode) sendBytesToUSB(packet, pos);
+
+    if (logToFile && SysSettings.logToFile && SysSettings.SDCardInserted) {
+        if (!logFile.isOpen() && !logFile.open(SIGNAL_FILENAME, O_CREAT | O_APPEND | O_WRITE)) {
+            Logger::error("Could not open signal log. Signal logging disabled");
+            logToFile = false;
+            return;
+        }
+        if (logBuffLength + pos - 2 > SIGNAL_LOG_BUFF) flushLog();
+        memcpy(logBuff + logBuffLength, packet + 2, pos - 2);
+        logBuffLength += pos - 2;
+    }
+}
+
+void SignalDecoder::flushLog()
+{
+    lastLogWrite = millis();
+    if (logBuffLength == 0 || !logFile.isOpen()) return;
+    if (logFile.write(logBuff, logBuffLength) != logBuffLength) {
+        Logger::error("Write to signal log failed!");
+        logToFile = false;
+    }
+    logFile.sync();
+    logBuffLength = 0;
+}
+
+void SignalDecoder::loop()
+{
+    if (logBuffLength > 0 && millis() - lastLogWrite > 1000) flushLog();
+    if (!SysSettings.logToFile && logFile.isOpen()) {
+        flushLog();
+        logFile.close();
+    }
+}
+
+void SignalDecoder::setStreamMode(uint8_t mode)
+{
+    if (mode > SIGSTREAM_ONLY) mode = SIGSTREAM_OFF;
+    streamMode = mode;
+    haveValue = 0; //so the host gets every value once right away
+}
+
+void SignalDecoder::setFileLogging(boolean enable)
+{
+    logToFile = enable;
+    if (!enable && logFile.isOpen()) {
+        flushLog();
+        logFile.close();
+    }
+}
+
+void SignalDecoder::printSignals()
+{
+    char buff[80];
+    for (int i = 0; i < MAX_SIGNALS; i++) {
+        SIGNAL_DEF &sig = getSignal(i);
+        if (!(sig.flags & SIG_ENABLED)) continue;
+        sprintf(buff, "SIGNAL%i=0x%x,%i,%i,%i,%c,%c,%g,%g", i, (unsigned int)sig.id, sig.bus, sig.startBit, sig.length,
+                (sig.flags & SIG_MOTOROLA) ? 'M' : 'I', (sig.flags & SIG_SIGNED) ? 'S' : 'U', sig.scale, sig.offset);
+        Logger::console(buff);
+    }
+}
+
+void SignalDecoder::printValues()
+{
+    char buff[40];
+    for (int i = 0; i < MAX_SIGNALS; i++) {
+        if (!(getSignal(i).flags & SIG_ENABLED)) continue;
+        if (haveValue & (1ul << i)) sprintf(buff, "Signal %i: %g", i, lastValue[i]);
+        else sprintf(buff, "Signal %i: not seen", i);
+        Logger::console(buff);
+    }
+}
+
+/*
+0xF1, PROTO_GET_SIGNAL_DEFS, count, then for each enabled signal:
+signal number, ID (4 bytes), bus, start bit, length, flags, scale (float), offset (float)
+*/
+void SignalDecoder::sendDefsBinary()
+{
+    uint8_t buff[17];
+    uint8_t count = 0;
+
+    for (int i = 0; i < MAX_SIGNALS; i++) if (getSignal(i).flags & SIG_ENABLED) count++;
+    buff[0] = 0xF1;
+    buff[1] = PROTO_GET_SIGNAL_DEFS;
+    buff[2] = count;
+    sendBytesToUSB(buff, 3);
+
+    for (int i = 0; i < MAX_SIGNALS; i++) {
+        SIGNAL_DEF &sig = getSignal(i);
+        if (!(sig.flags & SIG_ENABLED)) continue;
+        buff[0] = i;
+        buff[1] = (uint8_t)(sig.id & 0xFF);
+        buff[2] = (uint8_t)(sig.id >> 8);
+        buff[3] = (uint8_t)(sig.id >> 16);
+        buff[4] = (uint8_t)(sig.id >> 24);
+        buff[5] = sig.bus;
+        buff[6] = sig.startBit;
+        buff[7] = sig.length;
+        buff[8] = sig.flags;
+        memcpy(&buff[9], &sig.scale, 4);
+        memcpy(&buff[13], &sig.offset, 4);
+        sendBytesToUSB(buff, 17);
+    }
+}
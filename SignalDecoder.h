@@ -0,0 +1,112 @@
+/*
+ * SignalDecoder.h
+ *
+ * Decodes signals (DBC style: start bit, length, byte order, sign, scale and offset)
+ * out of received frames on the device so that long unattended logs and slow links
+ * only have to carry the handful of values that are actually wanted.
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#ifndef SIGNALDECODER_H_
+#define SIGNALDECODER_H_
+
+#include <Arduino.h>
+#include <due_can.h>
+#include <SdFat.h>
+#include "IDIndex.h"
+
+#define SIGNALS_PER_PAGE    16 //16 byte definitions fill a 256 byte EEPROM page
+#define SIGNAL_PAGES        2
+#define MAX_SIGNALS         (SIGNALS_PER_PAGE * SIGNAL_PAGES) //can't be over 32, the ID index returns slots as a bitfield
+#define SIGNAL_FILENAME     "SIGNALS.BIN"
+#define SIGNAL_LOG_BUFF     512
+
+//definition flags
+#define SIG_ENABLED     1
+#define SIG_MOTOROLA    2 //big endian. Start bit is the MSB in DBC numbering
+#define SIG_SIGNED      4
+#define SIG_UNUSED      0xFF //flags of an EEPROM page that was never initialized
+
+enum SIGNAL_STREAM_MODE {
+    SIGSTREAM_OFF = 0,
+    SIGSTREAM_WITH_FRAMES = 1, //decoded values are sent along with the normal frame traffic
+    SIGSTREAM_ONLY = 2 //raw frames are no longer sent over USB, only decoded values
+};
+
+struct SIGNAL_DEF { //16 bytes
+    uint32_t id;
+    uint8_t bus;
+    uint8_t startBit;
+    uint8_t length;
+    uint8_t flags;
+    float scale;
+    float offset;
+};
+
+struct SIGNAL_PAGE { //one page of the EEPROM layout from before the tables were SettingsStore records
+    SIGNAL_DEF signals[SIGNALS_PER_PAGE];
+};
+
+class SignalDecoder
+{
+public:
+    SignalDecoder();
+    void loadTable();
+    void saveTable(uint8_t which); //SettingsStore writes the table once changes stop coming
+    void compile();
+    bool setSignal(uint8_t which, char *definition);
+    void clearSignal(uint8_t which);
+    SIGNAL_DEF &getSignal(uint8_t which);
+    void processFrame(CAN_FRAME &frame, uint8_t bus, uint32_t timestamp);
+    void loop();
+    void printSignals();
+    void printValues();
+    void sendDefsBinary();
+    void setStreamMode(uint8_t mode);
+    void setFileLogging(boolean enable);
+    boolean sendRawFrames() { return streamMode != SIGSTREAM_ONLY; }
+
+private:
+    SIGNAL_PAGE pages[SIGNAL_PAGES];
+    IDIndex index;
+    //worked out by compile() so decoding a signal is a shift and a mask
+    uint8_t shift[MAX_SIGNALS];
+    uint8_t minLength[MAX_SIGNALS];
+    uint64_t mask[MAX_SIGNALS];
+    uint64_t lastRaw[MAX_SIGNALS];
+    float lastValue[MAX_SIGNALS];
+    uint32_t haveValue; //bitfield of signals seen at least once since compile
+    uint8_t streamMode;
+    boolean logToFile;
+    SdFile logFile;
+    uint8_t logBuff[SIGNAL_LOG_BUFF];
+    int logBuffLength;
+    uint32_t lastLogWrite;
+
+    void flushLog();
+};
+
+extern SignalDecoder signalDecoder;
+
+#endif /* SIGNALDECODER_H_ */
@@ -0,0 +1,231 @@
+/*
+ * TimeSync.cpp
+ *
+ * Master and slave ends of the CAN time sync
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#include "TimeSync.h"
+#include "GVRET.h"
+#include "config.h"
+#include "Logger.h"
+#include "Timebase.h"
+#include "CanBus.h"
+#include "SettingsStore.h"
+#include <Wire_EEPROM.h>
+
+TimeSync::TimeSync()
+{
+    config.mode = TIMESYNC_OFF;
+    config.bus = 0;
+    config.extended = 1;
+    config.reserved = 0;
+    config.id = TIMESYNC_DEFAULT_ID;
+    config.period = TIMESYNC_DEFAULT_PERIOD;
+    lastSent = 0;
+    lastReport = 0;
+    syncsSent = 0;
+    syncsLost = 0;
+    syncsReceived = 0;
+    seq = 0;
+    syncLocal = 0;
+}
+
+void TimeSync::setDefaults()
+{
+    config.mode = TIMESYNC_OFF;
+    config.bus = 0;
+    config.extended = 1;
+    config.reserved = 0;
+    config.id = TIMESYNC_DEFAULT_ID;
+    config.period = TIMESYNC_DEFAULT_PERIOD;
+}
+
+void TimeSync::loadSettings()
+{
+    settingsStore.attach(STORE_TIMESYNC, &config);
+    if (!settingsStore.isDirty(STORE_TIMESYNC)) { //otherwise what is in RAM is newer than anything stored
+        setDefaults();
+        if (!settingsStore.load(STORE_TIMESYNC)) { //from before the settings were a record, or a blank EEPROM
+            EEPROM.read(EEPROM_PAGE_TIMESYNC, config);
+            if (config.mode == 255) {
+                Logger::console("Resetting time sync settings to defaults");
+                setDefaults();
+            }
+            settingsStore.markDirty(STORE_TIMESYNC);
+        }
+    }
+    apply();
+}
+
+bool TimeSync::setup(uint8_t mode, uint8_t bus, uint32_t id, uint16_t period)
+{
+    if (mode > TIMESYNC_SLAVE || bus >= MAX_BUSES || id > 0x1FFFFFFF || period == 0) return false;
+    config.mode = mode;
+    config.bus = bus;
+    config.id = id;
+    config.extended = (id > 0x7FF) ? 1 : 0;
+    config.period = period;
+    settingsStore.markDirty(STORE_TIMESYNC);
+    apply();
+    return true;
+}
+
+void TimeSync::apply()
+{
+    servo.reset();
+    syncsSent = 0;
+    syncsLost = 0;
+    syncsReceived = 0;
+    syncLocal = 0;
+    lastSent = millis();
+    lastReport = millis();
+    timebase.setServo((config.mode == TIMESYNC_SLAVE) ? &servo : NULL);
+}
+
+/*
+How long the frame was on the wire. The slave timestamps a frame when it has been fully
+received so the follow up gives the end of the sync frame. A controller that stamps the
+start of a frame gets this added. Bit stuffing is taken as 10% which is about average for
+real data, with one data byte that is a few us either way.
+*/
+uint32_t TimeSync::frameMicros(uint8_t bus, CAN_FRAME &frame)
+{
+    uint32_t speed;
+    uint32_t bits = (frame.extended ? 64 : 44) + frame.length * 8;
+
+    speed = busRegistry.getSpeed(bus);
+    if (speed == 0) return 0;
+    bits += bits / 10;
+    return (uint32_t)((uint64_t)bits * 1000000ul / speed);
+}
+
+/*
+A sync frame's arrival time only comes in as the low 32 bits so the full local time is rebuilt
+from the current time, which is safe as long as the frame is handled within about an hour of
+coming in. It is kept until the follow up with the same sequence brings the master's time for it.
+*/
+void TimeSync::processFrame(CAN_FRAME &frame, uint8_t bus, uint32_t rxMicros)
+{
+    uint64_t reference = 0;
+
+    if (config.mode != TIMESYNC_SLAVE || bus != config.bus) return;
+    if (frame.id != config.id || frame.extended != config.extended) return;
+
+    if (frame.length == TIMESYNC_SYNC_LEN) {
+        if (syncLocal) syncsLost++;
+        syncLocal = timebase.micros64();
+        syncLocal -= (uint32_t)((uint32_t)syncLocal - rxMicros);
+        seq = frame.data.bytes[0];
+    } else if (frame.length == TIMESYNC_FOLLOW_UP_LEN && syncLocal && frame.data.bytes[0] == seq) {
+        for (int c = 7; c >= 1; c--) reference = (reference << 8) | frame.data.bytes[c];
+        servo.sample(syncLocal, reference);
+        syncLocal = 0;
+        syncsReceived++;
+    }
+}
+
+//the master's sync frame is done with, its follow up goes out with the time it was on the bus
+void TimeSync::frameDone(uint32_t tag, bool sent, uint64_t txTicks)
+{
+    CAN_FRAME frame;
+    CanBus *bus = busRegistry.get(config.bus);
+    uint64_t end;
+
+    if (config.mode != TIMESYNC_MASTER || (uint8_t)tag != seq || !bus) return;
+    if (!sent) {
+        syncsLost++;
+        return;
+    }
+    frame.id = config.id;
+    frame.extended = config.extended;
+    frame.rtr = 0;
+    frame.length = TIMESYNC_SYNC_LEN;
+    end = timebase.stampAt(txTicks);
+    if (bus->txStampAtStart()) end += frameMicros(config.bus, frame);
+
+    frame.length = TIMESYNC_FOLLOW_UP_LEN;
+    frame.data.bytes[0] = seq;
+    for (int c = 1; c < 8; c++) frame.data.bytes[c] = end >> ((c - 1) * 8);
+    if (sendFrameOnBus(frame, config.bus, TX_PRIO_HIGH)) syncsSent++;
+    else syncsLost++;
+}
+
+void TimeSync::loop()
+{
+    CAN_FRAME frame;
+
+    if (config.mode == TIMESYNC_MASTER) {
+        if ((uint32_t)(millis() - lastSent) < config.period) return;
+        lastSent += config.period;
+        if ((uint32_t)(millis() - lastSent) >= config.period) lastSent = millis(); //fell behind, don't burst
+        frame.id = config.id;
+        frame.extended = config.extended;
+        frame.rtr = 0;
+        frame.length = TIMESYNC_SYNC_LEN;
+        frame.data.bytes[0] = ++seq;
+        if (!sendFrameOnBus(frame, config.bus, TX_PRIO_HIGH, false, TX_SOURCE_TIMESYNC, seq)) syncsLost++;
+    } else if (config.mode == TIMESYNC_SLAVE) {
+        if ((uint32_t)(millis() - lastReport) < TIMESYNC_REPORT) return;
+        lastReport = millis();
+        sendStatusEvent(false);
+    }
+}
+
+/*
+EVENT_TIME_SYNC: mode << 4 | servo state, last error in us (4 bytes), rate correction in 0.01ppm (2 bytes)
+*/
+void TimeSync::sendStatusEvent(bool fileOnly)
+{
+    uint8_t data[7];
+    int32_t error = servo.getLastError();
+    int32_t freq = servo.getFreqPpb() / 10;
+
+    if (config.mode == TIMESYNC_OFF) return;
+    if (freq > 32767) freq = 32767;
+    if (freq < -32767) freq = -32767;
+    data[0] = (config.mode << 4) | ((config.mode == TIMESYNC_SLAVE) ? servo.getState() : (uint8_t)SERVO_LOCKED);
+    for (int c = 0; c < 4; c++) data[1 + c] = error >> (c * 8);
+    data[5] = freq & 0xFF;
+    data[6] = freq >> 8;
+    if (fileOnly) logEventFrame(EVENT_TIME_SYNC, config.bus, data, 7);
+    else sendEventFrame(EVENT_TIME_SYNC, config.bus, data, 7);
+}
+
+void TimeSync::printStatus()
+{
+    static const char *states[] = {"UNSYNCED", "TRACKING", "LOCKED"};
+
+    if (config.mode == TIMESYNC_OFF) {
+        Logger::console("Time sync is off");
+    } else if (config.mode == TIMESYNC_MASTER) {
+        Logger::console("Time sync master on bus %i ID 0x%x every %i ms, %i syncs sent, %i lost", config.bus, config.id,
+                        config.period, syncsSent, syncsLost);
+    } else {
+        Logger::console("Time sync slave on bus %i ID 0x%x, %i syncs received, %i without a follow up", config.bus,
+                        config.id, syncsReceived, syncsLost);
+        Logger::console("State: %s error: %i us rate: %i ppb", states[servo.getState()], servo.getLastError(),
+                        servo.getFreqPpb());
+    }
+}
@@ -0,0 +1,94 @@
+/*
+ * TimeSync.h
+ *
+ * Lines up the timestamps of several GVRET units on the same vehicle. One unit is the
+ * master and puts its time on a bus every so often, the others are slaves and run a
+ * ClockServo against those frames so their own timestamps come out in the master's
+ * timescale. Logs from all of them can then be merged as they are.
+ *
+ * It is two step like PTP. The master sends a sync frame carrying only a sequence number,
+ * then once the controller reports it sent, a follow up with the time it went. That way
+ * however long the sync frame waited in the transmit queue doesn't matter.
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#ifndef TIMESYNC_H_
+#define TIMESYNC_H_
+
+#include <Arduino.h>
+#include <due_can.h>
+#include "ClockServo.h"
+
+#define TIMESYNC_DEFAULT_ID     0x1FFFFFF0
+#define TIMESYNC_DEFAULT_PERIOD 100 //ms between sync frames from the master
+#define TIMESYNC_REPORT         1000 //ms between sync status events on a slave
+#define TIMESYNC_SYNC_LEN       1 //sync frame: sequence
+#define TIMESYNC_FOLLOW_UP_LEN  8 //follow up: sequence, then the master's time at the end of the sync frame in us, 56 bits
+
+enum TIMESYNC_MODE {
+    TIMESYNC_OFF = 0,
+    TIMESYNC_MASTER = 1,
+    TIMESYNC_SLAVE = 2
+};
+
+struct TIMESYNC_SETTINGS { //SettingsStore record STORE_TIMESYNC
+    uint8_t mode; //255 means the EEPROM page was never initialized
+    uint8_t bus;
+    uint8_t extended;
+    uint8_t reserved;
+    uint32_t id;
+    uint16_t period;
+};
+
+class TimeSync
+{
+public:
+    TimeSync();
+    void loadSettings();
+    bool setup(uint8_t mode, uint8_t bus, uint32_t id, uint16_t period);
+    void processFrame(CAN_FRAME &frame, uint8_t bus, uint32_t rxMicros);
+    void frameDone(uint32_t tag, bool sent, uint64_t txTicks);
+    void loop();
+    void sendStatusEvent(bool fileOnly);
+    void printStatus();
+
+private:
+    TIMESYNC_SETTINGS config;
+    ClockServo servo;
+    uint32_t lastSent; //millis
+    uint32_t lastReport; //millis
+    uint32_t syncsSent; //with their follow up
+    uint32_t syncsLost; //master: never got out. Slave: no follow up for them
+    uint32_t syncsReceived;
+    uint8_t seq; //of the last sync frame sent or received
+    uint64_t syncLocal; //slave: local time the last sync frame came in, 0 once it has had its follow up
+
+    void setDefaults();
+    void apply();
+    uint32_t frameMicros(uint8_t bus, CAN_FRAME &frame);
+};
+
+extern TimeSync timeSync;
+
+#endif /* TIMESYNC_H_ */
@@ -0,0 +1,177 @@
+/*
+ * Timebase.cpp
+ *
+ * 64 bit hardware timestamp counter and host time sync
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#include "Timebase.h"
+#include "GVRET.h"
+
+//TC2 channel 0 free runs over the full 32 bits and interrupts on overflow, every 102 seconds
+void TC6_Handler()
+{
+    if (TC2->TC_CHANNEL[0].TC_SR & TC_SR_COVFS) timebase.overflow();
+}
+
+Timebase::Timebase()
+{
+    overflows = 0;
+    lastEpoch = 0xFFFFFFFF;
+    servo = NULL;
+}
+
+void Timebase::begin()
+{
+    pmc_set_writeprotect(false);
+    pmc_enable_periph_clk(ID_TC6);
+    TC2->TC_CHANNEL[0].TC_CMR = TC_CMR_TCCLKS_TIMER_CLOCK1 | TC_CMR_WAVE | TC_CMR_WAVSEL_UP;
+    TC2->TC_CHANNEL[0].TC_IER = TC_IER_COVFS;
+    TC2->TC_CHANNEL[0].TC_IDR = ~TC_IER_COVFS;
+    NVIC_ClearPendingIRQ(TC6_IRQn);
+    NVIC_EnableIRQ(TC6_IRQn);
+    TC2->TC_CHANNEL[0].TC_CCR = TC_CCR_CLKEN | TC_CCR_SWTRG;
+}
+
+void Timebase::overflow()
+{
+    overflows++;
+}
+
+/*
+If the counter wrapped but its interrupt hasn't run yet, because interrupts are off or
+we are in a handler of the same or higher priority, the overflow is still pending in
+the NVIC. A small counter value along with that pending bit means the upper half is one behind.
+*/
+uint64_t Timebase::ticks()
+{
+    uint32_t primask = __get_PRIMASK();
+    uint32_t hi, lo;
+
+    __disable_irq();
+    hi = overflows;
+    lo = TC2->TC_CHANNEL[0].TC_CV;
+    if (NVIC_GetPendingIRQ(TC6_IRQn) && lo < 0x80000000ul) hi++;
+    __set_PRIMASK(primask);
+    return ((uint64_t)hi << 32) | lo;
+}
+
+uint64_t Timebase::micros64()
+{
+    return ticks() / TIMEBASE_TICKS_US;
+}
+
+uint32_t Timebase::micros32()
+{
+    return (uint32_t)micros64();
+}
+
+uint64_t Timebase::stamp64()
+{
+    return stampAt(ticks());
+}
+
+uint64_t Timebase::stampAt(uint64_t ticks)
+{
+    if (servo) return servo->toReference(ticks / TIMEBASE_TICKS_US);
+    return ticks / TIMEBASE_TICKS_US;
+}
+
+uint32_t Timebase::stamp32()
+{
+    return (uint32_t)stamp64();
+}
+
+void Timebase::setServo(ClockServo *servo)
+{
+    this->servo = servo;
+}
+
+int Timebase::printSeconds(char *buff)
+{
+    return printSeconds(buff, stamp64());
+}
+
+int Timebase::printSeconds(char *buff, uint64_t stamp)
+{
+    return sprintf(buff, "%lu.%06lu", (unsigned long)(stamp / 1000000), (unsigned long)(stamp % 1000000));
+}
+
+/*
+Every time the 32 bit microsecond timestamps in frame traffic wrap, and once at start up,
+the full 64 bit time goes out as an event so USB and SD captures can be unwrapped exactly.
+*/
+void Timebase::loop()
+{
+    uint64_t now = stamp64();
+
+    if ((uint32_t)(now >> 32) == lastEpoch) return;
+    lastEpoch = now >> 32;
+    announce(now, false);
+}
+
+//every new log file starts with the full time so it stands on its own
+void Timebase::logHeader()
+{
+    announce(stamp64(), true);
+}
+
+void Timebase::announce(uint64_t now, bool fileOnly)
+{
+    uint8_t data[8];
+
+    for (int c = 0; c < 8; c++) data[c] = now >> (c * 8);
+    if (fileOnly) logEventFrame(EVENT_TIMEBASE, 0, data, 8);
+    else sendEventFrame(EVENT_TIMEBASE, 0, data, 8);
+}
+
+/*
+0xF1, PROTO_TIME_SYNC64, sequence, tick count when the request was parsed (8), tick count
+just before this reply was written (8), ticks per second (4). Tick counts are in the same
+timescale as stamp64(). The host repeats this a few times
+and uses the round trips with the least delay to work out offset and drift against its clock.
+*/
+void Timebase::sendSync(uint8_t seq, uint64_t rxTicks)
+{
+    uint8_t buff[23];
+    uint64_t txTicks;
+    uint32_t hz = TIMEBASE_HZ;
+    int64_t syncOffset = 0;
+
+    flushSerialBuffer(); //keep it in order with frame traffic without it sitting in the buffer
+    //a slave reports in the master's timescale like everything else it sends
+    if (servo) {
+        uint64_t now = micros64();
+        syncOffset = (int64_t)(servo->toReference(now) - now) * TIMEBASE_TICKS_US;
+    }
+    rxTicks += syncOffset;
+    buff[0] = 0xF1;
+    buff[1] = PROTO_TIME_SYNC64;
+    buff[2] = seq;
+    for (int c = 0; c < 8; c++) buff[3 + c] = rxTicks >> (c * 8);
+    for (int c = 0; c < 4; c++) buff[19 + c] = hz >> (c * 8);
+    txTicks = ticks() + syncOffset;
+    for (int c = 0; c < 8; c++) buff[11 + c] = txTicks >> (c * 8);
+    SerialUSB.write(buff, 23);
+}
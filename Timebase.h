@@ -0,0 +1,70 @@
+/*
+ * Timebase.h
+ *
+ * One clock for everything that leaves the device with a timestamp. A timer/counter
+ * free runs at MCK/2 and its overflow interrupt extends it to 64 bits, so timestamps
+ * have 24ns resolution and never wrap in practice. The 32 bit microsecond values the
+ * existing protocol and file formats carry are the low half of the same count.
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#ifndef TIMEBASE_H_
+#define TIMEBASE_H_
+
+#include <Arduino.h>
+#include "ClockServo.h"
+
+#define TIMEBASE_HZ         (VARIANT_MCK / 2) //TIMER_CLOCK1
+#define TIMEBASE_TICKS_US   (TIMEBASE_HZ / 1000000)
+
+class Timebase
+{
+public:
+    Timebase();
+    void begin();
+    uint64_t ticks(); //safe from interrupts and with interrupts off
+    uint64_t micros64();
+    uint32_t micros32(); //drop in for micros() that agrees with micros64()
+    uint64_t stamp64(); //micros64() mapped onto the time sync master's clock when there is one
+    uint32_t stamp32();
+    uint64_t stampAt(uint64_t ticks); //stamp64() for a tick count taken earlier, like in an interrupt
+    void setServo(ClockServo *servo); //NULL when not following a master
+    int printSeconds(char *buff); //stamp64() in seconds with 6 decimal places. Returns characters written like sprintf
+    int printSeconds(char *buff, uint64_t stamp);
+    void overflow(); //only called from the timer interrupt
+    void loop();
+    void logHeader();
+    void sendSync(uint8_t seq, uint64_t rxTicks);
+
+private:
+    volatile uint32_t overflows;
+    uint32_t lastEpoch; //upper half of stamp64() last announced with EVENT_TIMEBASE
+    ClockServo *servo;
+
+    void announce(uint64_t now, bool fileOnly);
+};
+
+extern Timebase timebase;
+
+#endif /* TIMEBASE_H_ */
@@ -0,0 +1,532 @@
+/*
+ * TriggerEngine.cpp
+ *
+ * Trigger -> action rules for frames, digital inputs and timers
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#include "TriggerEngine.h"
+#include "GVRET.h"
+#include "config.h"
+#include "Logger.h"
+#include "SettingsStore.h"
+#include "sys_io.h"
+#include "EdgeCapture.h"
+#include <Wire_EEPROM.h>
+
+#define FULL_ID_MASK    0x1FFFFFFF
+
+static const char *actionNames[] = {"NONE", "OUT", "PIN", "SEND", "LOGON", "LOGOFF", "MARK"};
+
+int TriggerEngine::hexNibble(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+TriggerEngine::TriggerEngine()
+{
+    for (int i = 0; i < MAX_TRIGGERS; i++) clearRule(i);
+    memset(&digToggleRule, 0, sizeof(digToggleRule));
+    for (int i = 0; i <= MAX_TRIGGERS; i++) fireCount[i] = 0;
+    pendingReport = 0;
+    inputRules = 0;
+    timerRules = 0;
+}
+
+TRIGGER_RULE &TriggerEngine::getRule(uint8_t which)
+{
+    if (which >= MAX_TRIGGERS) return digToggleRule;
+    return pages[which / TRIGGERS_PER_PAGE].rules[which % TRIGGERS_PER_PAGE];
+}
+
+void TriggerEngine::loadTable()
+{
+    settingsStore.attach(STORE_TRIGGERS, pages);
+    if (!settingsStore.isDirty(STORE_TRIGGERS)) { //otherwise what is in RAM is newer than anything stored
+        memset(pages, 0, sizeof(pages));
+        if (!settingsStore.load(STORE_TRIGGERS)) { //from before the tables were records, or a blank EEPROM
+            for (int p = 0; p < TRIGGER_PAGES; p++) {
+                if (!settingsStore.tablePageUsed(EEPROM_PAGE_TRIGGERS + p)) continue; //nothing stored there
+                EEPROM.read(EEPROM_PAGE_TRIGGERS + p, pages[p]);
+                if (pages[p].rules[0].enabled == 255) {
+                    Logger::console("Resetting trigger rules page %i to defaults", p);
+                    for (int i = 0; i < TRIGGERS_PER_PAGE; i++) clearRule(p * TRIGGERS_PER_PAGE + i);
+                }
+            }
+            settingsStore.markDirty(STORE_TRIGGERS);
+        }
+    }
+    compile();
+}
+
+void TriggerEngine::saveTable(uint8_t which)
+{
+    if (which >= MAX_TRIGGERS) return;
+    settingsStore.markDirty(STORE_TRIGGERS);
+}
+
+void TriggerEngine::clearRule(uint8_t which)
+{
+    if (which >= MAX_TRIGGERS) return;
+    memset(&getRule(which), 0, sizeof(TRIGGER_RULE));
+}
+
+/*
+The digital toggle settings are kept as they always were (own EEPROM page and DIGTOG commands)
+but are turned into a rule here so there is only one place that watches frames and pins.
+*/
+void TriggerEngine::buildDigToggleRule()
+{
+    TRIGGER_RULE &rule = digToggleRule;
+    uint8_t length = digToggleSettings.length;
+
+    memset(&rule, 0, sizeof(rule));
+    if (!digToggleSettings.enabled) return;
+    if (length > 8) length = 8;
+    rule.enabled = 1;
+
+    if (digToggleSettings.mode & 1) { //frame in, toggle pin out
+        rule.trigger.type = TRIG_FRAME;
+        rule.trigger.source = (digToggleSettings.mode >> 1) & 3;
+        rule.trigger.id = digToggleSettings.rxTxID;
+        rule.trigger.idMask = FULL_ID_MASK;
+        rule.trigger.length = length;
+        for (int c = 0; c < length; c++) {
+            rule.trigger.dataMask[c] = 0xFF;
+            rule.trigger.dataValue[c] = digToggleSettings.payload[c];
+        }
+        rule.actions[0].type = ACT_PIN;
+        rule.actions[0].target = digToggleSettings.pin;
+        rule.actions[0].value = 2;
+    } else { //pin in, frame out on every change
+        rule.trigger.type = TRIG_INPUT;
+        rule.trigger.source = digToggleSettings.pin;
+        rule.trigger.flags = TRIGF_RAW_PIN | TRIGF_RISING | TRIGF_FALLING;
+        for (int i = 0; i < NUM_DIGITAL; i++) { //one of the digital inputs gets interrupt captured edges instead of polling
+            if (getDigitalPin(i) != digToggleSettings.pin) continue;
+            rule.trigger.source = i;
+            rule.trigger.flags = TRIGF_RISING | TRIGF_FALLING;
+        }
+        for (int bus = 0; bus < 2; bus++) {
+            ACTION &action = rule.actions[bus];
+            if (!(digToggleSettings.mode & (2 << bus))) continue;
+            action.type = ACT_SEND;
+            action.target = bus;
+            action.id = digToggleSettings.rxTxID;
+            action.extended = (action.id > 0x7FF) ? 1 : 0;
+            action.value = length;
+            for (int c = 0; c < length; c++) action.data[c] = digToggleSettings.payload[c];
+        }
+    }
+}
+
+/*
+Frame triggers with a full ID mask go into the ID index so frames without a rule cost a single
+hash probe. Masked IDs have to be looked at for every frame on their buses so they are wildcards.
+Should be called again whenever a rule or the digital toggle settings change.
+*/
+void TriggerEngine::compile()
+{
+    buildDigToggleRule();
+    index.clear();
+    inputRules = 0;
+    timerRules = 0;
+
+    for (int i = 0; i <= MAX_TRIGGERS; i++) {
+        TRIGGER_RULE &rule = getRule(i);
+        TRIGGER &trig = rule.trigger;
+        toggleState[i] = 0;
+        if (rule.enabled != 1) continue;
+
+        switch (trig.type) {
+        case TRIG_FRAME:
+            dataMask[i] = 0;
+            dataValue[i] = 0;
+            for (int c = 0; c < trig.length && c < 8; c++) {
+                dataMask[i] |= (uint64_t)trig.dataMask[c] << (c * 8);
+                dataValue[i] |= (uint64_t)(trig.dataValue[c] & trig.dataMask[c]) << (c * 8);
+            }
+            for (int bus = 0; bus < MAX_BUSES; bus++) {
+                if (!(trig.source & (1 << bus))) continue;
+                if ((trig.idMask & FULL_ID_MASK) == FULL_ID_MASK) {
+                    if (!index.add(bus, trig.id, i)) Logger::error("Could not index trigger %i", i);
+                } else index.addWildcard(bus, i);
+            }
+            break;
+        case TRIG_INPUT:
+            inputRules |= 1ul << i;
+            inputState[i] = readInput(trig);
+            debounce[i] = 0;
+            break;
+        case TRIG_TIMER:
+            timerRules |= 1ul << i;
+            nextTimer[i] = millis() + trig.id;
+            break;
+        }
+    }
+    //the toggle output starts out in the state setup() put it in
+    if (digToggleSettings.enabled && !(digToggleSettings.mode & 0x80)) toggleState[DIGTOGGLE_RULE] = 1;
+}
+
+bool TriggerEngine::readInput(TRIGGER &trigger)
+{
+    if (trigger.flags & TRIGF_RAW_PIN) return digitalRead(trigger.source);
+    return edgeCapture.getState(trigger.source);
+}
+
+//edges on the digital inputs arrive here already debounced and in order, short pulses included
+void TriggerEngine::inputEdge(uint8_t input, bool state)
+{
+    uint32_t bits = inputRules;
+    int which;
+
+    while (bits) {
+        which = __builtin_ctz(bits);
+        bits &= bits - 1;
+        TRIGGER &trig = getRule(which).trigger;
+        if ((trig.flags & TRIGF_RAW_PIN) || trig.source != input) continue;
+        inputState[which] = state;
+        if ((state && (trig.flags & TRIGF_RISING)) || (!state && (trig.flags & TRIGF_FALLING))) fire(which);
+    }
+}
+
+void TriggerEngine::processFrame(CAN_FRAME &frame, uint8_t bus)
+{
+    uint32_t slots = index.lookup(bus, frame.id);
+    int which;
+
+    while (slots) {
+        which = __builtin_ctz(slots);
+        slots &= slots - 1;
+        TRIGGER &trig = getRule(which).trigger;
+        if ((frame.id & trig.idMask) != (trig.id & trig.idMask)) continue;
+        if (frame.length < trig.length) continue;
+        if ((frame.data.value & dataMask[which]) != dataValue[which]) continue;
+        fire(which);
+    }
+}
+
+void TriggerEngine::fire(uint8_t which)
+{
+    TRIGGER_RULE &rule = getRule(which);
+    fireCount[which]++;
+    pendingReport |= 1ul << which;
+    for (int c = 0; c < MAX_TRIGGER_ACTIONS; c++) {
+        if (rule.actions[c].type != ACT_NONE) runAction(which, c, rule.actions[c]);
+    }
+}
+
+void TriggerEngine::runAction(uint8_t which, uint8_t num, ACTION &action)
+{
+    CAN_FRAME frame;
+    uint8_t data[2];
+    bool state = (action.value == 1);
+
+    switch (action.type) {
+    case ACT_OUTPUT:
+    case ACT_PIN:
+        if (action.value == 2) {
+            toggleState[which] ^= 1 << num;
+            state = toggleState[which] & (1 << num);
+        }
+        if (action.type == ACT_OUTPUT) setOutput(action.target, state);
+        else digitalWrite(action.target, state ? HIGH : LOW);
+        break;
+    case ACT_SEND:
+        frame.id = action.id;
+        frame.extended = action.extended;
+        frame.rtr = 0;
+        frame.length = (action.value > 8) ? 8 : action.value;
+        for (int c = 0; c < 8; c++) frame.data.bytes[c] = action.data[c];
+        sendFrameOnBus(frame, action.target, TX_PRIO_HIGH);
+        break;
+    case ACT_LOG_START:
+        if (SysSettings.SDCardInserted) SysSettings.logToFile = true;
+        break;
+    case ACT_LOG_STOP:
+        SysSettings.logToFile = false;
+        break;
+    case ACT_MARK:
+        data[0] = which;
+        data[1] = num;
+        sendEventFrame(EVENT_TRIGGER, 0, data, 2);
+        break;
+    }
+}
+
+void TriggerEngine::loop()
+{
+    uint32_t bits;
+    int which;
+    bool state;
+
+    //raw pins have to read the same for TRIGGER_DEBOUNCE loops in a row before an edge counts
+    bits = inputRules;
+    while (bits) {
+        which = __builtin_ctz(bits);
+        bits &= bits - 1;
+        TRIGGER &trig = getRule(which).trigger;
+        if (!(trig.flags & TRIGF_RAW_PIN)) continue; //inputEdge() handles these
+        state = readInput(trig);
+        if (state == inputState[which]) {
+            debounce[which] = 0;
+            continue;
+        }
+        if (++debounce[which] < TRIGGER_DEBOUNCE) continue;
+        inputState[which] = state;
+        debounce[which] = 0;
+        if ((state && (trig.flags & TRIGF_RISING)) || (!state && (trig.flags & TRIGF_FALLING))) fire(which);
+    }
+
+    bits = timerRules;
+    while (bits) {
+        which = __builtin_ctz(bits);
+        bits &= bits - 1;
+        if ((int32_t)(millis() - nextTimer[which]) < 0) continue;
+        nextTimer[which] += getRule(which).trigger.id;
+        //don't try to catch up if the loop was held up for a long time
+        if ((int32_t)(millis() - nextTimer[which]) >= 0) nextTimer[which] = millis() + getRule(which).trigger.id;
+        fire(which);
+    }
+
+    while (pendingReport) {
+        which = __builtin_ctz(pendingReport);
+        pendingReport &= ~(1ul << which);
+        if (which == DIGTOGGLE_RULE) Logger::info("Digital toggle rule fired");
+        else Logger::info("Trigger %i fired", which);
+    }
+}
+
+//Pattern like 0562XX1X. Fills in up to 8 bytes of mask and value and sets length to the number of bytes
+bool TriggerEngine::parsePattern(const char *str, uint8_t *mask, uint8_t *value, uint8_t &length)
+{
+    int len = strlen(str);
+    int hi, lo;
+
+    if ((len & 1) || len > 16) return false;
+    length = len / 2;
+    for (int c = 0; c < length; c++) {
+        hi = hexNibble(str[c * 2]);
+        lo = hexNibble(str[c * 2 + 1]);
+        mask[c] = 0;
+        value[c] = 0;
+        if (hi >= 0) {
+            mask[c] |= 0xF0;
+            value[c] |= hi << 4;
+        } else if (toupper(str[c * 2]) != 'X') return false;
+        if (lo >= 0) {
+            mask[c] |= 0x0F;
+            value[c] |= lo;
+        } else if (toupper(str[c * 2 + 1]) != 'X') return false;
+    }
+    return true;
+}
+
+/*
+FRAME,<bus>,<id>[,<id mask>[,<pattern>]] - pattern is hex bytes, X for a nibble that doesn't matter
+INPUT,<input>,<RISE|FALL|BOTH>
+TIMER,<milliseconds>
+*/
+bool TriggerEngine::parseTrigger(char *str, TRIGGER &trigger)
+{
+    char *tok = strtok(str, ",");
+    char *arg[4];
+    int bus;
+
+    memset(&trigger, 0, sizeof(trigger));
+    if (!tok) return false;
+    for (int c = 0; c < 4; c++) arg[c] = strtok(NULL, ",");
+
+    if (!strcasecmp(tok, "FRAME")) {
+        if (!arg[0] || !arg[1]) return false;
+        trigger.type = TRIG_FRAME;
+        bus = strtol(arg[0], NULL, 0);
+        if (bus < 0 || bus >= MAX_BUSES) return false;
+        trigger.source = 1 << bus;
+        trigger.id = strtoul(arg[1], NULL, 0);
+        trigger.idMask = arg[2] ? strtoul(arg[2], NULL, 0) : FULL_ID_MASK;
+        if (arg[3]) return parsePattern(arg[3], trigger.dataMask, trigger.dataValue, trigger.length);
+        return true;
+    }
+    if (!strcasecmp(tok, "INPUT")) {
+        if (!arg[0] || !arg[1]) return false;
+        trigger.type = TRIG_INPUT;
+        trigger.source = strtol(arg[0], NULL, 0);
+        if (trigger.source >= NUM_DIGITAL) return false;
+        if (!strcasecmp(arg[1], "RISE")) trigger.flags = TRIGF_RISING;
+        else if (!strcasecmp(arg[1], "FALL")) trigger.flags = TRIGF_FALLING;
+        else if (!strcasecmp(arg[1], "BOTH")) trigger.flags = TRIGF_RISING | TRIGF_FALLING;
+        else return false;
+        return true;
+    }
+    if (!strcasecmp(tok, "TIMER")) {
+        if (!arg[0]) return false;
+        trigger.type = TRIG_TIMER;
+        trigger.id = strtoul(arg[0], NULL, 0);
+        return trigger.id > 0;
+    }
+    return false;
+}
+
+/*
+OUT,<output>,<0|1|T>  PIN,<pin>,<0|1|T>  SEND,<bus>,<id>[,<hex payload>]  LOGON  LOGOFF  MARK
+*/
+bool TriggerEngine::parseAction(char *str, ACTION &action)
+{
+    char *tok = strtok(str, ",");
+    char *arg[3];
+    int hi, lo;
+
+    memset(&action, 0, sizeof(action));
+    if (!tok) return false;
+    for (int c = 0; c < 3; c++) arg[c] = strtok(NULL, ",");
+
+    for (int c = ACT_OUTPUT; c <= ACT_MARK; c++) {
+        if (!strcasecmp(tok, actionNames[c])) action.type = c;
+    }
+
+    switch (action.type) {
+    case ACT_OUTPUT:
+    case ACT_PIN:
+        if (!arg[0] || !arg[1]) return false;
+        action.target = strtol(arg[0], NULL, 0);
+        if (action.type == ACT_OUTPUT && action.target >= NUM_OUTPUT) return false;
+        if (toupper(arg[1][0]) == 'T') action.value = 2;
+        else action.value = strtol(arg[1], NULL, 0) ? 1 : 0;
+        return true;
+    case ACT_SEND:
+        if (!arg[0] || !arg[1]) return false;
+        action.target = strtol(arg[0], NULL, 0);
+        if (action.target >= MAX_BUSES) return false;
+        action.id = strtoul(arg[1], NULL, 0);
+        action.extended = (action.id > 0x7FF) ? 1 : 0;
+        if (arg[2]) {
+            int len = strlen(arg[2]);
+            if ((len & 1) || len > 16) return false;
+            action.value = len / 2;
+            for (int c = 0; c < action.value; c++) {
+                hi = hexNibble(arg[2][c * 2]);
+                lo = hexNibble(arg[2][c * 2 + 1]);
+                if (hi < 0 || lo < 0) return false;
+                action.data[c] = (hi << 4) | lo;
+            }
+        }
+        return true;
+    case ACT_LOG_START:
+    case ACT_LOG_STOP:
+    case ACT_MARK:
+        return true;
+    }
+    return false;
+}
+
+/*
+Rules come from the serial console as TRIGGER;ACTION[;ACTION]
+For example: FRAME,0,0x7E8,0x7FF,0562XX;OUT,0,T;MARK
+*/
+bool TriggerEngine::setRule(uint8_t which, char *definition)
+{
+    TRIGGER_RULE rule;
+    char *parts[1 + MAX_TRIGGER_ACTIONS];
+    char *ptr = definition;
+    int numParts = 0;
+
+    if (which >= MAX_TRIGGERS) return false;
+
+    //split on ; first since the parts are split on , with strtok
+    while (ptr && numParts < 1 + MAX_TRIGGER_ACTIONS) {
+        parts[numParts++] = ptr;
+        ptr = strchr(ptr, ';');
+        if (ptr) *ptr++ = 0;
+    }
+    if (ptr || numParts < 2) return false;
+
+    memset(&rule, 0, sizeof(rule));
+    if (!parseTrigger(parts[0], rule.trigger)) return false;
+    for (int c = 1; c < numParts; c++) {
+        if (!parseAction(parts[c], rule.actions[c - 1])) return false;
+    }
+    rule.enabled = 1;
+    getRule(which) = rule;
+    compile();
+    return true;
+}
+
+void TriggerEngine::printRules()
+{
+    char buff[120];
+    char *ptr;
+
+    for (int i = 0; i < MAX_TRIGGERS; i++) {
+        TRIGGER_RULE &rule = getRule(i);
+        TRIGGER &trig = rule.trigger;
+        if (rule.enabled != 1) continue;
+        ptr = buff;
+        ptr += sprintf(ptr, "TRIG%i=", i);
+        switch (trig.type) {
+        case TRIG_FRAME:
+            ptr += sprintf(ptr, "FRAME,%i,0x%x,0x%x", __builtin_ctz(trig.source | 0x100), (unsigned int)trig.id,
+                           (unsigned int)trig.idMask);
+            if (trig.length > 0) *ptr++ = ',';
+            for (int c = 0; c < trig.length; c++) {
+                *ptr++ = (trig.dataMask[c] & 0xF0) ? "0123456789ABCDEF"[trig.dataValue[c] >> 4] : 'X';
+                *ptr++ = (trig.dataMask[c] & 0x0F) ? "0123456789ABCDEF"[trig.dataValue[c] & 0xF] : 'X';
+            }
+            *ptr = 0;
+            break;
+        case TRIG_INPUT:
+            ptr += sprintf(ptr, "INPUT,%i,%s", trig.source, (trig.flags & TRIGF_RISING) ?
+                           ((trig.flags & TRIGF_FALLING) ? "BOTH" : "RISE") : "FALL");
+            break;
+        case TRIG_TIMER:
+            ptr += sprintf(ptr, "TIMER,%i", (int)trig.id);
+            break;
+        }
+        for (int c = 0; c < MAX_TRIGGER_ACTIONS; c++) {
+            ACTION &action = rule.actions[c];
+            if (action.type == ACT_NONE || action.type > ACT_MARK) continue;
+            ptr += sprintf(ptr, ";%s", actionNames[action.type]);
+            if (action.type == ACT_OUTPUT || action.type == ACT_PIN) {
+                if (action.value == 2) ptr += sprintf(ptr, ",%i,T", action.target);
+                else ptr += sprintf(ptr, ",%i,%i", action.target, action.value);
+            } else if (action.type == ACT_SEND) {
+                ptr += sprintf(ptr, ",%i,0x%x", action.target, (unsigned int)action.id);
+                if (action.value > 0) *ptr++ = ',';
+                for (int d = 0; d < action.value && d < 8; d++) ptr += sprintf(ptr, "%02X", action.data[d]);
+            }
+        }
+        Logger::console(buff);
+    }
+}
+
+void TriggerEngine::printStats()
+{
+    for (int i = 0; i < MAX_TRIGGERS; i++) {
+        if (getRule(i).enabled == 1) Logger::console("Trigger %i fired %i times", i, fireCount[i]);
+    }
+    if (digToggleRule.enabled == 1) Logger::console("Digital toggle fired %i times", fireCount[DIGTOGGLE_RULE]);
+}
@@ -0,0 +1,144 @@
+/*
+ * TriggerEngine.h
+ *
+ * A small table of trigger -> action rules. Triggers are received frames (ID/mask and
+ * masked payload compare), edges on the digital inputs or periodic timers. Actions set
+ * outputs, send frames, start or stop SD logging or put a mark in the log. The old
+ * single digital toggle setting is run as one more rule of this table.
+ *
+Copyright (c) 2014-2018 Collin Kidder, Michael Neuweiler, Charles Galpin
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+ */
+
+#ifndef TRIGGERENGINE_H_
+#define TRIGGERENGINE_H_
+
+#include <Arduino.h>
+#include <due_can.h>
+#include "IDIndex.h"
+
+#define TRIGGERS_PER_PAGE   4 //64 byte rules, 256 byte EEPROM page
+#define TRIGGER_PAGES       2
+#define MAX_TRIGGERS        (TRIGGERS_PER_PAGE * TRIGGER_PAGES)
+#define DIGTOGGLE_RULE      MAX_TRIGGERS //slot used for the rule built from digToggleSettings
+#define MAX_TRIGGER_ACTIONS 2
+#define TRIGGER_DEBOUNCE    4 //raw pin must read the same this many loops in a row. Digital inputs come from EdgeCapture
+
+enum TRIGGER_TYPE {
+    TRIG_NONE = 0,
+    TRIG_FRAME = 1, //frame received on any bus in the bus mask
+    TRIG_INPUT = 2, //edge on a digital input
+    TRIG_TIMER = 3  //every id milliseconds
+};
+
+enum ACTION_TYPE {
+    ACT_NONE = 0,
+    ACT_OUTPUT = 1,    //set one of the digital outputs. value 0 = low, 1 = high, 2 = toggle
+    ACT_PIN = 2,       //same but for any Arduino pin
+    ACT_SEND = 3,      //send a frame on bus target
+    ACT_LOG_START = 4, //start logging to SD
+    ACT_LOG_STOP = 5,
+    ACT_MARK = 6       //put an EVENT_TRIGGER record in the log and USB stream
+};
+
+//trigger flags
+#define TRIGF_RAW_PIN   1 //input is an Arduino pin number instead of one of the digital inputs
+#define TRIGF_RISING    2
+#define TRIGF_FALLING   4
+
+struct TRIGGER { //28 bytes
+    uint8_t type;
+    uint8_t source; //frame: bit mask of buses, input: input or pin number
+    uint8_t length; //frame: minimum length, also how many pattern bytes are used
+    uint8_t flags;
+    uint32_t id; //timer: period in milliseconds
+    uint32_t idMask;
+    uint8_t dataMask[8];
+    uint8_t dataValue[8];
+};
+
+struct ACTION { //16 bytes
+    uint8_t type;
+    uint8_t target; //output, pin or bus
+    uint8_t value; //output state, or frame length for ACT_SEND
+    uint8_t extended;
+    uint32_t id;
+    uint8_t data[8];
+};
+
+struct TRIGGER_RULE { //64 bytes
+    TRIGGER trigger;
+    ACTION actions[MAX_TRIGGER_ACTIONS];
+    uint8_t enabled; //255 means the EEPROM page was never initialized
+    uint8_t reserved[3];
+};
+
+struct TRIGGER_PAGE {
+    TRIGGER_RULE rules[TRIGGERS_PER_PAGE];
+};
+
+class TriggerEngine
+{
+public:
+    TriggerEngine();
+    void loadTable();
+    void saveTable(uint8_t which);
+    void compile();
+    bool setRule(uint8_t which, char *definition);
+    void clearRule(uint8_t which);
+    TRIGGER_RULE &getRule(uint8_t which);
+    void processFrame(CAN_FRAME &frame, uint8_t bus);
+    void inputEdge(uint8_t input, bool state); //debounced edge on one of the digital inputs
+    void loop();
+    void printRules();
+    void printStats();
+
+    //hex byte pattern with X for don't care nibbles. Doesn't depend on the table so others can use it
+    static bool parsePattern(const char *str, uint8_t *mask, uint8_t *value, uint8_t &length);
+    static int hexNibble(char c);
+
+private:
+    TRIGGER_PAGE pages[TRIGGER_PAGES];
+    TRIGGER_RULE digToggleRule;
+    IDIndex index;
+    uint64_t dataMask[MAX_TRIGGERS + 1]; //patterns as 64 bit values so a compare is one AND and one test
+    uint64_t dataValue[MAX_TRIGGERS + 1];
+    uint32_t nextTimer[MAX_TRIGGERS + 1];
+    uint8_t inputState[MAX_TRIGGERS + 1];
+    uint8_t debounce[MAX_TRIGGERS + 1];
+    uint8_t toggleState[MAX_TRIGGERS + 1]; //one bit per action
+    uint32_t fireCount[MAX_TRIGGERS + 1];
+    uint32_t pendingReport; //rules that fired since the last loop. Reported from there, not the RX path
+    uint32_t inputRules;
+    uint32_t timerRules;
+
+    void fire(uint8_t which);
+    void runAction(uint8_t which, uint8_t num, ACTION &action);
+    bool readInput(TRIGGER &trigger);
+    bool parseTrigger(char *str, TRIGGER &trigger);
+    bool parseAction(char *str, ACTION &action);
+    void buildDigToggleRule();
+};
+
+extern TriggerEngine triggerEngine;
+
+#endif /* TRIGGERENGINE_H_ */
@@ -33,6 +33,7 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #ifndef CONFIG_H_
 #define CONFIG_H_
 
+#include <stddef.h>
 #include "due_can.h"
 
 struct FILTER {  //should be 10 bytes
@@ -49,7 +50,34 @@ enum FILEOUTPUTTYPE {
     CRTD = 3
 };
 
-struct EEPROMSettings { //Must stay under 256 - currently somewhere around 222
+#define MAX_BUSES       5 //CAN0, CAN1, single wire, then extra MCP2515 channels
+#define FIRST_EXT_BUS   3
+#define EXT_BUSES       (MAX_BUSES - FIRST_EXT_BUS)
+
+enum TX_PRIORITY {
+    TX_PRIO_HIGH = 0, //replies and anything else that has a deadline: responder, ISO-TP, time sync, triggers
+    TX_PRIO_NORMAL = 1, //single frames from the host or console, gatewayed traffic and cyclic messages
+    TX_PRIO_LOW = 2, //bulk traffic that can wait: replay
+    TX_CLASSES = 3
+};
+
+//who queued a frame, so they can be told when it has gone out or been given up on
+enum TX_SOURCE {
+    TX_SOURCE_NONE = 0,
+    TX_SOURCE_RESPONDER = 1,
+    TX_SOURCE_REPLAY = 2,
+    TX_SOURCE_TIMESYNC = 3
+};
+
+struct EXTBUS_SETTINGS { //an MCP2515 on the SPI bus past the ones the board has
+    uint32_t speed;
+    boolean enabled;
+    boolean listenOnly;
+    uint8_t csPin; //255 = not fitted
+    uint8_t intPin;
+};
+
+struct EEPROMSettings { //SettingsStore saves it as tagged fields so it can grow, add new fields to its table too
     uint8_t version;
 
     uint32_t CAN0Speed;
@@ -73,11 +101,17 @@ struct EEPROMSettings { //Must stay under 256 - currently somewhere around 222
     uint8_t logLevel; //Level of logging to output on serial line
     uint8_t sysType; //0 = CANDUE, 1 = GEVCU, 2 = CANDue 1.3 to 2.1, 3 = CANDue 2.2
 
-    uint16_t valid; //stores a validity token to make sure EEPROM is not corrupt
+    uint16_t valid; //not used, SettingsStore keeps a CRC of the whole struct
 
     boolean CAN0ListenOnly; //if true we don't allow any messing with the bus but rather just passively monitor.
     boolean CAN1ListenOnly;
     boolean SWCANListenOnly;
+
+    uint16_t tablePages; //bit per page of the old table layout that held entries, only used to bring the tables over
+
+    EXTBUS_SETTINGS extBuses[EXT_BUSES]; //buses FIRST_EXT_BUS and up
+    boolean echoTx; //frames GVRET sends go to the host and log file too, flagged as sent
+    uint16_t storedRecords; //bit per SettingsStore table record that holds anything, the others aren't read at start up
 };
 
 struct DigitalCANToggleSettings { //16 bytes
@@ -150,7 +184,20 @@ extern DigitalCANToggleSettings digToggleSettings;
 #define CFG_BUILD_NUM	343
 #define CFG_VERSION "GVRET alpha 2017-11-09"
 #define EEPROM_PAGE		275 //this is within an eeprom space currently unused on GEVCU so it's safe
-#define EEPROM_VER		0x17
+#define EEPROM_VER		0x18 //0x17 and before were a straight EEPROMSettings copy at EEPROM_PAGE
+#define EEPROM_VER_LEGACY	0x17 //the only one of those whose layout is still read
+//how much of EEPROMSettings that copy held, everything after SWCANListenOnly came later
+#define EEPROM_LEGACY_LENGTH	(offsetof(EEPROMSettings, SWCANListenOnly) + sizeof(boolean))
+//where the tables were kept before they were SettingsStore records. Only read to bring them over
+#define EEPROM_PAGE_GWRULES		(EEPROM_PAGE + 2) //EEPROM_PAGE + 1 holds the digital toggle settings
+#define EEPROM_PAGE_SIGNALS		(EEPROM_PAGE + 3) //uses SIGNAL_PAGES pages
+#define EEPROM_PAGE_TRIGGERS	(EEPROM_PAGE + 5) //uses TRIGGER_PAGES pages
+#define EEPROM_PAGE_RESPONDER	(EEPROM_PAGE + 7) //uses RESPONSE_PAGES pages
+#define EEPROM_PAGE_CYCLIC		(EEPROM_PAGE + 11) //uses CYCLIC_PAGES pages
+#define EEPROM_PAGE_TIMESYNC	(EEPROM_PAGE + 15)
+#define EEPROM_PAGE_ADCFILTER	(EEPROM_PAGE + 16)
+#define EEPROM_PAGE_EDGES		(EEPROM_PAGE + 17)
+#define EEPROM_PAGE_STORE		(EEPROM_PAGE + 18) //SettingsStore slots, 92 pages with STORE_SLOTS at 4
 
 #define CANDUE_EEPROM_WP_PIN	18
 #define CANDUE_CAN0_EN_PIN		50
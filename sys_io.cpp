@@ -31,6 +31,9 @@ by stimmer
 */
 
 #include "sys_io.h"
+#include "Timebase.h"
+#include "SettingsStore.h"
+#include <Wire_EEPROM.h>
 
 #undef HID_ENABLED
 
@@ -38,28 +41,23 @@ uint8_t dig[NUM_DIGITAL];
 uint8_t adc[NUM_ANALOG][2];
 uint8_t out[NUM_OUTPUT];
 
-volatile int bufn,obufn;
+volatile int bufn;
+uint32_t obufn; //last buffer count sys_io_adc_poll() worked from
 volatile uint16_t adc_buf[NUM_ANALOG][256];   // 4 buffers of 256 readings
-uint16_t adc_values[NUM_ANALOG * 2];
-uint16_t adc_out_vals[NUM_ANALOG];
-
-int NumADCSamples;
+volatile uint32_t adc_buf_count; //buffers completed since startup. Buffer n is adc_buf[n & 3]
+volatile uint64_t adc_buf_ticks[4]; //timebase ticks when each buffer was completed
+uint32_t adc_overruns; //buffers sys_io_adc_poll() didn't get to before they were reused
+uint32_t adc_buf_span; //ticks taken by the last buffer
 
 //the ADC values fluctuate a lot so smoothing is required.
-uint16_t adc_buffer[NUM_ANALOG][64];
-uint8_t adc_pointer[NUM_ANALOG]; //pointer to next position to use
-
-ADC_COMP adc_comp[NUM_ANALOG];
-
-bool useRawADC = false;
+AdcFilter adcFilters[NUM_ANALOG];
+ADC_FILTER_SETTINGS adcFilterSettings[NUM_ANALOG];
 
 //forces the digital I/O ports to a safe state. This is called very early in initialization.
 void sys_early_setup()
 {
     int i;
 
-    NumADCSamples = 64;
-
     //Logger::info("Running on GEVCU 4.x hardware");
     dig[0]=48;
     dig[1]=49;
@@ -94,64 +92,88 @@ void sys_early_setup()
 }
 
 /*
-Initialize DMA driven ADC and read in gain/offset for each channel
+Initialize DMA driven ADC. The filter and gain/offset for each channel come from loadADCFilters()
 */
 void setup_sys_io()
 {
-    int i;
-
     setupFastADC();
+    setupCycleCounter();
+    adc_overruns = 0;
+    adc_buf_span = 0;
+}
 
-    for (i = 0; i < NUM_ANALOG; i++) {
-        for (int j = 0; j < NumADCSamples; j++) adc_buffer[i][j] = 0;
-        adc_pointer[i] = 0;
-        adc_values[i] = 0;
-        adc_out_vals[i] = 0;
+/*
+Filter settings for all four inputs are one SettingsStore record
+*/
+void loadADCFilters()
+{
+    bool changed = false;
+
+    settingsStore.attach(STORE_ADCFILTER, adcFilterSettings);
+    if (!settingsStore.isDirty(STORE_ADCFILTER)) { //otherwise what is in RAM is newer than anything stored
+        for (int i = 0; i < NUM_ANALOG; i++) AdcFilter::setDefaults(adcFilterSettings[i]);
+        if (!settingsStore.load(STORE_ADCFILTER)) { //from before the filters were a record, or a blank EEPROM
+            EEPROM.read(EEPROM_PAGE_ADCFILTER, adcFilterSettings);
+            changed = true;
+        }
     }
+    for (int i = 0; i < NUM_ANALOG; i++) {
+        if (adcFilterSettings[i].type == 255 || !adcFilters[i].configure(adcFilterSettings[i])) {
+            Logger::console("Resetting filter for analog input %i to defaults", i);
+            AdcFilter::setDefaults(adcFilterSettings[i]);
+            adcFilters[i].configure(adcFilterSettings[i]);
+            changed = true;
+        }
+    }
+    if (changed) settingsStore.markDirty(STORE_ADCFILTER);
 }
 
-uint16_t getRawADC(uint8_t which)
+bool setADCFilter(uint8_t which, ADC_FILTER_SETTINGS &settings)
 {
-    uint32_t val;
-
-    val = adc_values[adc[which][0]];
+    if (which >= NUM_ANALOG) return false;
+    if (!adcFilters[which].configure(settings)) return false;
+    adcFilterSettings[which] = settings;
+    settingsStore.markDirty(STORE_ADCFILTER);
+    return true;
+}
 
-    return val;
+void getADCFilter(uint8_t which, ADC_FILTER_SETTINGS &settings)
+{
+    if (which >= NUM_ANALOG) which = 0;
+    settings = adcFilterSettings[which];
 }
 
-/*
-Adds a new ADC reading to the buffer for a channel. The buffer is NumADCSamples large (either 32 or 64) and rolling
-*/
-void addNewADCVal(uint8_t which, uint16_t val)
+void printADCFilters()
 {
-    adc_buffer[which][adc_pointer[which]] = val;
-    adc_pointer[which] = (adc_pointer[which] + 1) % NumADCSamples;
+    static const char *types[] = {"NONE", "BOXCAR", "IIR", "CIC"};
+    uint32_t rate = adc_buf_span ? (uint32_t)((uint64_t)TIMEBASE_HZ * 256 / NUM_ANALOG / adc_buf_span) : 0;
+
+    Logger::console("Sampling each input at %i Hz, %i buffers lost", rate, adc_overruns);
+    for (int i = 0; i < NUM_ANALOG; i++) {
+        ADC_FILTER_SETTINGS &s = adcFilterSettings[i];
+        Logger::console("ADCFILTER%i=%s,%i,%i  ADCCAL%i=%i,%i  out: %i Hz value: %i raw: %i cost: %i avg %i max cycles/buffer", i,
+                        types[s.type], s.decimation, s.param, i, s.offset, s.gain, rate / s.decimation,
+                        adcFilters[i].getValue(), adcFilters[i].getRawValue(), adcFilters[i].getAvgCost(), adcFilters[i].getMaxCost());
+        adcFilters[i].resetCost();
+    }
 }
 
-/*
-Take the arithmetic average of the readings in the buffer for each channel. This smooths out the ADC readings
-*/
-uint16_t getADCAvg(uint8_t which)
+uint16_t getRawADC(uint8_t which)
 {
-    uint32_t sum;
-    sum = 0;
-    for (int j = 0; j < NumADCSamples; j++) sum += adc_buffer[which][j];
-    sum = sum / NumADCSamples;
-    return ((uint16_t)sum);
+    if (which >= NUM_ANALOG) which = 0;
+    return adcFilters[which].getRawValue();
 }
 
 /*
 get value of one of the 4 analog inputs
-Uses a special buffer which has smoothed and corrected ADC values. This call is very fast
+Returns the latest filtered and corrected value. This call is very fast
 because the actual work is done via DMA and then a separate polled step.
 */
 uint16_t getAnalog(uint8_t which)
 {
-    uint16_t val;
-
     if (which >= NUM_ANALOG) which = 0;
 
-    return adc_out_vals[which];
+    return adcFilters[which].getValue();
 }
 
 //get value of one of the 4 digital inputs
@@ -161,6 +183,12 @@ boolean getDigital(uint8_t which)
     return !(digitalRead(dig[which]));
 }
 
+uint8_t getDigitalPin(uint8_t which)
+{
+    if (which >= NUM_DIGITAL) which = 0;
+    return dig[which];
+}
+
 //set output high or not
 void setOutput(uint8_t which, boolean active)
 {
@@ -186,6 +214,22 @@ boolean getOutput(uint8_t which)
     return digitalRead(out[which]);
 }
 
+/*
+The Cortex-M3 has a free running cycle counter in the DWT unit. It's used to time
+short sections of code more finely than micros() can.
+*/
+void setupCycleCounter()
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+uint32_t getCycleCount()
+{
+    return DWT->CYCCNT;
+}
+
 /*
 When the ADC reads in the programmed # of readings it will do two things:
 1. It loads the next buffer and buffer size into current buffer and size
@@ -199,8 +243,10 @@ void ADC_Handler()      // move DMA pointers to next buffer
 {
     int f=ADC->ADC_ISR;
     if (f & (1<<27)) { //receive counter end of buffer
+        adc_buf_ticks[adc_buf_count & 3] = timebase.ticks();
+        adc_buf_count++;
         bufn=(bufn+1)&3;
-        ADC->ADC_RNPR=(uint32_t)adc_buf[bufn];
+        ADC->ADC_RNPR=(uint32_t)(uintptr_t)adc_buf[bufn];
         ADC->ADC_RNCR=256;
     }
 }
@@ -240,54 +286,63 @@ void setupFastADC()
     NVIC_EnableIRQ(ADC_IRQn);
     ADC->ADC_IDR=~(1<<27); //dont disable the ADC interrupt for rx end
     ADC->ADC_IER=1<<27; //do enable it
-    ADC->ADC_RPR=(uint32_t)adc_buf[0];   // DMA buffer
+    ADC->ADC_RPR=(uint32_t)(uintptr_t)adc_buf[0];   // DMA buffer
     ADC->ADC_RCR=256; //# of samples to take
-    ADC->ADC_RNPR=(uint32_t)adc_buf[1]; // next DMA buffer
+    ADC->ADC_RNPR=(uint32_t)(uintptr_t)adc_buf[1]; // next DMA buffer
     ADC->ADC_RNCR=256; //# of samples to take
-    bufn=obufn=0;
+    bufn=1; //index of the buffer queued up next. The interrupt moves it along
+    obufn=0;
+    adc_buf_count=0;
     ADC->ADC_PTCR=1; //enable dma mode
     ADC->ADC_CR=2; //start conversions
 
     Logger::debug("Fast ADC Mode Enabled");
 }
 
-//polls	for the end of an adc conversion event. Then processe buffer to extract the averaged
-//value. It takes this value and averages it with the existing value in an 8 position buffer
-//which serves as a super fast place for other code to retrieve ADC values
-// This is only used when RAWADC is not defined
+/*
+Runs every completed DMA buffer through the filter for each input. The four inputs are
+interleaved in the buffer, input 0 first. The cycle counter measures what each filter costs.
+*/
 void sys_io_adc_poll()
 {
-    if (obufn != bufn) {
-        uint32_t tempbuff[8] = {0,0,0,0,0,0,0,0}; //make sure its zero'd
-
-        //the eight or four enabled adcs are interleaved in the buffer
-        //this is a somewhat unrolled for loop with no incrementer. it's odd but it works
-
-        for (int i = 0; i < 256;) {
-            tempbuff[3] += adc_buf[obufn][i++];
-            tempbuff[2] += adc_buf[obufn][i++];
-            tempbuff[1] += adc_buf[obufn][i++];
-            tempbuff[0] += adc_buf[obufn][i++];
-        }
+    uint32_t count = adc_buf_count;
+    uint32_t start;
 
-        //now, all of the ADC values are summed over 32/64 readings. So, divide by 32/64 (shift by 5/6) to get the average
-        //then add that to the old value we had stored and divide by two to average those. Lots of averaging going on.
-        for (int j = 0; j < 4; j++) {
-            adc_values[j] += (tempbuff[j] >> 6);
-            adc_values[j] = adc_values[j] >> 1;
+    if (count == 0) return;
+    if (count - obufn > 2) { //fell far enough behind that the oldest ones may already be overwritten
+        adc_overruns += count - obufn - 1;
+        obufn = count - 1;
+    }
+    while (obufn != count) {
+        volatile uint16_t *buf = getADCBuffer(obufn);
+        if (obufn > 0) adc_buf_span = (uint32_t)(getADCBufferTicks(obufn) - getADCBufferTicks(obufn - 1));
+        for (int i = 0; i < NUM_ANALOG; i++) {
+            start = getCycleCount();
+            adcFilters[i].process(buf + i, NUM_ANALOG, 256 / NUM_ANALOG);
+            adcFilters[i].addCost(getCycleCount() - start);
         }
+        obufn++;
+    }
+}
 
+/*
+Access to the DMA buffers for code that wants every sample rather than the smoothed values.
+Buffers are numbered in the order they complete. One stays good until three more have
+completed after it, about 9ms with the timing set up above.
+*/
+uint32_t getADCBufferCount()
+{
+    return adc_buf_count;
+}
 
-        for (int i = 0; i < NUM_ANALOG; i++) {
-            int val;
-            val = getRawADC(i);
-//			addNewADCVal(i, val);
-//			adc_out_vals[i] = getADCAvg(i);
-            adc_out_vals[i] = val;
-        }
+volatile uint16_t *getADCBuffer(uint32_t n)
+{
+    return adc_buf[n & 3];
+}
 
-        obufn = bufn;
-    }
+uint64_t getADCBufferTicks(uint32_t n)
+{
+    return adc_buf_ticks[n & 3];
 }
 
 
@@ -33,22 +33,28 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include <Arduino.h>
 #include "config.h"
 #include "Logger.h"
-
-typedef struct {
-    uint16_t offset;
-    uint16_t gain;
-} ADC_COMP;
+#include "AdcFilter.h"
 
 void setup_sys_io();
 uint16_t getAnalog(uint8_t which); //get value of one of the 4 analog inputs
 uint16_t getDiffADC(uint8_t which);
 uint16_t getRawADC(uint8_t which);
 boolean getDigital(uint8_t which); //get value of one of the 4 digital inputs
+uint8_t getDigitalPin(uint8_t which); //Arduino pin number of a digital input
 void setOutput(uint8_t which, boolean active); //set output high or not
 boolean getOutput(uint8_t which); //get current value of output state (high?)
 void setupFastADC();
 void sys_io_adc_poll();
+void loadADCFilters();
+bool setADCFilter(uint8_t which, ADC_FILTER_SETTINGS &settings); //validates, applies and saves
+void getADCFilter(uint8_t which, ADC_FILTER_SETTINGS &settings);
+void printADCFilters();
+uint32_t getADCBufferCount(); //number of DMA buffers completed so far
+volatile uint16_t *getADCBuffer(uint32_t n); //256 samples, interleaved analog input 0 to 3
+uint64_t getADCBufferTicks(uint32_t n); //timebase ticks when buffer n completed
 void sys_early_setup();
 void setLED(uint8_t, boolean);
+void setupCycleCounter();
+uint32_t getCycleCount();
 #endif
 
@@ -0,0 +1,194 @@
+/*
+ * AdcFilter: settings checks, what each filter type puts out for known input, interleaved
+ * buffers, calibration and the CIC integrators wrapping.
+ */
+#include "Check.h"
+#include "AdcFilter.h"
+
+static ADC_FILTER_SETTINGS makeSettings(uint8_t type, uint16_t decimation, uint8_t param)
+{
+    ADC_FILTER_SETTINGS s;
+    AdcFilter::setDefaults(s);
+    s.type = type;
+    s.decimation = decimation;
+    s.param = param;
+    return s;
+}
+
+static void testValidate()
+{
+    ADC_FILTER_SETTINGS s;
+
+    AdcFilter::setDefaults(s);
+    CHECK(AdcFilter::validate(s));
+    s = makeSettings(ADC_FILTER_CIC + 1, 64, 0);
+    CHECK(!AdcFilter::validate(s));
+    s = makeSettings(ADC_FILTER_BOXCAR, 0, 0);
+    CHECK(!AdcFilter::validate(s));
+    s = makeSettings(ADC_FILTER_BOXCAR, ADC_MAX_DECIMATION + 1, 0);
+    CHECK(!AdcFilter::validate(s));
+    s = makeSettings(ADC_FILTER_IIR, 1, 0);
+    CHECK(!AdcFilter::validate(s));
+    s = makeSettings(ADC_FILTER_IIR, 1, 16);
+    CHECK(!AdcFilter::validate(s));
+    s = makeSettings(ADC_FILTER_IIR, 1, 15);
+    CHECK(AdcFilter::validate(s));
+    s = makeSettings(ADC_FILTER_CIC, 64, 0);
+    CHECK(!AdcFilter::validate(s));
+    s = makeSettings(ADC_FILTER_CIC, 64, ADC_CIC_MAX_ORDER + 1);
+    CHECK(!AdcFilter::validate(s));
+    s = makeSettings(ADC_FILTER_CIC, 102, 3); //102^3 is over 2^20
+    CHECK(!AdcFilter::validate(s));
+    s = makeSettings(ADC_FILTER_CIC, 101, 3);
+    CHECK(AdcFilter::validate(s));
+
+    AdcFilter filter;
+    s = makeSettings(ADC_FILTER_BOXCAR, 0, 0);
+    CHECK(!filter.configure(s));
+}
+
+static void testNone()
+{
+    AdcFilter filter;
+    ADC_FILTER_SETTINGS s = makeSettings(ADC_FILTER_NONE, 4, 0);
+    uint16_t samples[10] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+
+    CHECK(filter.configure(s));
+    CHECK_EQ(filter.process(samples, 1, 10), 2);
+    CHECK_EQ(filter.getValue(), 8);
+    CHECK_EQ(filter.process(samples, 1, 2), 1); //phase carries over between calls
+    CHECK_EQ(filter.getValue(), 2);
+}
+
+static void testBoxcar()
+{
+    AdcFilter filter;
+    ADC_FILTER_SETTINGS s = makeSettings(ADC_FILTER_BOXCAR, 4, 0);
+    uint16_t samples[8] = {100, 200, 300, 400, 4095, 4095, 4095, 4095};
+
+    CHECK(filter.configure(s));
+    CHECK_EQ(filter.process(samples, 1, 4), 1);
+    CHECK_EQ(filter.getValue(), 250);
+    CHECK_EQ(filter.process(samples + 4, 1, 3), 0);
+    CHECK_EQ(filter.getValue(), 250);
+    CHECK_EQ(filter.process(samples + 7, 1, 1), 1);
+    CHECK_EQ(filter.getValue(), 4095);
+    CHECK_EQ(filter.getOutputs(), 2);
+}
+
+//two channels interleaved like the ADC DMA buffer, each filtered on its own
+static void testStride()
+{
+    AdcFilter a, b;
+    ADC_FILTER_SETTINGS s = makeSettings(ADC_FILTER_BOXCAR, 8, 0);
+    uint16_t samples[32];
+
+    for (int i = 0; i < 16; i++) {
+        samples[i * 2] = 1000 + i;
+        samples[i * 2 + 1] = 3000;
+    }
+    CHECK(a.configure(s));
+    CHECK(b.configure(s));
+    CHECK_EQ(a.process(samples, 2, 16), 2);
+    CHECK_EQ(b.process(samples + 1, 2, 16), 2);
+    CHECK_EQ(a.getValue(), 1011); //average of 1008 to 1015, rounded down
+    CHECK_EQ(b.getValue(), 3000);
+}
+
+//the first sample seeds it, then each sample takes 1/2^param of what is left of a step
+static void testIir()
+{
+    AdcFilter filter;
+    ADC_FILTER_SETTINGS s = makeSettings(ADC_FILTER_IIR, 1, 3);
+    uint16_t samples[64];
+
+    CHECK(filter.configure(s));
+    samples[0] = 1000;
+    CHECK_EQ(filter.process(samples, 1, 1), 1);
+    CHECK_EQ(filter.getValue(), 1000);
+    for (int i = 0; i < 64; i++) samples[i] = 2000;
+    filter.process(samples, 1, 1);
+    CHECK_EQ(filter.getValue(), 1125); //an eighth of the step
+    filter.process(samples, 1, 24);
+    CHECK(filter.getValue() > 1950 && filter.getValue() < 2000);
+    filter.process(samples, 1, 64);
+    CHECK_EQ(filter.getValue(), 2000);
+}
+
+//DC in is DC out once the combs are primed, including after the integrators have wrapped
+static void testCic()
+{
+    AdcFilter filter;
+    ADC_FILTER_SETTINGS s = makeSettings(ADC_FILTER_CIC, 64, 3);
+    uint16_t samples[256];
+
+    for (int i = 0; i < 256; i++) samples[i] = 4095;
+    CHECK(filter.configure(s));
+    for (int i = 0; i < 4; i++) filter.process(samples, 1, 256);
+    CHECK_EQ(filter.getValue(), 4095);
+    //4095 * 64^3 per output, the last integrator wraps every few outputs
+    for (int i = 0; i < 200; i++) filter.process(samples, 1, 256);
+    CHECK_EQ(filter.getValue(), 4095);
+    CHECK_EQ(filter.getOutputs(), 816);
+
+    for (int i = 0; i < 256; i++) samples[i] = 1234;
+    for (int i = 0; i < 2; i++) filter.process(samples, 1, 256);
+    CHECK_EQ(filter.getValue(), 1234);
+
+    //a reset starts it clean again
+    filter.reset();
+    CHECK_EQ(filter.getOutputs(), 0);
+    filter.process(samples, 1, 256);
+    CHECK_EQ(filter.getValue(), 1234);
+}
+
+static void testCalibration()
+{
+    AdcFilter filter;
+    ADC_FILTER_SETTINGS s = makeSettings(ADC_FILTER_NONE, 1, 0);
+    uint16_t sample;
+
+    s.offset = 100;
+    s.gain = ADC_GAIN_ONE * 2;
+    CHECK(filter.configure(s));
+    sample = 1100;
+    filter.process(&sample, 1, 1);
+    CHECK_EQ(filter.getRawValue(), 1100);
+    CHECK_EQ(filter.getValue(), 2000);
+    sample = 50; //under the offset clamps at 0
+    filter.process(&sample, 1, 1);
+    CHECK_EQ(filter.getValue(), 0);
+
+    s.offset = -4095;
+    s.gain = 0xFFFF;
+    CHECK(filter.configure(s));
+    sample = 4095; //and over 16 bits at 0xFFFF
+    filter.process(&sample, 1, 1);
+    CHECK_EQ(filter.getValue(), 0xFFFF);
+}
+
+static void testCost()
+{
+    AdcFilter filter;
+
+    CHECK_EQ(filter.getAvgCost(), 0);
+    filter.addCost(100);
+    filter.addCost(300);
+    CHECK_EQ(filter.getAvgCost(), 200);
+    CHECK_EQ(filter.getMaxCost(), 300);
+    filter.resetCost();
+    CHECK_EQ(filter.getMaxCost(), 0);
+}
+
+int main()
+{
+    testValidate();
+    testNone();
+    testBoxcar();
+    testStride();
+    testIir();
+    testCic();
+    testCalibration();
+    testCost();
+    return checkResult();
+}
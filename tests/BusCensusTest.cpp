@@ -0,0 +1,85 @@
+/*
+ * BusCensus: the entries are split between the buses that exist and the interval
+ * statistics come out right.
+ */
+#include "Check.h"
+#include "GVRET.h"
+#include "CanBus.h"
+#include "BusCensus.h"
+
+static void setupBoard(bool dedicatedSWCAN, bool extBus)
+{
+    SysSettings.dedicatedSWCAN = dedicatedSWCAN;
+    for (int e = 0; e < EXT_BUSES; e++) {
+        settings.extBuses[e].csPin = 255;
+        settings.extBuses[e].intPin = 255;
+    }
+    if (extBus) {
+        settings.extBuses[0].csPin = 30;
+        settings.extBuses[0].intPin = 31;
+    }
+    setupBusRegistry();
+}
+
+static int fill(uint8_t bus, int ids)
+{
+    CAN_FRAME frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.length = 8;
+    for (int i = 0; i < ids; i++) {
+        frame.id = 0x100 + i;
+        busCensus.addFrame(frame, bus, 1000);
+    }
+    hostClearOutput();
+    busCensus.printTable(bus);
+    int lines = 0;
+    for (const char *c = hostOutput(); *c; c++) if (*c == '\n') lines++;
+    return lines ? lines - 2 : 0; //not counting the two header lines
+}
+
+static void testSplit()
+{
+    //two buses get 128 entries each, at most 7/8 of them used
+    setupBoard(false, false);
+    CHECK_EQ(fill(0, 200), 112);
+    CHECK_EQ(fill(1, 10), 10);
+    CHECK_EQ(fill(2, 10), 0); //no such bus
+
+    //a third and fourth bus take their share from the others and the census starts over
+    setupBoard(true, true);
+    CHECK_EQ(fill(0, 0), 0);
+    CHECK_EQ(fill(0, 200), 56);
+    CHECK_EQ(fill(2, 200), 56);
+    CHECK_EQ(fill(3, 200), 56);
+
+    //the same layout again keeps what has been seen
+    setupBoard(true, true);
+    CHECK_EQ(fill(3, 0), 56);
+}
+
+static void testIntervals()
+{
+    CAN_FRAME frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.id = 0x7E8;
+    frame.length = 8;
+
+    setupBoard(false, false);
+    busCensus.reset();
+    busCensus.addFrame(frame, 1, 1000);
+    busCensus.addFrame(frame, 1, 11000);
+    busCensus.addFrame(frame, 1, 19000);
+    frame.length = 4;
+    busCensus.addFrame(frame, 1, 31000);
+    hostClearOutput();
+    busCensus.printTable(1);
+    //periods 10000, 8000 and 12000: mean 10000, sample deviation 2000
+    CHECK_CONTAINS(hostOutput(), "7E8, 0, 4*, 4, 10000, 8000, 12000, 2000");
+}
+
+int main()
+{
+    testSplit();
+    testIntervals();
+    return checkResult();
+}
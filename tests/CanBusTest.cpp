@@ -0,0 +1,181 @@
+/*
+ * CanBus: the MCP2515 buses split the receive pool between the ones that exist,
+ * setFilter() programs the masks and filters of the chip in configuration mode, several
+ * frames at a time go to the controllers, each reported back when it is done, and an
+ * MCP2515 INT left low is serviced from the main loop.
+ */
+#include "Check.h"
+#include "GVRET.h"
+#include "CanBus.h"
+#include "Responder.h"
+#include "Timebase.h"
+
+extern MCP2515 SWCAN;
+
+#define RXF0SIDH 0x00
+#define RXF1SIDH 0x04
+#define RXF2SIDH 0x08
+#define RXF5SIDH 0x18
+#define RXM0SIDH 0x20
+#define RXM1SIDH 0x24
+#define RXB0CTRL 0x60
+#define RXB1CTRL 0x70
+#define CANCTRL  0x0F
+
+static void setupBoard(int extBuses)
+{
+    SysSettings.dedicatedSWCAN = true;
+    for (int e = 0; e < EXT_BUSES; e++) {
+        settings.extBuses[e].csPin = (e < extBuses) ? 30 + e * 2 : 255;
+        settings.extBuses[e].intPin = (e < extBuses) ? 31 + e * 2 : 255;
+    }
+    setupBusRegistry();
+}
+
+static const char *status(uint8_t bus)
+{
+    hostClearOutput();
+    busRegistry.get(bus)->printStatus();
+    return hostOutput();
+}
+
+static void testPool()
+{
+    setupBoard(0);
+    CHECK_CONTAINS(status(2), "most waiting 0 of 63");
+    setupBoard(1);
+    CHECK_CONTAINS(status(2), "most waiting 0 of 63");
+    CHECK_CONTAINS(status(3), "most waiting 0 of 63");
+    CHECK(busRegistry.get(3)->begin());
+    setupBoard(2);
+    CHECK_CONTAINS(status(3), "most waiting 0 of 31");
+    CHECK_CONTAINS(status(4), "most waiting 0 of 31");
+
+    //one that goes away is stopped so its share can be handed out again
+    CHECK(busRegistry.get(3)->isRunning());
+    CanBus *gone = busRegistry.get(3);
+    setupBoard(0);
+    CHECK(busRegistry.get(3) == NULL);
+    CHECK(!gone->isRunning());
+}
+
+static void testFilters()
+{
+    CanBus *bus = busRegistry.get(2);
+
+    CHECK(bus->begin());
+    CHECK_EQ(SWCAN.regs[RXB0CTRL] & 0x60, 0x60); //nothing set takes everything
+    CHECK_EQ(SWCAN.regs[RXB1CTRL] & 0x60, 0x60);
+
+    CHECK(bus->setFilter(0, 0x123, 0x7FF, false));
+    CHECK_EQ(SWCAN.regs[RXB0CTRL] & 0x60, 0);
+    CHECK_EQ(SWCAN.regs[RXB1CTRL] & 0x60, 0);
+    CHECK_EQ(SWCAN.regs[RXM0SIDH], 0xFF);
+    CHECK_EQ(SWCAN.regs[RXM0SIDH + 1], 0xE0);
+    CHECK_EQ(SWCAN.regs[RXF0SIDH], 0x24);
+    CHECK_EQ(SWCAN.regs[RXF0SIDH + 1], 0x60);
+    //the rest repeat it, the second buffer included, so nothing else gets in
+    CHECK_EQ(SWCAN.regs[RXF1SIDH], 0x24);
+    CHECK_EQ(SWCAN.regs[RXF5SIDH + 1], 0x60);
+    CHECK_EQ(SWCAN.regs[RXM1SIDH], 0xFF);
+    CHECK_EQ(SWCAN.regs[CANCTRL] & 0xE0, 0); //back out of configuration mode
+
+    //RXF1 shares RXM0 so a different mask can't go there
+    CHECK(!bus->setFilter(1, 0x456, 0x700, false));
+    CHECK(bus->setFilter(1, 0x456, 0x7FF, false));
+    CHECK_EQ(SWCAN.regs[RXF1SIDH], 0x8A);
+
+    CHECK(bus->setFilter(2, 0x18DAF110, 0x1FFFFFFF, true));
+    CHECK_EQ(SWCAN.regs[RXM1SIDH], 0xFF);
+    CHECK_EQ(SWCAN.regs[RXM1SIDH + 1], 0xE3);
+    CHECK_EQ(SWCAN.regs[RXM1SIDH + 3], 0xFF);
+    CHECK_EQ(SWCAN.regs[RXF2SIDH], 0xC6);
+    CHECK_EQ(SWCAN.regs[RXF2SIDH + 1], 0xCA); //IDE set
+    CHECK_EQ(SWCAN.regs[RXF2SIDH + 2], 0xF1);
+    CHECK_EQ(SWCAN.regs[RXF2SIDH + 3], 0x10);
+    CHECK_EQ(SWCAN.regs[RXF5SIDH], 0xC6);
+    CHECK_EQ(SWCAN.regs[RXM0SIDH + 1], 0xE0); //the first buffer keeps its own
+
+    CHECK(!bus->setFilter(MCP_FILTERS, 0, 0x7FF, false));
+
+    //clearing them all opens it up again
+    CHECK(bus->setFilter(0, 0, 0, false));
+    CHECK(bus->setFilter(1, 0, 0, false));
+    CHECK(bus->setFilter(2, 0, 0, true));
+    CHECK_EQ(SWCAN.regs[RXB0CTRL] & 0x60, 0x60);
+    CHECK_EQ(SWCAN.regs[RXB1CTRL] & 0x60, 0x60);
+    bus->end();
+}
+
+//the responder's latency comes from when the frame went, not when it was queued
+static void testTxDone()
+{
+    CanBus *bus = busRegistry.get(2);
+    CAN_FRAME frame;
+
+    memset(&frame, 0, sizeof(frame));
+    frame.id = 0x7E8;
+    frame.length = 8;
+    CHECK(bus->begin());
+    uint32_t sent = bus->txFrames;
+    for (int i = 0; i < 5; i++) CHECK(bus->queueFrame(frame, TX_PRIO_NORMAL, false));
+    busRegistry.loop();
+    busRegistry.loop();
+    CHECK_EQ(bus->txFrames, sent + 5);
+    CHECK_EQ(bus->txAborted, 0);
+
+    responder.resetStats();
+    CHECK(bus->queueFrame(frame, TX_PRIO_HIGH, false, TX_SOURCE_RESPONDER, timebase.micros32() - 500));
+    busRegistry.loop();
+    hostClearOutput();
+    responder.printStats();
+    CHECK_CONTAINS(hostOutput(), "Responses sent: 1 dropped: 0");
+    CHECK_CONTAINS(hostOutput(), "min: 500 us");
+
+    //one that never got out is reported as dropped when the bus is reset
+    hostClearOutput();
+    settings.singleWire_Enabled = true;
+    CHECK(bus->queueFrame(frame, TX_PRIO_LOW, true, TX_SOURCE_RESPONDER, 0)); //waits on the transceiver
+    bus->end();
+    responder.printStats();
+    CHECK_CONTAINS(hostOutput(), "Responses sent: 1 dropped: 1");
+    //the MCP2515 stamps a frame when it is done
+    CHECK_CONTAINS(status(2), "wakeup to frame end");
+}
+
+//SWCAN's INT pin. The interrupt has to go round until it goes high, then the main loop takes over
+static void testIntLeftLow()
+{
+    McpCanBus *bus = (McpCanBus *)busRegistry.get(2);
+    CAN_FRAME frame;
+    uint64_t ticks;
+    uint32_t before;
+
+    CHECK(bus->begin());
+    hostSetPin(CANDUE22_SW_INT, HIGH);
+    before = SPI.transactions;
+    bus->interrupt();
+    CHECK_EQ(SPI.transactions, before + 2); //status, then flags and EFLG once
+    before = SPI.transactions;
+    CHECK(!bus->read(frame, ticks));
+    CHECK_EQ(SPI.transactions, before);
+
+    hostSetPin(CANDUE22_SW_INT, LOW);
+    before = SPI.transactions;
+    bus->interrupt();
+    CHECK_EQ(SPI.transactions, before + 8); //it didn't give up after one pass
+    before = SPI.transactions;
+    CHECK(!bus->read(frame, ticks));
+    CHECK(SPI.transactions > before);
+    bus->end();
+}
+
+int main()
+{
+    setup();
+    testPool();
+    testFilters();
+    testTxDone();
+    testIntLeftLow();
+    return checkResult();
+}
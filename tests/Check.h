@@ -0,0 +1,38 @@
+/*
+ * The smallest test harness that does the job. Every failed CHECK prints where it was and the test
+ * carries on so one run shows everything that is broken. main() returns checkResult().
+ */
+#ifndef CHECK_H_
+#define CHECK_H_
+
+#include <stdio.h>
+#include <string.h>
+
+static int checksRun;
+static int checksFailed;
+
+#define CHECK(cond) do { \
+    checksRun++; \
+    if (!(cond)) { checksFailed++; printf("%s:%i: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); } \
+} while (0)
+
+#define CHECK_EQ(a, b) do { \
+    long long va = (long long)(a), vb = (long long)(b); \
+    checksRun++; \
+    if (va != vb) { checksFailed++; printf("%s:%i: %s is %lli, expected %lli\n", __FILE__, __LINE__, #a, va, vb); } \
+} while (0)
+
+#define CHECK_CONTAINS(haystack, needle) do { \
+    checksRun++; \
+    if (!strstr((haystack), (needle))) { \
+        checksFailed++; printf("%s:%i: \"%s\" not found in:\n%s\n", __FILE__, __LINE__, (needle), (haystack)); \
+    } \
+} while (0)
+
+static inline int checkResult()
+{
+    printf("%i checks, %i failed\n", checksRun, checksFailed);
+    return checksFailed ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,122 @@
+/*
+ * ClockServo against a simulated master that runs 100ppm fast and has some jitter on its sync
+ * frames. It has to lock, track the drift, ride out bad samples and jumps of the master without
+ * stepping once locked, and the mapped time may never go backwards.
+ */
+#include "Check.h"
+#include "ClockServo.h"
+
+#define SYNC_PERIOD 100000 //us
+#define DRIFT       100e-6
+#define WALK        250 //us between the timestamps taken in between sync frames
+
+static ClockServo servo;
+static uint64_t now; //local clock, us
+static int64_t masterShift; //jumps put into the master's clock
+static uint64_t lastStamp;
+static int backwards;
+static int64_t worstError; //mapping against the master while locked, away from the sync frames
+static uint32_t seed = 12345;
+static double freqAverage; //ppm over the last 100 sync frames of a run, one estimate on its own is jittery
+//microsecond stamps 100ms apart can't see much under 10ppm so that is how close the rate has to get
+
+static uint64_t master(uint64_t local)
+{
+    return 7000000000ull + local + (int64_t)(local * DRIFT) + masterShift;
+}
+
+static int jitter() //-15 to +15 us
+{
+    seed = seed * 1103515245u + 12345u;
+    return (int)((seed >> 16) % 31) - 15;
+}
+
+static void stamp()
+{
+    uint64_t ref = servo.toReference(now);
+    if (ref < lastStamp) backwards++;
+    lastStamp = ref;
+    if (servo.getState() == SERVO_LOCKED) {
+        int64_t err = (int64_t)(ref - master(now));
+        if (err < 0) err = -err;
+        if (err > worstError) worstError = err;
+    }
+}
+
+//runs the clocks for a while, stamping in between sync frames. A non zero late makes one sync frame that late
+static int run(int syncs, int late = 0, int lateAt = -1)
+{
+    int locked = -1;
+    freqAverage = 0.0;
+    for (int s = 0; s < syncs; s++) {
+        for (int w = 0; w < SYNC_PERIOD / WALK; w++) {
+            now += WALK;
+            stamp();
+        }
+        int delay = (s == lateAt) ? late : 0;
+        servo.sample(now, master(now) + jitter() - delay);
+        stamp();
+        if (s >= syncs - 100) freqAverage += servo.getFreqPpb() / 100000.0;
+        if (locked < 0 && servo.getState() == SERVO_LOCKED) locked = s;
+    }
+    return locked;
+}
+
+static void testAcquire()
+{
+    now = 1000000;
+    CHECK_EQ(servo.toReference(now), now); //unsynced is just the local clock
+    int locked = run(300);
+    CHECK(locked >= 0 && locked < 100);
+    CHECK_EQ(servo.getState(), SERVO_LOCKED);
+    CHECK(freqAverage > 90.0 && freqAverage < 110.0);
+    CHECK(servo.getLastError() < SERVO_LOCK && servo.getLastError() > -SERVO_LOCK);
+    CHECK(worstError < SERVO_LOCK);
+    CHECK_EQ(backwards, 0);
+}
+
+//one sync frame held up 5ms is thrown out and the servo stays locked
+static void testOutlier()
+{
+    worstError = 0;
+    run(20, 5000, 10);
+    CHECK_EQ(servo.getState(), SERVO_LOCKED);
+    CHECK(worstError < SERVO_LOCK);
+    CHECK_EQ(backwards, 0);
+}
+
+//the master jumps back 3ms while locked. That is slewed out, time never runs backwards
+static void testBackwardJump()
+{
+    masterShift -= 3000;
+    run(3);
+    CHECK_EQ(servo.getState(), SERVO_TRACKING);
+    run(400);
+    CHECK_EQ(servo.getState(), SERVO_LOCKED);
+    CHECK(servo.getLastError() < SERVO_LOCK && servo.getLastError() > -SERVO_LOCK);
+    CHECK(freqAverage > 90.0 && freqAverage < 110.0);
+    CHECK_EQ(backwards, 0);
+}
+
+//forward it isn't stepped while locked either, it can be once the lock is lost
+static void testForwardJump()
+{
+    masterShift += 50000;
+    run(3);
+    CHECK_EQ(servo.getState(), SERVO_TRACKING);
+    uint64_t before = servo.toReference(now);
+    CHECK(before < master(now) - 40000); //still slewing, not stepped
+    run(300);
+    CHECK_EQ(servo.getState(), SERVO_LOCKED);
+    CHECK(servo.getLastError() < SERVO_LOCK && servo.getLastError() > -SERVO_LOCK);
+    CHECK_EQ(backwards, 0);
+}
+
+int main()
+{
+    testAcquire();
+    testOutlier();
+    testBackwardJump();
+    testForwardJump();
+    return checkResult();
+}
@@ -0,0 +1,228 @@
+/*
+ * GatewayRules rule evaluation: the checksum types against the AUTOSAR reference vectors,
+ * every opcode of runOps, op parsing and printing and the rule table on the gateway path.
+ */
+#include "Check.h"
+#include "GatewayRules.h"
+
+static CAN_FRAME makeFrame(uint32_t id, uint8_t length, const uint8_t *bytes)
+{
+    CAN_FRAME frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.id = id;
+    frame.length = length;
+    memcpy(frame.data.bytes, bytes, length);
+    return frame;
+}
+
+//byteNum 7 is past the end of these frames so every byte is covered
+static uint8_t checksum(uint8_t type, uint8_t seed, uint8_t length, const uint8_t *bytes)
+{
+    CAN_FRAME frame = makeFrame(0x123, length, bytes);
+    return GatewayRules::calcChecksum(frame, type, 7, seed);
+}
+
+static void testCrcVectors()
+{
+    static const uint8_t v0[] = {0x00, 0x00, 0x00, 0x00};
+    static const uint8_t v1[] = {0xF2, 0x01, 0x83};
+    static const uint8_t v2[] = {0x0F, 0xAA, 0x00, 0x55};
+    static const uint8_t v3[] = {0x00, 0xFF, 0x55, 0x11};
+    static const uint8_t v4[] = {0x92, 0x6B, 0x55};
+    static const uint8_t v5[] = {0xFF, 0xFF, 0xFF, 0xFF};
+
+    CHECK_EQ(checksum(CSUM_CRC8_J1850, 0, 4, v0), 0x59);
+    CHECK_EQ(checksum(CSUM_CRC8_J1850, 0, 3, v1), 0x37);
+    CHECK_EQ(checksum(CSUM_CRC8_J1850, 0, 4, v2), 0x79);
+    CHECK_EQ(checksum(CSUM_CRC8_J1850, 0, 4, v3), 0xB8);
+    CHECK_EQ(checksum(CSUM_CRC8_J1850, 0, 3, v4), 0x8C);
+    CHECK_EQ(checksum(CSUM_CRC8_J1850, 0, 4, v5), 0x74);
+
+    CHECK_EQ(checksum(CSUM_CRC8_H2F, 0, 4, v0), 0x12);
+    CHECK_EQ(checksum(CSUM_CRC8_H2F, 0, 3, v1), 0xC2);
+    CHECK_EQ(checksum(CSUM_CRC8_H2F, 0, 4, v2), 0xC6);
+    CHECK_EQ(checksum(CSUM_CRC8_H2F, 0, 4, v3), 0x77);
+    CHECK_EQ(checksum(CSUM_CRC8_H2F, 0, 3, v4), 0x33);
+    CHECK_EQ(checksum(CSUM_CRC8_H2F, 0, 4, v5), 0x6C);
+
+    //the seed is the E2E data ID, fed in ahead of the data for J1850 and after it for H2F
+    static const uint8_t withId[] = {0x34, 0x00, 0x00, 0x00, 0x00};
+    static const uint8_t idLast[] = {0x00, 0x00, 0x00, 0x00, 0x34};
+    CHECK_EQ(checksum(CSUM_CRC8_J1850, 0x34, 4, v0), checksum(CSUM_CRC8_J1850, 0, 5, withId));
+    CHECK_EQ(checksum(CSUM_CRC8_H2F, 0x34, 4, v0), checksum(CSUM_CRC8_H2F, 0, 5, idLast));
+}
+
+static void testSimpleChecksums()
+{
+    static const uint8_t data[] = {0x01, 0x02, 0x04, 0x80, 0xFF};
+
+    CHECK_EQ(checksum(CSUM_XOR, 0, 5, data), 0x01 ^ 0x02 ^ 0x04 ^ 0x80 ^ 0xFF);
+    CHECK_EQ(checksum(CSUM_XOR, 0x5A, 5, data), 0x5A ^ 0x01 ^ 0x02 ^ 0x04 ^ 0x80 ^ 0xFF);
+    CHECK_EQ(checksum(CSUM_SUM, 0, 5, data), (0x01 + 0x02 + 0x04 + 0x80 + 0xFF) & 0xFF);
+    CHECK_EQ(checksum(CSUM_SUM, 0x10, 5, data), (0x10 + 0x01 + 0x02 + 0x04 + 0x80 + 0xFF) & 0xFF);
+    //0x123: 0x23 + 0x01 + length 5
+    CHECK_EQ(checksum(CSUM_SUM_ID, 0, 5, data), (0x23 + 0x01 + 5 + 0x01 + 0x02 + 0x04 + 0x80 + 0xFF) & 0xFF);
+
+    //the checksum byte itself is left out
+    CAN_FRAME frame = makeFrame(0x123, 5, data);
+    CHECK_EQ(GatewayRules::calcChecksum(frame, CSUM_XOR, 4, 0), 0x01 ^ 0x02 ^ 0x04 ^ 0x80);
+    CHECK_EQ(GatewayRules::calcChecksum(frame, CSUM_SUM, 0, 0), (0x02 + 0x04 + 0x80 + 0xFF) & 0xFF);
+
+    //an unknown type leaves the byte as it was
+    CHECK_EQ(GatewayRules::calcChecksum(frame, 99, 3, 0), 0x80);
+}
+
+static void testRunOps()
+{
+    static const uint8_t data[] = {0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88};
+    REWRITE_OP ops[MAX_REWRITE_OPS + 1];
+    uint8_t counter = 0;
+
+    CAN_FRAME frame = makeFrame(0x200, 8, data);
+    ops[0] = (REWRITE_OP){RW_SET, 0, 0xA5, 0};
+    ops[1] = (REWRITE_OP){RW_AND, 1, 0x0F, 0};
+    ops[2] = (REWRITE_OP){RW_OR, 2, 0x80, 0};
+    ops[3] = (REWRITE_OP){RW_XOR, 3, 0xFF, 0};
+    ops[4] = (REWRITE_OP){RW_NOP, 4, 0xFF, 0};
+    CHECK(GatewayRules::runOps(frame, ops, 5, counter));
+    CHECK_EQ(frame.data.bytes[0], 0xA5);
+    CHECK_EQ(frame.data.bytes[1], 0x02);
+    CHECK_EQ(frame.data.bytes[2], 0xB3);
+    CHECK_EQ(frame.data.bytes[3], 0xBB);
+    CHECK_EQ(frame.data.bytes[4], 0x55);
+    CHECK_EQ(counter, 0);
+
+    //the counter lives under its mask and wraps within it, the other bits are kept
+    frame = makeFrame(0x200, 8, data);
+    ops[0] = (REWRITE_OP){RW_COUNTER, 6, 0x3C, 0};
+    for (int i = 1; i <= 20; i++) {
+        CHECK(GatewayRules::runOps(frame, ops, 1, counter));
+        CHECK_EQ(frame.data.bytes[6], (0x77 & ~0x3C) | ((i & 0x0F) << 2));
+    }
+    CHECK_EQ(counter, 20);
+
+    //an empty mask doesn't count
+    ops[0].value = 0;
+    CHECK(GatewayRules::runOps(frame, ops, 1, counter));
+    CHECK_EQ(counter, 20);
+
+    //a checksum after a rewrite sees the rewritten data
+    frame = makeFrame(0x200, 4, data);
+    ops[0] = (REWRITE_OP){RW_SET, 0, 0x00, 0};
+    ops[1] = (REWRITE_OP){RW_CHECKSUM, 3, CSUM_XOR, 0};
+    CHECK(GatewayRules::runOps(frame, ops, 2, counter));
+    CHECK_EQ(frame.data.bytes[3], 0x22 ^ 0x33);
+
+    //byte numbers only ever address the 8 data bytes
+    frame = makeFrame(0x200, 8, data);
+    ops[0] = (REWRITE_OP){RW_SET, 9, 0xEE, 0};
+    CHECK(GatewayRules::runOps(frame, ops, 1, counter));
+    CHECK_EQ(frame.data.bytes[1], 0xEE);
+
+    //DROP stops the program there
+    frame = makeFrame(0x200, 8, data);
+    ops[0] = (REWRITE_OP){RW_SET, 0, 0x01, 0};
+    ops[1] = (REWRITE_OP){RW_DROP, 0, 0, 0};
+    ops[2] = (REWRITE_OP){RW_SET, 1, 0x01, 0};
+    CHECK(!GatewayRules::runOps(frame, ops, 3, counter));
+    CHECK_EQ(frame.data.bytes[0], 0x01);
+    CHECK_EQ(frame.data.bytes[1], 0x22);
+
+    //no more than MAX_REWRITE_OPS run however many are asked for
+    frame = makeFrame(0x200, 8, data);
+    for (int c = 0; c < MAX_REWRITE_OPS; c++) ops[c] = (REWRITE_OP){RW_NOP, 0, 0, 0};
+    ops[MAX_REWRITE_OPS] = (REWRITE_OP){RW_DROP, 0, 0, 0};
+    CHECK(GatewayRules::runOps(frame, ops, MAX_REWRITE_OPS + 1, counter));
+}
+
+static void testParseOp()
+{
+    REWRITE_OP op;
+    char buff[32];
+
+    strcpy(buff, "chk:7:3:0x20");
+    CHECK(GatewayRules::parseOp(buff, op));
+    CHECK_EQ(op.opcode, RW_CHECKSUM);
+    CHECK_EQ(op.byteNum, 7);
+    CHECK_EQ(op.value, CSUM_CRC8_J1850);
+    CHECK_EQ(op.param, 0x20);
+
+    strcpy(buff, "DROP");
+    CHECK(GatewayRules::parseOp(buff, op));
+    CHECK_EQ(op.opcode, RW_DROP);
+
+    strcpy(buff, "SET:8:1");
+    CHECK(!GatewayRules::parseOp(buff, op));
+    strcpy(buff, "MUL:1:2");
+    CHECK(!GatewayRules::parseOp(buff, op));
+    strcpy(buff, "NOP:1:2");
+    CHECK(!GatewayRules::parseOp(buff, op));
+
+    op = (REWRITE_OP){RW_COUNTER, 6, 0x0F, 0};
+    CHECK_EQ(GatewayRules::printOp(buff, op), (int)strlen("CNT:6:0xf:0"));
+    CHECK(!strcmp(buff, "CNT:6:0xf:0"));
+    CHECK(GatewayRules::parseOp(buff, op));
+    CHECK_EQ(op.opcode, RW_COUNTER);
+    CHECK_EQ(op.value, 0x0F);
+}
+
+static void testRuleTable()
+{
+    GatewayRules rules;
+    char def[96];
+    static const uint8_t data[] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+
+    for (int i = 0; i < MAX_REWRITE_RULES; i++) rules.clearRule(i);
+    rules.compile();
+    rules.resetStats();
+
+    strcpy(def, "0x120,0,SET:2:0xFF,CNT:6:0x0F,CHK:7:3");
+    CHECK(rules.setRule(0, def));
+    strcpy(def, "0x121,1,DROP");
+    CHECK(rules.setRule(1, def));
+    strcpy(def, "0x122,2,SET:0:1");
+    CHECK(!rules.setRule(2, def)); //only CAN0 and CAN1 are bridged
+    strcpy(def, "0x122,0,SET:0:1,SET:0:1,SET:0:1,SET:0:1,SET:0:1,SET:0:1");
+    CHECK(!rules.setRule(2, def));
+    CHECK(!rules.setRule(MAX_REWRITE_RULES, def));
+
+    CAN_FRAME frame = makeFrame(0x120, 8, data);
+    CHECK(rules.processFrame(frame, 0));
+    CHECK_EQ(frame.data.bytes[2], 0xFF);
+    CHECK_EQ(frame.data.bytes[6], 0x01);
+    CHECK_EQ(frame.data.bytes[7], GatewayRules::calcChecksum(frame, CSUM_CRC8_J1850, 7, 0));
+
+    //rules are per source bus
+    frame = makeFrame(0x120, 8, data);
+    CHECK(rules.processFrame(frame, 1));
+    CHECK_EQ(frame.data.bytes[2], 0x00);
+
+    frame = makeFrame(0x121, 8, data);
+    CHECK(!rules.processFrame(frame, 1));
+    CHECK(rules.processFrame(frame, 0));
+
+    //five of the longest ops still print in one line
+    strcpy(def, "0x1FFFFFFF,1,DROP:7:255:255,DROP:7:255:255,DROP:7:255:255,DROP:7:255:255,DROP:7:255:255");
+    CHECK(rules.setRule(MAX_REWRITE_RULES - 1, def));
+    hostClearOutput();
+    rules.printRules();
+    CHECK_CONTAINS(hostOutput(), "GWRULE0=0x120,0,SET:2:0xff:0,CNT:6:0xf:0,CHK:7:0x3:0");
+    CHECK_CONTAINS(hostOutput(), "GWRULE1=0x121,1,DROP:0:0x0:0");
+    CHECK_CONTAINS(hostOutput(), "GWRULE7=0x1fffffff,1,DROP:7:0xff:255,DROP:7:0xff:255,DROP:7:0xff:255,DROP:7:0xff:255,DROP:7:0xff:255");
+
+    rules.clearRule(0);
+    rules.compile();
+    frame = makeFrame(0x120, 8, data);
+    CHECK(rules.processFrame(frame, 0));
+    CHECK_EQ(frame.data.bytes[2], 0x00);
+}
+
+int main()
+{
+    testCrcVectors();
+    testSimpleChecksums();
+    testRunOps();
+    testParseOp();
+    testRuleTable();
+    return checkResult();
+}
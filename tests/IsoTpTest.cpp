@@ -0,0 +1,151 @@
+/*
+ * IsoTp: the shared PDU buffer, the load timeout and PDUs the binary protocol has to throw away.
+ */
+#include "Check.h"
+#include "GVRET.h"
+#include "IsoTp.h"
+
+static int outputCount(const uint8_t *bytes, size_t len)
+{
+    const uint8_t *out = (const uint8_t *)hostOutput();
+    int count = 0;
+    for (size_t i = 0; i + len <= hostOutputLength(); i++) {
+        if (!memcmp(out + i, bytes, len)) count++;
+    }
+    return count;
+}
+
+static bool outputHas(const uint8_t *bytes, size_t len)
+{
+    return outputCount(bytes, len) > 0;
+}
+
+static bool statusSent(uint8_t session, uint8_t result)
+{
+    uint8_t status[4] = {0xF1, PROTO_ISOTP_STATUS, session, result};
+    return outputHas(status, 4);
+}
+
+static void run()
+{
+    for (int i = 0; i < 200; i++) loop();
+    flushSerialBuffer();
+}
+
+static void receive(uint32_t id, const uint8_t *data)
+{
+    CAN_FRAME frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.id = id;
+    frame.length = 8;
+    memcpy(frame.data.bytes, data, 8);
+    isoTp.processFrame(frame, 0);
+}
+
+static void testOversizePdu()
+{
+    static uint8_t cmd[5 + 5000];
+    const uint8_t keepAlive[] = {0xF1, PROTO_KEEPALIVE};
+    const uint8_t alive[] = {0xF1, PROTO_KEEPALIVE, 0xDE, 0xAD};
+
+    //a PDU longer than ISO-TP allows, made of keepalive commands
+    cmd[0] = 0xF1;
+    cmd[1] = PROTO_ISOTP_SEND;
+    cmd[2] = 0;
+    cmd[3] = 5000 & 0xFF;
+    cmd[4] = 5000 >> 8;
+    for (int i = 5; i < 5005; i += 2) memcpy(cmd + i, keepAlive, 2);
+    hostClearOutput();
+    hostInput(cmd, sizeof(cmd));
+    hostInput(keepAlive, sizeof(keepAlive));
+    run();
+    CHECK(statusSent(0, ISOTP_INVALID));
+    CHECK_EQ(outputCount(alive, sizeof(alive)), 1); //only the keepalive after it was taken as a command
+}
+
+static void testLoadTimeout()
+{
+    uint8_t cmd[5 + 20] = {0xF1, PROTO_ISOTP_SEND, 0, 20, 0};
+    uint32_t sent = Can0.sentCount;
+
+    hostClearOutput();
+    hostInput(cmd, 10); //header and 5 of the 20 bytes
+    run();
+    CHECK(!statusSent(0, ISOTP_TIMEOUT_LOAD));
+    hostAdvanceMicros((ISOTP_TIMEOUT + 10) * 1000);
+    run();
+    CHECK(statusSent(0, ISOTP_TIMEOUT_LOAD));
+
+    //the rest turning up late is read and dropped
+    hostInput(cmd + 10, 15);
+    run();
+    CHECK_EQ(Can0.sentCount, sent);
+
+    //and the session works again
+    hostClearOutput();
+    hostInput(cmd, sizeof(cmd));
+    run();
+    CHECK(!statusSent(0, ISOTP_BUSY));
+    CHECK_EQ(Can0.sentCount, sent + 1); //first frame, waiting on flow control now
+    CHECK_EQ(Can0.lastSent.data.bytes[0], 0x10);
+    hostAdvanceMicros((ISOTP_TIMEOUT + 10) * 1000);
+    run();
+    CHECK(statusSent(0, ISOTP_TIMEOUT_BS));
+}
+
+static void testSharedBuffer()
+{
+    const uint8_t first[8] = {0x10, 0x0A, 1, 2, 3, 4, 5, 6};
+    const uint8_t consecutive[8] = {0x21, 7, 8, 9, 10, 0, 0, 0};
+    const uint8_t single[8] = {0x03, 0x62, 0xF1, 0x90, 0, 0, 0, 0};
+    const uint8_t pdu[] = {0xF1, PROTO_ISOTP_RECEIVE, 0, 10, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+    const uint8_t singlePdu[] = {0xF1, PROTO_ISOTP_RECEIVE, 1, 3, 0, 0x62, 0xF1, 0x90};
+
+    //session 0 is part way through receiving a PDU so it has the buffer
+    receive(0x7E8, first);
+    CHECK(!isoTp.startLoad(1, 20));
+
+    //a second multi frame PDU is turned away with an overflow flow control
+    hostClearOutput();
+    receive(0x7E9, first);
+    flushSerialBuffer();
+    CHECK(statusSent(1, ISOTP_BUSY));
+    run();
+    CHECK_EQ(Can0.lastSent.id, 0x7E1);
+    CHECK_EQ(Can0.lastSent.data.bytes[0], 0x32);
+
+    //single frames never need the buffer
+    hostClearOutput();
+    receive(0x7E9, single);
+    flushSerialBuffer();
+    CHECK(outputHas(singlePdu, sizeof(singlePdu)));
+
+    receive(0x7E8, consecutive);
+    flushSerialBuffer();
+    CHECK(outputHas(pdu, sizeof(pdu)));
+    CHECK(isoTp.startLoad(1, 20));
+    isoTp.closeSession(1);
+    CHECK(isoTp.startLoad(0, 20));
+}
+
+int main()
+{
+    const uint8_t binary[] = {0xE7, 0xE7};
+    //session 0 talks to 0x7E0 / 0x7E8 on CAN0, session 1 to 0x7E1 / 0x7E9
+    const uint8_t setupSessions[] = {
+        0xF1, PROTO_ISOTP_SETUP, 0, 0, 0xE0, 0x07, 0, 0, 0xE8, 0x07, 0, 0, 0, 0, 0, 0,
+        0xF1, PROTO_ISOTP_SETUP, 1, 0, 0xE1, 0x07, 0, 0, 0xE9, 0x07, 0, 0, 0, 0, 0, 0
+    };
+
+    setup();
+    settings.CAN0_Enabled = true;
+    setupBuses();
+    hostInput(binary, sizeof(binary));
+    hostInput(setupSessions, sizeof(setupSessions));
+    run();
+
+    testOversizePdu();
+    testLoadTimeout();
+    testSharedBuffer();
+    return checkResult();
+}
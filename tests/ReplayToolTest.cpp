@@ -0,0 +1,66 @@
+/*
+ * tools/gvret_replay.py against the firmware: the sketch runs here behind a pseudo terminal,
+ * the tool plays Sample.csv through it and every real frame in the log has to reach CAN0 or CAN1.
+ */
+#include "Check.h"
+#include "GVRET.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define SAMPLE_FRAMES 300 //Sample.csv also has an event and an echoed frame that must not be sent
+
+int main()
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    CHECK(master >= 0 && grantpt(master) == 0 && unlockpt(master) == 0);
+    char *slave = ptsname(master);
+    fcntl(master, F_SETFL, O_NONBLOCK);
+
+    setup();
+    settings.CAN0_Enabled = true;
+    settings.CAN1_Enabled = true;
+    setupBuses();
+    uint32_t before = Can0.sentCount + Can1.sentCount;
+
+    int outPipe[2];
+    CHECK(pipe(outPipe) == 0);
+    pid_t tool = fork();
+    if (tool == 0) {
+        dup2(outPipe[1], STDOUT_FILENO);
+        execl(PYTHON, PYTHON, GVRET_DIR "/tools/gvret_replay.py", TESTS_DIR "/Sample.csv", "--port", slave, (char *)NULL);
+        _exit(127);
+    }
+    close(outPipe[1]);
+
+    //the device side: bytes from the tool go into SerialUSB, whatever it writes goes back
+    uint8_t buff[512];
+    int status = -1;
+    for (int spins = 0; spins < 2000000; spins++) {
+        ssize_t got = read(master, buff, sizeof(buff));
+        if (got > 0) hostInput(buff, got);
+        loop();
+        flushSerialBuffer();
+        if (hostOutputLength()) {
+            if (write(master, hostOutput(), hostOutputLength()) < 0) break;
+            hostClearOutput();
+        }
+        hostAdvanceMicros(50);
+        if (waitpid(tool, &status, WNOHANG) == tool) break;
+        if (got <= 0) usleep(20);
+    }
+    if (!WIFEXITED(status)) kill(tool, SIGKILL);
+
+    char report[1024];
+    ssize_t len = read(outPipe[0], report, sizeof(report) - 1);
+    report[len > 0 ? len : 0] = 0;
+    printf("%s", report);
+
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    CHECK_EQ(Can0.sentCount + Can1.sentCount - before, SAMPLE_FRAMES);
+    CHECK_CONTAINS(report, "300 frames streamed");
+    CHECK_CONTAINS(report, "Device sent 300 frames");
+    return checkResult();
+}
@@ -0,0 +1,319 @@
+/*
+ * SerialConsole: every command in the table is typed in at least once, good values and bad,
+ * and what it said back and what it changed are checked. The keys in the help are compared
+ * against the cases here so a new command without a test fails. The short and LAWICEL
+ * commands are covered at the end.
+ */
+#include "Check.h"
+#include "GVRET.h"
+#include "SerialConsole.h"
+#include "CanBus.h"
+
+struct CONSOLE_CASE {
+    const char *key; //table key this case covers
+    const char *line;
+    const char *reply; //has to be somewhere in what came back
+};
+
+static const CONSOLE_CASE cases[] = {
+    {"LOGLEVEL", "LOGLEVEL=1", "setting loglevel to 'info'"},
+    {"SYSTYPE", "SYSTYPE=2", "System type updated"},
+    {"SYSTYPE", "SYSTYPE=7", "Invalid system type"},
+    {"SETTINGSSTATUS", "SETTINGSSTATUS=1", "Settings: not stored yet, write pending"},
+    {"BOOTSTATUS", "BOOTSTATUS=1", "Buses up"},
+
+    {"CAN0EN", "CAN0EN=1", "Setting CAN0 Enabled to 1"},
+    {"CAN0SPEED", "CAN0SPEED=250000", "Setting CAN0 Baud Rate to 250000"},
+    {"CAN0SPEED", "CAN0SPEED=0", "Invalid baud rate!"},
+    {"CAN0LISTENONLY", "CAN0LISTENONLY=1", "Setting CAN0 Listen Only to 1"},
+    {"CAN0LISTENONLY", "CAN0LISTENONLY=0", "Setting CAN0 Listen Only to 0"},
+    {"CAN0FILTER", "CAN0FILTER3=0x100,0x7F0,0,1", "Setting CAN0FILTER3 to ID 0x100 Mask 0x7F0 Extended 0 Enabled 1"},
+    {"CAN0FILTER", "CAN0FILTER8=0x100,0x7F0,0,1", "Invalid index for CAN0FILTER. Must be between 0 and 7"},
+    {"CAN1EN", "CAN1EN=1", "Setting CAN1 Enabled to 1"},
+    {"CAN1SPEED", "CAN1SPEED=125000", "Setting CAN1 Baud Rate to 125000"},
+    {"CAN1LISTENONLY", "CAN1LISTENONLY=0", "Setting CAN1 Listen Only to 0"},
+    {"CAN1FILTER", "CAN1FILTER0=0x18DAF100,0x1FFFFF00,1,1", "Setting CAN1FILTER0 to ID 0x18DAF100 Mask 0x1FFFFF00 Extended 1"},
+    {"CAN0SEND", "CAN0SEND=0x200,4,1,2,3,4", "Sending frame with id: 0x200 len: 4"},
+    {"CAN0SEND", "CAN0SEND=0x200,9", ""}, //quietly not sent, testValues counts what went out
+    {"CAN1SEND", "CAN1SEND=0x201,2,0xAA,0xBB", "Sending frame with id: 0x201 len: 2"},
+    {"MARK", "MARK=pressed the brake", "Mark: pressed the brake"},
+    {"SWWAKE", "SWWAKE=0x621,1,0", "Single wire CAN is off"},
+    {"SINGLEWIRE", "SINGLEWIRE=1", "Setting SINGLEWIRE to 1"},
+    {"SINGLEWIRE", "SINGLEWIRE=2", "Invalid setting! Enter a value 0 - 1"},
+    {"SWSPEED", "SWSPEED=33333", "Setting SWCAN Baud Rate to 33333"},
+    {"SWLISTENONLY", "SWLISTENONLY=1", "Setting SWCAN Listen Only to 1"},
+    {"SWLISTENONLY", "SWLISTENONLY=3", "Invalid setting! Enter a value 0 - 1"},
+    {"SWSEND", "SWSEND=0x100,1,0", "Bus 2 transmit queue is full or the bus is off"},
+    {"SWWAKE", "SWWAKE=0x621,8,0,0x40,0,0,0,0,0,0", "Sending frame with id: 0x621 len: 8"},
+    {"EXTBUS", "EXTBUS0=1,500000,0,30,31", "MCP2515 on CS 30 INT 31: 0 received, 0 waiting, most waiting 0 of 63"},
+    {"EXTBUS", "EXTBUS0=1,0", "Invalid setting! Enter enable, baud rate"},
+    {"EXTBUS", "EXTBUS1=0,500000", "Bus 4 has no CS and INT pins set"},
+
+    {"BINSERIAL", "BINSERIAL=0", "Setting BINSERIAL to 0"},
+    {"TXECHO", "TXECHO=1", "Setting TXECHO to 1"},
+    {"FILETYPE", "FILETYPE=2", "Setting File Output Type to 2"},
+    {"FILETYPE", "FILETYPE=9", "Setting File Output Type to 3"},
+    {"FILEBASE", "FILEBASE=CANLOG", "Setting FILEBASE to CANLOG"},
+    {"FILEBASE", "FILEBASE=ABCDEFGHIJKLMNOPQRSTUVWXYZABCDEFGHIJ", "Too long!"},
+    {"FILEEXT", "FILEEXT=TXT", "Setting FILEEXT to TXT"},
+    {"FILENUM", "FILENUM=5", "Setting FILENUM to 5"},
+    {"FILENUM", "FILENUM=70000", "Invalid setting! Enter a value 0 - 65535"},
+    {"FILEAPPEND", "FILEAPPEND=1", "Setting FILEAPPEND to 1"},
+    {"FILEAUTO", "FILEAUTO=0", "Setting FILEAUTO to 0"},
+
+    {"DIGTOGEN", "DIGTOGEN=0", "Setting DIGTOGEN to 0"},
+    {"DIGTOGMODE", "DIGTOGMODE=1", "Setting DIGTOGMODE to 1"},
+    {"DIGTOGLEVEL", "DIGTOGLEVEL=1", "Setting DIGTOGLEVEL to 1"},
+    {"DIGTOGPIN", "DIGTOGPIN=12", "Setting DIGTOGPIN to 12"},
+    {"DIGTOGPIN", "DIGTOGPIN=99", "Invalid setting! Enter a value 0 - 77"},
+    {"DIGTOGID", "DIGTOGID=0x123", "Setting DIGTOGID to 291"},
+    {"DIGTOGCAN0", "DIGTOGCAN0=1", "Setting DIGTOGCAN0 to 1"},
+    {"DIGTOGCAN1", "DIGTOGCAN1=0", "Setting DIGTOGCAN1 to 0"},
+    {"DIGTOGLEN", "DIGTOGLEN=4", "Setting DIGTOGLEN to 4"},
+    {"DIGTOGPAYLOAD", "DIGTOGPAYLOAD=1,2,0x33", "Set new payload bytes"},
+
+    {"GWRULE", "GWRULE0=0x1A0,0,SET:2:0xFF,CNT:6:0x0F", "Set gateway rule 0"},
+    {"GWRULE", "GWRULE1=0x1A0,0,BOGUS:1:1", "Error processing rule definition"},
+    {"GWSTATS", "GWSTATS=1", "Rule 0 hits: 0"},
+    {"GWSTATS", "GWSTATS=0", "Gateway statistics reset"},
+    {"GWRULE", "GWRULE0=OFF", "Cleared gateway rule 0"},
+
+    {"TRIG", "TRIG0=TIMER,1000;MARK", "Set trigger 0"},
+    {"TRIG", "TRIG1=NOTATRIGGER;MARK", "Error processing trigger definition"},
+    {"TRIGSTATS", "TRIGSTATS=1", "Trigger 0 fired 0 times"},
+    {"TRIG", "TRIG0=OFF", "Cleared trigger 0"},
+
+    {"ISOTP", "ISOTP0=0,0x7E0,0x7E8", "Opened ISO-TP session 0"},
+    {"ISOTP", "ISOTP1=0", "Need at least BUS,TXID,RXID"},
+    {"ISOTPSTATUS", "ISOTPSTATUS=1", "ISO-TP session 0: bus 0 tx 0x7E0 rx 0x7E8"},
+    {"ISOTP", "ISOTP0=OFF", "Closed ISO-TP session 0"},
+
+    {"RESP", "RESP0=0,0x7E0,0322F190;0,0x7E8,0662F190R3R4AA;200", "Set response 0"},
+    {"RESP", "RESP1=0", "Error processing response definition"},
+    {"RESPSTATS", "RESPSTATS=1", "Response 0 requests answered"},
+    {"RESPSTATS", "RESPSTATS=0", "Responder statistics reset"},
+    {"RESP", "RESP0=OFF", "Cleared response 0"},
+
+    {"CYCLIC", "CYCLIC0=0,0x3F1,10,0000000000000000,CNT:6:0x0F", "Set cyclic message 0"},
+    {"CYCLIC", "CYCLIC1=0,0x3F1", "Error processing cyclic message definition"},
+    {"CYCLICSTATS", "CYCLICSTATS=1", "Cyclic 0 sent"},
+    {"CYCLICSTATS", "CYCLICSTATS=0", "Cyclic message statistics reset"},
+    {"CYCLIC", "CYCLIC0=OFF", "Cleared cyclic message 0"},
+
+    {"SDREPLAY", "SDREPLAY=CAN0.BIN,1,0,100,10X", "Could not start replay"},
+    {"SDREPLAY", "SDREPLAY=STOP", "SD card replay stopped"},
+    {"REPLAYSTATUS", "REPLAYSTATUS=1", "No SD card replay running"},
+
+    {"TIMESYNC", "TIMESYNC=MASTER,0", "Time sync master on bus 0 ID 0x1FFFFFF0 every 100 ms"},
+    {"TIMESYNC", "TIMESYNC=SLAVE", "Invalid time sync setting"},
+    {"TIMESYNC", "TIMESYNC=BOGUS,0", "Invalid time sync setting"},
+    {"TIMESYNC", "TIMESYNC=OFF", "Time sync is off"},
+    {"TIMESYNCSTATUS", "TIMESYNCSTATUS=1", "Time sync is off"},
+
+    {"ADCSTREAM", "ADCSTREAM=3,8", "Streaming inputs 0x3 to USB, averaging 8 samples"},
+    {"ADCSTREAM", "ADCSTREAM=OFF", "Analog streaming stopped"},
+    {"ADCSTATUS", "ADCSTATUS=1", "Analog streaming is off"},
+    {"ADCFILTER", "ADCFILTER0=CIC,16,3", "ADCFILTER0=CIC,16,3"},
+    {"ADCFILTER", "ADCFILTER0=FOO,1", "Invalid analog filter setting"},
+    {"ADCFILTER", "ADCFILTER0=IIR,1,16", "Invalid analog filter setting"},
+    {"ADCCAL", "ADCCAL1=12,0.805", "ADCCAL1=12,3297"},
+    {"ADCCAL", "ADCCAL1=12,20", "Invalid analog calibration"},
+    {"ADCFILTERS", "ADCFILTERS=1", "ADCFILTER2=BOXCAR,64,0  ADCCAL2=0,4096"},
+
+    {"EDGES", "EDGES=1,500", "Debounce: 500 us  events for inputs: 0x1"},
+    {"EDGESTATUS", "EDGESTATUS=1", "Input 3:"},
+
+    {"CENSUS", "CENSUS=0", "Bus 0: 0 IDs"},
+    {"CENSUS", "CENSUS=9", "Bus 3: 0 IDs"},
+    {"CENSUSRESET", "CENSUSRESET=1", "Census cleared"},
+    {"CENSUSSAVE", "CENSUSSAVE=30", "Census will be saved every 30 seconds while logging"},
+    {"CENSUSSAVE", "CENSUSSAVE=0", "Could not save census. Is there an SD card?"},
+    {"BUSLOAD", "BUSLOAD=1", "Bus 1 load 100ms: 0.0%"},
+    {"BUSLOAD", "BUSLOAD=0", "Bus load statistics reset"},
+    {"BUSLOADSTUFF", "BUSLOADSTUFF=1", "Setting bus load stuff bit calculation to worst case"},
+    {"BUSLOADSTUFF", "BUSLOADSTUFF=5", "Invalid setting! Enter a value 0 - 1"},
+    {"BUSSTATUS", "BUSSTATUS=1", "Bus 3: active"},
+    {"BUSES", "BUSES=1", "1 high voltage wakeups"},
+    {"BUSOFFRECOVERY", "BUSOFFRECOVERY=100,2000", "Bus-off recovery after 100 ms backing off to 2000 ms"},
+    {"BUSOFFRECOVERY", "BUSOFFRECOVERY=0", "Automatic bus-off recovery disabled"},
+    {"BUSOFFRECOVERY", "BUSOFFRECOVERY=20000", "Invalid setting! Delays are 0 - 10000 and 0 - 60000 ms"},
+
+    {"SIGNAL", "SIGNAL0=0x3D3,0,24,16,I,S,0.1,-400", "Set signal 0"},
+    {"SIGNAL", "SIGNAL1=0x3D3,0", "Error processing signal definition"},
+    {"SIGNALS", "SIGNALS=0", "SIGNAL0=0x3d3,0,24,16,I,S,0.1,-400"},
+    {"SIGNALS", "SIGNALS=1", "Signal 0: not seen"},
+    {"SIGNAL", "SIGNAL0=OFF", "Cleared signal 0"},
+    {"SIGNALSTREAM", "SIGNALSTREAM=0", "Setting signal stream mode to 0"},
+    {"SIGNALSTREAM", "SIGNALSTREAM=3", "Invalid setting! Enter a value 0 - 2"},
+    {"SIGNALLOG", "SIGNALLOG=0", "Setting signal logging to 0"},
+    {"SIGNALLOG", "SIGNALLOG=2", "Invalid setting! Enter a value 0 - 1"},
+
+    {NULL, "NOSUCHKEY=1", "Unknown command"},
+    {NULL, "CAN0EN=", "Command needs a value"},
+    {NULL, "GWRULE99=OFF", "Invalid index for GWRULE"}
+};
+
+#define NUM_CASES (sizeof(cases) / sizeof(cases[0]))
+
+static void run()
+{
+    for (int i = 0; i < 20; i++) {
+        loop();
+        hostAdvanceMicros(1000);
+    }
+    flushSerialBuffer();
+}
+
+static const char *type(const char *line)
+{
+    hostClearOutput();
+    hostInput(line, strlen(line));
+    hostInput("\r", 1);
+    run();
+    return hostOutput();
+}
+
+static void testCases()
+{
+    for (unsigned c = 0; c < NUM_CASES; c++) {
+        const char *reply = type(cases[c].line);
+        if (!strstr(reply, cases[c].reply)) printf("after %s:\n", cases[c].line);
+        CHECK_CONTAINS(reply, cases[c].reply);
+    }
+}
+
+//what the cases above were meant to change
+static void testValues()
+{
+    CHECK_EQ(settings.sysType, 2);
+    CHECK_EQ(settings.CAN0Speed, 250000);
+    CHECK_EQ(settings.CAN0Filters[3].id, 0x100);
+    CHECK_EQ(settings.CAN0Filters[3].mask, 0x7F0);
+    CHECK(settings.CAN0Filters[3].enabled);
+    CHECK_EQ(settings.CAN1Filters[0].id, 0x18DAF100);
+    CHECK(settings.CAN1Filters[0].extended);
+    CHECK_EQ(settings.CAN1Speed, 125000);
+    CHECK(settings.singleWire_Enabled);
+    CHECK_EQ(settings.SWCANSpeed, 33333);
+    CHECK(settings.SWCANListenOnly);
+    CHECK(settings.extBuses[0].enabled);
+    CHECK_EQ(settings.extBuses[0].speed, 500000);
+    CHECK_EQ(settings.extBuses[0].csPin, 30);
+    CHECK(settings.echoTx);
+    CHECK_EQ(settings.fileOutputType, CRTD);
+    CHECK(!strcmp(settings.fileNameBase, "CANLOG"));
+    CHECK(!strcmp(settings.fileNameExt, "TXT"));
+    CHECK_EQ(settings.fileNum, 5);
+    CHECK(settings.appendFile);
+    CHECK_EQ(digToggleSettings.mode, 0x83); //receive, default high, CAN0
+    CHECK_EQ(digToggleSettings.pin, 12);
+    CHECK_EQ(digToggleSettings.rxTxID, 0x123);
+    CHECK_EQ(digToggleSettings.length, 4);
+    CHECK_EQ(digToggleSettings.payload[2], 0x33);
+    CHECK_EQ(Can0.sentCount, 1);
+    CHECK_EQ(Can1.sentCount, 2); //CAN1SEND and SWWAKE, single wire is on CAN1 on this board
+}
+
+//the bus is restarted through the registry so the mode is on the controller, not only in settings
+static void testListenOnly()
+{
+    type("CAN1LISTENONLY=1");
+    CHECK(Can1.listenMode);
+    CHECK(busRegistry.get(1)->isRunning());
+    type("CAN1LISTENONLY=0");
+    CHECK(!Can1.listenMode);
+}
+
+//every key the help shows has at least one case
+static void testCoverage()
+{
+    char key[CONSOLE_KEY_MAX];
+    const char *line = type("h");
+    int keys = 0;
+
+    CHECK_CONTAINS(line, "System Menu:");
+    for (; *line; line = strchr(line, '\n') ? strchr(line, '\n') + 1 : line + strlen(line)) {
+        int len = 0;
+        while (len < CONSOLE_KEY_MAX - 1 && ((line[len] >= 'A' && line[len] <= 'Z') || isdigit(line[len]))) len++;
+        if (len == 0 || (line[len] != '=' && line[len] != '<')) continue;
+        memcpy(key, line, len);
+        key[len] = 0;
+        bool found = false;
+        for (unsigned c = 0; c < NUM_CASES && !found; c++) {
+            if (!cases[c].key) continue;
+            size_t k = strlen(cases[c].key);
+            //filters are listed CAN0FILTER0 to CAN0FILTER7
+            found = !strncmp(key, cases[c].key, k) && (key[k] == 0 || isdigit(key[k]));
+        }
+        if (!found) printf("no test for %s\n", key);
+        CHECK(found);
+        keys++;
+    }
+    CHECK(keys > 60);
+}
+
+static void testShortCommands()
+{
+    CHECK_CONTAINS(type("?"), "Short Commands:");
+    CHECK_CONTAINS(type("K"), "all outputs: ON");
+    CHECK_CONTAINS(type("J"), "all outputs: OFF");
+    type("s");
+    CHECK(SysSettings.logToFile);
+    type("S");
+    CHECK(!SysSettings.logToFile);
+    CHECK_CONTAINS(type("V"), "V1013");
+    CHECK_CONTAINS(type("N"), "ND00D");
+    CHECK_CONTAINS(type("F"), "F00\r");
+    CHECK_EQ(type("O")[0], '\r');
+    CHECK(SysSettings.lawicelMode);
+    CHECK_EQ(type("P")[0], '\r');
+    CHECK_EQ(type("A")[0], '\r');
+}
+
+static void testLawicel()
+{
+    uint32_t sent = Can0.sentCount;
+
+    type("X1");
+    CHECK(SysSettings.lawicelAutoPoll);
+    CHECK_CONTAINS(type("t1232AABB"), "z");
+    CHECK_EQ(Can0.sentCount, sent + 1);
+    CHECK_EQ(Can0.lastSent.id, 0x123);
+    CHECK_EQ(Can0.lastSent.length, 2);
+    CHECK_EQ(Can0.lastSent.data.bytes[1], 0xBB);
+    CHECK_CONTAINS(type("T18DAF1101FF"), "Z");
+    CHECK_EQ(Can0.lastSent.id, 0x18DAF110);
+    type("X0");
+    CHECK(!SysSettings.lawicelAutoPoll);
+    type("Z1");
+    CHECK(SysSettings.lawicelTimestamping);
+    type("Z0");
+    type("S6");
+    CHECK_EQ(settings.CAN0Speed, 500000);
+    CHECK_EQ(type("C")[0], '\r');
+    CHECK(!busRegistry.get(0)->isRunning());
+    CHECK_EQ(type("L")[0], '\r');
+    CHECK(busRegistry.get(0)->isRunning());
+}
+
+//last since it throws the settings away at the next power up
+static void testFactoryReset()
+{
+    CHECK_CONTAINS(type("R"), "Power cycle to reset to factory defaults");
+    CHECK_EQ(settings.version, 0xFF);
+}
+
+int main()
+{
+    setup();
+    settings.useBinarySerialComm = false;
+    settings.singleWire_Enabled = false;
+    testCases();
+    testValues();
+    testListenOnly();
+    testCoverage();
+    testShortCommands();
+    testLawicel();
+    testFactoryReset();
+    return checkResult();
+}
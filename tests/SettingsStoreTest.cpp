@@ -0,0 +1,147 @@
+/*
+ * SettingsStore: settings kept by firmware from before the store are brought over, without
+ * anything added to EEPROMSettings since being read from past the end of that old copy. The
+ * feature tables are brought over from their old pages too and changes to them are written later
+ * from loop() rather than by whoever changed them. Empty tables aren't read at start up.
+ */
+#include "Check.h"
+#include "GVRET.h"
+#include "SettingsStore.h"
+#include "GatewayRules.h"
+#include <Wire_EEPROM.h>
+
+static uint8_t before[sizeof(EEPROM.mem)];
+
+static void commit()
+{
+    for (int c = 0; c < 1000; c++) {
+        hostAdvanceMicros(STORE_COMMIT_DELAY * 1000);
+        settingsStore.loop();
+    }
+}
+
+//the old copy is followed by whatever else was on that page
+static void testLegacy()
+{
+    uint8_t *page = EEPROM.mem + EEPROM_PAGE * 256;
+    EEPROMSettings old;
+
+    memset(page, 0xAA, 256);
+    memset(&old, 0xAA, sizeof(old));
+    old.version = EEPROM_VER_LEGACY;
+    old.CAN0Speed = 250000;
+    old.SWCANListenOnly = true;
+    memcpy(page, &old, EEPROM_LEGACY_LENGTH);
+
+    setup();
+    CHECK_EQ(settings.version, EEPROM_VER);
+    CHECK_EQ(settings.CAN0Speed, 250000);
+    CHECK(settings.SWCANListenOnly);
+    for (int b = 0; b < EXT_BUSES; b++) {
+        CHECK(!settings.extBuses[b].enabled);
+        CHECK_EQ(settings.extBuses[b].csPin, 255);
+    }
+    CHECK(!settings.echoTx);
+    CHECK(settingsStore.isDirty(STORE_SETTINGS));
+
+    //once the store has it the old page isn't looked at again
+    commit();
+    CHECK(!settingsStore.isDirty(STORE_SETTINGS));
+    memset(page, 0, 256);
+    loadSettings();
+    CHECK_EQ(settings.CAN0Speed, 250000);
+    CHECK_EQ(settings.version, EEPROM_VER);
+    CHECK(!settingsStore.isDirty(STORE_SETTINGS));
+}
+
+//an older layout than that can't be trusted at all
+static void testTooOld()
+{
+    memset(EEPROM.mem, 0, sizeof(EEPROM.mem));
+    EEPROM.mem[EEPROM_PAGE * 256] = EEPROM_VER_LEGACY - 1;
+    memset(EEPROM.mem + EEPROM_PAGE * 256 + 1, 0xAA, 255);
+    settingsStore = SettingsStore();
+    loadSettings();
+    CHECK_EQ(settings.version, EEPROM_VER);
+    CHECK_EQ(settings.CAN0Speed, 500000);
+    CHECK(!settings.SWCANListenOnly);
+}
+
+static void testTables()
+{
+    REWRITE_TABLE old;
+    char rule[] = "0x120,0,SET:2:0xFF";
+
+    memset(&old, 0, sizeof(old));
+    old.rules[2].id = 0x321;
+    old.rules[2].enabled = 1;
+    EEPROM.write(EEPROM_PAGE_GWRULES, old);
+    settings.tablePages = 1; //only the gateway page was used
+    gatewayRules.loadTable();
+    CHECK_EQ(gatewayRules.table.rules[2].id, 0x321);
+    CHECK(settingsStore.isDirty(STORE_GWRULES));
+    commit();
+
+    //from the record now, the old page isn't read again
+    memset(EEPROM.mem + EEPROM_PAGE_GWRULES * 256, 0, 256);
+    gatewayRules.table.rules[2].id = 0;
+    gatewayRules.loadTable();
+    CHECK_EQ(gatewayRules.table.rules[2].id, 0x321);
+    CHECK(!settingsStore.isDirty(STORE_GWRULES));
+
+    //saving only marks the table, it goes out later from loop() a page at a time
+    CHECK(gatewayRules.setRule(5, rule));
+    memcpy(before, EEPROM.mem, sizeof(before));
+    gatewayRules.saveTable();
+    CHECK(!memcmp(before, EEPROM.mem, sizeof(before)));
+    CHECK(settingsStore.isDirty(STORE_GWRULES));
+    commit();
+    CHECK(memcmp(before, EEPROM.mem, sizeof(before)));
+    gatewayRules.clearRule(5);
+    gatewayRules.loadTable();
+    CHECK_EQ(gatewayRules.table.rules[5].id, 0x120);
+    CHECK_EQ(gatewayRules.table.rules[2].id, 0x321);
+}
+
+//what start up does with the same EEPROM
+static void reboot()
+{
+    settingsStore = SettingsStore();
+    loadSettings();
+    gatewayRules.loadTable();
+}
+
+static void testEmptyTables()
+{
+    char rule[] = "0x55,1,SET:0:0x01";
+
+    for (int i = 0; i < MAX_REWRITE_RULES; i++) gatewayRules.clearRule(i);
+    gatewayRules.saveTable();
+    CHECK(settings.storedRecords & (1 << STORE_GWRULES));
+    commit();
+    CHECK(!(settings.storedRecords & (1 << STORE_GWRULES)));
+
+    reboot();
+    hostClearOutput();
+    settingsStore.printStatus();
+    CHECK_CONTAINS(hostOutput(), "Gateway rules: empty, not read at start up");
+    CHECK_EQ(gatewayRules.table.rules[2].id, 0);
+
+    //the next copy still has to go after the ones already there
+    CHECK(gatewayRules.setRule(1, rule));
+    gatewayRules.saveTable();
+    commit();
+    CHECK(settings.storedRecords & (1 << STORE_GWRULES));
+    reboot();
+    CHECK_EQ(gatewayRules.table.rules[1].id, 0x55);
+    CHECK_EQ(gatewayRules.table.rules[5].id, 0);
+}
+
+int main()
+{
+    testLegacy();
+    testTooOld();
+    testTables();
+    testEmptyTables();
+    return checkResult();
+}
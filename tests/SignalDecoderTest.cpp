@@ -0,0 +1,48 @@
+/*
+ * SignalDecoder: the definitions tools/dbc2signals.py makes from Sample.dbc decode to
+ * the values the DBC describes.
+ */
+#include "Check.h"
+#include "GVRET.h"
+#include "CanBus.h"
+#include "SignalDecoder.h"
+
+static void define(uint8_t which, const char *def)
+{
+    char buff[80];
+    strcpy(buff, def);
+    CHECK(signalDecoder.setSignal(which, buff));
+}
+
+static void receive(uint32_t id, uint64_t data)
+{
+    CAN_FRAME frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.id = id;
+    frame.length = 8;
+    frame.data.value = data;
+    signalDecoder.processFrame(frame, 0, 0);
+}
+
+int main()
+{
+    for (int i = 0; i < MAX_SIGNALS; i++) signalDecoder.clearSignal(i);
+    //what dbc2signals.py prints for Sample.dbc, the dbc2signals test checks that it still does
+    define(0, "0x3D3,0,24,16,I,S,0.1,-400");
+    define(1, "0x3D3,0,7,8,M,U,0.5,0");
+    define(2, "0x18FEF1FE,0,0,16,I,U,0.00390625,0");
+
+    char bad[40];
+    strcpy(bad, "0x3D3,0,60,8,I,U");
+    CHECK(!signalDecoder.setSignal(3, bad)); //runs past the end of the frame
+
+    //PackCurrent raw 0xFF38 = -200 -> -420 A, PackSOC 0xC8 -> 100 %
+    receive(0x3D3, 0xFF380000C8ull);
+    receive(0x18FEF1FE, 0x1900); //6400 / 256 = 25 km/h
+    hostClearOutput();
+    signalDecoder.printValues();
+    CHECK_CONTAINS(hostOutput(), "Signal 0: -420");
+    CHECK_CONTAINS(hostOutput(), "Signal 1: 100");
+    CHECK_CONTAINS(hostOutput(), "Signal 2: 25");
+    return checkResult();
+}
@@ -0,0 +1,93 @@
+/*
+ * TimeSync: the master's follow up carries when the sync frame was on the bus, not when it was
+ * queued, and a slave takes that time for the sync frame's arrival.
+ */
+#include "Check.h"
+#include "GVRET.h"
+#include "CanBus.h"
+#include "TimeSync.h"
+#include "Timebase.h"
+
+static void frameOf(CAN_FRAME &frame, uint8_t length)
+{
+    memset(&frame, 0, sizeof(frame));
+    frame.id = TIMESYNC_DEFAULT_ID;
+    frame.extended = 1;
+    frame.length = length;
+}
+
+static uint64_t followUpTime(CAN_FRAME &frame)
+{
+    uint64_t time = 0;
+    for (int c = 7; c >= 1; c--) time = (time << 8) | frame.data.bytes[c];
+    return time;
+}
+
+//the sync frame sits behind other traffic for 3ms, none of which shows up in the follow up
+static void testMaster()
+{
+    uint64_t sentAt;
+
+    settings.CAN0Speed = 500000;
+    CHECK(busRegistry.get(0)->begin());
+    CHECK(timeSync.setup(TIMESYNC_MASTER, 0, TIMESYNC_DEFAULT_ID, 100));
+    hostAdvanceMicros(100000);
+    timeSync.loop();
+    hostAdvanceMicros(3000);
+    busRegistry.loop(); //given to the controller
+    sentAt = timebase.micros64();
+    busRegistry.loop(); //done with, the follow up is queued
+    busRegistry.loop();
+
+    CHECK_EQ(Can0.lastSent.id, TIMESYNC_DEFAULT_ID);
+    CHECK_EQ(Can0.lastSent.length, TIMESYNC_FOLLOW_UP_LEN);
+    CHECK_EQ(Can0.lastSent.data.bytes[0], 1);
+    //the SAM3X stamps the start of the frame, a 1 byte extended frame is about 160us at 500k
+    CHECK(followUpTime(Can0.lastSent) >= sentAt + 140);
+    CHECK(followUpTime(Can0.lastSent) <= sentAt + 180);
+
+    hostClearOutput();
+    timeSync.printStatus();
+    CHECK_CONTAINS(hostOutput(), "1 syncs sent, 0 lost");
+}
+
+static void testSlave()
+{
+    CAN_FRAME sync, followUp;
+    uint64_t master = 5000000000ull;
+
+    CHECK(timeSync.setup(TIMESYNC_SLAVE, 0, TIMESYNC_DEFAULT_ID, 100));
+    frameOf(sync, TIMESYNC_SYNC_LEN);
+    sync.data.bytes[0] = 7;
+    frameOf(followUp, TIMESYNC_FOLLOW_UP_LEN);
+    followUp.data.bytes[0] = 7;
+    for (int c = 1; c < 8; c++) followUp.data.bytes[c] = master >> ((c - 1) * 8);
+
+    //a follow up on its own does nothing
+    timeSync.processFrame(followUp, 0, timebase.micros32());
+    CHECK(timebase.stamp64() < master);
+
+    timeSync.processFrame(sync, 0, timebase.micros32());
+    hostAdvanceMicros(2000); //the follow up comes a while after
+    timeSync.processFrame(followUp, 0, timebase.micros32());
+    CHECK(timebase.stamp64() >= master + 2000);
+    CHECK(timebase.stamp64() <= master + 2001);
+
+    //one whose follow up never comes is counted, a follow up for another sequence is ignored
+    timeSync.processFrame(sync, 0, timebase.micros32());
+    sync.data.bytes[0] = 8;
+    timeSync.processFrame(sync, 0, timebase.micros32());
+    timeSync.processFrame(followUp, 0, timebase.micros32());
+    hostClearOutput();
+    timeSync.printStatus();
+    CHECK_CONTAINS(hostOutput(), "1 syncs received, 1 without a follow up");
+    timeSync.setup(TIMESYNC_OFF, 0, TIMESYNC_DEFAULT_ID, 100);
+}
+
+int main()
+{
+    setup();
+    testMaster();
+    testSlave();
+    return checkResult();
+}
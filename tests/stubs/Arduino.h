@@ -0,0 +1,180 @@
+/*
+ * Just enough of the Arduino Due core for the sketch to build and run on a PC.
+ * Registers are plain structs in RAM, time only moves when a test calls hostAdvanceMicros(),
+ * everything written to SerialUSB ends up in hostOutput() and SerialUSB reads what hostInput() was given.
+ */
+#ifndef ARDUINO_H_
+#define ARDUINO_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <math.h>
+#include <ctype.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define CHANGE 2
+#define FALLING 3
+#define RISING 4
+#define HEX 16
+#define DEC 10
+#define BIN 2
+#define PROGMEM
+
+#define min(a,b) ((a)<(b)?(a):(b))
+#define max(a,b) ((a)>(b)?(a):(b))
+
+class String
+{
+public:
+    String();
+    String(const char *str);
+    String(char chr);
+    String(int val);
+    String(unsigned int val);
+    void concat(const String &str);
+    void concat(const char *str);
+    void concat(int val);
+    void concat(unsigned int val);
+    void toUpperCase();
+    const char *c_str() const;
+    bool startsWith(const char *prefix) const;
+    String substring(unsigned int from) const;
+    long toInt() const;
+    unsigned int length() const;
+    char charAt(unsigned int idx) const;
+    bool operator==(const String &other) const;
+
+private:
+    char buf[128];
+};
+
+class Print
+{
+public:
+    size_t print(const char *str);
+    size_t print(char chr);
+    size_t print(const String &str);
+    size_t print(int val, int base = DEC);
+    size_t print(unsigned int val, int base = DEC);
+    size_t print(long val, int base = DEC);
+    size_t print(unsigned long val, int base = DEC);
+    size_t print(long long val, int base = DEC);
+    size_t print(unsigned long long val, int base = DEC);
+    size_t print(double val, int digits = 2);
+    size_t println();
+    template<class T> size_t println(T val) { return print(val) + println(); }
+    template<class T> size_t println(T val, int fmt) { return print(val, fmt) + println(); }
+    size_t write(uint8_t chr);
+    size_t write(const uint8_t *data, size_t len);
+    int available();
+    int read();
+    void begin(int baud);
+    int availableForWrite();
+    operator bool();
+};
+
+extern Print SerialUSB, Serial;
+
+uint32_t micros();
+uint32_t millis();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void pinMode(uint32_t pin, uint32_t mode);
+void digitalWrite(uint32_t pin, uint32_t val);
+int digitalRead(uint32_t pin);
+void attachInterrupt(uint32_t pin, void (*isr)(void), uint32_t mode);
+void detachInterrupt(uint32_t pin);
+void noInterrupts();
+void interrupts();
+long random(long howBig);
+long random(long howSmall, long howBig);
+#define digitalPinToInterrupt(p) (p)
+
+//SAM3X peripherals the sketch touches directly
+struct AdcRegs {
+    volatile uint32_t ADC_CR, ADC_MR, ADC_CHER, ADC_ISR, ADC_IER, ADC_IDR;
+    volatile uint32_t ADC_RPR, ADC_RCR, ADC_RNPR, ADC_RNCR, ADC_PTCR;
+};
+extern AdcRegs *ADC;
+
+struct TcChannel {
+    volatile uint32_t TC_CCR, TC_CMR, TC_CV, TC_RA, TC_RB, TC_RC, TC_SR, TC_IER, TC_IDR, TC_IMR;
+};
+struct Tc {
+    TcChannel TC_CHANNEL[3];
+};
+extern Tc *TC0, *TC1, *TC2;
+
+enum IRQn_Type { ADC_IRQn, TC0_IRQn, TC1_IRQn, TC2_IRQn, TC3_IRQn, TC4_IRQn, TC5_IRQn, TC6_IRQn, TC7_IRQn, TC8_IRQn };
+#define ID_TC0 27
+#define ID_TC3 30
+#define ID_TC5 32
+#define ID_TC6 33
+#define ID_TC7 34
+#define ID_TC8 35
+#define ID_ADC 37
+
+#define TC_CMR_TCCLKS_TIMER_CLOCK1 0
+#define TC_CMR_TCCLKS_TIMER_CLOCK4 3
+#define TC_CMR_WAVSEL_UP (0)
+#define TC_CMR_WAVSEL_UP_RC (2 << 13)
+#define TC_CMR_WAVE (1 << 15)
+#define TC_CCR_CLKEN 1
+#define TC_CCR_CLKDIS 2
+#define TC_CCR_SWTRG 4
+#define TC_IER_COVFS (1 << 0)
+#define TC_IER_CPCS (1 << 4)
+#define TC_IDR_CPCS (1 << 4)
+#define TC_SR_COVFS (1 << 0)
+#define TC_SR_CPCS (1 << 4)
+
+uint32_t NVIC_GetPendingIRQ(IRQn_Type irq);
+void NVIC_EnableIRQ(IRQn_Type irq);
+void NVIC_DisableIRQ(IRQn_Type irq);
+void NVIC_SetPriority(IRQn_Type irq, uint32_t prio);
+void NVIC_ClearPendingIRQ(IRQn_Type irq);
+void pmc_enable_periph_clk(uint32_t id);
+void pmc_set_writeprotect(bool enable);
+void adc_init(AdcRegs *adc, uint32_t mck, uint32_t freq, uint32_t startup);
+#define ADC_FREQ_MAX 20000000
+#define ADC_STARTUP_FAST 12
+
+extern uint32_t SystemCoreClock;
+#define VARIANT_MCK 84000000
+
+struct DwtRegs { volatile uint32_t CTRL, CYCCNT; };
+extern DwtRegs *DWT;
+struct CoreDebugRegs { volatile uint32_t DEMCR; };
+extern CoreDebugRegs *CoreDebug;
+#define CoreDebug_DEMCR_TRCENA_Msk (1 << 24)
+#define DWT_CTRL_CYCCNTENA_Msk 1
+
+uint32_t __get_PRIMASK();
+void __set_PRIMASK(uint32_t mask);
+void __disable_irq();
+void __enable_irq();
+
+typedef struct { volatile uint32_t PIO_PDSR; } Pio;
+typedef struct { Pio *pPort; uint32_t ulPin; } PinDescription;
+extern const PinDescription g_APinDescription[];
+
+//test side controls
+void hostAdvanceMicros(uint32_t us);
+const char *hostOutput(); //always zero terminated, binary output can have zeros of its own
+size_t hostOutputLength();
+void hostClearOutput();
+void hostInput(const void *data, size_t len);
+void hostSetPin(uint32_t pin, int level); //what digitalRead() gets, LOW until set
+
+#endif
@@ -0,0 +1,238 @@
+/*
+ * Bodies for the stubbed Arduino core and libraries. Nothing here talks to hardware, the
+ * controllers swallow whatever is sent and time is whatever the test last set it to.
+ */
+#include <Arduino.h>
+#include <due_can.h>
+#include <due_wire.h>
+#include <Wire_EEPROM.h>
+#include <MCP2515.h>
+#include <SdFat.h>
+#include <SPI.h>
+
+static uint64_t hostMicros;
+static char output[65536];
+static size_t outputLen;
+static uint8_t input[16384];
+static size_t inputLen, inputPos;
+
+//the timebase counter runs at VARIANT_MCK / 2 like TC6 does. Tests don't run long enough for it to wrap
+void hostAdvanceMicros(uint32_t us)
+{
+    hostMicros += us;
+    TC2->TC_CHANNEL[0].TC_CV = (uint32_t)(hostMicros * (VARIANT_MCK / 2000000));
+}
+
+const char *hostOutput()
+{
+    return output;
+}
+
+size_t hostOutputLength()
+{
+    return outputLen;
+}
+
+void hostClearOutput()
+{
+    outputLen = 0;
+    output[0] = 0;
+}
+
+void hostInput(const void *data, size_t len)
+{
+    if (inputPos == inputLen) inputPos = inputLen = 0;
+    if (inputLen + len > sizeof(input)) len = sizeof(input) - inputLen;
+    memcpy(input + inputLen, data, len);
+    inputLen += len;
+}
+
+static size_t emit(const void *data, size_t len)
+{
+    if (outputLen + len >= sizeof(output)) len = sizeof(output) - 1 - outputLen;
+    memcpy(output + outputLen, data, len);
+    outputLen += len;
+    output[outputLen] = 0;
+    return len;
+}
+
+static size_t emit(const char *str)
+{
+    return emit(str, strlen(str));
+}
+
+static size_t emitNumber(unsigned long long val, bool negative, int base)
+{
+    char buff[70];
+    int pos = sizeof(buff) - 1;
+    buff[pos] = 0;
+    if (base < 2) base = 10;
+    do {
+        int digit = val % base;
+        buff[--pos] = digit < 10 ? '0' + digit : 'A' + digit - 10;
+        val /= base;
+    } while (val);
+    if (negative) buff[--pos] = '-';
+    return emit(buff + pos);
+}
+
+size_t Print::print(const char *str) { return emit(str); }
+size_t Print::print(char chr) { char buff[2] = {chr, 0}; return emit(buff); }
+size_t Print::print(const String &str) { return emit(str.c_str()); }
+size_t Print::print(int val, int base) { return print((long long)val, base); }
+size_t Print::print(unsigned int val, int base) { return emitNumber(val, false, base); }
+size_t Print::print(long val, int base) { return print((long long)val, base); }
+size_t Print::print(unsigned long val, int base) { return emitNumber(val, false, base); }
+size_t Print::print(unsigned long long val, int base) { return emitNumber(val, false, base); }
+
+size_t Print::print(long long val, int base)
+{
+    //like the Arduino core only base 10 gets a sign, anything else prints the two's complement
+    if (base == DEC && val < 0) return emitNumber(-(unsigned long long)val, true, base);
+    if (base != DEC) return emitNumber((uint32_t)val, false, base);
+    return emitNumber(val, false, base);
+}
+
+size_t Print::print(double val, int digits)
+{
+    char buff[40];
+    snprintf(buff, sizeof(buff), "%.*f", digits, val);
+    return emit(buff);
+}
+
+size_t Print::println() { return emit("\r\n"); }
+size_t Print::write(uint8_t chr) { return emit(&chr, 1); }
+size_t Print::write(const uint8_t *data, size_t len) { return emit(data, len); }
+int Print::available() { return this == &SerialUSB ? inputLen - inputPos : 0; }
+int Print::read() { return available() ? input[inputPos++] : -1; }
+void Print::begin(int baud) {}
+int Print::availableForWrite() { return 1024; }
+Print::operator bool() { return true; }
+
+Print SerialUSB, Serial;
+
+String::String() { buf[0] = 0; }
+String::String(const char *str) { snprintf(buf, sizeof(buf), "%s", str); }
+String::String(char chr) { buf[0] = chr; buf[1] = 0; }
+String::String(int val) { snprintf(buf, sizeof(buf), "%i", val); }
+String::String(unsigned int val) { snprintf(buf, sizeof(buf), "%u", val); }
+void String::concat(const String &str) { concat(str.buf); }
+void String::concat(const char *str) { strncat(buf, str, sizeof(buf) - strlen(buf) - 1); }
+void String::concat(int val) { concat(String(val)); }
+void String::concat(unsigned int val) { concat(String(val)); }
+void String::toUpperCase() { for (char *c = buf; *c; c++) *c = toupper(*c); }
+const char *String::c_str() const { return buf; }
+bool String::startsWith(const char *prefix) const { return !strncmp(buf, prefix, strlen(prefix)); }
+String String::substring(unsigned int from) const { return from < strlen(buf) ? String(buf + from) : String(); }
+long String::toInt() const { return atol(buf); }
+unsigned int String::length() const { return strlen(buf); }
+char String::charAt(unsigned int idx) const { return idx < strlen(buf) ? buf[idx] : 0; }
+bool String::operator==(const String &other) const { return !strcmp(buf, other.buf); }
+
+uint32_t micros() { return (uint32_t)hostMicros; }
+uint32_t millis() { return (uint32_t)(hostMicros / 1000); }
+void delay(uint32_t ms) { hostAdvanceMicros(ms * 1000); }
+void delayMicroseconds(uint32_t us) { hostAdvanceMicros(us); }
+void pinMode(uint32_t pin, uint32_t mode) {}
+void digitalWrite(uint32_t pin, uint32_t val) {}
+static uint8_t pinLevels[256];
+void hostSetPin(uint32_t pin, int level) { if (pin < sizeof(pinLevels)) pinLevels[pin] = level; }
+int digitalRead(uint32_t pin) { return pin < sizeof(pinLevels) ? pinLevels[pin] : LOW; }
+void attachInterrupt(uint32_t pin, void (*isr)(void), uint32_t mode) {}
+void detachInterrupt(uint32_t pin) {}
+void noInterrupts() {}
+void interrupts() {}
+long random(long howBig) { return howBig ? rand() % howBig : 0; }
+long random(long howSmall, long howBig) { return howSmall + random(howBig - howSmall); }
+
+static AdcRegs adcRegs;
+static Tc tcRegs[3];
+static DwtRegs dwtRegs;
+static CoreDebugRegs coreDebugRegs;
+static Pio pioRegs;
+AdcRegs *ADC = &adcRegs;
+Tc *TC0 = &tcRegs[0], *TC1 = &tcRegs[1], *TC2 = &tcRegs[2];
+DwtRegs *DWT = &dwtRegs;
+CoreDebugRegs *CoreDebug = &coreDebugRegs;
+#define PIN {&pioRegs, 0}
+#define PINS10 PIN, PIN, PIN, PIN, PIN, PIN, PIN, PIN, PIN, PIN
+const PinDescription g_APinDescription[100] = {PINS10, PINS10, PINS10, PINS10, PINS10, PINS10, PINS10, PINS10, PINS10, PINS10};
+uint32_t SystemCoreClock = VARIANT_MCK;
+
+uint32_t NVIC_GetPendingIRQ(IRQn_Type irq) { return 0; }
+void NVIC_EnableIRQ(IRQn_Type irq) {}
+void NVIC_DisableIRQ(IRQn_Type irq) {}
+void NVIC_SetPriority(IRQn_Type irq, uint32_t prio) {}
+void NVIC_ClearPendingIRQ(IRQn_Type irq) {}
+void pmc_enable_periph_clk(uint32_t id) {}
+void pmc_set_writeprotect(bool enable) {}
+void adc_init(AdcRegs *adc, uint32_t mck, uint32_t freq, uint32_t startup) {}
+uint32_t __get_PRIMASK() { return 0; }
+void __set_PRIMASK(uint32_t mask) {}
+void __disable_irq() {}
+void __enable_irq() {}
+
+CANRaw Can0, Can1;
+uint32_t CANRaw::begin(uint32_t baud, uint8_t enablePin) { return baud; }
+bool CANRaw::sendFrame(CAN_FRAME &frame) { lastSent = frame; sentCount++; return true; }
+uint16_t CANRaw::available() { return 0; }
+uint32_t CANRaw::read(CAN_FRAME &frame) { return 0; }
+void CANRaw::enable() {}
+void CANRaw::disable() {}
+void CANRaw::enable_autobaud_listen_mode() { listenMode = true; }
+void CANRaw::disable_autobaud_listen_mode() { listenMode = false; }
+int CANRaw::setRXFilter(uint8_t mailbox, uint32_t id, uint32_t mask, bool extended) { return mailbox; }
+uint32_t CANRaw::get_status() { return 0; }
+uint32_t CANRaw::get_rx_error_cnt() { return 0; }
+uint32_t CANRaw::get_tx_error_cnt() { return 0; }
+void CANRaw::setGeneralCallback(void (*cb)(CAN_FRAME *)) {}
+void CANRaw::attachCANInterrupt(void (*cb)(CAN_FRAME *)) {}
+void CANRaw::detachCANInterrupt(uint8_t mailbox) {}
+void CANRaw::setCallback(uint8_t mailbox, void (*cb)(CAN_FRAME *)) {}
+uint32_t CANRaw::mailbox_get_status(uint8_t mailbox) { return CAN_MSR_MRDY | (micros() & CAN_MSR_MTIMESTAMP_Msk); }
+void CANRaw::mailbox_send_abort_cmd(uint8_t mailbox) {}
+uint32_t CANRaw::get_internal_timer_value() { return micros() & CAN_MSR_MTIMESTAMP_Msk; }
+
+MCP2515::MCP2515(uint8_t csPin, uint8_t intPin) { memset(regs, 0, sizeof(regs)); }
+int MCP2515::Init(uint32_t baud, uint8_t freq) { return 1; }
+void MCP2515::intHandler() {}
+bool MCP2515::GetRXFrame(CAN_FRAME &frame) { return false; }
+bool MCP2515::sendFrame(CAN_FRAME &frame) { return true; }
+uint16_t MCP2515::available() { return 0; }
+uint32_t MCP2515::read(CAN_FRAME &frame) { return 0; }
+void MCP2515::enable() {}
+void MCP2515::disable() {}
+void MCP2515::InitFilters(bool permissive) {}
+uint8_t MCP2515::Read(uint8_t address) { return address == 0x0E ? (regs[0x0F] & 0xE0) : regs[address & 0x7F]; }
+void MCP2515::Write(uint8_t address, uint8_t data) { regs[address & 0x7F] = data; }
+void MCP2515::BitModify(uint8_t address, uint8_t mask, uint8_t data) { Write(address, (Read(address) & ~mask) | (data & mask)); }
+uint8_t MCP2515::Status() { return 0; }
+uint8_t MCP2515::RXStatus() { return 0; }
+void MCP2515::Mode(uint8_t mode) {}
+void MCP2515::Reset() {}
+
+SPIClass SPI;
+void SPIClass::begin() {}
+uint8_t SPIClass::transfer(uint8_t data) { return 0; }
+void SPIClass::transfer(void *buf, size_t len) {}
+void SPIClass::beginTransaction(SPISettings settings) { transactions++; }
+void SPIClass::endTransaction() {}
+
+TwoWire Wire;
+void TwoWire::begin() {}
+void TwoWire::setClock(uint32_t clock) {}
+
+EEPROMCLASS EEPROM;
+
+bool SdFile::open(const char *name, int flags) { return false; }
+bool SdFile::isOpen() { return false; }
+int SdFile::write(const void *data, size_t len) { return 0; }
+int SdFile::read(void *data, size_t len) { return 0; }
+bool SdFile::sync() { return false; }
+bool SdFile::close() { return false; }
+bool SdFile::seekSet(uint32_t pos) { return false; }
+uint32_t SdFile::fileSize() { return 0; }
+uint32_t SdFile::curPosition() { return 0; }
+int SdFile::available() { return 0; }
+bool SdFat::begin(uint8_t csPin, int speed) { return false; }
+bool SdFat::exists(const char *name) { return false; }
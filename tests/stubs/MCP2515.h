@@ -0,0 +1,31 @@
+#ifndef MCP2515_H_
+#define MCP2515_H_
+
+#include "can_common.h"
+#include <SPI.h>
+
+class MCP2515 : public CAN_COMMON
+{
+public:
+    MCP2515(uint8_t csPin, uint8_t intPin);
+    int Init(uint32_t baud, uint8_t freq);
+    void intHandler();
+    bool GetRXFrame(CAN_FRAME &frame);
+    bool sendFrame(CAN_FRAME &frame);
+    uint16_t available();
+    uint32_t read(CAN_FRAME &frame);
+    void enable();
+    void disable();
+    void InitFilters(bool permissive);
+    uint8_t Read(uint8_t address);
+    void Write(uint8_t address, uint8_t data);
+    void BitModify(uint8_t address, uint8_t mask, uint8_t data);
+    uint8_t Status();
+    uint8_t RXStatus();
+    void Mode(uint8_t mode);
+    void Reset();
+
+    uint8_t regs[0x80]; //register file so what the firmware programs can be checked. CANSTAT follows CANCTRL's mode
+};
+
+#endif
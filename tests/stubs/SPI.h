@@ -0,0 +1,27 @@
+#ifndef SPI_H_
+#define SPI_H_
+
+#include <Arduino.h>
+
+#define MSBFIRST 1
+#define SPI_MODE0 0
+
+struct SPISettings {
+    SPISettings(uint32_t clock, int order, int mode) {}
+};
+
+class SPIClass
+{
+public:
+    void begin();
+    uint8_t transfer(uint8_t data);
+    void transfer(void *buf, size_t len);
+    void beginTransaction(SPISettings settings);
+    void endTransaction();
+
+    uint32_t transactions;
+};
+
+extern SPIClass SPI;
+
+#endif
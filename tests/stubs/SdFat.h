@@ -0,0 +1,37 @@
+#ifndef SDFAT_H_
+#define SDFAT_H_
+
+#include <Arduino.h>
+
+#define O_APPEND 1
+#define O_WRITE 2
+#define O_CREAT 4
+#define O_TRUNC 8
+#define O_READ 16
+#define O_RDONLY 16
+#define SPI_FULL_SPEED 0
+
+//There is never a card in the slot
+class SdFile
+{
+public:
+    bool open(const char *name, int flags);
+    bool isOpen();
+    int write(const void *data, size_t len);
+    int read(void *data, size_t len);
+    bool sync();
+    bool close();
+    bool seekSet(uint32_t pos);
+    uint32_t fileSize();
+    uint32_t curPosition();
+    int available();
+};
+
+class SdFat
+{
+public:
+    bool begin(uint8_t csPin, int speed);
+    bool exists(const char *name);
+};
+
+#endif
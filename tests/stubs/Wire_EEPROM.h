@@ -0,0 +1,20 @@
+#ifndef WIRE_EEPROM_H_
+#define WIRE_EEPROM_H_
+
+#include <Arduino.h>
+
+//The whole EEPROM as a RAM array. Addresses are 256 byte pages like the real library
+class EEPROMCLASS
+{
+public:
+    template<class T> int read(uint32_t address, T &value) { memcpy(&value, mem + address * 256, sizeof(T)); return sizeof(T); }
+    template<class T> int write(uint32_t address, const T &value) { memcpy(mem + address * 256, &value, sizeof(T)); return sizeof(T); }
+    int read(uint32_t address, uint8_t &value) { value = mem[address * 256]; return 1; }
+    void setWPPin(uint8_t pin) {}
+
+    uint8_t mem[512 * 256];
+};
+
+extern EEPROMCLASS EEPROM;
+
+#endif
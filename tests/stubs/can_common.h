@@ -0,0 +1,35 @@
+#ifndef CAN_COMMON_H_
+#define CAN_COMMON_H_
+
+#include <Arduino.h>
+
+typedef union {
+    uint64_t value;
+    struct { uint32_t low; uint32_t high; };
+    struct { uint16_t s0, s1, s2, s3; };
+    uint8_t bytes[8];
+    uint8_t byte[8];
+} BytesUnion;
+
+typedef struct {
+    uint32_t id;
+    uint32_t fid;
+    uint8_t rtr;
+    uint8_t priority;
+    uint8_t extended;
+    uint16_t time;
+    uint8_t length;
+    BytesUnion data;
+} CAN_FRAME;
+
+class CAN_COMMON
+{
+public:
+    virtual bool sendFrame(CAN_FRAME &frame) = 0;
+    virtual uint16_t available() = 0;
+    virtual uint32_t read(CAN_FRAME &frame) = 0;
+    virtual void enable() = 0;
+    virtual void disable() = 0;
+};
+
+#endif
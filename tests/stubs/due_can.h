@@ -0,0 +1,50 @@
+#ifndef DUE_CAN_H_
+#define DUE_CAN_H_
+
+#include "can_common.h"
+
+//A controller that accepts everything it is given and finishes sending it straight away
+class CANRaw : public CAN_COMMON
+{
+public:
+    uint32_t begin(uint32_t baud, uint8_t enablePin);
+    bool sendFrame(CAN_FRAME &frame);
+    uint16_t available();
+    uint32_t read(CAN_FRAME &frame);
+    void enable();
+    void disable();
+    void enable_autobaud_listen_mode();
+    void disable_autobaud_listen_mode();
+    int setRXFilter(uint8_t mailbox, uint32_t id, uint32_t mask, bool extended);
+    uint32_t get_status();
+    uint32_t get_rx_error_cnt();
+    uint32_t get_tx_error_cnt();
+    void setGeneralCallback(void (*cb)(CAN_FRAME *));
+    void attachCANInterrupt(void (*cb)(CAN_FRAME *));
+    void detachCANInterrupt(uint8_t mailbox);
+    void setCallback(uint8_t mailbox, void (*cb)(CAN_FRAME *));
+    uint32_t mailbox_get_status(uint8_t mailbox);
+    void mailbox_send_abort_cmd(uint8_t mailbox);
+    uint32_t get_internal_timer_value();
+
+    uint32_t sentCount;
+    CAN_FRAME lastSent;
+    bool listenMode;
+};
+
+extern CANRaw Can0, Can1;
+
+#define CAN_SR_ERRA (1u << 16)
+#define CAN_SR_WARN (1u << 17)
+#define CAN_SR_ERRP (1u << 18)
+#define CAN_SR_BOFF (1u << 19)
+#define CAN_SR_CERR (1u << 24)
+#define CAN_SR_SERR (1u << 25)
+#define CAN_SR_AERR (1u << 26)
+#define CAN_SR_FERR (1u << 27)
+#define CAN_SR_BERR (1u << 28)
+#define CAN_MSR_MTIMESTAMP_Msk (0xffffu)
+#define CAN_MSR_MABT (1u << 22)
+#define CAN_MSR_MRDY (1u << 23)
+
+#endif
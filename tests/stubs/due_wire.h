@@ -0,0 +1,15 @@
+#ifndef DUE_WIRE_H_
+#define DUE_WIRE_H_
+
+#include <Arduino.h>
+
+class TwoWire
+{
+public:
+    void begin();
+    void setClock(uint32_t clock);
+};
+
+extern TwoWire Wire;
+
+#endif
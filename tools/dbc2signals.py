@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+"""
+Turns the signals of a DBC file into SIGNALn= console commands for GVRET's on-device decoder.
+
+Only the subset the decoder can use is read: BO_ messages and their plain SG_ signals.
+Multiplexed signals, value tables and attributes are skipped. The firmware holds 32 signals
+so pick the ones wanted by name if the file has more than that.
+
+    dbc2signals.py car.dbc --bus 0 --signals VehicleSpeed,PackSOC,PackCurrent
+    dbc2signals.py car.dbc --bus 1 --first 8 --port /dev/ttyACM0
+
+Without --port the commands are printed so they can be pasted into a terminal or
+piped wherever they need to go. Which signal went to which slot is listed on stderr. Each command saves its signal to EEPROM on the device.
+"""
+
+import argparse
+import re
+import sys
+import time
+
+MAX_SIGNALS = 32  # SIGNALS_PER_PAGE * SIGNAL_PAGES in SignalDecoder.h
+
+BO_RE = re.compile(r'^\s*BO_\s+(\d+)\s+(\w+)\s*:')
+SG_RE = re.compile(r'^\s*SG_\s+(\w+)\s*(M|m\d+)?\s*:\s*(\d+)\|(\d+)@([01])([+-])\s*'
+                   r'\(\s*([-+0-9.eE]+)\s*,\s*([-+0-9.eE]+)\s*\)')
+
+
+def parse_dbc(path):
+    """Returns a list of (message name, CAN ID, signal name, start bit, length, motorola, signed, scale, offset)"""
+    signals = []
+    msg_id = None
+    msg_name = None
+    with open(path, encoding='latin-1') as dbc:
+        for num, line in enumerate(dbc, 1):
+            m = BO_RE.match(line)
+            if m:
+                msg_id = int(m.group(1)) & 0x1FFFFFFF  # bit 31 only marks extended IDs in a DBC
+                msg_name = m.group(2)
+                continue
+            m = SG_RE.match(line)
+            if not m:
+                continue
+            if msg_id is None:
+                print('%s:%i: signal outside of a message, skipped' % (path, num), file=sys.stderr)
+                continue
+            if m.group(2):
+                print('%s:%i: %s is multiplexed, skipped' % (path, num, m.group(1)), file=sys.stderr)
+                continue
+            signals.append((msg_name, msg_id, m.group(1), int(m.group(3)), int(m.group(4)), m.group(5) == '0',
+                            m.group(6) == '-', float(m.group(7)), float(m.group(8))))
+    return signals
+
+
+def fits(start, length, motorola):
+    """Same checks as SignalDecoder::setSignal"""
+    if start > 63 or length < 1 or length > 64:
+        return False
+    if motorola:
+        msb = (7 - start // 8) * 8 + start % 8
+        return msb - length + 1 >= 0
+    return start + length <= 64
+
+
+def number(val):
+    return '%.9g' % val
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Convert DBC signals to GVRET SIGNALn= commands')
+    parser.add_argument('dbc', help='DBC file to read')
+    parser.add_argument('--bus', type=int, default=0, help='bus the messages are on (default 0)')
+    parser.add_argument('--signals', help='comma separated signal names to take, in this order. Default is all of them')
+    parser.add_argument('--first', type=int, default=0, help='signal slot to start at (default 0)')
+    parser.add_argument('--port', help='serial device of the GVRET to send the commands to instead of printing them')
+    args = parser.parse_args()
+
+    signals = parse_dbc(args.dbc)
+    if args.signals:
+        byName = {}
+        for sig in signals:
+            byName.setdefault(sig[2], sig)
+        wanted = []
+        for name in args.signals.split(','):
+            if name not in byName:
+                sys.exit('No signal named %s in %s' % (name, args.dbc))
+            wanted.append(byName[name])
+        signals = wanted
+
+    commands = []
+    slot = args.first
+    for msg, msg_id, name, start, length, motorola, signed, scale, offset in signals:
+        if not fits(start, length, motorola):
+            print('%s.%s does not fit in 8 bytes, skipped' % (msg, name), file=sys.stderr)
+            continue
+        if slot >= MAX_SIGNALS:
+            print('Out of signal slots at %s.%s, use --signals to choose' % (msg, name), file=sys.stderr)
+            break
+        commands.append(('SIGNAL%i=0x%X,%i,%i,%i,%s,%s,%s,%s' % (slot, msg_id, args.bus, start, length,
+                         'M' if motorola else 'I', 'S' if signed else 'U', number(scale), number(offset)),
+                         '%s.%s' % (msg, name)))
+        slot += 1
+
+    if not args.port:
+        for cmd, name in commands:
+            print(cmd)
+            print('%s -> %s' % (cmd.split('=')[0], name), file=sys.stderr)
+        return
+
+    # the console takes one line at a time and writes EEPROM after each so give it a moment
+    with open(args.port, 'w') as port:
+        for cmd, name in commands:
+            port.write(cmd + '\n')
+            port.flush()
+            print('%s (%s)' % (cmd, name))
+            time.sleep(0.1)
+
+
+if __name__ == '__main__':
+    main()
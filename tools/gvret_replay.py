@@ -0,0 +1,249 @@
+#!/usr/bin/env python3
+"""
+Plays a capture back onto the bus through a GVRET using the credit based replay protocol.
+
+Reads the three formats GVRET logs in: BINARYFILE, GVRET (CSV) and CRTD. Frames are streamed
+with their time from the start of the log and the device sends each one when its own clock
+says so, so USB scheduling doesn't show up as bus timing. The device hands out credits for
+free queue slots and this never sends a frame it doesn't hold a credit for.
+
+    gvret_replay.py capture.csv --port /dev/ttyACM0
+    gvret_replay.py capture.bin --port /dev/ttyACM0 --bus-map 1,0 --speed 200
+    gvret_replay.py capture.crtd --port /dev/ttyACM0 --untimed
+
+Events GVRET wrote into the log and frames it logged as sent by itself are skipped, the
+same as an SD card replay on the device does. When the device has sent the last frame it
+reports the timing error and throughput it achieved and those are printed.
+
+Protocol, every message starts with 0xF1 and all values are little endian:
+    host -> device  0xF1, 26, flags                        start. flags bit 0 = keep the original timing
+    device -> host  0xF1, 28, credits (2)                  frames that may be sent on top of those held now
+    host -> device  0xF1, 27, time us (4), bus, ID (4, bit 31 = extended), length, data
+    host -> device  0xF1, 28                               ask for any credits not handed out yet
+    host -> device  0xF1, 29, 0 = finish, 1 = abort
+    device -> host  0xF1, 29, frames sent, avg error us, max error us, elapsed us, frames/s,
+                    frames sent without credit, frames over 1ms late (4 bytes each)
+"""
+
+import argparse
+import os
+import select
+import struct
+import sys
+import termios
+import time
+import tty
+
+PROTO_BUILD_CAN_FRAME = 0
+PROTO_REPLAY_START = 26
+PROTO_REPLAY_FRAME = 27
+PROTO_REPLAY_CREDIT = 28
+PROTO_REPLAY_END = 29
+
+REPLAY_TIMED = 1
+SUMMARY_LEN = 2 + 7 * 4
+WRAP = 1 << 32
+
+
+def read_binary(path):
+    """BINARYFILE: time us (4), ID (4), length | bus << 4, data"""
+    with open(path, 'rb') as f:
+        data = f.read()
+    pos = 0
+    while pos + 9 <= len(data):
+        stamp, ident, lenbus = struct.unpack_from('<IIB', data, pos)
+        length = min(lenbus & 0xF, 8)
+        if pos + 9 + length > len(data):
+            break
+        yield stamp, lenbus >> 4, ident, data[pos + 9:pos + 9 + length]
+        pos += 9 + length
+
+
+def read_gvret(path):
+    """GVRET: millis,ID,extended,bus,length,data... ID and data in hex"""
+    with open(path, encoding='latin-1') as f:
+        for line in f:
+            tok = line.strip().split(',')
+            if len(tok) < 5 or not tok[0].isdigit():
+                continue  # header, marks and notes
+            try:
+                length = int(tok[4])
+                ident = int(tok[1], 16)
+                if int(tok[2]):
+                    ident |= 1 << 31
+                payload = bytes(int(b, 16) for b in tok[5:5 + length])
+            except ValueError:
+                continue
+            if len(payload) != length or length > 8:
+                continue
+            yield int(tok[0]) * 1000, int(tok[3]), ident, payload
+
+
+def read_crtd(path):
+    """CRTD: seconds R11|R29|T11|T29 ID data... everything on bus 0"""
+    with open(path, encoding='latin-1') as f:
+        for line in f:
+            tok = line.split()
+            if len(tok) < 3 or tok[1][:1] not in ('R', 'T') or tok[1][1:] not in ('11', '29'):
+                continue
+            try:
+                stamp = int(float(tok[0]) * 1000000)
+                ident = int(tok[2], 16)
+                payload = bytes(int(b, 16) for b in tok[3:11])
+            except ValueError:
+                continue
+            if tok[1][0] == 'T':
+                ident |= 0x40000000  # GVRET_TX_FLAG, so it is skipped like the device does
+            if tok[1][1:] == '29':
+                ident |= 1 << 31
+            yield stamp, 0, ident, payload
+
+
+def detect_format(path):
+    with open(path, 'rb') as f:
+        head = f.read(512)
+    try:
+        text = head.decode('ascii')
+    except UnicodeDecodeError:
+        return 'binary'
+    for line in text.splitlines():
+        tok = line.split()
+        if len(tok) >= 3 and tok[1][:1] in ('R', 'T') and tok[1][1:] in ('11', '29'):
+            return 'crtd'
+        if line.count(',') >= 4 and line.split(',')[0].isdigit():
+            return 'gvret'
+    return 'binary'
+
+
+def frames(path, fmt, bus_map, speed):
+    """Yields (time us from the first frame, bus, ID with bit 31 = extended, data)"""
+    reader = {'binary': read_binary, 'gvret': read_gvret, 'crtd': read_crtd}[fmt]
+    first = None
+    prev = None
+    elapsed = 0
+    for stamp, bus, ident, payload in reader(path):
+        if (ident & 0x7FFFFFFF) > 0x1FFFFFFF:
+            continue  # GVRET events and frames it sent itself
+        if bus >= len(bus_map) or bus_map[bus] is None:
+            continue
+        if first is None:
+            first = prev = stamp
+        elapsed += (stamp - prev) % WRAP  # binary logs wrap their 32 bit timestamps
+        prev = stamp
+        yield (elapsed * 100 // speed) % WRAP if speed else 0, bus_map[bus], ident, payload
+
+
+class Device:
+    """Raw serial link to the GVRET and a parser for what comes back from it"""
+
+    def __init__(self, port):
+        self.fd = os.open(port, os.O_RDWR | os.O_NOCTTY)
+        self.saved = termios.tcgetattr(self.fd)
+        tty.setraw(self.fd)
+        self.rx = bytearray()
+        self.credits = 0
+        self.summary = None
+
+    def close(self):
+        termios.tcsetattr(self.fd, termios.TCSADRAIN, self.saved)
+        os.close(self.fd)
+
+    def write(self, data):
+        view = memoryview(data)
+        while view:
+            done = os.write(self.fd, view)
+            view = view[done:]
+
+    def poll(self, timeout):
+        ready, _, _ = select.select([self.fd], [], [], timeout)
+        if ready:
+            self.rx += os.read(self.fd, 4096)
+            self.parse()
+
+    def parse(self):
+        """Credits and the summary are picked out. Received frames are skipped by their length,
+        anything else is dropped a byte at a time until the next 0xF1"""
+        rx = self.rx
+        while rx:
+            if rx[0] != 0xF1:
+                del rx[0]
+                continue
+            if len(rx) < 2:
+                return
+            cmd = rx[1]
+            if cmd == PROTO_REPLAY_CREDIT:
+                if len(rx) < 4:
+                    return
+                self.credits += rx[2] | (rx[3] << 8)
+                del rx[:4]
+            elif cmd == PROTO_REPLAY_END:
+                if len(rx) < SUMMARY_LEN:
+                    return
+                self.summary = struct.unpack_from('<7I', rx, 2)
+                del rx[:SUMMARY_LEN]
+            elif cmd == PROTO_BUILD_CAN_FRAME:
+                if len(rx) < 11:
+                    return
+                size = 12 + min(rx[10] & 0xF, 8)
+                if len(rx) < size:
+                    return
+                del rx[:size]
+            else:
+                del rx[0]
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Replay a GVRET, CRTD or binary log through a GVRET')
+    parser.add_argument('log', help='capture to play back')
+    parser.add_argument('--port', required=True, help='serial device of the GVRET, e.g. /dev/ttyACM0')
+    parser.add_argument('--format', choices=('auto', 'binary', 'gvret', 'crtd'), default='auto')
+    parser.add_argument('--bus-map', default='0,1,2,3,4',
+                        help='bus to send frames from each logged bus on, - drops that bus (default 0,1,2,3,4)')
+    parser.add_argument('--speed', type=int, default=100, help='playback speed in percent (default 100)')
+    parser.add_argument('--untimed', action='store_true', help='send as fast as the bus takes frames')
+    args = parser.parse_args()
+
+    fmt = detect_format(args.log) if args.format == 'auto' else args.format
+    bus_map = [None if b.strip() == '-' else int(b) for b in args.bus_map.split(',')]
+    speed = 0 if args.untimed else args.speed
+    if speed < 0:
+        sys.exit('Speed has to be positive')
+
+    dev = Device(args.port)
+    sent = 0
+    started = time.monotonic()
+    try:
+        dev.write(bytes([0xE7, 0xE7]))  # binary mode
+        dev.write(bytes([0xF1, PROTO_REPLAY_START, REPLAY_TIMED if speed else 0]))
+        try:
+            for stamp, bus, ident, payload in frames(args.log, fmt, bus_map, speed):
+                while dev.credits == 0:
+                    dev.poll(0.5)
+                    if dev.credits == 0:
+                        dev.write(bytes([0xF1, PROTO_REPLAY_CREDIT]))
+                dev.write(struct.pack('<BBIBIB', 0xF1, PROTO_REPLAY_FRAME, stamp, bus, ident, len(payload)) + payload)
+                dev.credits -= 1
+                sent += 1
+                dev.poll(0)
+            dev.write(bytes([0xF1, PROTO_REPLAY_END, 0]))
+        except KeyboardInterrupt:
+            dev.write(bytes([0xF1, PROTO_REPLAY_END, 1]))
+            print('Stopped, waiting for the device to report')
+        while dev.summary is None:
+            dev.poll(1.0)
+    finally:
+        dev.close()
+
+    frames_sent, avg_err, max_err, elapsed, fps, overruns, late = dev.summary
+    print('%s: %i frames streamed in %.1f s' % (args.log, sent, time.monotonic() - started))
+    print('Device sent %i frames in %.3f s, %i frames/s' % (frames_sent, elapsed / 1e6, fps))
+    if speed:
+        print('Timing error avg %i us, max %i us, %i frames over 1 ms late' % (avg_err, max_err, late))
+    if overruns:
+        print('%i frames arrived without credit and were dropped' % overruns)
+    if frames_sent != sent:
+        print('%i frames were not sent' % (sent - frames_sent))
+
+
+if __name__ == '__main__':
+    main()